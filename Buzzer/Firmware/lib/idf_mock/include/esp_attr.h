@@ -0,0 +1,10 @@
+/* Host side stand-in for ESP-IDF's memory placement attributes, which mean nothing off the device.
+*/
+
+#ifndef ESP_ATTR_H
+#define ESP_ATTR_H
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#endif
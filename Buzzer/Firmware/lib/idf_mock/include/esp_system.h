@@ -0,0 +1,12 @@
+/* Host side stand-in for ESP-IDF system functions.
+*/
+
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+
+#include <stdint.h>
+
+// Report the free heap, in bytes. Always mock_free_heap.
+uint32_t esp_get_free_heap_size(void);
+
+#endif
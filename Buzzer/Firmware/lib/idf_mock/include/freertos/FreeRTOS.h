@@ -0,0 +1,42 @@
+/* Host side stand-in for FreeRTOS's basic definitions.
+
+Tests are single threaded, so critical sections only count how deeply they're nested, letting tests check every
+one is left.
+
+*/
+
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_attr.h"
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFF)
+#define portTICK_PERIOD_MS 10  // CONFIG_FREERTOS_HZ is 100.
+
+typedef struct
+{
+    int nesting;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+
+#define portENTER_CRITICAL(mux) ((mux)->nesting++)
+#define portEXIT_CRITICAL(mux) ((mux)->nesting--)
+#define portENTER_CRITICAL_SAFE(mux) portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_SAFE(mux) portEXIT_CRITICAL(mux)
+
+extern int mock_yields;
+#define portYIELD_FROM_ISR() (mock_yields++)
+
+#endif
@@ -0,0 +1,21 @@
+/* Host side stand-in for FreeRTOS queues.
+
+Tests are single threaded, so nothing ever waits. Receiving from an empty queue, or sending to a full one, fails
+straight away.
+
+*/
+
+#ifndef FREERTOS_QUEUE_H
+#define FREERTOS_QUEUE_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct mock_queue *QueueHandle_t;  // See idf_mock.h.
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+BaseType_t xQueueReset(QueueHandle_t queue);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+#endif
@@ -0,0 +1,19 @@
+/* Host side stand-in for FreeRTOS mutexes.
+
+Tests are single threaded, so a mutex is never contended, and only counts how often it's held, letting tests check
+it's always given back.
+
+*/
+
+#ifndef FREERTOS_SEMPHR_H
+#define FREERTOS_SEMPHR_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct mock_mutex *SemaphoreHandle_t;  // See idf_mock.h.
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex);
+
+#endif
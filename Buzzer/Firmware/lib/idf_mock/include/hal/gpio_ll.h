@@ -0,0 +1,45 @@
+/* Host side stand-in for the ESP-IDF GPIO low level layer, which sets the same interrupt types as the driver does.
+*/
+
+#ifndef HAL_GPIO_LL_H
+#define HAL_GPIO_LL_H
+
+#include <stdint.h>
+#include "driver/gpio.h"
+
+typedef struct
+{
+    int unused;
+} gpio_dev_t;
+
+extern gpio_dev_t GPIO;
+extern int mock_gpio_levels[GPIO_NUM_MAX];
+extern gpio_int_type_t mock_gpio_intr_types[GPIO_NUM_MAX];
+extern gpio_int_type_t mock_gpio_wakeup_types[GPIO_NUM_MAX];
+
+
+// These are inline on the device too, so interrupt handlers can call them from IRAM.
+static inline int gpio_ll_get_level(gpio_dev_t *hw, uint32_t gpio_num)
+{
+    return mock_gpio_levels[gpio_num];
+}
+
+
+static inline void gpio_ll_set_level(gpio_dev_t *hw, uint32_t gpio_num, uint32_t level)
+{
+    mock_gpio_levels[gpio_num] = (level != 0) ? 1 : 0;
+}
+
+
+static inline void gpio_ll_set_intr_type(gpio_dev_t *hw, uint32_t gpio_num, gpio_int_type_t intr_type)
+{
+    mock_gpio_intr_types[gpio_num] = intr_type;
+}
+
+
+static inline void gpio_ll_wakeup_enable(gpio_dev_t *hw, uint32_t gpio_num, gpio_int_type_t intr_type)
+{
+    mock_gpio_wakeup_types[gpio_num] = intr_type;
+}
+
+#endif
@@ -0,0 +1,90 @@
+/* Host side stand-ins for the parts of ESP-IDF, FreeRTOS and lwIP our firmware uses, so its modules can be unit
+tested and benchmarked off the device, see test/README.
+
+Each stand-in is as thin as it can be. Time only moves when a test says so, GPIO levels are just remembered, tasks
+never run, queues never block and sockets record what's sent to them rather than sending it. Tests set all this up,
+and inspect it, through what's declared here.
+
+*/
+
+#ifndef IDF_MOCK_H
+#define IDF_MOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "hal/gpio_ll.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+
+#define MOCK_SENDS 16  // Number of the most recent sends we keep.
+#define MOCK_SEND_MAX 1100  // Largest send we keep, bigger than any message.
+#define MOCK_RECVS 16  // Number of chunks a test can push for receiving at once.
+
+// A timer, which is running until stopped.
+struct esp_timer
+{
+    esp_timer_cb_t callback;
+    void *arg;
+    uint64_t period_us;
+    bool running;
+};
+
+// A task, which never runs.
+struct mock_task
+{
+    TaskFunction_t function;
+    const char *name;
+    UBaseType_t priority;
+    BaseType_t core;
+};
+
+// A mutex, which is held until given back.
+struct mock_mutex
+{
+    int held;
+};
+
+// A single send on one of our sockets.
+typedef struct
+{
+    int sock;
+    int size;
+    uint8_t data[MOCK_SEND_MAX];
+} mock_send_t;
+
+extern int64_t mock_time_us;  // Returned by esp_timer_get_time(), and gives the tick count.
+extern int mock_gpio_levels[GPIO_NUM_MAX];  // Last level set on each pin, or the level a test has given an input.
+extern gpio_isr_t mock_gpio_isrs[GPIO_NUM_MAX];  // Handler added for each pin. NULL for none.
+extern int mock_pm_locks_held;  // Number of power management locks acquired and not yet released.
+extern int mock_yields;  // Number of times an interrupt has asked to yield to a task it woke.
+extern int mock_notifies;  // Number of task notifications given.
+extern uint32_t mock_free_heap;  // Returned by esp_get_free_heap_size().
+extern int mock_send_count;  // Number of sends since reset, including those no longer kept.
+extern bool mock_send_fail;  // Whether sends should fail.
+extern int mock_send_limit;  // Most bytes each send takes, as if the socket were nearly full. 0 for no limit.
+extern int mock_connect_result;  // Returned by connect().
+extern int mock_closes;  // Number of sockets closed.
+
+
+// Put every stand-in back as it was at boot. Tests should call this before each test, before initialising any
+// modules, which forgets any timers, tasks, queues and sockets they created.
+void mock_reset(void);
+
+// Report the given send, counting from 0 at reset.
+// Returns NULL if there's been no such send, or it's no longer kept.
+const mock_send_t *mock_sent(int index);
+
+// Report the most recent send. Returns NULL if there's been none since reset.
+const mock_send_t *mock_last_sent(void);
+
+// Give the given bytes to the next receive, on any socket.
+// A receive with less room than this gets what fits, and the rest is left for the next.
+void mock_recv_push(const void *data, int size);
+
+#endif
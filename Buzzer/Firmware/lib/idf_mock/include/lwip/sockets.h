@@ -0,0 +1,40 @@
+/* Host side stand-in for lwIP sockets.
+
+The host's own socket definitions are used, but the calls themselves go to mock_* versions, which never touch the
+network. Whatever is sent is recorded, and whatever a test has pushed is received. Every socket is always ready, so
+once there's nothing left to receive the peer appears to have closed the connection.
+
+*/
+
+#ifndef LWIP_SOCKETS_H
+#define LWIP_SOCKETS_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+int mock_socket(int domain, int type, int protocol);
+int mock_connect(int sock, const struct sockaddr *addr, socklen_t size);
+int mock_bind(int sock, const struct sockaddr *addr, socklen_t size);
+int mock_setsockopt(int sock, int level, int name, const void *value, socklen_t size);
+ssize_t mock_send(int sock, const void *data, size_t size, int flags);
+ssize_t mock_recv(int sock, void *buffer, size_t size, int flags);
+int mock_select(int count, fd_set *read_fds, fd_set *write_fds, fd_set *except_fds, struct timeval *timeout);
+int mock_shutdown(int sock, int how);
+int mock_close(int sock);
+
+#define socket mock_socket
+#define connect mock_connect
+#define bind mock_bind
+#define setsockopt mock_setsockopt
+#define send mock_send
+#define recv mock_recv
+#define select mock_select
+#define shutdown mock_shutdown
+#define close mock_close
+
+#endif
@@ -0,0 +1,492 @@
+/* Host side stand-ins for the parts of ESP-IDF, FreeRTOS and lwIP our firmware uses, see idf_mock.h.
+
+Everything is allocated from small fixed pools, which mock_reset() empties, so tests never leak and creation fails,
+as it could on the device, if a pool runs out.
+
+*/
+
+#include <string.h>
+#include "idf_mock.h"
+#include "esp_system.h"
+
+#define MOCK_TIMERS 4
+#define MOCK_TASKS 8
+#define MOCK_QUEUES 4
+#define MOCK_QUEUE_BYTES 256  // Room for each queue's items.
+#define MOCK_PM_LOCKS 4
+#define MOCK_MUTEXES 4
+#define MOCK_FIRST_SOCKET 10
+#define MOCK_STACK_FREE 1024  // High water mark reported for every task.
+
+// A queue, of items copied in and out.
+struct mock_queue
+{
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t first;  // Index of the oldest item.
+    UBaseType_t count;
+    uint8_t items[MOCK_QUEUE_BYTES];
+};
+
+// A power management lock, which counts how often it's held.
+struct esp_pm_lock
+{
+    esp_pm_lock_type_t type;
+    int held;
+};
+
+// A chunk pushed by a test for receiving.
+typedef struct
+{
+    int size;
+    int taken;  // Bytes already received.
+    uint8_t data[MOCK_SEND_MAX];
+} mock_recv_t;
+
+int64_t mock_time_us;
+int mock_gpio_levels[GPIO_NUM_MAX];
+gpio_isr_t mock_gpio_isrs[GPIO_NUM_MAX];
+gpio_int_type_t mock_gpio_intr_types[GPIO_NUM_MAX];
+gpio_int_type_t mock_gpio_wakeup_types[GPIO_NUM_MAX];
+gpio_dev_t GPIO;
+int mock_pm_locks_held;
+int mock_yields;
+int mock_notifies;
+uint32_t mock_free_heap;
+int mock_send_count;
+bool mock_send_fail;
+int mock_send_limit;
+int mock_connect_result;
+int mock_closes;
+
+static struct esp_timer _timers[MOCK_TIMERS];
+static int _timer_count;
+static struct mock_task _tasks[MOCK_TASKS];
+static int _task_count;
+static struct mock_queue _queues[MOCK_QUEUES];
+static int _queue_count;
+static struct esp_pm_lock _pm_locks[MOCK_PM_LOCKS];
+static int _pm_lock_count;
+static struct mock_mutex _mutexes[MOCK_MUTEXES];
+static int _mutex_count;
+static int _next_socket;
+static mock_send_t _sends[MOCK_SENDS];  // Circular, indexed by send count.
+static mock_recv_t _recvs[MOCK_RECVS];  // Circular.
+static int _recv_first;  // Index of the oldest chunk.
+static int _recv_count;
+static int _notifications;  // Notifications not yet taken, for every task at once.
+
+
+// Put every stand-in back as it was at boot.
+void mock_reset(void)
+{
+    mock_time_us = 0;
+    memset(mock_gpio_levels, 0, sizeof(mock_gpio_levels));
+    memset(mock_gpio_isrs, 0, sizeof(mock_gpio_isrs));
+    memset(mock_gpio_intr_types, 0, sizeof(mock_gpio_intr_types));
+    memset(mock_gpio_wakeup_types, 0, sizeof(mock_gpio_wakeup_types));
+    mock_pm_locks_held = 0;
+    mock_yields = 0;
+    mock_notifies = 0;
+    mock_free_heap = 100000;
+    mock_send_count = 0;
+    mock_send_fail = false;
+    mock_send_limit = 0;
+    mock_connect_result = 0;
+    mock_closes = 0;
+
+    _timer_count = 0;
+    _task_count = 0;
+    _queue_count = 0;
+    _pm_lock_count = 0;
+    _mutex_count = 0;
+    _next_socket = MOCK_FIRST_SOCKET;
+    _recv_first = 0;
+    _recv_count = 0;
+    _notifications = 0;
+}
+
+
+// Report the given send, counting from 0 at reset.
+const mock_send_t *mock_sent(int index)
+{
+    if(index < 0 || index >= mock_send_count || index < (mock_send_count - MOCK_SENDS)) return NULL;
+    return &_sends[index % MOCK_SENDS];
+}
+
+
+// Report the most recent send.
+const mock_send_t *mock_last_sent(void)
+{
+    return mock_sent(mock_send_count - 1);
+}
+
+
+// Give the given bytes to the next receive.
+void mock_recv_push(const void *data, int size)
+{
+    if(_recv_count == MOCK_RECVS || size > MOCK_SEND_MAX) return;
+
+    mock_recv_t *chunk = &_recvs[(_recv_first + _recv_count) % MOCK_RECVS];
+    memcpy(chunk->data, data, size);
+    chunk->size = size;
+    chunk->taken = 0;
+    _recv_count++;
+}
+
+
+// Time.
+
+int64_t esp_timer_get_time(void)
+{
+    return mock_time_us;
+}
+
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle)
+{
+    if(_timer_count == MOCK_TIMERS) return ESP_ERR_NO_MEM;
+
+    struct esp_timer *timer = &_timers[_timer_count++];
+    timer->callback = args->callback;
+    timer->arg = args->arg;
+    timer->period_us = 0;
+    timer->running = false;
+    *handle = timer;
+    return ESP_OK;
+}
+
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us)
+{
+    if(timer->running) return ESP_FAIL;
+
+    timer->period_us = period_us;
+    timer->running = true;
+    return ESP_OK;
+}
+
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if(!timer->running) return ESP_FAIL;
+
+    timer->running = false;
+    return ESP_OK;
+}
+
+
+// GPIO.
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    return mock_gpio_levels[gpio_num];
+}
+
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    mock_gpio_levels[gpio_num] = (level != 0) ? 1 : 0;
+    return ESP_OK;
+}
+
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    mock_gpio_intr_types[gpio_num] = intr_type;
+    return ESP_OK;
+}
+
+
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    mock_gpio_wakeup_types[gpio_num] = intr_type;
+    return ESP_OK;
+}
+
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    return ESP_OK;
+}
+
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
+{
+    mock_gpio_isrs[gpio_num] = isr_handler;
+    return ESP_OK;
+}
+
+
+// Power management.
+
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t lock_type, int arg, const char *name, esp_pm_lock_handle_t *handle)
+{
+    if(_pm_lock_count == MOCK_PM_LOCKS) return ESP_ERR_NO_MEM;
+
+    struct esp_pm_lock *lock = &_pm_locks[_pm_lock_count++];
+    lock->type = lock_type;
+    lock->held = 0;
+    *handle = lock;
+    return ESP_OK;
+}
+
+
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle)
+{
+    handle->held++;
+    mock_pm_locks_held++;
+    return ESP_OK;
+}
+
+
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle)
+{
+    if(handle->held == 0) return ESP_FAIL;
+
+    handle->held--;
+    mock_pm_locks_held--;
+    return ESP_OK;
+}
+
+
+// System.
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return mock_free_heap;
+}
+
+
+// Tasks.
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth, void *param,
+    UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    if(_task_count == MOCK_TASKS) return pdFAIL;
+
+    struct mock_task *task = &_tasks[_task_count++];
+    task->function = function;
+    task->name = name;
+    task->priority = priority;
+    task->core = core;
+    if(handle != NULL) *handle = task;
+    return pdPASS;
+}
+
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    static struct mock_task main_task = { NULL, "main", 1, 0 };
+    return &main_task;
+}
+
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(mock_time_us / (portTICK_PERIOD_MS * 1000));
+}
+
+
+void vTaskDelay(TickType_t ticks)
+{
+    mock_time_us += (int64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    mock_notifies++;
+    _notifications++;
+    return pdPASS;
+}
+
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    uint32_t taken = _notifications;
+
+    if(clear_on_exit) {
+        _notifications = 0;
+    } else if(_notifications > 0) {
+        _notifications--;
+    }
+
+    return taken;
+}
+
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    return MOCK_STACK_FREE;
+}
+
+
+// Mutexes.
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    if(_mutex_count == MOCK_MUTEXES) return NULL;
+
+    struct mock_mutex *mutex = &_mutexes[_mutex_count++];
+    mutex->held = 0;
+    return mutex;
+}
+
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks)
+{
+    mutex->held++;
+    return pdTRUE;
+}
+
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+    if(mutex->held == 0) return pdFALSE;
+
+    mutex->held--;
+    return pdTRUE;
+}
+
+
+// Queues.
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    if(_queue_count == MOCK_QUEUES || (length * item_size) > MOCK_QUEUE_BYTES) return NULL;
+
+    struct mock_queue *queue = &_queues[_queue_count++];
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->first = 0;
+    queue->count = 0;
+    return queue;
+}
+
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken)
+{
+    if(queue->count == queue->length) return pdFALSE;
+
+    UBaseType_t index = (queue->first + queue->count) % queue->length;
+    memcpy(&queue->items[index * queue->item_size], item, queue->item_size);
+    queue->count++;
+
+    // Whoever receives from this is waiting for it, and has a higher priority than whatever we interrupted.
+    if(woken != NULL) *woken = pdTRUE;
+    return pdTRUE;
+}
+
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    if(queue->count == 0) return pdFALSE;
+
+    memcpy(item, &queue->items[queue->first * queue->item_size], queue->item_size);
+    queue->first = (queue->first + 1) % queue->length;
+    queue->count--;
+    return pdTRUE;
+}
+
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+    queue->first = 0;
+    queue->count = 0;
+    return pdPASS;
+}
+
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return queue->count;
+}
+
+
+// Sockets.
+
+int mock_socket(int domain, int type, int protocol)
+{
+    return _next_socket++;
+}
+
+
+int mock_connect(int sock, const struct sockaddr *addr, socklen_t size)
+{
+    return mock_connect_result;
+}
+
+
+int mock_bind(int sock, const struct sockaddr *addr, socklen_t size)
+{
+    return 0;
+}
+
+
+int mock_setsockopt(int sock, int level, int name, const void *value, socklen_t size)
+{
+    return 0;
+}
+
+
+ssize_t mock_send(int sock, const void *data, size_t size, int flags)
+{
+    if(mock_send_fail) return -1;
+    if(mock_send_limit > 0 && size > mock_send_limit) size = mock_send_limit;
+
+    mock_send_t *sent = &_sends[mock_send_count % MOCK_SENDS];
+    sent->sock = sock;
+    sent->size = (int)size;
+    memcpy(sent->data, data, (size < MOCK_SEND_MAX) ? size : MOCK_SEND_MAX);
+    mock_send_count++;
+    return size;
+}
+
+
+ssize_t mock_recv(int sock, void *buffer, size_t size, int flags)
+{
+    if(_recv_count == 0) return 0;  // Nothing left, as if the peer had closed.
+
+    mock_recv_t *chunk = &_recvs[_recv_first];
+    int count = chunk->size - chunk->taken;
+    if(count > (int)size) count = (int)size;
+
+    memcpy(buffer, &chunk->data[chunk->taken], count);
+    chunk->taken += count;
+
+    if(chunk->taken == chunk->size)
+    {
+        _recv_first = (_recv_first + 1) % MOCK_RECVS;
+        _recv_count--;
+    }
+
+    return count;
+}
+
+
+int mock_select(int count, fd_set *read_fds, fd_set *write_fds, fd_set *except_fds, struct timeval *timeout)
+{
+    // Every socket is always ready, so leave the sets as they are.
+    int ready = 0;
+
+    for(int sock = 0; sock < count; sock++)
+    {
+        if(read_fds != NULL && FD_ISSET(sock, read_fds)) ready++;
+    }
+
+    return ready;
+}
+
+
+int mock_shutdown(int sock, int how)
+{
+    return 0;
+}
+
+
+int mock_close(int sock)
+{
+    mock_closes++;
+    return 0;
+}
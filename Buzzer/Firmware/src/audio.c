@@ -1,75 +1,199 @@
 /* Functions to control audio.
 
-Communication between the interrupt and other threads is via global bools, which can be written and read atomically.
-These flags can be set by any thread to request an action and are cleared by the audio playback interrupt.
+The sounder is driven by the LEDC peripheral, which generates the square wave in hardware, so no interrupt is needed
+while a tone plays. Each sound is a pattern of tones and silences, stepped through with a one shot esp_timer, so the
+CPU is only involved at the start of each step. The LEDC clock stops in light sleep, so we hold a power management
+lock while a pattern plays.
+
+Each event has its own pattern. Patterns may use the team pitch, so each team's buzzers sound different.
+
+The current pattern is protected by a mutex, since it's changed by whichever task sets our mode and stepped by the
+esp_timer task.
 
 */
 
-// #include "freertos/FreeRTOS.h"
-// #include "freertos/task.h"
-#include "driver/gpio.h"
-// #include "driver/timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "driver/ledc.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
 #include "global.h"
 #include "audio.h"
 #include "gpio.h"
 
-static volatile bool _audio_start;  // Signal to start playback.
-static volatile bool _audio_stop;  // Signal to stop playback.
-static volatile int _audio_count;  // Count through playback. 0 => not playing back.
+// LEDC setup.
+#define AUDIO_LEDC_MODE LEDC_LOW_SPEED_MODE
+#define AUDIO_LEDC_TIMER LEDC_TIMER_0
+#define AUDIO_LEDC_CHANNEL LEDC_CHANNEL_0
+#define AUDIO_LEDC_RESOLUTION LEDC_TIMER_10_BIT
+#define AUDIO_DUTY_ON 512  // 50%, for the loudest square wave.
+#define AUDIO_DUTY_OFF 0
 
+// Special step frequencies.
+#define AUDIO_SILENCE 0
+#define AUDIO_TEAM_PITCH 1  // Use the team pitch.
 
-// Interrupt tick handler.
-void IRAM_ATTR audio_tick(void)
+// A single step of a pattern.
+typedef struct
 {
-    // Check signals.
-    // Stop takes priority, so check start first.
-    if(_audio_start)
-    {
-        _audio_start = false;
+    uint16_t freq_hz;  // AUDIO_SILENCE, AUDIO_TEAM_PITCH or frequency.
+    uint16_t ms;  // Duration. 0 marks the end of the pattern.
+} audio_step_t;
+
+// Pitch for each team, in the order of team IDs.
+static const uint16_t _team_pitch[8] = { 1047, 1319, 1568, 2093, 1175, 1397, 1760, 2349 };
+
+// Patterns for each event, see audio_event_t.
+static const audio_step_t _pattern_answer[] = {
+    { AUDIO_TEAM_PITCH, 150 }, { AUDIO_SILENCE, 50 }, { AUDIO_TEAM_PITCH, 150 }, { AUDIO_SILENCE, 50 },
+    { AUDIO_TEAM_PITCH, 600 }, { AUDIO_SILENCE, 0 }
+};
+
+static const audio_step_t _pattern_latch[] = {
+    { AUDIO_TEAM_PITCH, 30 }, { AUDIO_SILENCE, 0 }
+};
+
+static const audio_step_t *_patterns[AUDIO_EVENT_COUNT] = { _pattern_answer, _pattern_latch };
+
+static SemaphoreHandle_t _audio_lock;  // Protects everything below.
+static esp_timer_handle_t _audio_timer;
+static const audio_step_t *_pattern;  // Pattern being played. NULL if none.
+static int _step;  // Index of the step being played.
+static uint16_t _pitch;  // Our team pitch.
+static esp_pm_lock_handle_t _audio_awake_lock;  // Held while _pattern is not NULL.
+
 
-        // Don't restart the audio if it's already playing, but do consume the start signal.
-        if(_audio_count == 0)
-        {
-            _audio_count = 1000;
-        }
+// Stop the current pattern, if any.
+// Must be called with our lock held.
+static void stop_pattern(void)
+{
+    if(_pattern == NULL) return;
+
+    _pattern = NULL;
+    ledc_set_duty(AUDIO_LEDC_MODE, AUDIO_LEDC_CHANNEL, AUDIO_DUTY_OFF);
+    ledc_update_duty(AUDIO_LEDC_MODE, AUDIO_LEDC_CHANNEL);
+    esp_pm_lock_release(_audio_awake_lock);
+}
+
+
+// Start the current step of the current pattern, or stop if we've reached the end.
+// Must be called with our lock held.
+static void start_step(void)
+{
+    const audio_step_t *step = &_pattern[_step];
+
+    if(step->ms == 0)
+    {
+        // End of pattern.
+        stop_pattern();
+        return;
     }
 
-    if(_audio_stop)
+    if(step->freq_hz == AUDIO_SILENCE)
     {
-        _audio_stop = false;
-        _audio_count = 1;  // 1 causes us to turn off the transducer and then stop playback.
+        ledc_set_duty(AUDIO_LEDC_MODE, AUDIO_LEDC_CHANNEL, AUDIO_DUTY_OFF);
+    } else {
+        uint32_t freq = (step->freq_hz == AUDIO_TEAM_PITCH) ? _pitch : step->freq_hz;
+        ledc_set_freq(AUDIO_LEDC_MODE, AUDIO_LEDC_TIMER, freq);
+        ledc_set_duty(AUDIO_LEDC_MODE, AUDIO_LEDC_CHANNEL, AUDIO_DUTY_ON);
     }
 
-    // Now playback, if needed.
-    if(_audio_count > 0)
+    ledc_update_duty(AUDIO_LEDC_MODE, AUDIO_LEDC_CHANNEL);
+    esp_timer_start_once(_audio_timer, (uint64_t)step->ms * 1000);
+}
+
+
+// Timer callback, to move on to the next step.
+// If a pattern was started, or stopped, while we waited for our lock, the step we were timing is no longer playing.
+// Any new step has restarted the timer, so if it's running again there's nothing for us to do.
+static void audio_timer_callback(void *param)
+{
+    xSemaphoreTake(_audio_lock, portMAX_DELAY);
+
+    if(_pattern != NULL && !esp_timer_is_active(_audio_timer))
     {
-        _audio_count--;
-        gpio_set_level(PIN_BUZZER, _audio_count & 1);
+        _step++;
+        start_step();
     }
+
+    xSemaphoreGive(_audio_lock);
 }
 
 
 // Initialise audio.
-// Must be called before any other audio_* functions.
+// Must be called before any other audio_* functions, and after gpio_init().
 void audio_init(void)
 {
-    _audio_start = false;
-    _audio_stop = false;
-    _audio_count = 0;
+    _audio_lock = xSemaphoreCreateMutex();
+    _pattern = NULL;
+    _step = 0;
+    _pitch = _team_pitch[(read_module_id() >> 4) & 7];
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "audio", &_audio_awake_lock);
+
+    ledc_timer_config_t timer = {
+        .speed_mode = AUDIO_LEDC_MODE,
+        .duty_resolution = AUDIO_LEDC_RESOLUTION,
+        .timer_num = AUDIO_LEDC_TIMER,
+        .freq_hz = _pitch,
+        .clk_cfg = LEDC_AUTO_CLK
+    };
+    ledc_timer_config(&timer);
+
+    ledc_channel_config_t channel = {
+        .gpio_num = PIN_BUZZER,
+        .speed_mode = AUDIO_LEDC_MODE,
+        .channel = AUDIO_LEDC_CHANNEL,
+        .intr_type = LEDC_INTR_DISABLE,
+        .timer_sel = AUDIO_LEDC_TIMER,
+        .duty = AUDIO_DUTY_OFF,
+        .hpoint = 0
+    };
+    ledc_channel_config(&channel);
+
+    esp_timer_create_args_t timer_args = {
+        .callback = audio_timer_callback,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "audio"
+    };
+    esp_timer_create(&timer_args, &_audio_timer);
+}
+
+
+// Play the pattern for the given event, replacing anything already playing.
+void audio_play(audio_event_t event)
+{
+    xSemaphoreTake(_audio_lock, portMAX_DELAY);
+
+    esp_timer_stop(_audio_timer);
+    if(_pattern == NULL) esp_pm_lock_acquire(_audio_awake_lock);
+    _pattern = _patterns[event];
+    _step = 0;
+    start_step();
+
+    xSemaphoreGive(_audio_lock);
 }
 
 
 // Start audio playback.
+// Doesn't restart the answer pattern if it's already playing.
 void audio_start(void)
 {
-    // Just set the flag.
-    _audio_start = true;
+    xSemaphoreTake(_audio_lock, portMAX_DELAY);
+    bool playing = (_pattern == _patterns[AUDIO_ANSWER]);
+    xSemaphoreGive(_audio_lock);
+
+    if(!playing) audio_play(AUDIO_ANSWER);
 }
 
 
 // Stop audio playback.
 void audio_stop(void)
 {
-    // Just set the flag.
-    _audio_stop = true;
+    xSemaphoreTake(_audio_lock, portMAX_DELAY);
+
+    esp_timer_stop(_audio_timer);
+    stop_pattern();
+
+    xSemaphoreGive(_audio_lock);
 }
@@ -5,18 +5,26 @@
 #ifndef AUDIO_H
 #define AUDIO_H
 
+// Events that have their own sound.
+typedef enum
+{
+    AUDIO_ANSWER,  // Our answer has been accepted.
+    AUDIO_LATCH,  // We've latched a press while armed.
+    AUDIO_EVENT_COUNT
+} audio_event_t;
+
 // Initialise audio.
-// Must be called before any other audio_* functions.
+// Must be called before any other audio_* functions, and after gpio_init().
 void audio_init(void);
 
+// Play the sound for the given event, replacing anything already playing.
+void audio_play(audio_event_t event);
+
 // Start audio playback.
+// Doesn't restart the answer sound if it's already playing.
 void audio_start(void);
 
 // Stop audio playback.
 void audio_stop(void);
 
-// Tick.
-// Should be called every millisecond.
-void IRAM_ATTR audio_tick(void);
-
 #endif
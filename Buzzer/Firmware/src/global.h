@@ -1,5 +1,18 @@
 /* Definitions to be included in all source files, before any other user header files.
 
+Task plan. The press path gets a core to itself, so nothing else can delay it:
+Core 1 (APP CPU):
+  Button interrupt
+  ButtonPress task, priority 10. Timestamps are taken in the interrupt, this sends them.
+Core 0 (PRO CPU), with everything else:
+  WIFI (23), esp_timer (22) and lwIP (18) tasks, pinned here by sdkconfig
+  Udp task, priority 5. Press resends and acknowledgements, and mode broadcasts
+  Main task, priority 4. Receives and applies messages from the host, and writes firmware updates
+  Heartbeat task, priority 3. Heartbeats, sync pongs and telemetry
+Sends from the press task still go through lwIP on core 0, which is above all of our own tasks there.
+
+Build with PRESS_JITTER_STATS defined to log the time from each button edge to its send, with the worst case seen.
+
 */
 
 #ifndef GLOBAL_H
@@ -8,4 +21,14 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+// Cores, see task plan above.
+#define CORE_PRESS 1
+#define CORE_NETWORK 0
+
+// Task priorities, see task plan above.
+#define PRIORITY_PRESS 10
+#define PRIORITY_UDP 5
+#define PRIORITY_HOST 4
+#define PRIORITY_HEARTBEAT 3
+
 #endif
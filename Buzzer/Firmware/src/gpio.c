@@ -1,8 +1,12 @@
 /* Functions to control GPIOs.
 
+The battery is measured through a divider that halves its voltage, so it's always in range of the ADC.
+
 */
 
 #include "driver/gpio.h"
+#include "driver/adc.h"
+#include "esp_adc_cal.h"
 #include "global.h"
 #include "gpio.h"
 
@@ -10,6 +14,14 @@
 #define ID_SIZE 7
 static int _id_pins[ID_SIZE] = {25, 26, 27, 9, 10, 13, 5};
 
+// Battery measurement.
+#define BATTERY_CHANNEL ADC1_CHANNEL_0  // PIN_BATTERY.
+#define BATTERY_DIVIDER 2
+#define BATTERY_SAMPLES 8  // Averaged to reduce noise.
+#define DEFAULT_VREF_MV 1100  // Used if the chip's eFuse doesn't have a calibrated reference.
+
+static esp_adc_cal_characteristics_t _adc_chars;
+
 
 // Configure the specified pin as an input.
 static void configure_input_pin(int pin)
@@ -50,6 +62,10 @@ void gpio_init(void)
     {
         configure_input_pin(_id_pins[i]);
     }
+
+    adc1_config_width(ADC_WIDTH_BIT_12);
+    adc1_config_channel_atten(BATTERY_CHANNEL, ADC_ATTEN_DB_11);
+    esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, DEFAULT_VREF_MV, &_adc_chars);
 }
 
 
@@ -66,3 +82,20 @@ uint8_t read_module_id(void)
 
     return id;
 }
+
+
+// Read battery voltage, in mV.
+// Returns 0 if it can't be read.
+int read_battery_mv(void)
+{
+    int total = 0;
+
+    for(int i = 0; i < BATTERY_SAMPLES; i++)
+    {
+        int raw = adc1_get_raw(BATTERY_CHANNEL);
+        if(raw < 0) return 0;
+        total += raw;
+    }
+
+    return esp_adc_cal_raw_to_voltage(total / BATTERY_SAMPLES, &_adc_chars) * BATTERY_DIVIDER;
+}
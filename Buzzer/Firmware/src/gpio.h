@@ -10,6 +10,7 @@
 #define PIN_LED_BUTTON 16
 #define PIN_BUZZER 12
 #define PIN_BUTTON 17
+#define PIN_BATTERY 36  // Battery voltage, via the FireBeetle's divider. ADC1 channel 0.
 
 // Configure all required pins as inputs/outputs.
 void gpio_init(void);
@@ -17,4 +18,8 @@ void gpio_init(void);
 // Read module ID from GPIOs.
 uint8_t read_module_id(void);
 
+// Read battery voltage, in mV.
+// Returns 0 if it can't be read.
+int read_battery_mv(void);
+
 #endif
@@ -1,42 +1,298 @@
 /* Functions to communicate with the host.
 
+The host tells us how often to send heartbeats, quickly while a question is open and slowly otherwise.
+
+The host synchronises its clock with ours using NTP style pings. We record when each ping arrives and the heartbeat
+task replies with that time and the time it sends the reply, so the host can remove our processing delay.
+
+At handshake time the host may select UDP transport. If so, presses and heartbeats are sent as UDP datagrams, so a
+lost TCP segment can't hold them up. Each press carries a sequence number and is resent until the host acknowledges
+it. Heartbeats aren't acknowledged. If a press gets no acknowledgement after several tries we fall back to TCP for the
+rest of the connection. Everything else, including all messages from the host, stays on TCP.
+
+Mode changes for the whole swarm may also be broadcast by the host, so that every buzzer changes mode at the same
+time, rather than one after another as with individual TCP messages. Each broadcast carries a sequence number, so we
+can ignore duplicates and late copies. We report when we applied each broadcast, so the host can see how spread out
+the swarm was. Team mode broadcasts also say which teams should arm, and may exclude a single buzzer. If the host is
+running several quizzes in different rooms it tells us which room we're in, and we ignore broadcasts for other rooms.
+
+The host gives us a token for each session. If we lose our connection, we present it when we reconnect, so the host
+can resume our session, rather than treating us as a new buzzer. The token is only kept in RAM, since after a reboot
+our clock has restarted and the host's sync with it is no longer valid.
+
+Every so often we also send a telemetry message, with our signal strength, reconnect and send failure counts, free
+stack and heap, and battery voltage. This lets the host tell radio problems apart from firmware problems or a flat
+battery. It's separate from the heartbeat, so heartbeats stay a single byte.
+
+The host can also ask for a dump of our latency trace, see trace.c, to see where the time goes on real hardware.
+
+The host can update our firmware, see ota.c, by streaming an image to us in chunks. Each step is acknowledged with a
+status, giving how much has been written so far, so the host can keep a few chunks in flight. While an update is in
+progress we stay in our low latency radio profile whatever the host asks for, since power saving would throttle the
+transfer. Losing the host abandons the update.
+
+After our version byte every message over TCP, in both directions, is framed with its length. This lets our ID be 16
+bits, with our team in the top byte, and lets messages we don't know be skipped. Messages that are ready at the same
+time are sent together, in a single segment: the heartbeat task batches heartbeats, telemetry and sync replies, and we
+batch replies to each batch of messages from the host. Presses are always sent straight away.
+
+Messages from the host are received in batches, whatever has arrived, waking regularly to check the link. The host
+sends sync pings every 500ms, so if we've heard nothing for a few seconds the link is dead and we return, so
+reconnecting can start straight away.
+
+The UDP sockets are owned by the UDP task, which opens and closes them as needed, waits for acknowledgements and
+broadcasts, and resends presses.
+
 */
 
+#include <errno.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "lwip/sockets.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "global.h"
 #include "host.h"
 #include "gpio.h"
+#include "ota.h"
 #include "state.h"
+#include "trace.h"
+#include "wifi.h"
 
 // Hardcode host IP address.
 #define HOST_IP "192.168.2.5"
+#define HOST_PORT 9753
 
 static volatile int _host_socket;
+static SemaphoreHandle_t _send_lock;  // Held for each send on our TCP socket, so frames from different tasks can't mix.
+static TaskHandle_t _heartbeat_task;
+static TaskHandle_t _udp_task;
+static TaskHandle_t _main_task;  // The task that processes messages from the host.
+static uint16_t _buzzer_id;  // Our ID as the host sees it, with our team in the top byte.
+static uint32_t _resume_token;  // Token from the host to resume our session on reconnect. 0 for none.
+
+// UDP transport.
+static volatile bool _udp_wanted;  // Whether the host has selected UDP for this connection.
+static volatile int _udp_socket;  // 0 if not open.
+
+// The most recent press, which if sent over UDP may be waiting for the host to acknowledge it.
+static portMUX_TYPE _press_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t _press_seq;  // Sequence number of the most recent press.
+static int64_t _press_time;  // Time of the most recent press, in us since boot.
+static bool _press_pending;  // Whether the most recent press is waiting for acknowledgement.
+static int _press_sends;  // Number of times the most recent press has been sent.
+static int64_t _press_last_send;  // Time the most recent press was last sent, in us since boot.
+
+// Mode broadcasts.
+static int _broadcast_socket;  // 0 if not open.
+static volatile bool _broadcast_any;  // Whether we've had any broadcasts on this connection.
+static uint16_t _broadcast_seq;  // Sequence number of the latest broadcast applied.
+static volatile uint8_t _room;  // Room the host has put us in, 0 if it hasn't.
+
+#define BROADCAST_PORT 9755
+#define UDP_MAX_MSG 16
+#define UDP_ID_SIZE 2  // Our ID, at the start of each datagram we send.
+#define UDP_WIDE_ID 0x80  // Flag in the first byte of our datagrams showing the ID takes 2 bytes.
+#define PRESS_MSG_SIZE 14
+#define PRESS_RETRY_MS 20  // Resend unacknowledged presses this often.
+#define PRESS_MAX_SENDS 10  // After this we give up on UDP and fall back to TCP.
+
+// The most recent sync ping, waiting for the heartbeat task to reply to it.
+static portMUX_TYPE _sync_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t _sync_seq;  // Sequence number from the ping.
+static int64_t _sync_recv_time;  // Time the ping was received, in us since boot.
+
+static volatile int _heartbeat_period_ms;  // Set by the host.
+static volatile bool _sync_pending;  // Whether a sync ping is waiting for the heartbeat task to reply.
+
+#define HEARTBEAT_DEFAULT_MS 1000  // Until the host tells us otherwise.
+#define HEARTBEAT_MIN_MS 50
+#define HEARTBEAT_MAX_MS 10000
+
+// Telemetry.
+static volatile uint32_t _send_failures;  // Number of failed sends since boot.
+static int _host_connects;  // Number of successful host connections since boot.
+static volatile bool _telemetry_due;  // Whether telemetry should be sent with the next heartbeat.
+
+static bool _radio_low_latency;  // Radio profile the host last asked for.
+
+#define TELEMETRY_PERIOD_MS 10000
+#define TELEMETRY_MSG_SIZE 19
+#define TELEMETRY_FAST_CONNECT 0x01  // Flag bit for the last WIFI connection being a fast reconnect.
+
+#define TRACE_ENTRY_SIZE 10  // Size of each event in a trace message.
+
+#define OTA_STATUS_MSG_SIZE 6
+#define OTA_DATA_HEADER_SIZE 6  // Parameter bytes of an OTA data message before its data.
+
+// Framing of TCP messages.
+#define FRAME_HEADER_SIZE 2  // Each message is preceded by its size.
+#define FRAME_SMALL_MAX 32  // Largest message we frame on the stack. Anything bigger must come with room for its header.
+#define BATCH_MAX 64  // Size of each batch of messages to send together.
+
+// A batch of framed messages to send together.
+typedef struct
+{
+    uint8_t data[BATCH_MAX];
+    int size;
+} batch_t;
+
+// Receiving from the host.
+#define HOST_RX_BUFFER (OTA_CHUNK_MAX + 16)  // Larger than any message, so a complete one always fits.
+#define HOST_RX_POLL_MS 100  // How often we check our connection is still alive while waiting for messages.
+#define HOST_RX_TIMEOUT_MS 3000  // The host pings us every 500ms, so if we hear nothing for this long it's gone...
+#define HOST_RX_TIMEOUT_HEARTBEATS 4  // ...unless our heartbeats are slower than usual, when it pings once per period.
+
+#ifdef PRESS_JITTER_STATS
+static const char *TAG = "host";
+
+// Time from button edge to send returning, for every press since boot.
+static int64_t _press_delay_min_us;
+static int64_t _press_delay_max_us;
+static int _press_delay_count;
+#endif
 
 // Message values.
-#define MSG_VERSION     0x04
+#define MSG_VERSION     0x12
 #define MSG_MODE_PREFIX 0x20
-#define MSG_MODE_MASK   0xFC
+#define MSG_MODE_MASK   0xF8
 #define MSG_MODE_LED    0x01
 #define MSG_MODE_AUDIO  0x02
-#define MSG_PRESS       0x30
+#define MSG_MODE_ARMED  0x04
+#define MSG_SYNC_PONG   0x33
+#define MSG_PROBE_REPLY 0x34
+#define MSG_PRESS_SEQ   0x35
+#define MSG_MODE_APPLIED 0x36
+#define MSG_TELEMETRY   0x38
+#define MSG_TRACE       0x39
+#define MSG_OTA_STATUS  0x3A
+#define MSG_HELLO       0x3B
+#define MSG_SYNC_PING   0x40
+#define MSG_PROBE       0x41
+#define MSG_RADIO       0x42
+#define MSG_RADIO_LOW_LATENCY 0x01
+#define MSG_TRANSPORT   0x43
+#define MSG_TRANSPORT_UDP 0x01
+#define MSG_PRESS_ACK   0x44
+#define MSG_MODE_BROADCAST 0x45
+#define MSG_TEAM_MODE_BROADCAST 0x4E
+#define MSG_RESUME_TOKEN 0x47
+#define MSG_HEARTBEAT_PERIOD 0x48
+#define MSG_TRACE_REQUEST 0x49
+#define MSG_OTA_BEGIN   0x4A
+#define MSG_OTA_DATA    0x4B
+#define MSG_OTA_END     0x4C
+#define MSG_OTA_ABORT   0x4D
+#define MSG_ROOM        0x4F
 #define MSG_HEARTBEAT   0x31
 #define MSG_ERR_BAD_MSG 0x7F
-#define MSG_ID_PREFIX   0x80
+#define MSG_NO_BUZZER   0xFFFF  // ID in a team mode broadcast meaning no buzzer is left out.
 
 
-// Send the given message to our host.
+// Send the given bytes to our host, as they are. These must be whole frames, or our version byte.
+// The press, heartbeat and main tasks all send, so we hold our lock until every byte has gone, otherwise their frames
+// could be interleaved, and the host would lose track of where each starts.
 // Returns true on success, false on failure.
-static bool host_send(uint8_t message_byte)
+static bool host_send_raw(const uint8_t *bytes, int size)
 {
-    if(_host_socket == 0) return false;
+    xSemaphoreTake(_send_lock, portMAX_DELAY);
 
-    // Send message byte.
-    char msg[] = {message_byte};
-    if(send(_host_socket, msg, 1, 0) < 0)
+    int sock = _host_socket;
+    int sent = 0;
+
+    while(sock != 0 && sent < size)
     {
-        // Error sending.
-        _host_socket = 0;
+        int count = send(sock, &bytes[sent], size - sent, 0);
+        if(count <= 0)
+        {
+            // Error sending.
+            _send_failures++;
+            if(_host_socket == sock) _host_socket = 0;
+            break;
+        }
+
+        sent += count;
+    }
+
+    xSemaphoreGive(_send_lock);
+    return (sock != 0 && sent == size);
+}
+
+
+// Write the given value into the given buffer, big endian.
+static void put_be(uint8_t *buffer, uint64_t value, int size)
+{
+    for(int i = size - 1; i >= 0; i--)
+    {
+        buffer[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+
+// Send the given message to our host, framed. The message must be no bigger than FRAME_SMALL_MAX.
+// Returns true on success, false on failure.
+static bool host_send_bytes(const uint8_t *msg, int size)
+{
+    uint8_t frame[FRAME_HEADER_SIZE + FRAME_SMALL_MAX];
+    put_be(frame, size, FRAME_HEADER_SIZE);
+    memcpy(&frame[FRAME_HEADER_SIZE], msg, size);
+    return host_send_raw(frame, FRAME_HEADER_SIZE + size);
+}
+
+
+// Add the given message to the given batch, framed, sending what's already in the batch first if there's no room.
+static void batch_add(batch_t *batch, const uint8_t *msg, int size)
+{
+    if((batch->size + FRAME_HEADER_SIZE + size) > BATCH_MAX)
+    {
+        host_send_raw(batch->data, batch->size);
+        batch->size = 0;
+    }
+
+    put_be(&batch->data[batch->size], size, FRAME_HEADER_SIZE);
+    memcpy(&batch->data[batch->size + FRAME_HEADER_SIZE], msg, size);
+    batch->size += FRAME_HEADER_SIZE + size;
+}
+
+
+// Send everything in the given batch, and empty it.
+static void batch_flush(batch_t *batch)
+{
+    if(batch->size == 0) return;
+
+    host_send_raw(batch->data, batch->size);
+    batch->size = 0;
+}
+
+
+// Read a value of the given size from the given buffer, big endian.
+static uint32_t get_be(const uint8_t *buffer, int size)
+{
+    uint32_t value = 0;
+    for(int i = 0; i < size; i++) value = (value << 8) | buffer[i];
+    return value;
+}
+
+
+// Send the given message bytes to our host as a UDP datagram, prefixed by our ID.
+// Returns true on success, false on failure or if we're not using UDP.
+static bool udp_send(const uint8_t *msg, int size)
+{
+    int sock = _udp_socket;
+    if(!_udp_wanted || sock == 0) return false;
+
+    uint8_t datagram[UDP_ID_SIZE + UDP_MAX_MSG];
+    put_be(datagram, _buzzer_id, UDP_ID_SIZE);
+    datagram[0] |= UDP_WIDE_ID;
+    memcpy(&datagram[UDP_ID_SIZE], msg, size);
+
+    if(send(sock, datagram, UDP_ID_SIZE + size, 0) < 0)
+    {
+        _send_failures++;
         return false;
     }
 
@@ -44,15 +300,368 @@ static bool host_send(uint8_t message_byte)
 }
 
 
-// Task to send heartbeats to our host.
+// Open a UDP socket to our host.
+// Returns the socket on success, 0 on failure.
+static int udp_open(void)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if(sock < 0) return 0;
+
+    struct sockaddr_in host_addr;
+    host_addr.sin_addr.s_addr = inet_addr(HOST_IP);
+    host_addr.sin_family = AF_INET;
+    host_addr.sin_port = htons(HOST_PORT);
+
+    if(connect(sock, (struct sockaddr *)&host_addr, sizeof(struct sockaddr_in)) != 0)
+    {
+        close(sock);
+        return 0;
+    }
+
+    return sock;
+}
+
+
+// Open a UDP socket to receive mode broadcasts.
+// Returns the socket on success, 0 on failure.
+static int broadcast_open(void)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if(sock < 0) return 0;
+
+    struct sockaddr_in addr;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BROADCAST_PORT);
+
+    if(bind(sock, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) != 0)
+    {
+        close(sock);
+        return 0;
+    }
+
+    return sock;
+}
+
+
+// Apply the given mode message.
+static void apply_mode(uint8_t msg)
+{
+    // Check bits to see which outputs should be on.
+    bool led = ((msg & MSG_MODE_LED) != 0);
+    bool audio = ((msg & MSG_MODE_AUDIO) != 0);
+    bool armed = ((msg & MSG_MODE_ARMED) != 0);
+    state_enable(led, audio, armed);
+    trace(TRACE_MODE_APPLIED, msg);
+}
+
+
+// Receive and apply a mode broadcast.
+static void process_broadcast(void)
+{
+    uint8_t msg[UDP_MAX_MSG];
+    int count = recv(_broadcast_socket, msg, sizeof(msg), 0);
+    if(_host_socket == 0) return;  // Not connected, ignore.
+
+    uint8_t mode;
+    if(count == 4 && msg[0] == MSG_MODE_BROADCAST) {
+        mode = msg[3];
+    } else if((count == 8 || count == 9) && msg[0] == MSG_TEAM_MODE_BROADCAST) {
+        // Team mode broadcast. This says which teams should arm, and may be meant for everyone except us.
+        // Broadcasts for a single room end with its number.
+        if(count == 9 && msg[8] != _room) return;
+        if(get_be(&msg[6], 2) == _buzzer_id) return;
+
+        mode = msg[3];
+        if((get_be(&msg[4], 2) & (1 << (_buzzer_id >> 8))) != 0) mode |= MSG_MODE_ARMED;
+    } else {
+        return;  // Not a valid broadcast, ignore.
+    }
+
+    // Ignore duplicates and late copies. Sequence numbers wrap, so compare the difference.
+    uint16_t seq = (msg[1] << 8) | msg[2];
+    if(_broadcast_any && (int16_t)(seq - _broadcast_seq) <= 0) return;
+
+    int64_t now = esp_timer_get_time();
+    _broadcast_any = true;
+    _broadcast_seq = seq;
+    apply_mode(mode);
+
+    // Report when we applied it.
+    uint8_t reply[11];
+    reply[0] = MSG_MODE_APPLIED;
+    reply[1] = msg[1];
+    reply[2] = msg[2];
+    put_be(&reply[3], (uint64_t)now, 8);
+    if(!udp_send(reply, sizeof(reply))) host_send_bytes(reply, sizeof(reply));
+}
+
+
+// Build a press message for the given press.
+static void build_press(uint8_t *msg, uint8_t seq, int64_t press_time)
+{
+    // We send the time the press happened, plus how long ago that was. The host can use the age to correct for our
+    // own queueing delay, even before our clocks are synchronised.
+    int64_t age = esp_timer_get_time() - press_time;
+    if(age > UINT32_MAX) age = UINT32_MAX;
+
+    msg[0] = MSG_PRESS_SEQ;
+    msg[1] = seq;
+    put_be(&msg[2], (uint64_t)press_time, 8);
+    put_be(&msg[10], (uint64_t)age, 4);
+}
+
+
+// Resend the pending press, if there is one and it's due.
+// If we've sent it too many times, give up on UDP and send it over TCP instead.
+static void resend_press(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&_press_lock);
+    bool due = _press_pending && (now - _press_last_send) >= (PRESS_RETRY_MS * 1000);
+    bool give_up = (_press_sends >= PRESS_MAX_SENDS);
+    uint8_t seq = _press_seq;
+    int64_t press_time = _press_time;
+
+    if(due)
+    {
+        _press_sends++;
+        _press_last_send = now;
+        if(give_up) _press_pending = false;
+    }
+    portEXIT_CRITICAL(&_press_lock);
+
+    if(!due) return;
+
+    uint8_t msg[PRESS_MSG_SIZE];
+    build_press(msg, seq, press_time);
+
+    if(give_up)
+    {
+        // UDP isn't getting through, use TCP for the rest of this connection.
+        _udp_wanted = false;
+        host_send_bytes(msg, sizeof(msg));
+        return;
+    }
+
+    udp_send(msg, sizeof(msg));
+}
+
+
+// Receive a press acknowledgement.
+static void process_ack(void)
+{
+    uint8_t msg[UDP_MAX_MSG];
+    int count = recv(_udp_socket, msg, sizeof(msg), 0);
+    if(count != 2 || msg[0] != MSG_PRESS_ACK) return;  // Not a valid acknowledgement, ignore.
+
+    portENTER_CRITICAL(&_press_lock);
+    if(msg[1] == _press_seq) _press_pending = false;
+    portEXIT_CRITICAL(&_press_lock);
+}
+
+
+// Task to manage our UDP sockets, receive press acknowledgements and mode broadcasts, and resend presses.
+static void udp_task(void *param)
+{
+    while(1)
+    {
+        // We always listen for broadcasts. Our own UDP socket is only open if we're using UDP.
+        if(_broadcast_socket == 0) _broadcast_socket = broadcast_open();
+
+        if(!_udp_wanted && _udp_socket != 0)
+        {
+            close(_udp_socket);
+            _udp_socket = 0;
+        }
+
+        if(_udp_wanted && _udp_socket == 0) _udp_socket = udp_open();
+
+        int broadcast_socket = _broadcast_socket;
+        int udp_socket = _udp_socket;
+
+        if(broadcast_socket == 0 && udp_socket == 0)
+        {
+            // No sockets, wait a while before trying again.
+            vTaskDelay(100 / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        // Wait for something to receive, or until it's time to check for resends.
+        fd_set fds;
+        FD_ZERO(&fds);
+        if(broadcast_socket != 0) FD_SET(broadcast_socket, &fds);
+        if(udp_socket != 0) FD_SET(udp_socket, &fds);
+        int max_socket = (broadcast_socket > udp_socket) ? broadcast_socket : udp_socket;
+
+        struct timeval timeout = { .tv_sec = 0, .tv_usec = PRESS_RETRY_MS * 1000 };
+        int ready = select(max_socket + 1, &fds, NULL, NULL, &timeout);
+
+        if(ready > 0)
+        {
+            if(broadcast_socket != 0 && FD_ISSET(broadcast_socket, &fds)) process_broadcast();
+            if(udp_socket != 0 && FD_ISSET(udp_socket, &fds)) process_ack();
+        }
+
+        resend_press();
+    }
+}
+
+
+// Reply to the most recent sync ping, in the given batch.
+static void send_sync_pong(batch_t *batch)
+{
+    uint8_t msg[18];
+    msg[0] = MSG_SYNC_PONG;
+
+    portENTER_CRITICAL(&_sync_lock);
+    msg[1] = _sync_seq;
+    put_be(&msg[2], (uint64_t)_sync_recv_time, 8);
+    portEXIT_CRITICAL(&_sync_lock);
+
+    // The send time must be as late as possible, so we're sent as soon as the batch has room.
+    put_be(&msg[10], (uint64_t)esp_timer_get_time(), 8);
+    batch_add(batch, msg, sizeof(msg));
+}
+
+
+// Report the least free stack any of our tasks has had, in bytes.
+static int stack_free(void)
+{
+    int least = state_stack_free();
+    TaskHandle_t tasks[] = { _heartbeat_task, _udp_task, _main_task };
+
+    for(int i = 0; i < sizeof(tasks) / sizeof(tasks[0]); i++)
+    {
+        int task_free = uxTaskGetStackHighWaterMark(tasks[i]);
+        if(task_free < least) least = task_free;
+    }
+
+    return least;
+}
+
+
+// Limit the given count to fit in 16 bits.
+static uint16_t clamp_u16(int64_t value)
+{
+    if(value < 0) return 0;
+    if(value > UINT16_MAX) return UINT16_MAX;
+    return (uint16_t)value;
+}
+
+
+// Send a telemetry message to our host, in the given batch.
+static void send_telemetry(batch_t *batch)
+{
+    int64_t connect_us;
+    bool fast;
+    wifi_last_connect(&connect_us, &fast);
+
+    uint8_t msg[TELEMETRY_MSG_SIZE];
+    msg[0] = MSG_TELEMETRY;
+    msg[1] = (uint8_t)(int8_t)wifi_rssi();
+    put_be(&msg[2], clamp_u16(wifi_connect_count()), 2);
+    put_be(&msg[4], clamp_u16(_host_connects), 2);
+    put_be(&msg[6], clamp_u16(connect_us / 1000), 2);
+    msg[8] = fast ? TELEMETRY_FAST_CONNECT : 0;
+    put_be(&msg[9], clamp_u16(_send_failures), 2);
+    put_be(&msg[11], clamp_u16(stack_free()), 2);
+    put_be(&msg[13], clamp_u16(read_battery_mv()), 2);
+    put_be(&msg[15], esp_get_free_heap_size(), 4);
+    batch_add(batch, msg, sizeof(msg));
+}
+
+
+// Task to send heartbeats and telemetry to our host, and reply to sync pings.
+// Whatever is due at once is sent together.
+// The heartbeat period can be changed by the host at any time, which also wakes us.
 static void heartbeat_task(void *param)
 {
+    static batch_t batch;
+    TickType_t last_heartbeat = xTaskGetTickCount();
+    TickType_t last_telemetry = last_heartbeat;
+
     while(1)
     {
-        // We should only try to send if we have an open socket. host_send() handles that for us.
-        host_send(MSG_HEARTBEAT);
-        vTaskDelay(1000 / portTICK_PERIOD_MS);  // Send roughly every 1 second.
+        // Wait until the next heartbeat is due, or we're woken by a sync ping or a new period.
+        TickType_t period = _heartbeat_period_ms / portTICK_PERIOD_MS;
+        TickType_t elapsed = xTaskGetTickCount() - last_heartbeat;
+        TickType_t wait = (elapsed >= period) ? 0 : (period - elapsed);
+        bool woken = (ulTaskNotifyTake(pdTRUE, wait) > 0);
+
+        period = _heartbeat_period_ms / portTICK_PERIOD_MS;
+
+        if((xTaskGetTickCount() - last_heartbeat) >= period)
+        {
+            // We should only try to send if we have an open socket. host_send_raw() handles that for us.
+            // Heartbeats go over UDP if we can, with no acknowledgement.
+            uint8_t heartbeat = MSG_HEARTBEAT;
+            if(!udp_send(&heartbeat, 1)) batch_add(&batch, &heartbeat, 1);
+            last_heartbeat = xTaskGetTickCount();
+
+            // Telemetry is too big for UDP, so always goes over TCP.
+            if(_telemetry_due || (last_heartbeat - last_telemetry) >= (TELEMETRY_PERIOD_MS / portTICK_PERIOD_MS))
+            {
+                _telemetry_due = false;
+                send_telemetry(&batch);
+                last_telemetry = last_heartbeat;
+            }
+        }
+
+        // The sync reply goes last, so its send time is as late as possible.
+        if(woken && _sync_pending)
+        {
+            _sync_pending = false;
+            send_sync_pong(&batch);
+        }
+
+        batch_flush(&batch);
+    }
+}
+
+
+// Send our latency trace to our host.
+static void send_trace(void)
+{
+    // These are too big for our stack. The message has room for its frame header.
+    static trace_entry_t entries[TRACE_SIZE];
+    static uint8_t frame[FRAME_HEADER_SIZE + 2 + (TRACE_SIZE * TRACE_ENTRY_SIZE)];
+    uint8_t *msg = &frame[FRAME_HEADER_SIZE];
+
+    int count = trace_read(entries);
+    msg[0] = MSG_TRACE;
+    msg[1] = (uint8_t)count;
+
+    for(int i = 0; i < count; i++)
+    {
+        uint8_t *entry = &msg[2 + (i * TRACE_ENTRY_SIZE)];
+        put_be(entry, (uint64_t)entries[i].time, 8);
+        entry[8] = entries[i].event;
+        entry[9] = entries[i].arg;
     }
+
+    int size = 2 + (count * TRACE_ENTRY_SIZE);
+    put_be(frame, size, FRAME_HEADER_SIZE);
+    host_send_raw(frame, FRAME_HEADER_SIZE + size);
+}
+
+
+// Report the status of the firmware update to our host, in the given batch.
+static void send_ota_status(batch_t *batch, ota_status_t status)
+{
+    uint8_t msg[OTA_STATUS_MSG_SIZE];
+    msg[0] = MSG_OTA_STATUS;
+    msg[1] = (uint8_t)status;
+    put_be(&msg[2], ota_written(), 4);
+    batch_add(batch, msg, sizeof(msg));
+}
+
+
+// Select our radio profile. A firmware update overrides the host's choice, see above.
+static void apply_radio_profile(void)
+{
+    wifi_set_low_latency(_radio_low_latency || ota_active());
 }
 
 
@@ -61,9 +670,26 @@ static void heartbeat_task(void *param)
 void host_init(void)
 {
     _host_socket = 0;
+    _udp_wanted = false;
+    _udp_socket = 0;
+    _press_seq = 0;
+    _press_pending = false;
+    _resume_token = 0;
+    _heartbeat_period_ms = HEARTBEAT_DEFAULT_MS;
+    _sync_pending = false;
+    _broadcast_socket = 0;
+    _send_failures = 0;
+    _host_connects = 0;
+    _telemetry_due = false;
+    _radio_low_latency = false;
+    _main_task = xTaskGetCurrentTaskHandle();  // Messages are processed by whichever task calls us.
+    _send_lock = xSemaphoreCreateMutex();
 
-    // Start our heartbeat task.
-    xTaskCreate(heartbeat_task, "Heartbeat", 2048, NULL, 1, NULL);
+    // Start our heartbeat and UDP tasks.
+    // Both stay off the press core, see global.h.
+    xTaskCreatePinnedToCore(heartbeat_task, "Heartbeat", 2048, NULL, PRIORITY_HEARTBEAT, &_heartbeat_task,
+        CORE_NETWORK);
+    xTaskCreatePinnedToCore(udp_task, "Udp", 2048, NULL, PRIORITY_UDP, &_udp_task, CORE_NETWORK);
 }
 
 
@@ -77,10 +703,16 @@ bool host_connect(void)
         return false;
     }
 
+    // Until the host selects UDP we use TCP for everything, and the default heartbeat.
+    _udp_wanted = false;
+    _heartbeat_period_ms = HEARTBEAT_DEFAULT_MS;
+    _broadcast_any = false;
+    _room = 0;
+
     struct sockaddr_in host_addr;
     host_addr.sin_addr.s_addr = inet_addr(HOST_IP);
     host_addr.sin_family = AF_INET;
-    host_addr.sin_port = htons(9753);
+    host_addr.sin_port = htons(HOST_PORT);
 
     int err = connect(sock, (struct sockaddr *)&host_addr, sizeof(struct sockaddr_in));
     if(err != 0) {
@@ -91,41 +723,296 @@ bool host_connect(void)
         return false;
     }
 
-    // We're connected to the host. Send initial messages.
+    // We're connected to the host. Our messages are tiny, so don't let Nagle hold them up.
+    int nodelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    // Until the host tells us otherwise, save power.
+    _radio_low_latency = false;
+    wifi_set_low_latency(false);
+
+    // Send initial messages.
     _host_socket = sock;
-    uint8_t id = read_module_id();  // We need to know our ID.
 
-    if(!host_send(MSG_VERSION)) return false;
-    if(!host_send(MSG_ID_PREFIX | id)) return false;
+    // We need to know our ID. Our module ID switches give our team in the top 3 bits, and our number in the rest.
+    uint8_t module_id = read_module_id();
+    _buzzer_id = ((module_id >> 4) << 8) | (module_id & 15);
+
+    // Our version is unframed, so the host knows to expect frames after it. Then we give our ID, and ask to resume
+    // our last session, if we have one, so the host keeps our stats and restores our mode.
+    uint8_t version = MSG_VERSION;
+    uint8_t hello[7];
+    hello[0] = MSG_HELLO;
+    put_be(&hello[1], _buzzer_id, 2);
+    put_be(&hello[3], _resume_token, 4);
+
+    if(!host_send_raw(&version, 1) || !host_send_bytes(hello, sizeof(hello)))
+    {
+        close(sock);
+        return false;
+    }
 
+    // Let the host know how we're doing straight away.
+    _host_connects++;
+    _telemetry_due = true;
     return true;
 }
 
 
+// Report the number of parameter bytes following the message starting at the given bytes from our host, of which
+// the given number are available. If that's too few to tell, returns a size they're too few for.
+// Returns -1 if the message isn't recognised.
+static int message_size(const uint8_t *msg, int available)
+{
+    if((msg[0] & MSG_MODE_MASK) == MSG_MODE_PREFIX) return 0;
+
+    switch(msg[0])
+    {
+        case MSG_SYNC_PING:
+        case MSG_PROBE:
+        case MSG_RADIO:
+        case MSG_TRANSPORT:
+        case MSG_ROOM:
+            return 1;
+
+        case MSG_HEARTBEAT_PERIOD:
+            return 2;
+
+        case MSG_RESUME_TOKEN:
+            return 4;
+
+        case MSG_TRACE_REQUEST:
+        case MSG_OTA_END:
+        case MSG_OTA_ABORT:
+            return 0;
+
+        case MSG_OTA_BEGIN:
+            return 36;
+
+        case MSG_OTA_DATA:
+        {
+            // The data length is in the header.
+            if(available < (1 + OTA_DATA_HEADER_SIZE)) return OTA_DATA_HEADER_SIZE;
+
+            int size = get_be(&msg[5], 2);
+            if(size > OTA_CHUNK_MAX) return -1;
+            return OTA_DATA_HEADER_SIZE + size;
+        }
+
+        default:
+            return -1;
+    }
+}
+
+
+// Process the given complete message from our host, of the given size, received at the given time.
+// The parameter bytes follow the message byte. Any replies go in the given batch.
+static void process_message(const uint8_t *msg, int size, int64_t recv_time, batch_t *batch)
+{
+    trace_at(TRACE_RECV, msg[0], recv_time);
+
+    // Messages we don't know are from some later version, so are skipped. Those too short to hold their parameters
+    // are errors. Any extra parameters are for later versions too, so are ignored.
+    int needed = message_size(msg, size);
+    if(needed < 0) return;
+
+    if(size < (needed + 1))
+    {
+        uint8_t error = MSG_ERR_BAD_MSG;
+        batch_add(batch, &error, 1);
+        return;
+    }
+
+    if((msg[0] & MSG_MODE_MASK) == MSG_MODE_PREFIX) {
+        // Mode message.
+        apply_mode(msg[0]);
+    } else if(msg[0] == MSG_SYNC_PING) {
+        // Clock sync ping. Note when it arrived and let the heartbeat task reply.
+        portENTER_CRITICAL(&_sync_lock);
+        _sync_seq = msg[1];
+        _sync_recv_time = recv_time;
+        portEXIT_CRITICAL(&_sync_lock);
+
+        _sync_pending = true;
+        xTaskNotifyGive(_heartbeat_task);
+    } else if(msg[0] == MSG_PROBE) {
+        // Round trip time probe. Echo it straight back.
+        uint8_t reply[2];
+        reply[0] = MSG_PROBE_REPLY;
+        reply[1] = msg[1];
+        batch_add(batch, reply, sizeof(reply));
+    } else if(msg[0] == MSG_RADIO) {
+        // Radio profile.
+        _radio_low_latency = ((msg[1] & MSG_RADIO_LOW_LATENCY) != 0);
+        apply_radio_profile();
+    } else if(msg[0] == MSG_RESUME_TOKEN) {
+        // Token to resume this session if we reconnect.
+        _resume_token = ((uint32_t)msg[1] << 24) | ((uint32_t)msg[2] << 16) | ((uint32_t)msg[3] << 8) | msg[4];
+    } else if(msg[0] == MSG_HEARTBEAT_PERIOD) {
+        // Heartbeat period, in ms. Wake the heartbeat task so it takes effect straight away.
+        int ms = (msg[1] << 8) | msg[2];
+        if(ms < HEARTBEAT_MIN_MS) ms = HEARTBEAT_MIN_MS;
+        if(ms > HEARTBEAT_MAX_MS) ms = HEARTBEAT_MAX_MS;
+        _heartbeat_period_ms = ms;
+        xTaskNotifyGive(_heartbeat_task);
+    } else if(msg[0] == MSG_TRACE_REQUEST) {
+        // Dump our latency trace.
+        send_trace();
+    } else if(msg[0] == MSG_TRANSPORT) {
+        // Transport selection. The UDP task will open its socket when it sees this.
+        _udp_wanted = ((msg[1] & MSG_TRANSPORT_UDP) != 0);
+    } else if(msg[0] == MSG_ROOM) {
+        // Room we're in, so we know which broadcasts are for us.
+        _room = msg[1];
+    } else if(msg[0] == MSG_OTA_BEGIN) {
+        // Start of a firmware update. This erases flash, so takes a while.
+        send_ota_status(batch, ota_begin(get_be(&msg[1], 4), &msg[5]));
+        apply_radio_profile();
+    } else if(msg[0] == MSG_OTA_DATA) {
+        // Chunk of firmware image.
+        send_ota_status(batch, ota_write(get_be(&msg[1], 4), &msg[7], get_be(&msg[5], 2)));
+        apply_radio_profile();
+    } else if(msg[0] == MSG_OTA_END) {
+        // End of a firmware update. If it verifies we restart into it.
+        send_ota_status(batch, ota_end());
+        apply_radio_profile();
+    } else if(msg[0] == MSG_OTA_ABORT) {
+        // Firmware update cancelled.
+        ota_abort();
+        apply_radio_profile();
+    }
+}
+
+
+// Report how long we wait to hear from the host before deciding it's gone, in us.
+static int64_t host_rx_timeout_us(void)
+{
+    if(_heartbeat_period_ms <= HEARTBEAT_DEFAULT_MS) return HOST_RX_TIMEOUT_MS * 1000;
+
+    int64_t timeout_ms = (int64_t)_heartbeat_period_ms * HOST_RX_TIMEOUT_HEARTBEATS;
+    if(timeout_ms < HOST_RX_TIMEOUT_MS) timeout_ms = HOST_RX_TIMEOUT_MS;
+    return timeout_ms * 1000;
+}
+
+
 // Listen for, and process, incoming messages from the host.
-// Only returns when communication with the host is lost.
+// Only returns when communication with the host is lost, having closed our connection.
 void host_process_messages(void)
 {
-    while(_host_socket != 0)
+    int sock = _host_socket;
+    static uint8_t buffer[HOST_RX_BUFFER];  // Too big for our stack.
+    static batch_t batch;  // Replies to the messages received together.
+    int buffered = 0;  // Number of bytes in buffer, which start with an incomplete message.
+    bool bad_frame = false;
+    int64_t last_recv = esp_timer_get_time();
+
+    // A failed send elsewhere also means we've lost the host.
+    while(_host_socket == sock)
     {
-        uint8_t msg;
-        recv(_host_socket, &msg, 1, 0);
+        // Wait for something to arrive. We wake regularly to check whether the link has died.
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(sock, &fds);
+        struct timeval timeout = { .tv_sec = 0, .tv_usec = HOST_RX_POLL_MS * 1000 };
+        int ready = select(sock + 1, &fds, NULL, NULL, &timeout);
+        int64_t now = esp_timer_get_time();
+
+        if(ready < 0) break;  // Socket error.
+
+        if(ready == 0)
+        {
+            // The host sends sync pings regularly, so if it's gone quiet the link is dead.
+            if((now - last_recv) >= host_rx_timeout_us()) break;
+            continue;
+        }
+
+        // Read everything that's arrived, as far as we have room.
+        int count = recv(sock, &buffer[buffered], sizeof(buffer) - buffered, MSG_DONTWAIT);
+        if(count == 0) break;  // Host closed the connection.
+        if(count < 0)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) continue;
+            break;  // Error receiving.
+        }
 
-        if((msg & MSG_MODE_MASK) == MSG_MODE_PREFIX) {
-            // Mode message. Check bits to see which outputs should be on.
-            bool led = ((msg & MSG_MODE_LED) != 0);
-            bool audio = ((msg & MSG_MODE_AUDIO) != 0);
-            state_enable(led, audio);
-        } else {
-            // Unrecognised message, error.
-            host_send(MSG_ERR_BAD_MSG);
+        last_recv = now;
+        buffered += count;
+
+        // Process every complete message.
+        int start = 0;
+        while((buffered - start) >= FRAME_HEADER_SIZE)
+        {
+            int size = get_be(&buffer[start], FRAME_HEADER_SIZE);
+            if(size == 0 || (FRAME_HEADER_SIZE + size) > sizeof(buffer))
+            {
+                // We'd never have room for this, so can't find the next message. The connection is no good.
+                bad_frame = true;
+                break;
+            }
+
+            if((buffered - start) < (FRAME_HEADER_SIZE + size)) break;  // Incomplete, wait for the rest.
+
+            process_message(&buffer[start + FRAME_HEADER_SIZE], size, now, &batch);
+            start += FRAME_HEADER_SIZE + size;
         }
+
+        batch_flush(&batch);
+        if(bad_frame) break;
+
+        // Move any incomplete message to the start of the buffer.
+        memmove(buffer, &buffer[start], buffered - start);
+        buffered -= start;
     }
+
+    batch.size = 0;
+
+    // Any firmware update can't be finished now.
+    ota_abort();
+
+    // Make sure nothing else tries to use our connection, then close it.
+    if(_host_socket == sock) _host_socket = 0;
+    shutdown(sock, SHUT_RDWR);
+    close(sock);
 }
 
 
 // Send a button press message to our host.
-void host_send_press(void)
+// The press time is in us since boot, as returned by esp_timer_get_time().
+void host_send_press(int64_t press_time)
 {
-    host_send(MSG_PRESS);
+    bool udp = _udp_wanted && (_udp_socket != 0);
+
+    portENTER_CRITICAL(&_press_lock);
+    uint8_t seq = ++_press_seq;
+    _press_time = press_time;
+    _press_pending = udp;  // Only UDP presses are acknowledged.
+    _press_sends = 1;
+    _press_last_send = esp_timer_get_time();
+    portEXIT_CRITICAL(&_press_lock);
+
+    uint8_t msg[PRESS_MSG_SIZE];
+    build_press(msg, seq, press_time);
+
+    trace(TRACE_SEND_START, seq);
+
+    if(udp) {
+        // If this fails the UDP task will resend it.
+        udp_send(msg, sizeof(msg));
+    } else {
+        host_send_bytes(msg, sizeof(msg));
+    }
+
+    trace(TRACE_SEND_DONE, seq);
+
+#ifdef PRESS_JITTER_STATS
+    // Presses are only sent by the press task, so these don't need a lock.
+    int64_t delay = esp_timer_get_time() - press_time;
+    if(_press_delay_count == 0 || delay < _press_delay_min_us) _press_delay_min_us = delay;
+    if(_press_delay_count == 0 || delay > _press_delay_max_us) _press_delay_max_us = delay;
+    _press_delay_count++;
+
+    ESP_LOGI(TAG, "Press to send %lldus, min %lldus, max %lldus, worst jitter %lldus over %d presses",
+        (long long)delay, (long long)_press_delay_min_us, (long long)_press_delay_max_us,
+        (long long)(_press_delay_max_us - _press_delay_min_us), _press_delay_count);
+#endif
 }
@@ -14,11 +14,11 @@ void host_init(void);
 bool host_connect(void);
 
 // Listen for, and process, incoming messages from the host.
-// Only returns when communication with the host is lost.
+// Only returns when communication with the host is lost, having closed our connection.
 void host_process_messages(void);
 
 // Send a button press message to our host.
-// May be called from interrupts.
-void host_send_press(void);
+// The press time is in us since boot, as returned by esp_timer_get_time().
+void host_send_press(int64_t press_time);
 
 #endif
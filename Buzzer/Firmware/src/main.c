@@ -1,65 +1,45 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "driver/timer.h"
 #include "nvs_flash.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
 
 #include "global.h"
 #include "audio.h"
 #include "gpio.h"
 #include "host.h"
+#include "ota.h"
 #include "state.h"
 #include "wifi.h"
 
 // #include "freertos/FreeRTOS.h"
 // #include "freertos/task.h"
 #include "driver/gpio.h"
-#include "driver/timer.h"
 #include "global.h"
 #include "audio.h"
 #include "gpio.h"
 #include "state.h"
 
-static int _timer_state_divide;  // Divide counter for state tick.
+// Delays before trying to reconnect to the host. Each failure doubles the delay, up to the maximum. The actual delay
+// is randomised between half and all of this, so a swarm that loses the host together doesn't all return together.
+#define RECONNECT_MIN_MS 250
+#define RECONNECT_MAX_MS 8000
 
 
-// Interrupt tick handler.
-static void IRAM_ATTR audio_isr(void *param)
+// Setup power management.
+// Nothing needs a regular tick, so whenever all our tasks are waiting the CPU goes into light sleep, and the radio
+// wakes for beacons. The button wakes us when pressed. Anything that can't cope with this holds a power management
+// lock while it needs to.
+static void setup_power(void)
 {
-    // Timer admin.
-    TIMERG0.int_clr_timers.t0 = 1;
-    TIMERG0.hw_timer[0].config.alarm_en = 1;
-
-    // Call the audio tick every millisecond.
-    audio_tick();
-
-    // Call the state tick every 125ms.
-    _timer_state_divide++;
-    if(_timer_state_divide >= 125)
-    {
-        state_tick();
-        _timer_state_divide = 0;
-    }
-}
-
-
-// Setup the tick timer.
-static void setup_timer(void)
-{
-    _timer_state_divide = 0;
-
-    timer_config_t config;
-    config.divider = 80;  // Set prescaler for 1 MHz clock.
-    config.counter_dir = TIMER_COUNT_UP;
-    config.alarm_en = 1;
-    config.intr_type = TIMER_INTR_LEVEL;
-    config.auto_reload = TIMER_AUTORELOAD_EN;
-    config.counter_en = TIMER_PAUSE;
-    timer_init(TIMER_GROUP_0, 0, &config);
-    timer_set_counter_value(TIMER_GROUP_0, 0 ,0);
-    timer_isr_register(TIMER_GROUP_0, 0, audio_isr, NULL, ESP_INTR_FLAG_IRAM, NULL);
-    timer_set_alarm_value(TIMER_GROUP_0, 0, 1000);  // Period in ms.
-    timer_enable_intr(TIMER_GROUP_0, 0);
-    timer_start(TIMER_GROUP_0, 0);
+    esp_pm_config_esp32_t config = {
+        .max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = 80,  // Lowest that keeps the APB clock, and so our tone frequencies, unchanged.
+        .light_sleep_enable = true
+    };
+    esp_pm_configure(&config);
+    esp_sleep_enable_gpio_wakeup();
 }
 
 
@@ -73,6 +53,9 @@ static bool run(void)
     if(!wifi_connect()) return false;
     if(!host_connect()) return false;
 
+    // Reaching the host proves any new firmware works.
+    ota_connected();
+
     // We're connected to the host. Process any messages it sends us, until we're disconnected.
     state_connected();
     host_process_messages();
@@ -91,24 +74,36 @@ void app_main(void)
 
     ESP_ERROR_CHECK(ret);
 
+    // If this is new firmware, it has a limited time to prove itself.
+    ota_init();
+
+    // We process messages from the host, see the task plan in global.h.
+    vTaskPrioritySet(NULL, PRIORITY_HOST);
+
     // Initialise everything else.
     gpio_init();
+    audio_init();
     wifi_init();
     state_init();
     host_init();
-    audio_init();
-    setup_timer();
+    setup_power();
 
     // Main loop.
+    int backoff_ms = RECONNECT_MIN_MS;
     while(1)
     {
         // Try talking to the host.
-        if(!run())
+        if(run())
         {
-            // Couldn't connect to host. Wait before trying again.
-            vTaskDelay(2000 / portTICK_PERIOD_MS);
+            // We were connected, so start backing off from the minimum again.
+            backoff_ms = RECONNECT_MIN_MS;
         }
 
-        // We aren't connected to the host, try again.
+        // We aren't connected to the host. Wait before trying again.
+        int delay_ms = (backoff_ms / 2) + (esp_random() % ((backoff_ms / 2) + 1));
+        vTaskDelay(delay_ms / portTICK_PERIOD_MS);
+
+        backoff_ms *= 2;
+        if(backoff_ms > RECONNECT_MAX_MS) backoff_ms = RECONNECT_MAX_MS;
     }
 }
@@ -0,0 +1,197 @@
+/* Firmware updates over the air.
+
+The host streams a new image to us in chunks, see host.c, which we write straight to whichever OTA partition we aren't
+running from. Chunks must arrive in order. We hash the image as it's written, and at the end check that against the
+SHA-256 the host gave us at the start, and let the OTA library validate the image itself. Only then is it made the
+boot partition, and we restart into it.
+
+New firmware has to prove itself. The bootloader starts it in the pending verify state, and it's only marked valid once
+it has connected to the host, which shows WIFI and host communication work. If it hasn't done so within a couple of
+minutes we roll back to the previous firmware. Any reboot before then, such as a crash, also rolls back, since the
+bootloader won't start a pending image twice.
+
+Writing flash stalls both cores while each sector is erased or written, so the host must not update us while a
+question is open.
+
+*/
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include "global.h"
+#include "ota.h"
+
+#define OTA_VERIFY_TIMEOUT_MS 120000  // New firmware that hasn't reached the host by now is rolled back.
+#define OTA_RESTART_DELAY_MS 500  // Time for our final status to reach the host before we restart.
+
+static const char *TAG = "ota";
+
+static bool _ota_pending_verify;  // Whether we're running new firmware that hasn't proved itself yet.
+static esp_timer_handle_t _ota_verify_timer;  // Rolls back unproven firmware.
+static esp_timer_handle_t _ota_restart_timer;  // Restarts us into new firmware.
+
+// The update in progress.
+static const esp_partition_t *_ota_partition;  // Partition being written. NULL if no update in progress.
+static esp_ota_handle_t _ota_handle;
+static mbedtls_sha256_context _ota_sha;  // Hash of the image so far.
+static uint8_t _ota_expected_sha[32];  // Hash the host says the image should have.
+static uint32_t _ota_size;  // Total size of the image.
+static uint32_t _ota_written;  // Bytes of the image written so far.
+
+
+// Give up on new firmware that hasn't reached the host in time, and go back to the previous firmware.
+// Called from the esp_timer task.
+static void verify_timeout(void *param)
+{
+    ESP_LOGE(TAG, "New firmware hasn't reached the host, rolling back");
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+}
+
+
+// Restart into new firmware.
+// Called from the esp_timer task.
+static void restart(void *param)
+{
+    esp_restart();
+}
+
+
+// Initialise firmware updates.
+// If we're running new firmware that hasn't yet proved itself, this starts the timer that will roll it back.
+void ota_init(void)
+{
+    _ota_partition = NULL;
+    _ota_pending_verify = false;
+
+    esp_timer_create_args_t restart_args = { .callback = restart, .name = "ota_restart" };
+    esp_timer_create(&restart_args, &_ota_restart_timer);
+
+    esp_ota_img_states_t state;
+    if(esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) != ESP_OK) return;
+    if(state != ESP_OTA_IMG_PENDING_VERIFY) return;
+
+    ESP_LOGI(TAG, "New firmware, rolling back unless we reach the host within %ds", OTA_VERIFY_TIMEOUT_MS / 1000);
+    _ota_pending_verify = true;
+
+    esp_timer_create_args_t verify_args = { .callback = verify_timeout, .name = "ota_verify" };
+    esp_timer_create(&verify_args, &_ota_verify_timer);
+    esp_timer_start_once(_ota_verify_timer, (uint64_t)OTA_VERIFY_TIMEOUT_MS * 1000);
+}
+
+
+// Report that we've connected to the host.
+// This proves new firmware works, so it's kept and rollback is cancelled.
+void ota_connected(void)
+{
+    if(!_ota_pending_verify) return;
+
+    esp_timer_stop(_ota_verify_timer);
+    esp_ota_mark_app_valid_cancel_rollback();
+    _ota_pending_verify = false;
+    ESP_LOGI(TAG, "New firmware reached the host, keeping it");
+}
+
+
+// Start an update, with an image of the given size and SHA-256.
+// Any update already in progress is abandoned.
+ota_status_t ota_begin(uint32_t size, const uint8_t *sha256)
+{
+    ota_abort();
+
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    if(partition == NULL || size == 0 || size > partition->size) return OTA_BEGIN_FAILED;
+
+    // This erases as much of the partition as the image needs, which takes a few seconds.
+    if(esp_ota_begin(partition, size, &_ota_handle) != ESP_OK) return OTA_BEGIN_FAILED;
+
+    _ota_partition = partition;
+    _ota_size = size;
+    _ota_written = 0;
+    memcpy(_ota_expected_sha, sha256, sizeof(_ota_expected_sha));
+
+    mbedtls_sha256_init(&_ota_sha);
+    mbedtls_sha256_starts_ret(&_ota_sha, 0);
+
+    ESP_LOGI(TAG, "Updating, %u byte image", (unsigned)size);
+    return OTA_OK;
+}
+
+
+// Write the given chunk of image, which must start at the given offset.
+ota_status_t ota_write(uint32_t offset, const uint8_t *data, int size)
+{
+    if(_ota_partition == NULL) return OTA_WRITE_FAILED;
+
+    if(offset != _ota_written || (_ota_size - _ota_written) < (uint32_t)size ||
+        esp_ota_write(_ota_handle, data, size) != ESP_OK)
+    {
+        ota_abort();
+        return OTA_WRITE_FAILED;
+    }
+
+    mbedtls_sha256_update_ret(&_ota_sha, data, size);
+    _ota_written += size;
+    return OTA_OK;
+}
+
+
+// Finish the update. If the image verifies, we restart into it shortly.
+ota_status_t ota_end(void)
+{
+    if(_ota_partition == NULL || _ota_written != _ota_size)
+    {
+        ota_abort();
+        return OTA_VERIFY_FAILED;
+    }
+
+    uint8_t sha[32];
+    mbedtls_sha256_finish_ret(&_ota_sha, sha);
+    mbedtls_sha256_free(&_ota_sha);
+
+    // esp_ota_end() checks the image is one we can boot, as well as finishing the write.
+    const esp_partition_t *partition = _ota_partition;
+    _ota_partition = NULL;
+    esp_err_t err = esp_ota_end(_ota_handle);
+
+    if(memcmp(sha, _ota_expected_sha, sizeof(sha)) != 0 || err != ESP_OK ||
+        esp_ota_set_boot_partition(partition) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Update failed verification");
+        return OTA_VERIFY_FAILED;
+    }
+
+    ESP_LOGI(TAG, "Update verified, restarting");
+    esp_timer_start_once(_ota_restart_timer, OTA_RESTART_DELAY_MS * 1000);
+    return OTA_DONE;
+}
+
+
+// Abandon any update in progress.
+void ota_abort(void)
+{
+    if(_ota_partition == NULL) return;
+
+    // esp_ota_end() frees the handle, even though the image is incomplete.
+    esp_ota_end(_ota_handle);
+    mbedtls_sha256_free(&_ota_sha);
+    _ota_partition = NULL;
+    ESP_LOGW(TAG, "Update abandoned after %u bytes", (unsigned)_ota_written);
+}
+
+
+// Report whether an update is in progress.
+bool ota_active(void)
+{
+    return _ota_partition != NULL;
+}
+
+
+// Report how many bytes of image have been written so far.
+uint32_t ota_written(void)
+{
+    return _ota_written;
+}
@@ -0,0 +1,47 @@
+/* Firmware updates over the air.
+
+*/
+
+#ifndef OTA_H
+#define OTA_H
+
+// Results of each update step. The values are sent to the host, so must not change.
+typedef enum
+{
+    OTA_OK = 0,  // Step succeeded, the update continues.
+    OTA_DONE = 1,  // Image written and verified. We'll restart into it shortly.
+    OTA_BEGIN_FAILED = 2,  // Couldn't start the update, eg image too big for our partition.
+    OTA_WRITE_FAILED = 3,  // Couldn't write a chunk, or it wasn't the next one. The update is abandoned.
+    OTA_VERIFY_FAILED = 4  // Image incomplete, or its hash or contents are wrong. The update is abandoned.
+} ota_status_t;
+
+#define OTA_CHUNK_MAX 1024  // Largest chunk of image the host may send at once.
+
+// Initialise firmware updates.
+// If we're running new firmware that hasn't yet proved itself, this starts the timer that will roll it back.
+void ota_init(void);
+
+// Report that we've connected to the host.
+// This proves new firmware works, so it's kept and rollback is cancelled.
+void ota_connected(void);
+
+// Start an update, with an image of the given size and SHA-256.
+// Any update already in progress is abandoned.
+ota_status_t ota_begin(uint32_t size, const uint8_t *sha256);
+
+// Write the given chunk of image, which must start at the given offset.
+ota_status_t ota_write(uint32_t offset, const uint8_t *data, int size);
+
+// Finish the update. If the image verifies, we restart into it shortly.
+ota_status_t ota_end(void);
+
+// Abandon any update in progress.
+void ota_abort(void);
+
+// Report whether an update is in progress.
+bool ota_active(void);
+
+// Report how many bytes of image have been written so far.
+uint32_t ota_written(void);
+
+#endif
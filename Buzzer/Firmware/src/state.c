@@ -3,19 +3,38 @@
 The current state controls which inputs and outputs are in use.
 The state is changed due to external conditions, such as messages from the host or losing contact with the host.
 
-A regular tick is required, which presumably is called in an interrupt context. Communication between the interrupt
-and main thread is via global bools, which can be written and read atomically.
+There is no regular tick, so the CPU can sleep whenever there's nothing to do. The status LED flashes from an
+esp_timer, which only runs while we're trying to connect. Communication between the interrupt and main thread is via
+global bools, which can be written and read atomically.
+
+The button interrupt and press task have a core to themselves, see global.h.
+
+The button is handled by a GPIO interrupt, rather than polling, so that each press is timestamped at the moment the
+button was pressed. Only level interrupts can wake the chip from light sleep, so the interrupt waits for the level
+opposite to the button's current state, and flips that each time it fires. The interrupt debounces the button and
+queues the press time, which is then sent to the host by a separate task, since sending cannot be done from an
+interrupt.
+
+When armed, the interrupt also latches the first press and lights the button LED itself, so the player sees their
+press immediately, rather than after a round trip to the host. Further presses aren't reported until the host confirms
+or cancels the latched press by setting a new mode. While armed we also hold a power management lock, so the CPU
+stays awake at full speed and presses are timestamped without waiting for it to wake up.
 
 */
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "driver/gpio.h"
+#include "hal/gpio_ll.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
 #include "global.h"
 #include "audio.h"
 #include "gpio.h"
 #include "host.h"
 #include "state.h"
+#include "trace.h"
 
 // States.
 // #define STATE_CONNECT   0  // Connecting to host.
@@ -27,65 +46,158 @@ and main thread is via global bools, which can be written and read atomically.
 static volatile bool _connected;
 static volatile bool _led_on;
 static volatile bool _button_pressed = false;
-static volatile bool _status_flashing;
+static volatile bool _armed;  // Whether the next press should be latched.
+static volatile bool _latched;  // Whether we've latched a press, which the host hasn't yet confirmed or cancelled.
 static volatile int _flash_phase;
+static esp_timer_handle_t _flash_timer;  // Flashes the status LED. Only runs while we're connecting.
+static esp_pm_lock_handle_t _armed_lock;  // Held while armed.
+static volatile int64_t _button_release_time;  // Time of the last button release, in us since boot.
+static QueueHandle_t _press_queue;  // Press times waiting to be sent to the host, in us since boot.
+static TaskHandle_t _press_task;
 
+#define BUTTON_DEBOUNCE_US 5000  // Button must be released for this long before another press is accepted.
+#define PRESS_QUEUE_SIZE 8
+#define STATUS_FLASH_US 125000  // Time between status LED toggles while connecting.
 
-// Check the state of the button and act accordingly.
-static void check_button(void)
+
+// Button level interrupt handler.
+// This runs from IRAM, even while flash is being written, so must not call anything that isn't in IRAM. The GPIO
+// driver functions aren't, so we go straight to the hardware throughout.
+static void IRAM_ATTR button_isr(void *param)
 {
+    // Record the time first, so it's as close to the edge as we can get.
+    int64_t now = esp_timer_get_time();
+
     // The button is wired active low.
-    int pin = gpio_get_level(PIN_BUTTON);
+    int pin = gpio_ll_get_level(&GPIO, PIN_BUTTON);
     bool new_state = (pin == 0);
+    trace_at(TRACE_BUTTON_EDGE, new_state ? 1 : 0, now);
 
-    if(new_state && !_button_pressed && _connected)
+    // Wait for the opposite level next, both to interrupt and to wake from light sleep.
+    gpio_int_type_t next = new_state ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL;
+    gpio_ll_set_intr_type(&GPIO, PIN_BUTTON, next);
+    gpio_ll_wakeup_enable(&GPIO, PIN_BUTTON, next);
+
+    if(new_state)
     {
-        // The button is newly pressed and we should be reporting presses.
-        host_send_press();
-        // audio_start();  // Temp test.
+        // Contact bounce produces a burst of edges. A press only counts if the button has been released for long
+        // enough, so bounces on both press and release are ignored.
+        if(!_button_pressed && _connected && !_latched && (now - _button_release_time) >= BUTTON_DEBOUNCE_US)
+        {
+            // The button is newly pressed and we should be reporting presses.
+            if(_armed)
+            {
+                // Latch this press and show it straight away.
+                _latched = true;
+                gpio_ll_set_level(&GPIO, PIN_LED_BUTTON, 1);
+            }
+
+            BaseType_t woken = pdFALSE;
+            xQueueSendFromISR(_press_queue, &now, &woken);
+            trace(TRACE_PRESS_QUEUED, 0);
+            if(woken) portYIELD_FROM_ISR();
+        }
+    } else {
+        _button_release_time = now;
     }
 
     _button_pressed = new_state;
 
     // Set PCB LED to button state to aid debugging.
-    if(new_state)
-    {
-        gpio_set_level(PIN_LED_PCB, 1);
-    } else {
-        gpio_set_level(PIN_LED_PCB, 0);
-    }
+    gpio_ll_set_level(&GPIO, PIN_LED_PCB, new_state ? 1 : 0);
 }
 
 
-// Task to poll button.
-static void button_poll_task(void *param)
+// Task to send button presses queued by the interrupt.
+// We're pinned to the press core, so install the interrupt from here, which puts it on the same core.
+static void button_press_task(void *param)
 {
+    gpio_set_intr_type(PIN_BUTTON, GPIO_INTR_LOW_LEVEL);
+    gpio_wakeup_enable(PIN_BUTTON, GPIO_INTR_LOW_LEVEL);
+    gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+    gpio_isr_handler_add(PIN_BUTTON, button_isr, NULL);
+
     while(1)
     {
-        check_button();
-        vTaskDelay(10 / portTICK_PERIOD_MS);  // Check roughly every 10 milliseconds.
+        int64_t press_time;
+        if(xQueueReceive(_press_queue, &press_time, portMAX_DELAY) == pdTRUE)
+        {
+            trace(TRACE_PRESS_DEQUEUED, 0);
+            host_send_press(press_time);
+
+            // Once latched no more presses are queued, so this must be the latched one.
+            if(_latched) audio_play(AUDIO_LATCH);
+        }
     }
 }
 
 
+// Status LED flash timer callback.
+static void flash_timer_callback(void *param)
+{
+    _flash_phase = 1 - _flash_phase;
+    gpio_set_level(PIN_LED_STATUS, _flash_phase);
+}
+
+
+// Flash the status LED, or turn it on solid.
+static void set_status_flashing(bool flashing)
+{
+    esp_timer_stop(_flash_timer);
+
+    if(flashing) {
+        esp_timer_start_periodic(_flash_timer, STATUS_FLASH_US);
+    } else {
+        _flash_phase = 1;
+        gpio_set_level(PIN_LED_STATUS, 1);
+    }
+}
+
+
+// Set whether we're armed, holding our power management lock while we are.
+static void set_armed(bool armed)
+{
+    if(armed && !_armed) esp_pm_lock_acquire(_armed_lock);
+    if(!armed && _armed) esp_pm_lock_release(_armed_lock);
+
+    _armed = armed;
+}
+
+
 // Initialise state machine.
 // Must be called before any other state_* functions.
 void state_init(void)
 {
     _flash_phase = 0;
+    _button_release_time = 0;
+    _armed = false;
+    esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "armed", &_armed_lock);
+
+    esp_timer_create_args_t timer_args = {
+        .callback = flash_timer_callback,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "flash"
+    };
+    esp_timer_create(&timer_args, &_flash_timer);
+
     state_connect();
 
-    // Start our button pool task.
-    xTaskCreate(button_poll_task, "ButtonPool", 2048, NULL, 5, NULL);
+    // Start our button press task, which enables the button interrupt. The button is released at startup, if not the
+    // interrupt fires straight away and sorts it out.
+    _press_queue = xQueueCreate(PRESS_QUEUE_SIZE, sizeof(int64_t));
+    xTaskCreatePinnedToCore(button_press_task, "ButtonPress", 2048, NULL, PRIORITY_PRESS, &_press_task, CORE_PRESS);
 }
 
 
 // Tell state to indicate we are trying to connect to server.
 void state_connect(void)
 {
+    set_armed(false);
+    _latched = false;
     _connected = false;
     _led_on = false;
-    _status_flashing = true;
+    set_status_flashing(true);
     gpio_set_level(PIN_LED_BUTTON, 0);
     audio_stop();
 }
@@ -94,17 +206,22 @@ void state_connect(void)
 // Tell state to indicate we are connected to server.
 void state_connected(void)
 {
+    set_armed(false);
+    _latched = false;
     _connected = true;
     _led_on = false;
-    _status_flashing = false;
+    set_status_flashing(false);
     gpio_set_level(PIN_LED_BUTTON, 0);
     audio_stop();
 }
 
 
-// Specify whether LED and buzzer are enabled.
-void state_enable(bool led, bool audio)
+// Specify whether LED and buzzer are enabled, and whether we're armed.
+// Any latched press is cleared.
+void state_enable(bool led, bool audio, bool armed)
 {
+    set_armed(armed);
+    _latched = false;
     _led_on = led;
     gpio_set_level(PIN_LED_BUTTON, led ? 1 : 0);
 
@@ -113,23 +230,11 @@ void state_enable(bool led, bool audio)
     } else {
         audio_stop();
     }
-
-    _status_flashing = false;
 }
 
 
-// Tick.
-// Should be called every 125ms.
-void IRAM_ATTR state_tick(void)
+// Report the least free stack our button press task has had, in bytes.
+int state_stack_free(void)
 {
-    if(_status_flashing)
-    {
-        // Toggle status LED.
-        _flash_phase = 1 - _flash_phase;
-    } else {
-        // Force status LED on.
-        _flash_phase = 1;
-    }
-
-    gpio_set_level(PIN_LED_STATUS, _flash_phase);
+    return uxTaskGetStackHighWaterMark(_press_task);
 }
@@ -18,11 +18,11 @@ void state_connect(void);
 // Tell state to indicate we are connected to server.
 void state_connected(void);
 
-// Specify whether LED and buzzer are enabled.
-void state_enable(bool led, bool audio);
+// Specify whether LED and buzzer are enabled, and whether we're armed.
+// Any latched press is cleared.
+void state_enable(bool led, bool audio, bool armed);
 
-// Tick.
-// Should be called every 125ms.
-void IRAM_ATTR state_tick(void);
+// Report the least free stack our button press task has had, in bytes.
+int state_stack_free(void);
 
 #endif
@@ -0,0 +1,64 @@
+/* Latency tracing.
+
+To see where the time goes between a button press and the host seeing it, the interesting points along the way record
+timestamped events in a small ring buffer. The host can ask for the buffer to be dumped, so this works on real
+hardware in a real venue. Recording an event is cheap and can be done from an interrupt, so tracing is always on.
+
+The oldest events are overwritten once the buffer is full.
+
+*/
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "global.h"
+#include "trace.h"
+
+static portMUX_TYPE _trace_lock = portMUX_INITIALIZER_UNLOCKED;  // Protects everything below.
+static trace_entry_t _trace[TRACE_SIZE];  // Circular.
+static int _trace_next;  // Index to write the next event to.
+static int _trace_count;  // Number of valid events.
+
+
+// Record the given event as happening now.
+// May be called from an interrupt.
+void IRAM_ATTR trace(trace_event_t event, uint8_t arg)
+{
+    trace_at(event, arg, esp_timer_get_time());
+}
+
+
+// Record the given event as happening at the given time, in us since boot.
+// May be called from an interrupt.
+void IRAM_ATTR trace_at(trace_event_t event, uint8_t arg, int64_t time)
+{
+    portENTER_CRITICAL_SAFE(&_trace_lock);
+
+    trace_entry_t *entry = &_trace[_trace_next];
+    entry->time = time;
+    entry->event = (uint8_t)event;
+    entry->arg = arg;
+
+    _trace_next = (_trace_next + 1) % TRACE_SIZE;
+    if(_trace_count < TRACE_SIZE) _trace_count++;
+
+    portEXIT_CRITICAL_SAFE(&_trace_lock);
+}
+
+
+// Copy out the recorded events, oldest first.
+// The given buffer must have room for TRACE_SIZE entries. Returns the number copied.
+int trace_read(trace_entry_t *entries)
+{
+    portENTER_CRITICAL(&_trace_lock);
+
+    int count = _trace_count;
+    int first = (_trace_next + TRACE_SIZE - count) % TRACE_SIZE;
+
+    for(int i = 0; i < count; i++)
+    {
+        entries[i] = _trace[(first + i) % TRACE_SIZE];
+    }
+
+    portEXIT_CRITICAL(&_trace_lock);
+    return count;
+}
@@ -0,0 +1,42 @@
+/* Latency tracing.
+
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+// Traced events. The values are sent to the host, so must not change.
+typedef enum
+{
+    TRACE_BUTTON_EDGE = 1,  // Button changed state, arg = 1 for pressed, 0 for released.
+    TRACE_PRESS_QUEUED = 2,  // Interrupt queued a press for sending.
+    TRACE_PRESS_DEQUEUED = 3,  // Press task took a press from the queue.
+    TRACE_SEND_START = 4,  // About to send a press, arg = sequence number.
+    TRACE_SEND_DONE = 5,  // Send of a press returned, arg = sequence number.
+    TRACE_RECV = 6,  // Received a message from the host, arg = message byte.
+    TRACE_MODE_APPLIED = 7  // Applied a mode, arg = mode byte.
+} trace_event_t;
+
+// A single traced event.
+typedef struct
+{
+    int64_t time;  // In us since boot.
+    uint8_t event;  // trace_event_t.
+    uint8_t arg;
+} trace_entry_t;
+
+#define TRACE_SIZE 64  // Number of events we keep.
+
+// Record the given event as happening now.
+// May be called from an interrupt.
+void IRAM_ATTR trace(trace_event_t event, uint8_t arg);
+
+// Record the given event as happening at the given time, in us since boot.
+// May be called from an interrupt.
+void IRAM_ATTR trace_at(trace_event_t event, uint8_t arg, int64_t time);
+
+// Copy out the recorded events, oldest first.
+// The given buffer must have room for TRACE_SIZE entries. Returns the number copied.
+int trace_read(trace_entry_t *entries);
+
+#endif
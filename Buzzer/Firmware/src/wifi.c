@@ -1,10 +1,30 @@
 /* Functions to connect to WIFI and get an IP address from DHCP.
 
+By default the radio uses modem sleep, waking up for each beacon from the AP. This saves a lot of power, but means
+an incoming or outgoing message can be held for up to a beacon interval. While a question is armed the host switches
+us to a low latency profile, with the radio always awake. That also stops the CPU going into light sleep, which would
+otherwise delay handling whatever the radio receives.
+
+A full connection scans every channel for the AP and then waits for DHCP, which can take several seconds. To get back
+quickly after losing the connection, we save the channel, BSSID and IP settings of the last good connection in NVS.
+On reconnect we first try going straight to that AP with that IP, and only fall back to a full scan and DHCP if that
+doesn't work quickly. The time each connection took is recorded, so the improvement can be checked.
+
+Using that IP without asking the DHCP server would let its lease run out, and the server give it to someone else, so
+once connected we restart DHCP. lwIP restores the address it was last given, see CONFIG_LWIP_DHCP_RESTORE_LAST_IP,
+and asks for it straight back rather than starting from scratch, so this only costs a single exchange, and renews the
+lease. After that lwIP keeps renewing it as usual.
+
 */
 
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
+#include "nvs.h"
 #include "global.h"
 #include "wifi.h"
 
@@ -12,64 +32,123 @@
 #define WIFI_SSID "BeastQuiz"
 #define WIFI_PASSWORD "SassThatHoopyFordPrefect"
 #define WIFI_MAX_RETRIES 6  // After this we wait for a while before trying again.
+#define WIFI_FAST_TIMEOUT_MS 1500  // How long to give a fast reconnect before falling back to a full one.
+#define WIFI_FULL_TIMEOUT_MS 15000  // How long to give a full connection, including all retries.
+#define WIFI_STOP_TIMEOUT_MS 200  // How long to wait for an abandoned attempt to stop.
+#define WIFI_LEASE_TIMEOUT_MS 2000  // How long to give DHCP to renew our lease after a fast reconnect.
+
+// NVS storage for the last good connection.
+#define WIFI_NVS_NAMESPACE "wifi"
+#define WIFI_NVS_KEY "last"
+
+static const char *TAG = "wifi";
 
 /* We need to signal from our callback function to our main thread when connection to WIFI has succeeded or failed. To
 do this we use an event group. Each bit is a separate event, we only care about 2 success and failure.
 */
 static EventGroupHandle_t _wifi_event_signal;  // Event group to signal result back to main thread.
-static volatile int _wifi_connect_retries;  // Number of retries so far.
-#define WIFI_CONNECTED 1  // Connected to WIFI and DHCP IP address received.
-#define WIFI_FAILED 2  // Failed to connect to WIFI WIFI_MAX_RETRIES times.
+static volatile int _wifi_connect_retries;  // Number of retries left for the current attempt.
+static esp_netif_t *_wifi_netif;
+static bool _wifi_started;  // Whether we've started the WIFI driver.
+static int64_t _wifi_last_connect_us;  // How long our most recent successful connection took.
+static bool _wifi_last_fast;  // Whether our most recent successful connection was a fast reconnect.
+static int _wifi_connects;  // Number of successful connections since boot.
+static esp_pm_lock_handle_t _wifi_awake_lock;  // Held while we're in the low latency profile.
+static bool _wifi_low_latency;
+#define WIFI_CONNECTED 1  // Connected to WIFI and IP address received. Cleared when we disconnect.
+#define WIFI_FAILED 2  // Failed to connect to WIFI, after all retries.
+
+// Settings of the last good connection, as stored in NVS.
+typedef struct
+{
+    uint8_t channel;
+    uint8_t bssid[6];
+    esp_netif_ip_info_t ip_info;
+} wifi_last_t;
 
 
-// Event handler for WIFI conenction.
+// Event handler for WIFI connection.
 static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
     if(event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
         // Start connection to WIFI.
-        _wifi_connect_retries = 0;
         esp_wifi_connect();
         return;
     }
 
     if(event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        // Failed to connect to WIFI.
-        if(_wifi_connect_retries >= WIFI_MAX_RETRIES) {
-            // Too many attempts, give up for now.
+        // Failed to connect to WIFI, or lost an existing connection.
+        xEventGroupClearBits(_wifi_event_signal, WIFI_CONNECTED);
+
+        if(_wifi_connect_retries <= 0) {
+            // Too many attempts, or we weren't trying, give up for now.
             xEventGroupSetBits(_wifi_event_signal, WIFI_FAILED);
             return;
         }
 
         // Retry.
-        _wifi_connect_retries++;
+        _wifi_connect_retries--;
         esp_wifi_connect();
         return;
     }
 
     if(event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-        // Got IP address from DHCP, just signal main thread.
+        // Got IP address, either from DHCP or static, just signal main thread.
         xEventGroupSetBits(_wifi_event_signal, WIFI_CONNECTED);
     }
 }
 
 
-// Setup WIFI structures and config.
-// Must be called before any other wifi_* functions.
-void wifi_init(void)
+// Load the settings of the last good connection from NVS.
+// Returns true on success, false if there aren't any.
+static bool load_last(wifi_last_t *last)
 {
-    _wifi_event_signal = xEventGroupCreate();
+    nvs_handle_t handle;
+    if(nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) return false;
 
-    esp_netif_init();
-    esp_event_loop_create_default();
-    esp_netif_create_default_wifi_sta();
+    size_t size = sizeof(wifi_last_t);
+    esp_err_t err = nvs_get_blob(handle, WIFI_NVS_KEY, last, &size);
+    nvs_close(handle);
 
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    esp_wifi_init(&cfg);
+    return (err == ESP_OK && size == sizeof(wifi_last_t));
+}
+
+
+// Save the settings of the given connection to NVS, if they've changed.
+static void save_last(const wifi_last_t *last)
+{
+    wifi_last_t old;
+    if(load_last(&old) && memcmp(&old, last, sizeof(wifi_last_t)) == 0) return;  // No change, save flash wear.
+
+    nvs_handle_t handle;
+    if(nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) return;
+
+    nvs_set_blob(handle, WIFI_NVS_KEY, last, sizeof(wifi_last_t));
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+
+// Forget the settings of the last good connection, since they didn't work.
+static void forget_last(void)
+{
+    nvs_handle_t handle;
+    if(nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) return;
 
+    nvs_erase_key(handle, WIFI_NVS_KEY);
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+
+// Set our station config. If the last good connection is given we go straight to its AP, otherwise we scan.
+static void set_config(const wifi_last_t *last)
+{
     wifi_config_t wifi_config = {
         .sta = {
             .ssid = WIFI_SSID,
             .password = WIFI_PASSWORD,
+            .scan_method = WIFI_FAST_SCAN,
             .threshold.authmode = WIFI_AUTH_WPA2_PSK,
             .pmf_cfg = {
                 .capable = true,
@@ -77,38 +156,195 @@ void wifi_init(void)
             }
         }
     };
-    esp_wifi_set_mode(WIFI_MODE_STA);
+
+    if(last != NULL)
+    {
+        wifi_config.sta.channel = last->channel;
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, last->bssid, sizeof(wifi_config.sta.bssid));
+    } else {
+        wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    }
+
     esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
 }
 
 
-// Attempt to connect to WIFI and get an IP address from DHCP.
+// Abandon a failed or timed out connection attempt. Make sure the driver isn't still trying before we change anything,
+// and that its disconnect event can't be mistaken for the result of our next attempt.
+static void abandon(void)
+{
+    _wifi_connect_retries = 0;
+    esp_wifi_disconnect();
+    xEventGroupWaitBits(_wifi_event_signal, WIFI_FAILED, pdTRUE, pdFALSE, WIFI_STOP_TIMEOUT_MS / portTICK_PERIOD_MS);
+}
+
+
+// Make a single connection attempt, with the given number of retries, and wait up to the given timeout.
 // Returns true on success, false on failure.
-bool wifi_connect(void)
+static bool attempt(int retries, int timeout_ms)
+{
+    xEventGroupClearBits(_wifi_event_signal, WIFI_CONNECTED | WIFI_FAILED);
+    _wifi_connect_retries = retries;
+
+    if(_wifi_started) {
+        esp_wifi_connect();
+    } else {
+        // Starting the driver will connect, see event_handler().
+        _wifi_started = true;
+        esp_wifi_start();
+    }
+
+    // Wait for response.
+    EventBits_t signal = xEventGroupWaitBits(_wifi_event_signal, WIFI_CONNECTED | WIFI_FAILED, pdFALSE, pdFALSE,
+        timeout_ms / portTICK_PERIOD_MS);
+
+    if((signal & WIFI_CONNECTED) != 0) return true;
+
+    abandon();
+    return false;
+}
+
+
+// Restart DHCP after a fast reconnect, which used the IP address from last time without asking, and wait for it to
+// renew our lease, usually of that same address.
+// Returns true on success, false on failure, having disconnected.
+static bool renew_lease(void)
+{
+    // Our IP is cleared until DHCP gives us one, which is signalled as for connecting.
+    xEventGroupClearBits(_wifi_event_signal, WIFI_CONNECTED | WIFI_FAILED);
+    esp_netif_dhcpc_start(_wifi_netif);
+
+    EventBits_t signal = xEventGroupWaitBits(_wifi_event_signal, WIFI_CONNECTED | WIFI_FAILED, pdFALSE, pdFALSE,
+        WIFI_LEASE_TIMEOUT_MS / portTICK_PERIOD_MS);
+
+    if((signal & WIFI_CONNECTED) != 0) return true;
+
+    ESP_LOGW(TAG, "No DHCP lease after fast reconnect");
+    abandon();
+    return false;
+}
+
+
+// Setup WIFI structures and config.
+// Must be called before any other wifi_* functions.
+void wifi_init(void)
 {
-    // Register for events.
+    _wifi_event_signal = xEventGroupCreate();
+    _wifi_started = false;
+    _wifi_last_connect_us = 0;
+    _wifi_last_fast = false;
+    _wifi_connects = 0;
+    _wifi_low_latency = false;
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "wifi", &_wifi_awake_lock);
+
+    esp_netif_init();
+    esp_event_loop_create_default();
+    _wifi_netif = esp_netif_create_default_wifi_sta();
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    esp_wifi_init(&cfg);
+
+    // Our handler stays registered, so it sees us losing the connection as well as connecting.
     esp_event_handler_instance_t wifi_events;
     esp_event_handler_instance_t got_ip_event;
     esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, event_handler, NULL, &wifi_events);
     esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, event_handler, NULL, &got_ip_event);
 
-    // Attempt to connect.
-    esp_wifi_start();
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    set_config(NULL);
+    wifi_set_low_latency(false);
+}
 
-    // Wait for response.
-    EventBits_t signal = xEventGroupWaitBits(_wifi_event_signal, WIFI_CONNECTED | WIFI_FAILED, pdFALSE, pdFALSE,
-        portMAX_DELAY);
 
-    // We don't want any more events to be processed, so unregister handler.
-    esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, got_ip_event);
-    esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_events);
+// Attempt to connect to WIFI and get an IP address.
+// Does nothing if we're still connected from last time.
+// Returns true on success, false on failure.
+bool wifi_connect(void)
+{
+    if((xEventGroupGetBits(_wifi_event_signal) & WIFI_CONNECTED) != 0) return true;  // Still connected.
+
+    int64_t start = esp_timer_get_time();
+    bool fast = false;
+    bool ok = false;
 
-    // Check which signal we got back.
-    if((signal & WIFI_FAILED) != 0) {
-        // Fail.
-        return false;
+    // First try going straight back to where we were last time.
+    wifi_last_t last;
+    memset(&last, 0, sizeof(last));  // We compare these, so padding must match.
+    if(load_last(&last))
+    {
+        set_config(&last);
+        esp_netif_dhcpc_stop(_wifi_netif);
+        esp_netif_set_ip_info(_wifi_netif, &last.ip_info);
+
+        fast = true;
+        ok = attempt(0, WIFI_FAST_TIMEOUT_MS) && renew_lease();
+
+        if(!ok) forget_last();
+    }
+
+    if(!ok)
+    {
+        // Full scan and DHCP.
+        fast = false;
+        set_config(NULL);
+        esp_netif_dhcpc_start(_wifi_netif);
+        ok = attempt(WIFI_MAX_RETRIES, WIFI_FULL_TIMEOUT_MS);
+    }
+
+    if(!ok) return false;
+
+    // Record how long that took, and where we connected, for next time.
+    _wifi_last_connect_us = esp_timer_get_time() - start;
+    _wifi_last_fast = fast;
+    _wifi_connects++;
+    ESP_LOGI(TAG, "Connected in %lldms (%s)", (long long)(_wifi_last_connect_us / 1000), fast ? "fast" : "full");
+
+    wifi_ap_record_t ap;
+    if(esp_wifi_sta_get_ap_info(&ap) == ESP_OK && esp_netif_get_ip_info(_wifi_netif, &last.ip_info) == ESP_OK)
+    {
+        last.channel = ap.primary;
+        memcpy(last.bssid, ap.bssid, sizeof(last.bssid));
+        save_last(&last);
     }
 
-    // Success.
     return true;
 }
+
+
+// Report how long our most recent successful connection took, in us, and whether it was a fast reconnect.
+void wifi_last_connect(int64_t *duration_us, bool *fast)
+{
+    *duration_us = _wifi_last_connect_us;
+    *fast = _wifi_last_fast;
+}
+
+
+// Report the number of successful connections since boot.
+int wifi_connect_count(void)
+{
+    return _wifi_connects;
+}
+
+
+// Report the signal strength of our AP, in dBm.
+// Returns 0 if we're not connected.
+int wifi_rssi(void)
+{
+    wifi_ap_record_t ap;
+    if(esp_wifi_sta_get_ap_info(&ap) != ESP_OK) return 0;
+    return ap.rssi;
+}
+
+
+// Select the radio power profile.
+// Low latency keeps the radio and CPU awake all the time, otherwise they sleep between beacons to save power.
+void wifi_set_low_latency(bool low_latency)
+{
+    esp_wifi_set_ps(low_latency ? WIFI_PS_NONE : WIFI_PS_MIN_MODEM);
+
+    if(low_latency && !_wifi_low_latency) esp_pm_lock_acquire(_wifi_awake_lock);
+    if(!low_latency && _wifi_low_latency) esp_pm_lock_release(_wifi_awake_lock);
+
+    _wifi_low_latency = low_latency;
+}
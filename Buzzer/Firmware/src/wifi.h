@@ -1,5 +1,7 @@
 /* Functions to connect to WIFI and get an IP address from DHCP.
 
+Reconnects go straight to the last good AP, with the last good IP, if they can.
+
 */
 
 #ifndef WIFI_H
@@ -9,8 +11,23 @@
 // Must be called before any other wifi_* functions.
 void wifi_init(void);
 
-// Attempt to connect to WIFI and get an IP address from DHCP.
+// Attempt to connect to WIFI and get an IP address.
+// Does nothing if we're still connected from last time.
 // Returns true on success, false on failure.
 bool wifi_connect(void);
 
+// Report how long our most recent successful connection took, in us, and whether it was a fast reconnect.
+void wifi_last_connect(int64_t *duration_us, bool *fast);
+
+// Report the number of successful connections since boot.
+int wifi_connect_count(void);
+
+// Report the signal strength of our AP, in dBm.
+// Returns 0 if we're not connected.
+int wifi_rssi(void);
+
+// Select the radio power profile.
+// Low latency keeps the radio and CPU awake all the time, otherwise they sleep between beacons to save power.
+void wifi_set_low_latency(bool low_latency);
+
 #endif
@@ -0,0 +1,317 @@
+/* Micro-benchmarks of the press path, from the button interrupt to the press being sent, and of applying a mode.
+
+These run on the host, see test/README, so the times are the host's, not the ESP32's, and include the thin
+stand-ins from lib/idf_mock. They're for comparing one version of our own code with another, run on the same
+machine, not for predicting latency on the device.
+
+The state machine, host connection and tracing are all included for real. Audio, firmware updates, WIFI and GPIO are
+replaced by fakes below that do nothing. Each benchmark is run BENCH_RUNS times, of BENCH_ITERATIONS calls each, and
+the fastest run is reported, which is the one least disturbed by whatever else the machine was doing.
+
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <unity.h>
+#include "idf_mock.h"
+#include "../../src/state.c"
+#include "../../src/host.c"
+#include "../../src/trace.c"
+
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 100000
+#endif
+
+#define BENCH_RUNS 5
+#define BENCH_EDGE_US 10000  // Time between button edges, long enough for every press to be debounced.
+
+
+// Fake audio_play(), see src/audio.c.
+void audio_play(audio_event_t event)
+{
+}
+
+
+// Fake audio_start(), see src/audio.c.
+void audio_start(void)
+{
+}
+
+
+// Fake audio_stop(), see src/audio.c.
+void audio_stop(void)
+{
+}
+
+
+// Fake ota_begin(), see src/ota.c.
+ota_status_t ota_begin(uint32_t size, const uint8_t *sha256)
+{
+    return OTA_OK;
+}
+
+
+// Fake ota_write(), see src/ota.c.
+ota_status_t ota_write(uint32_t offset, const uint8_t *data, int size)
+{
+    return OTA_OK;
+}
+
+
+// Fake ota_end(), see src/ota.c.
+ota_status_t ota_end(void)
+{
+    return OTA_OK;
+}
+
+
+// Fake ota_abort(), see src/ota.c.
+void ota_abort(void)
+{
+}
+
+
+// Fake ota_active(), see src/ota.c.
+bool ota_active(void)
+{
+    return false;
+}
+
+
+// Fake ota_written(), see src/ota.c.
+uint32_t ota_written(void)
+{
+    return 0;
+}
+
+
+// Fake wifi_last_connect(), see src/wifi.c.
+void wifi_last_connect(int64_t *duration_us, bool *fast)
+{
+    *duration_us = 0;
+    *fast = false;
+}
+
+
+// Fake wifi_connect_count(), see src/wifi.c.
+int wifi_connect_count(void)
+{
+    return 0;
+}
+
+
+// Fake wifi_rssi(), see src/wifi.c.
+int wifi_rssi(void)
+{
+    return 0;
+}
+
+
+// Fake wifi_set_low_latency(), see src/wifi.c.
+void wifi_set_low_latency(bool low_latency)
+{
+}
+
+
+// Fake read_module_id(), see src/gpio.c.
+uint8_t read_module_id(void)
+{
+    return 0x25;
+}
+
+
+// Fake read_battery_mv(), see src/gpio.c.
+int read_battery_mv(void)
+{
+    return 0;
+}
+
+
+// Start each benchmark connected to the host, over TCP, with the button released.
+void setUp(void)
+{
+    mock_reset();
+    _button_pressed = false;
+    _armed = false;
+    mock_gpio_levels[PIN_BUTTON] = 1;
+    state_init();
+    host_init();
+
+    mock_time_us = 1000000;
+    TEST_ASSERT_TRUE(host_connect());
+    state_connected();
+}
+
+
+// Nothing to tidy up, the next setUp() starts afresh.
+void tearDown(void)
+{
+}
+
+
+// Report the host's monotonic time, in ns.
+static int64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((int64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+
+// Press the button, as the hardware would, and run the interrupt.
+static void press(void)
+{
+    mock_time_us += BENCH_EDGE_US;
+    mock_gpio_levels[PIN_BUTTON] = 0;
+    button_isr(NULL);
+}
+
+
+// Release the button, as the hardware would, and run the interrupt.
+static void release(void)
+{
+    mock_time_us += BENCH_EDGE_US;
+    mock_gpio_levels[PIN_BUTTON] = 1;
+    button_isr(NULL);
+}
+
+
+// Do what the press task does with each press the interrupt queues.
+static void send_queued_press(void)
+{
+    int64_t press_time;
+    if(xQueueReceive(_press_queue, &press_time, 0) == pdTRUE)
+    {
+        trace(TRACE_PRESS_DEQUEUED, 0);
+        host_send_press(press_time);
+    }
+}
+
+
+// Print, under the given name, the fastest of our runs of the given function, in ns per call of what we're measuring,
+// which the function calls the given number of times.
+static void bench(const char *name, void (*function)(void), int calls)
+{
+    int64_t best = INT64_MAX;
+
+    for(int run = 0; run < BENCH_RUNS; run++)
+    {
+        int64_t start = now_ns();
+        for(int i = 0; i < BENCH_ITERATIONS; i++) function();
+        int64_t elapsed = now_ns() - start;
+        if(elapsed < best) best = elapsed;
+    }
+
+    double per_call = (double)best / ((double)BENCH_ITERATIONS * calls);
+
+    char message[80];
+    snprintf(message, sizeof(message), "%-32s %8.1f ns/call", name, per_call);
+    TEST_MESSAGE(message);
+}
+
+
+// A press and its release, both counted, with the queue emptied as the press task would.
+static void isr_press_release(void)
+{
+    press();
+    release();
+    xQueueReset(_press_queue);
+}
+
+
+// A bounce, pressed again straight after being released, so ignored.
+static void isr_bounce(void)
+{
+    mock_gpio_levels[PIN_BUTTON] = 1;
+    button_isr(NULL);
+    mock_gpio_levels[PIN_BUTTON] = 0;
+    button_isr(NULL);
+}
+
+
+// A press sent over TCP.
+static void press_tcp(void)
+{
+    mock_time_us += BENCH_EDGE_US;
+    host_send_press(mock_time_us);
+}
+
+
+// A press sent over UDP, and acknowledged.
+static void press_udp(void)
+{
+    mock_time_us += BENCH_EDGE_US;
+    host_send_press(mock_time_us);
+    _press_pending = false;
+}
+
+
+// Everything from the button edge to the press being sent, and the release.
+static void press_path(void)
+{
+    press();
+    send_queued_press();
+    release();
+}
+
+
+// A mode message from the host, decoded and applied.
+static void receive_mode(void)
+{
+    static const uint8_t msg[] = { MSG_MODE_PREFIX | MSG_MODE_ARMED };
+    static batch_t batch;
+
+    process_message(msg, sizeof(msg), mock_time_us, &batch);
+    batch_flush(&batch);
+}
+
+
+// Benchmark the button interrupt, for counted presses and for bounces.
+static void test_bench_isr(void)
+{
+    bench("button_isr press/release", isr_press_release, 2);
+
+    press();
+    bench("button_isr bounce", isr_bounce, 2);
+}
+
+
+// Benchmark sending a press to the host, over each transport.
+static void test_bench_press_send(void)
+{
+    int sends = mock_send_count;
+    bench("host_send_press tcp", press_tcp, 1);
+    TEST_ASSERT_EQUAL_INT(sends + (BENCH_RUNS * BENCH_ITERATIONS), mock_send_count);
+
+    _udp_wanted = true;
+    _udp_socket = udp_open();
+    bench("host_send_press udp", press_udp, 1);
+}
+
+
+// Benchmark the whole press path, from the interrupt to the send returning.
+static void test_bench_press_path(void)
+{
+    int sends = mock_send_count;
+    bench("press path, edge to send", press_path, 1);
+    TEST_ASSERT_EQUAL_INT(sends + (BENCH_RUNS * BENCH_ITERATIONS), mock_send_count);
+}
+
+
+// Benchmark decoding and applying a mode from the host.
+static void test_bench_receive_mode(void)
+{
+    bench("process_message mode", receive_mode, 1);
+    TEST_ASSERT_TRUE(_armed);
+}
+
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_bench_isr);
+    RUN_TEST(test_bench_press_send);
+    RUN_TEST(test_bench_press_path);
+    RUN_TEST(test_bench_receive_mode);
+    return UNITY_END();
+}
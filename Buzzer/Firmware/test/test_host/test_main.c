@@ -0,0 +1,605 @@
+/* Unit tests for the host protocol encoder and decoder, see src/host.c and Protocol.txt.
+
+These run on the host, see test/README. The encoder and decoder are static, so we include the source itself. Tracing
+is simple enough to use for real, but the state machine, firmware updates, WIFI and GPIO are replaced by fakes below,
+which record what they're asked to do. Everything host.c sends is recorded by the lwIP stand-in.
+
+*/
+
+#include <unity.h>
+#include "idf_mock.h"
+#include "../../src/host.c"
+#include "../../src/trace.c"
+
+#define TEST_MODULE_ID 0x25  // Team 2, number 5.
+#define TEST_BUZZER_ID 0x0205
+#define TEST_START_US 1000000
+
+// What our fakes have been asked to do.
+static int _state_enables;
+static bool _state_led;
+static bool _state_audio;
+static bool _state_armed;
+static int _ota_aborts;
+static uint32_t _ota_offset;
+static int _ota_size;
+static bool _wifi_low_latency;
+
+static int _connection;  // Our socket to the host. host_process_messages() forgets it once the host has gone.
+
+
+// Fake state_enable(), see src/state.c.
+void state_enable(bool led, bool audio, bool armed)
+{
+    _state_enables++;
+    _state_led = led;
+    _state_audio = audio;
+    _state_armed = armed;
+}
+
+
+// Fake state_stack_free(), see src/state.c.
+int state_stack_free(void)
+{
+    return 2000;
+}
+
+
+// Fake ota_begin(), see src/ota.c.
+ota_status_t ota_begin(uint32_t size, const uint8_t *sha256)
+{
+    return OTA_OK;
+}
+
+
+// Fake ota_write(), see src/ota.c.
+ota_status_t ota_write(uint32_t offset, const uint8_t *data, int size)
+{
+    _ota_offset = offset;
+    _ota_size = size;
+    return OTA_OK;
+}
+
+
+// Fake ota_end(), see src/ota.c.
+ota_status_t ota_end(void)
+{
+    return OTA_DONE;
+}
+
+
+// Fake ota_abort(), see src/ota.c.
+void ota_abort(void)
+{
+    _ota_aborts++;
+}
+
+
+// Fake ota_active(), see src/ota.c.
+bool ota_active(void)
+{
+    return false;
+}
+
+
+// Fake ota_written(), see src/ota.c.
+uint32_t ota_written(void)
+{
+    return 0x12345;
+}
+
+
+// Fake wifi_last_connect(), see src/wifi.c.
+void wifi_last_connect(int64_t *duration_us, bool *fast)
+{
+    *duration_us = 1500000;
+    *fast = true;
+}
+
+
+// Fake wifi_connect_count(), see src/wifi.c.
+int wifi_connect_count(void)
+{
+    return 3;
+}
+
+
+// Fake wifi_rssi(), see src/wifi.c.
+int wifi_rssi(void)
+{
+    return -60;
+}
+
+
+// Fake wifi_set_low_latency(), see src/wifi.c.
+void wifi_set_low_latency(bool low_latency)
+{
+    _wifi_low_latency = low_latency;
+}
+
+
+// Fake read_module_id(), see src/gpio.c.
+uint8_t read_module_id(void)
+{
+    return TEST_MODULE_ID;
+}
+
+
+// Fake read_battery_mv(), see src/gpio.c.
+int read_battery_mv(void)
+{
+    return 70000;  // More than fits, to check it's clamped.
+}
+
+
+// Start each test connected to the host, over TCP, at TEST_START_US.
+void setUp(void)
+{
+    mock_reset();
+    _state_enables = 0;
+    _ota_aborts = 0;
+    _wifi_low_latency = false;
+    _trace_next = 0;
+    _trace_count = 0;
+
+    _resume_token = 0;
+    _press_seq = 0;
+    _room = 0;
+    _broadcast_seq = 0;
+    _send_failures = 0;
+    host_init();
+
+    mock_time_us = TEST_START_US;
+    TEST_ASSERT_TRUE(host_connect());
+    _connection = _host_socket;
+}
+
+
+// Check nothing is left inside a critical section, or holding a lock.
+void tearDown(void)
+{
+    TEST_ASSERT_EQUAL_INT(0, _send_lock->held);
+    TEST_ASSERT_EQUAL_INT(0, _press_lock.nesting);
+    TEST_ASSERT_EQUAL_INT(0, _sync_lock.nesting);
+    TEST_ASSERT_EQUAL_INT(0, _trace_lock.nesting);
+}
+
+
+// Check the given send was on the given socket, and was exactly the given bytes.
+static void check_sent(const mock_send_t *sent, int sock, const uint8_t *expected, int size)
+{
+    TEST_ASSERT_NOT_NULL(sent);
+    TEST_ASSERT_EQUAL_INT(sock, sent->sock);
+    TEST_ASSERT_EQUAL_INT(size, sent->size);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, sent->data, size);
+}
+
+
+// Receive the given bytes from the host and process them, until the host appears to close the connection.
+static void receive(const uint8_t *bytes, int size)
+{
+    mock_recv_push(bytes, size);
+    host_process_messages();
+}
+
+
+// Check we send our version unframed, then a framed hello with our ID and no resume token.
+static void test_hello(void)
+{
+    uint8_t version[] = { MSG_VERSION };
+    uint8_t hello[] = { 0x00, 0x07, MSG_HELLO, 0x02, 0x05, 0x00, 0x00, 0x00, 0x00 };
+
+    TEST_ASSERT_EQUAL_INT(2, mock_send_count);
+    check_sent(mock_sent(0), _connection, version, sizeof(version));
+    check_sent(mock_sent(1), _connection, hello, sizeof(hello));
+    TEST_ASSERT_EQUAL_HEX16(TEST_BUZZER_ID, _buzzer_id);
+}
+
+
+// Check the parameter sizes of every message we understand, and that we don't claim to understand others.
+static void test_message_sizes(void)
+{
+    uint8_t modes[] = { 0x20, 0x23, 0x27 };
+    for(int i = 0; i < sizeof(modes); i++) TEST_ASSERT_EQUAL_INT(0, message_size(&modes[i], 1));
+
+    uint8_t ones[] = { MSG_SYNC_PING, MSG_PROBE, MSG_RADIO, MSG_TRANSPORT, MSG_ROOM };
+    for(int i = 0; i < sizeof(ones); i++) TEST_ASSERT_EQUAL_INT(1, message_size(&ones[i], 1));
+
+    uint8_t msg = MSG_HEARTBEAT_PERIOD;
+    TEST_ASSERT_EQUAL_INT(2, message_size(&msg, 1));
+    msg = MSG_RESUME_TOKEN;
+    TEST_ASSERT_EQUAL_INT(4, message_size(&msg, 1));
+    msg = MSG_TRACE_REQUEST;
+    TEST_ASSERT_EQUAL_INT(0, message_size(&msg, 1));
+    msg = MSG_OTA_BEGIN;
+    TEST_ASSERT_EQUAL_INT(36, message_size(&msg, 1));
+
+    // Broadcasts, acknowledgements and anything newer than us aren't understood over TCP.
+    uint8_t unknown[] = { MSG_PRESS_ACK, MSG_MODE_BROADCAST, MSG_TEAM_MODE_BROADCAST, 0x50, 0x28, 0xFF };
+    for(int i = 0; i < sizeof(unknown); i++) TEST_ASSERT_EQUAL_INT(-1, message_size(&unknown[i], 1));
+}
+
+
+// Check data messages are sized by their header, and ones too big to be real are rejected.
+static void test_ota_data_size(void)
+{
+    uint8_t data[] = { MSG_OTA_DATA, 0x00, 0x00, 0x04, 0x00, 0x00, 0x10 };
+    TEST_ASSERT_EQUAL_INT(OTA_DATA_HEADER_SIZE, message_size(data, 3));
+    TEST_ASSERT_EQUAL_INT(OTA_DATA_HEADER_SIZE + 16, message_size(data, sizeof(data)));
+
+    data[5] = (OTA_CHUNK_MAX + 1) >> 8;
+    data[6] = (OTA_CHUNK_MAX + 1) & 0xFF;
+    TEST_ASSERT_EQUAL_INT(-1, message_size(data, sizeof(data)));
+}
+
+
+// Check messages that arrive together are all processed, and their replies sent together.
+static void test_frames_together(void)
+{
+    uint8_t bytes[] = {
+        0x00, 0x02, MSG_PROBE, 0x07,
+        0x00, 0x01, 0x23,
+        0x00, 0x02, MSG_PROBE, 0x08
+    };
+    uint8_t replies[] = { 0x00, 0x02, MSG_PROBE_REPLY, 0x07, 0x00, 0x02, MSG_PROBE_REPLY, 0x08 };
+
+    int sends = mock_send_count;
+    receive(bytes, sizeof(bytes));
+
+    TEST_ASSERT_EQUAL_INT(sends + 1, mock_send_count);
+    check_sent(mock_last_sent(), _connection, replies, sizeof(replies));
+    TEST_ASSERT_EQUAL_INT(1, _state_enables);
+    TEST_ASSERT_TRUE(_state_led);
+    TEST_ASSERT_TRUE(_state_audio);
+    TEST_ASSERT_FALSE(_state_armed);
+}
+
+
+// Check a message split between reads is processed once it's complete.
+static void test_frame_split(void)
+{
+    uint8_t bytes[] = { 0x00, 0x02, MSG_PROBE, 0x09 };
+    uint8_t reply[] = { 0x00, 0x02, MSG_PROBE_REPLY, 0x09 };
+
+    mock_recv_push(&bytes[0], 1);
+    mock_recv_push(&bytes[1], 2);
+    mock_recv_push(&bytes[3], 1);
+    host_process_messages();
+
+    check_sent(mock_last_sent(), _connection, reply, sizeof(reply));
+}
+
+
+// Check unknown messages are skipped, extra parameters ignored, and messages too short for theirs are errors.
+static void test_message_lengths(void)
+{
+    uint8_t bytes[] = {
+        0x00, 0x03, 0x50, 0x01, 0x02,  // Unknown.
+        0x00, 0x04, MSG_PROBE, 0x0A, 0xEE, 0xEE,  // Extended.
+        0x00, 0x01, MSG_PROBE  // Too short.
+    };
+    uint8_t replies[] = { 0x00, 0x02, MSG_PROBE_REPLY, 0x0A, 0x00, 0x01, MSG_ERR_BAD_MSG };
+
+    receive(bytes, sizeof(bytes));
+    check_sent(mock_last_sent(), _connection, replies, sizeof(replies));
+}
+
+
+// Check an empty frame loses the connection, without processing anything after it, and abandons any update.
+static void test_bad_frame(void)
+{
+    uint8_t bytes[] = { 0x00, 0x00, 0x00, 0x02, MSG_PROBE, 0x01 };
+    int sends = mock_send_count;
+
+    receive(bytes, sizeof(bytes));
+
+    TEST_ASSERT_EQUAL_INT(sends, mock_send_count);
+    TEST_ASSERT_EQUAL_INT(0, _host_socket);
+    TEST_ASSERT_EQUAL_INT(1, _ota_aborts);
+}
+
+
+// Check settings from the host are applied.
+static void test_settings(void)
+{
+    uint8_t bytes[] = {
+        0x00, 0x03, MSG_HEARTBEAT_PERIOD, 0x00, 0x10,
+        0x00, 0x05, MSG_RESUME_TOKEN, 0xDE, 0xAD, 0xBE, 0xEF,
+        0x00, 0x02, MSG_ROOM, 0x03,
+        0x00, 0x02, MSG_TRANSPORT, MSG_TRANSPORT_UDP,
+        0x00, 0x02, MSG_RADIO, MSG_RADIO_LOW_LATENCY
+    };
+
+    receive(bytes, sizeof(bytes));
+
+    TEST_ASSERT_EQUAL_INT(HEARTBEAT_MIN_MS, _heartbeat_period_ms);
+    TEST_ASSERT_EQUAL_UINT32(0xDEADBEEF, _resume_token);
+    TEST_ASSERT_EQUAL_INT(3, _room);
+    TEST_ASSERT_TRUE(_udp_wanted);
+    TEST_ASSERT_TRUE(_wifi_low_latency);
+}
+
+
+// Check we wait longer for the host once it slows our heartbeats, since it then pings us less often.
+static void test_rx_timeout_follows_heartbeat(void)
+{
+    TEST_ASSERT_EQUAL_INT64(HOST_RX_TIMEOUT_MS * 1000, host_rx_timeout_us());
+
+    uint8_t bytes[] = { 0x00, 0x03, MSG_HEARTBEAT_PERIOD, 0x0B, 0xB8 };  // 3s.
+    receive(bytes, sizeof(bytes));
+    TEST_ASSERT_EQUAL_INT64(3000 * HOST_RX_TIMEOUT_HEARTBEATS * 1000, host_rx_timeout_us());
+}
+
+
+// Check a sync ping is noted with the time it arrived, and the pong carries it.
+static void test_sync(void)
+{
+    uint8_t bytes[] = { 0x00, 0x02, MSG_SYNC_PING, 0x42 };
+    receive(bytes, sizeof(bytes));
+
+    TEST_ASSERT_TRUE(_sync_pending);
+    TEST_ASSERT_EQUAL_INT(1, mock_notifies);
+    TEST_ASSERT_EQUAL_INT64(TEST_START_US, _sync_recv_time);
+
+    batch_t batch = { .size = 0 };
+    mock_time_us = TEST_START_US + 250;
+    send_sync_pong(&batch);
+
+    uint8_t pong[] = {
+        0x00, 0x12, MSG_SYNC_PONG, 0x42,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x0F, 0x42, 0x40,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x0F, 0x43, 0x3A
+    };
+    TEST_ASSERT_EQUAL_INT(sizeof(pong), batch.size);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(pong, batch.data, sizeof(pong));
+}
+
+
+// Check firmware update messages reach the updater, and are answered with its status.
+static void test_ota(void)
+{
+    uint8_t bytes[] = {
+        0x00, 0x0A, MSG_OTA_DATA, 0x00, 0x00, 0x04, 0x00, 0x00, 0x03, 0xAA, 0xBB, 0xCC,
+        0x00, 0x01, MSG_OTA_END
+    };
+    uint8_t replies[] = {
+        0x00, 0x06, MSG_OTA_STATUS, OTA_OK, 0x00, 0x01, 0x23, 0x45,
+        0x00, 0x06, MSG_OTA_STATUS, OTA_DONE, 0x00, 0x01, 0x23, 0x45
+    };
+
+    receive(bytes, sizeof(bytes));
+
+    TEST_ASSERT_EQUAL_UINT32(0x400, _ota_offset);
+    TEST_ASSERT_EQUAL_INT(3, _ota_size);
+    check_sent(mock_last_sent(), _connection, replies, sizeof(replies));
+}
+
+
+// Check presses carry their time and age, over TCP, with a new sequence number each.
+static void test_press_tcp(void)
+{
+    mock_time_us = TEST_START_US + 0x1234;
+    host_send_press(TEST_START_US);
+
+    uint8_t press[] = {
+        0x00, 0x0E, MSG_PRESS_SEQ, 0x01,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x0F, 0x42, 0x40,
+        0x00, 0x00, 0x12, 0x34
+    };
+    check_sent(mock_last_sent(), _host_socket, press, sizeof(press));
+    TEST_ASSERT_FALSE(_press_pending);
+
+    host_send_press(TEST_START_US);
+    TEST_ASSERT_EQUAL_HEX8(0x02, mock_last_sent()->data[3]);
+}
+
+
+// Check presses over UDP carry our wide ID, and are resent until acknowledged.
+static void test_press_udp(void)
+{
+    _udp_wanted = true;
+    _udp_socket = udp_open();
+
+    host_send_press(TEST_START_US);
+    const mock_send_t *sent = mock_last_sent();
+    TEST_ASSERT_EQUAL_INT(_udp_socket, sent->sock);
+    TEST_ASSERT_EQUAL_INT(UDP_ID_SIZE + PRESS_MSG_SIZE, sent->size);
+    TEST_ASSERT_EQUAL_HEX8(UDP_WIDE_ID | 0x02, sent->data[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x05, sent->data[1]);
+    TEST_ASSERT_EQUAL_HEX8(MSG_PRESS_SEQ, sent->data[2]);
+    TEST_ASSERT_TRUE(_press_pending);
+
+    // Not yet due, then due.
+    int sends = mock_send_count;
+    mock_time_us = TEST_START_US + (PRESS_RETRY_MS * 1000) - 1;
+    resend_press();
+    TEST_ASSERT_EQUAL_INT(sends, mock_send_count);
+    mock_time_us = TEST_START_US + (PRESS_RETRY_MS * 1000);
+    resend_press();
+    TEST_ASSERT_EQUAL_INT(sends + 1, mock_send_count);
+
+    // A stale acknowledgement is ignored, the right one stops the resends.
+    uint8_t stale[] = { MSG_PRESS_ACK, 0x00 };
+    uint8_t ack[] = { MSG_PRESS_ACK, 0x01 };
+    mock_recv_push(stale, sizeof(stale));
+    process_ack();
+    TEST_ASSERT_TRUE(_press_pending);
+    mock_recv_push(ack, sizeof(ack));
+    process_ack();
+    TEST_ASSERT_FALSE(_press_pending);
+}
+
+
+// Check a press that's never acknowledged falls back to TCP, for the rest of the connection.
+static void test_press_udp_fallback(void)
+{
+    _udp_wanted = true;
+    _udp_socket = udp_open();
+    host_send_press(TEST_START_US);
+
+    for(int i = 1; i <= PRESS_MAX_SENDS; i++)
+    {
+        mock_time_us = TEST_START_US + (i * PRESS_RETRY_MS * 1000);
+        resend_press();
+    }
+
+    TEST_ASSERT_FALSE(_udp_wanted);
+    TEST_ASSERT_FALSE(_press_pending);
+    TEST_ASSERT_EQUAL_INT(_host_socket, mock_last_sent()->sock);
+    TEST_ASSERT_EQUAL_HEX8(MSG_PRESS_SEQ, mock_last_sent()->data[FRAME_HEADER_SIZE]);
+}
+
+
+// Receive the given broadcast, and check whether it was applied.
+static void check_broadcast(const uint8_t *msg, int size, bool applied)
+{
+    int enables = _state_enables;
+    mock_recv_push(msg, size);
+    process_broadcast();
+    TEST_ASSERT_EQUAL_INT(applied ? (enables + 1) : enables, _state_enables);
+}
+
+
+// Check mode broadcasts are applied in order, and reported.
+static void test_broadcast(void)
+{
+    uint8_t first[] = { MSG_MODE_BROADCAST, 0x00, 0x05, 0x23 };
+    uint8_t late[] = { MSG_MODE_BROADCAST, 0x00, 0x04, 0x20 };
+    uint8_t wrapped[] = { MSG_MODE_BROADCAST, 0x80, 0x06, 0x20 };  // More than half the sequence on, so behind.
+
+    check_broadcast(first, sizeof(first), true);
+    TEST_ASSERT_TRUE(_state_led);
+
+    uint8_t applied[] = {
+        0x00, 0x0B, MSG_MODE_APPLIED, 0x00, 0x05,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x0F, 0x42, 0x40
+    };
+    check_sent(mock_last_sent(), _host_socket, applied, sizeof(applied));
+
+    check_broadcast(first, sizeof(first), false);
+    check_broadcast(late, sizeof(late), false);
+    check_broadcast(wrapped, sizeof(wrapped), false);
+}
+
+
+// Check team mode broadcasts arm our team, leave out the buzzer they name, and are ignored by other rooms.
+static void test_team_broadcast(void)
+{
+    uint8_t ours[] = { MSG_TEAM_MODE_BROADCAST, 0x00, 0x01, 0x20, 0x00, 0x04, 0xFF, 0xFF };
+    uint8_t others[] = { MSG_TEAM_MODE_BROADCAST, 0x00, 0x02, 0x20, 0x00, 0x03, 0xFF, 0xFF };
+    uint8_t not_us[] = { MSG_TEAM_MODE_BROADCAST, 0x00, 0x03, 0x20, 0x00, 0x00, 0x02, 0x05 };
+
+    check_broadcast(ours, sizeof(ours), true);
+    TEST_ASSERT_TRUE(_state_armed);
+    check_broadcast(others, sizeof(others), true);
+    TEST_ASSERT_FALSE(_state_armed);
+    check_broadcast(not_us, sizeof(not_us), false);
+
+    uint8_t room_2[] = { MSG_TEAM_MODE_BROADCAST, 0x00, 0x05, 0x20, 0x00, 0x00, 0xFF, 0xFF, 0x02 };
+    uint8_t room_3[] = { MSG_TEAM_MODE_BROADCAST, 0x00, 0x06, 0x20, 0x00, 0x00, 0xFF, 0xFF, 0x03 };
+    _room = 3;
+    check_broadcast(room_2, sizeof(room_2), false);
+    check_broadcast(room_3, sizeof(room_3), true);
+}
+
+
+// Check telemetry is laid out as Protocol.txt says, with counts clamped.
+static void test_telemetry(void)
+{
+    batch_t batch = { .size = 0 };
+    send_telemetry(&batch);
+
+    uint8_t telemetry[] = {
+        0x00, TELEMETRY_MSG_SIZE, MSG_TELEMETRY,
+        0xC4,  // -60dBm.
+        0x00, 0x03,  // WIFI connections.
+        0x00, 0x01,  // Host connections.
+        0x05, 0xDC,  // 1500ms to connect.
+        TELEMETRY_FAST_CONNECT,
+        0x00, 0x00,  // Failed sends.
+        0x04, 0x00,  // Least free stack, from the stand-in tasks.
+        0xFF, 0xFF,  // Battery, clamped.
+        0x00, 0x01, 0x86, 0xA0  // Free heap.
+    };
+    TEST_ASSERT_EQUAL_INT(sizeof(telemetry), batch.size);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(telemetry, batch.data, sizeof(telemetry));
+}
+
+
+// Check a batch too full for the next message is sent first.
+static void test_batch_full(void)
+{
+    batch_t batch = { .size = 0 };
+    uint8_t msg[19] = { MSG_PROBE_REPLY };  // 3 fit in a batch, framed, but not 4.
+    int sends = mock_send_count;
+
+    for(int i = 0; i < 3; i++) batch_add(&batch, msg, sizeof(msg));
+    TEST_ASSERT_EQUAL_INT(sends, mock_send_count);
+    TEST_ASSERT_EQUAL_INT(3 * (FRAME_HEADER_SIZE + sizeof(msg)), batch.size);
+
+    batch_add(&batch, msg, sizeof(msg));
+    TEST_ASSERT_EQUAL_INT(sends + 1, mock_send_count);
+    TEST_ASSERT_EQUAL_INT(3 * (FRAME_HEADER_SIZE + sizeof(msg)), mock_last_sent()->size);
+    TEST_ASSERT_EQUAL_INT(FRAME_HEADER_SIZE + sizeof(msg), batch.size);
+}
+
+
+// Check a failed send loses the connection, and is counted.
+static void test_send_failure(void)
+{
+    mock_send_fail = true;
+    host_send_press(TEST_START_US);
+
+    TEST_ASSERT_EQUAL_INT(0, _host_socket);
+    TEST_ASSERT_EQUAL_UINT32(1, _send_failures);
+}
+
+
+// Check a frame the socket only takes part of is sent in full, in order.
+static void test_partial_send(void)
+{
+    mock_send_limit = 5;
+    int sends = mock_send_count;
+    host_send_press(TEST_START_US);
+
+    uint8_t frame[FRAME_HEADER_SIZE + PRESS_MSG_SIZE];
+    int size = 0;
+    for(int i = sends; i < mock_send_count; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(_connection, mock_sent(i)->sock);
+        memcpy(&frame[size], mock_sent(i)->data, mock_sent(i)->size);
+        size += mock_sent(i)->size;
+    }
+
+    TEST_ASSERT_EQUAL_INT(4, mock_send_count - sends);
+    TEST_ASSERT_EQUAL_INT(sizeof(frame), size);
+    TEST_ASSERT_EQUAL_HEX8(PRESS_MSG_SIZE, frame[1]);
+    TEST_ASSERT_EQUAL_HEX8(MSG_PRESS_SEQ, frame[FRAME_HEADER_SIZE]);
+}
+
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_hello);
+    RUN_TEST(test_message_sizes);
+    RUN_TEST(test_ota_data_size);
+    RUN_TEST(test_frames_together);
+    RUN_TEST(test_frame_split);
+    RUN_TEST(test_message_lengths);
+    RUN_TEST(test_bad_frame);
+    RUN_TEST(test_settings);
+    RUN_TEST(test_rx_timeout_follows_heartbeat);
+    RUN_TEST(test_sync);
+    RUN_TEST(test_ota);
+    RUN_TEST(test_press_tcp);
+    RUN_TEST(test_press_udp);
+    RUN_TEST(test_press_udp_fallback);
+    RUN_TEST(test_broadcast);
+    RUN_TEST(test_team_broadcast);
+    RUN_TEST(test_telemetry);
+    RUN_TEST(test_batch_full);
+    RUN_TEST(test_send_failure);
+    RUN_TEST(test_partial_send);
+    return UNITY_END();
+}
@@ -0,0 +1,267 @@
+/* Unit tests for the state machine and its button interrupt, see src/state.c.
+
+These run on the host, see test/README. The interrupt and most of the state are static, so we include the source
+itself. Tracing is simple enough to use for real, but audio and the host connection are replaced by fakes below.
+
+*/
+
+#include <unity.h>
+#include "idf_mock.h"
+#include "../../src/state.c"
+#include "../../src/trace.c"
+
+#define TEST_START_US 1000000  // Well after boot, so the first press isn't held up by debouncing.
+
+// What our fakes have been asked to do.
+static int _audio_starts;
+static int _audio_stops;
+
+
+// Fake audio_play(), see src/audio.c. Only the press task plays sounds, and that never runs here.
+void audio_play(audio_event_t event)
+{
+}
+
+
+// Fake audio_start(), see src/audio.c.
+void audio_start(void)
+{
+    _audio_starts++;
+}
+
+
+// Fake audio_stop(), see src/audio.c.
+void audio_stop(void)
+{
+    _audio_stops++;
+}
+
+
+// Fake host_send_press(), see src/host.c. Only the press task sends presses, and that never runs here.
+void host_send_press(int64_t press_time)
+{
+}
+
+
+// Start each test freshly booted, at TEST_START_US, with the button released.
+void setUp(void)
+{
+    mock_reset();
+    _audio_starts = 0;
+    _audio_stops = 0;
+    _trace_next = 0;
+    _trace_count = 0;
+
+    _button_pressed = false;
+    _armed = false;
+    mock_gpio_levels[PIN_BUTTON] = 1;
+    state_init();
+
+    mock_time_us = TEST_START_US;
+}
+
+
+// Check nothing is left inside a critical section.
+void tearDown(void)
+{
+    TEST_ASSERT_EQUAL_INT(0, _trace_lock.nesting);
+}
+
+
+// Press or release the button at the given time, in us since boot, and run the interrupt as the hardware would.
+static void set_button(bool pressed, int64_t time)
+{
+    mock_time_us = time;
+    mock_gpio_levels[PIN_BUTTON] = pressed ? 0 : 1;
+    button_isr(NULL);
+}
+
+
+// Report the number of presses waiting to be sent.
+static int presses_queued(void)
+{
+    return uxQueueMessagesWaiting(_press_queue);
+}
+
+
+// Check we flash the status LED while connecting, and ignore the button.
+static void test_connecting(void)
+{
+    TEST_ASSERT_TRUE(_flash_timer->running);
+    TEST_ASSERT_EQUAL_INT64(STATUS_FLASH_US, _flash_timer->period_us);
+    TEST_ASSERT_EQUAL_INT(0, mock_gpio_levels[PIN_LED_BUTTON]);
+
+    // The interrupt still follows the button, but nothing is queued.
+    set_button(true, TEST_START_US);
+    TEST_ASSERT_EQUAL_INT(0, presses_queued());
+    TEST_ASSERT_EQUAL_INT(GPIO_INTR_HIGH_LEVEL, mock_gpio_intr_types[PIN_BUTTON]);
+    TEST_ASSERT_EQUAL_INT(1, mock_gpio_levels[PIN_LED_PCB]);
+}
+
+
+// Check connecting stops the flashing, and connecting again restarts it.
+static void test_connected(void)
+{
+    state_connected();
+    TEST_ASSERT_FALSE(_flash_timer->running);
+    TEST_ASSERT_EQUAL_INT(1, mock_gpio_levels[PIN_LED_STATUS]);
+
+    state_connect();
+    TEST_ASSERT_TRUE(_flash_timer->running);
+}
+
+
+// Check a press is timestamped at the interrupt and queued, and the interrupt waits for the opposite level each time.
+static void test_press_queued(void)
+{
+    state_connected();
+
+    set_button(true, TEST_START_US);
+    TEST_ASSERT_EQUAL_INT(1, presses_queued());
+    TEST_ASSERT_EQUAL_INT(GPIO_INTR_HIGH_LEVEL, mock_gpio_intr_types[PIN_BUTTON]);
+    TEST_ASSERT_EQUAL_INT(GPIO_INTR_HIGH_LEVEL, mock_gpio_wakeup_types[PIN_BUTTON]);
+    TEST_ASSERT_EQUAL_INT(1, mock_yields);
+
+    set_button(false, TEST_START_US + 100000);
+    TEST_ASSERT_EQUAL_INT(1, presses_queued());
+    TEST_ASSERT_EQUAL_INT(GPIO_INTR_LOW_LEVEL, mock_gpio_intr_types[PIN_BUTTON]);
+    TEST_ASSERT_EQUAL_INT(0, mock_gpio_levels[PIN_LED_PCB]);
+
+    int64_t press_time;
+    TEST_ASSERT_TRUE(xQueueReceive(_press_queue, &press_time, 0));
+    TEST_ASSERT_EQUAL_INT64(TEST_START_US, press_time);
+}
+
+
+// Check bounces on both press and release are ignored, and presses count again once released for long enough.
+static void test_debounce(void)
+{
+    state_connected();
+    int64_t t = TEST_START_US;
+
+    set_button(true, t);
+    set_button(false, t + 100);
+    set_button(true, t + 200);  // Bounce on pressing.
+    TEST_ASSERT_EQUAL_INT(1, presses_queued());
+
+    t += 100000;
+    set_button(false, t);
+    set_button(true, t + BUTTON_DEBOUNCE_US - 1);  // Bounce on releasing.
+    TEST_ASSERT_EQUAL_INT(1, presses_queued());
+
+    t += 100000;
+    set_button(false, t);
+    set_button(true, t + BUTTON_DEBOUNCE_US);
+    TEST_ASSERT_EQUAL_INT(2, presses_queued());
+}
+
+
+// Check the button being seen as pressed twice in a row only counts once.
+static void test_held(void)
+{
+    state_connected();
+
+    set_button(true, TEST_START_US);
+    set_button(true, TEST_START_US + 100000);
+    TEST_ASSERT_EQUAL_INT(1, presses_queued());
+}
+
+
+// Check the press and the interrupt queueing it are traced, at the time of the edge.
+static void test_press_traced(void)
+{
+    state_connected();
+    set_button(true, TEST_START_US);
+
+    trace_entry_t entries[TRACE_SIZE];
+    TEST_ASSERT_EQUAL_INT(2, trace_read(entries));
+    TEST_ASSERT_EQUAL_INT(TRACE_BUTTON_EDGE, entries[0].event);
+    TEST_ASSERT_EQUAL_INT(1, entries[0].arg);
+    TEST_ASSERT_EQUAL_INT64(TEST_START_US, entries[0].time);
+    TEST_ASSERT_EQUAL_INT(TRACE_PRESS_QUEUED, entries[1].event);
+}
+
+
+// Check an armed buzzer latches its first press and lights its LED itself, ignoring presses until a new mode.
+static void test_armed_latch(void)
+{
+    state_connected();
+    state_enable(false, false, true);
+    TEST_ASSERT_EQUAL_INT(1, mock_pm_locks_held);
+
+    set_button(true, TEST_START_US);
+    TEST_ASSERT_TRUE(_latched);
+    TEST_ASSERT_EQUAL_INT(1, mock_gpio_levels[PIN_LED_BUTTON]);
+    TEST_ASSERT_EQUAL_INT(1, presses_queued());
+
+    set_button(false, TEST_START_US + 100000);
+    set_button(true, TEST_START_US + 200000);
+    TEST_ASSERT_EQUAL_INT(1, presses_queued());
+
+    // The host confirms it, which clears the latch.
+    state_enable(true, false, false);
+    TEST_ASSERT_FALSE(_latched);
+    TEST_ASSERT_EQUAL_INT(0, mock_pm_locks_held);
+    TEST_ASSERT_EQUAL_INT(1, mock_gpio_levels[PIN_LED_BUTTON]);
+
+    set_button(false, TEST_START_US + 300000);
+    set_button(true, TEST_START_US + 400000);
+    TEST_ASSERT_EQUAL_INT(2, presses_queued());
+}
+
+
+// Check an unarmed press leaves the button LED to the host.
+static void test_unarmed_press(void)
+{
+    state_connected();
+    set_button(true, TEST_START_US);
+
+    TEST_ASSERT_FALSE(_latched);
+    TEST_ASSERT_EQUAL_INT(0, mock_gpio_levels[PIN_LED_BUTTON]);
+}
+
+
+// Check arming twice only takes the power management lock once, and losing the host gives it up.
+static void test_armed_lock(void)
+{
+    state_connected();
+    state_enable(false, false, true);
+    state_enable(true, false, true);
+    TEST_ASSERT_EQUAL_INT(1, mock_pm_locks_held);
+
+    state_connect();
+    TEST_ASSERT_EQUAL_INT(0, mock_pm_locks_held);
+}
+
+
+// Check modes set the LED and audio.
+static void test_enable(void)
+{
+    state_connected();
+    int stops = _audio_stops;
+
+    state_enable(true, true, false);
+    TEST_ASSERT_EQUAL_INT(1, mock_gpio_levels[PIN_LED_BUTTON]);
+    TEST_ASSERT_EQUAL_INT(1, _audio_starts);
+
+    state_enable(false, false, false);
+    TEST_ASSERT_EQUAL_INT(0, mock_gpio_levels[PIN_LED_BUTTON]);
+    TEST_ASSERT_EQUAL_INT(stops + 1, _audio_stops);
+}
+
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_connecting);
+    RUN_TEST(test_connected);
+    RUN_TEST(test_press_queued);
+    RUN_TEST(test_debounce);
+    RUN_TEST(test_held);
+    RUN_TEST(test_press_traced);
+    RUN_TEST(test_armed_latch);
+    RUN_TEST(test_unarmed_press);
+    RUN_TEST(test_armed_lock);
+    RUN_TEST(test_enable);
+    return UNITY_END();
+}
@@ -0,0 +1,80 @@
+/* Benchmarks for the press path and other hot paths, using the fake buzzers from replay_test.go.
+
+Run with:
+  go test -run XXX -bench . -benchmem
+
+*/
+
+package main
+
+import "testing"
+
+
+// Time from a press arriving on a buzzer connection to the winning buzzer being told to light up.
+// Arbitration is off, so this is our own handling time, without the window we'd otherwise wait for.
+func BenchmarkPressToDecision(b *testing.B) {
+    rig := createRig(b, 0x001, 0x101, 0x201, 0x301)
+    defer rig.Close()
+
+    ids := []int{0x001, 0x101, 0x201, 0x301}
+    rig.controller.commandWindow(0)
+    b.ReportAllocs()
+    b.ResetTimer()
+
+    for i := 0; i < b.N; i++ {
+        b.StopTimer()
+        rig.Ask(0x0F)
+        id := ids[i % len(ids)]
+        b.StartTimer()
+
+        rig.buzzers[id].Press(0)
+        if winner := rig.WaitDecision(); winner != id {
+            b.Fatalf("Winner %s, expected %s", BuzzerIdToString(winner), BuzzerIdToString(id))
+        }
+    }
+}
+
+
+// Cost of sending a mode to every buzzer directly, as without UDP broadcasts, until all have received it.
+func BenchmarkSetModeAll(b *testing.B) {
+    var ids []int
+    for team := 0; team < 4; team++ {
+        for n := 0; n < 8; n++ { ids = append(ids, team << BuzzerTeamShift | n) }
+    }
+
+    rig := createRig(b, ids...)
+    defer rig.Close()
+
+    b.ReportAllocs()
+    b.ResetTimer()
+
+    for i := 0; i < b.N; i++ {
+        on := (i & 1) == 0
+        rig.swarm.SetModeAll(on, false)
+
+        want := ModeCommand(on, false)
+        for received := 0; received < len(ids); {
+            if m := <-rig.modes; m.mode == want { received++ }
+        }
+    }
+}
+
+
+// Cost of handling a heartbeat, including allocations.
+// Each write to the pipe only completes once the Buzzer is reading again, so by then it has handled the previous one.
+func BenchmarkHeartbeat(b *testing.B) {
+    rig := createRig(b, 0x001)
+    defer rig.Close()
+
+    buzzer := rig.buzzers[0x001]
+    heartbeat := []byte{0, 1, MsgHeartbeatByte}  // Framed here, so we don't count our own allocations.
+    b.ReportAllocs()
+    b.ResetTimer()
+
+    for i := 0; i < b.N; i++ {
+        buzzer.sendRaw(heartbeat)
+    }
+
+    b.StopTimer()
+    buzzer.sendRaw(heartbeat)  // Make sure the last one has been handled.
+}
@@ -1,26 +1,49 @@
 /* Functions for communicating with physical buzzers.
 
+Each buzzer has a TCP connection to us. Framed buzzers may also send presses and heartbeats over UDP, see udp.go,
+which is selected at handshake time.
+
+We talk to two kinds of buzzer, which can be connected at once. Current buzzers frame every message after their
+version byte with its length, in both directions, see Protocol.txt. This lets their IDs be 16 bits, and lets us skip
+messages we don't understand. Version 4 buzzers use the original single byte protocol, with 7 bit IDs, which we
+convert to our wider IDs as they connect. They only send untimed presses and heartbeats, and understand nothing but
+modes, so none of the optional features here apply to them.
+
+Each buzzer is assigned to a room once its hello is in, see room.go, and is handled by that room's swarm and
+controller from then on. Framed buzzers may ask for a room in their hello.
+
+Framed messages are read whole into a buffer of our own, so decoding them doesn't allocate. Whatever is queued to send
+to a buzzer when we come to send is written together, so several messages can share a packet.
+
 */
 
 package main
 
+import "bufio"
+import "encoding/binary"
 import "fmt"
+import "io"
 import "net"
+import "sync"
+import "time"
 
 
 // External interface.
 
 // Create a Buzzer object based on the given connection and start processing incoming messages.
-func HandleNode(conn net.Conn, controller *Controller, swarm *Swarm) {
+// The buzzer joins whichever of the given rooms it belongs in, once it's said who it is.
+// If a UDP transport is given, the buzzer will be told to use it if it can. May be nil.
+func HandleNode(conn net.Conn, rooms *Rooms, udp *UdpTransport) {
     var p Buzzer
     p.conn = conn
-    p.controller = controller
-    p.swarm = swarm
+    p.udp = udp
+    p.rooms = rooms
     p.id = 0xFF
     p.sends = make(chan []byte, 100)
+    p.clock = CreateClockSync()
 
-    // Since all messages are single bytes, we only read 1 byte at a time from our connection.
-    p.buffer = make([]byte, 1)
+    // Read in batches, so a single read can pick up several messages.
+    p.reader = bufio.NewReaderSize(conn, BuzzerReadBufferSize)
 
     go p.processIncoming()
     go p.processOutgoing()
@@ -30,20 +53,146 @@ func HandleNode(conn net.Conn, controller *Controller, swarm *Swarm) {
 // Send a mode message to this Buzzer.
 // This may be slow, call as a Go routine if appropriate.
 func (this *Buzzer) SetMode(ledOn bool, buzzerOn bool) {
-    var b byte = 0x20
+    this.SendMode(ModeCommand(ledOn, buzzerOn))
+}
+
 
-    if ledOn { b |= 1 }
-    if buzzerOn { b |= 2 }
+// Send the given mode command byte to this Buzzer.
+// Buzzers using the single byte protocol don't support arming, so are sent the mode without the armed bit.
+func (this *Buzzer) SendMode(b byte) {
+    if !this.framed { b &^= CmdModeArmed }
 
     // fmt.Printf("Set buzzer %s mode %x\n", this.ID(), b)
     this.sends <- []byte{b}
 }
 
 
+// Give this Buzzer the token it should present to resume its session if it reconnects.
+// Does nothing if the buzzer doesn't frame its messages, since older firmware can't resume.
+func (this *Buzzer) SetResumeToken(token uint32) {
+    if !this.framed { return }
+
+    msg := []byte{CmdResumeToken, 0, 0, 0, 0}
+    binary.BigEndian.PutUint32(msg[1:], token)
+    this.sends <- msg
+}
+
+
+// Tell this Buzzer which room it's in, so it can ignore other rooms' broadcasts.
+// Does nothing if the buzzer doesn't frame its messages, since older firmware has no rooms.
+func (this *Buzzer) SendRoom(tag byte) {
+    if !this.framed { return }
+
+    this.sends <- []byte{CmdRoom, tag}
+}
+
+
+// Build the mode command byte for the given outputs.
+func ModeCommand(ledOn bool, buzzerOn bool) byte {
+    var b byte = CmdModePrefix
+
+    if ledOn { b |= CmdModeLed }
+    if buzzerOn { b |= CmdModeBuzzer }
+
+    return b
+}
+
+
+// Send a clock sync ping to this Buzzer.
+// Does nothing if the buzzer doesn't frame its messages, since older firmware doesn't support sync.
+// Must only be called from the Swarm's Go routine.
+func (this *Buzzer) SendSyncPing() {
+    if !this.framed { return }
+
+    this.syncSeq++
+    this.sends <- []byte{CmdSyncPing, this.syncSeq}
+}
+
+
+// Send a round trip time probe to this Buzzer.
+// Does nothing if the buzzer doesn't frame its messages, since older firmware doesn't support probes.
+// Must only be called from the Swarm's Go routine.
+func (this *Buzzer) SendProbe() {
+    if !this.framed { return }
+
+    this.probeSeq++
+    this.sends <- []byte{CmdProbe, this.probeSeq}
+}
+
+
+// Send a radio profile message to this Buzzer.
+// Does nothing if the buzzer doesn't frame its messages, since older firmware doesn't support radio profiles.
+func (this *Buzzer) SetRadioProfile(lowLatency bool) {
+    if !this.framed { return }
+
+    var profile byte = 0
+    if lowLatency { profile = 1 }
+    this.sends <- []byte{CmdRadio, profile}
+}
+
+
+// Tell this Buzzer how often to send heartbeats.
+// Does nothing if the buzzer doesn't frame its messages, since older firmware always sends them every 1s.
+func (this *Buzzer) SetHeartbeat(period time.Duration) {
+    if !this.framed { return }
+
+    ms := period / time.Millisecond
+    this.sends <- []byte{CmdHeartbeat, byte(ms >> 8), byte(ms)}
+}
+
+
+// Ask this Buzzer for its latency trace, which is printed when it arrives.
+// Returns false if the buzzer doesn't frame its messages, since older firmware doesn't support tracing.
+func (this *Buzzer) RequestTrace() bool {
+    if !this.framed { return false }
+
+    this.sends <- []byte{CmdTraceRequest}
+    return true
+}
+
+
+// Start a firmware update on this Buzzer, with an image of the given size and SHA-256.
+// Must only be called for framed buzzers.
+func (this *Buzzer) SendOtaBegin(size int, sha [32]byte) {
+    msg := make([]byte, 1 + 4 + len(sha))
+    msg[0] = CmdOtaBegin
+    binary.BigEndian.PutUint32(msg[1:5], uint32(size))
+    copy(msg[5:], sha[:])
+    this.sends <- msg
+}
+
+
+// Send the given chunk of firmware image, at the given offset, to this Buzzer.
+// Must only be called for framed buzzers.
+func (this *Buzzer) SendOtaData(offset int, data []byte) {
+    msg := make([]byte, 1 + 4 + 2 + len(data))
+    msg[0] = CmdOtaData
+    binary.BigEndian.PutUint32(msg[1:5], uint32(offset))
+    binary.BigEndian.PutUint16(msg[5:7], uint16(len(data)))
+    copy(msg[7:], data)
+    this.sends <- msg
+}
+
+
+// Finish a firmware update on this Buzzer. If the image verifies the buzzer restarts into it.
+// Must only be called for framed buzzers.
+func (this *Buzzer) SendOtaEnd() {
+    this.sends <- []byte{CmdOtaEnd}
+}
+
+
+// Abandon any firmware update on this Buzzer.
+// Must only be called for framed buzzers.
+func (this *Buzzer) SendOtaAbort() {
+    this.sends <- []byte{CmdOtaAbort}
+}
+
+
 // Disconnect from this buzzer.
 func (this *Buzzer) Disconnect() {
     this.conn.Close()
-    this.swarm.Disconnected(this.id, this)
+    if this.udp != nil { this.udp.Unregister(this.id, this) }
+    if this.swarm != nil { this.swarm.Disconnected(this.id, this) }
 }
 
 
@@ -55,8 +204,29 @@ func (this *Buzzer) ID() string {
 
 // Convert the given buzzer ID to a string.
 func BuzzerIdToString(id int) string {
-    team := (id >> 4) & 7
-    return fmt.Sprintf("%s%d", _teamLetters[team], id & 15)
+    return fmt.Sprintf("%s%d", _teamLetters[BuzzerTeam(id)], id & (MaxTeamBuzzers - 1))
+}
+
+
+// Report the team ID of the given buzzer ID.
+func BuzzerTeam(id int) int {
+    return (id >> BuzzerTeamShift) & (MaxTeams - 1)
+}
+
+
+// Convert the given 7 bit ID, from a buzzer using the single byte protocol, to our ID.
+func BuzzerIdFromLegacy(legacy byte) int {
+    return int(legacy >> 4) << BuzzerTeamShift | int(legacy & 15)
+}
+
+
+// Convert the given ID to 7 bits, for buzzers using the single byte protocol.
+// Returns false if the ID doesn't fit.
+func BuzzerIdToLegacy(id int) (byte, bool) {
+    team := BuzzerTeam(id)
+    n := id & (MaxTeamBuzzers - 1)
+    if team >= 8 || n >= 16 { return 0, false }
+    return byte(team << 4 | n), true
 }
 
 
@@ -69,36 +239,119 @@ func TeamIdToString(id int) string {
 // Object to represent a physical buzzer with which we're communicating.
 type Buzzer struct {
     conn net.Conn
-    controller *Controller
+    rooms *Rooms
+    room *Room  // The room we're in. nil until the handshake has assigned us one.
+    controller *Controller  // Our room's controller. nil until we're in a room.
     id int
-    swarm *Swarm
+    swarm *Swarm  // Our room's swarm. nil until we're in a room.
     buzzerVersion byte
-    buffer []byte  // Storage for incoming messages.
-    sends chan []byte  // Bytes to send, which should be synchronised.
+    reader *bufio.Reader  // Buffered incoming messages.
+    payload [BuzzerMaxPayload]byte  // Storage for incoming message parameters.
+    stats *linkStats  // Timing stats for this buzzer, owned by our swarm.
+    sends chan []byte  // Messages to send, which should be synchronised. Each is unframed.
+    framed bool  // Whether we frame messages, and so have our optional features. Set at handshake, before any sends.
+    frame [BuzzerMaxFrame]byte  // The latest framed message received.
+    frameSize int  // Size of the latest framed message.
+    framePos int  // How much of the latest framed message has been read.
+    udp *UdpTransport  // nil if not using UDP.
+    pressLock sync.Mutex  // Protects press sequence numbers, since presses may arrive via TCP or UDP.
+    anyPress bool  // Whether we've had any sequenced presses yet.
+    lastPressSeq byte  // Sequence number of the last sequenced press received.
+    clock *ClockSync  // Sync with the buzzer's clock, for this connection.
+    syncSeq byte  // Sequence number of the last sync ping sent.
+    probeSeq byte  // Sequence number of the last probe sent.
+    sentLock sync.Mutex  // Protects send times, which are written by our outgoing and read by our incoming routines.
+    syncSent [256]int64  // Time we sent each sync ping, in us, indexed by sequence number.
+    probeSent [256]int64  // Time we sent each probe, in us, indexed by sequence number.
 }
 
 
 // Internals.
 
-// We always expect all buzzers contacted to be on the latest firmware version.
+// We expect all buzzers contacted to be on the latest firmware version, apart from any still on the single byte
+// protocol. Versions in between were never released.
+const (
+    BuzzerLegacyVersion = 4
+    BuzzerExpectedVersion = 18
+)
+
+// Sizes of our message storage.
+const (
+    BuzzerReadBufferSize = 4096
+    BuzzerMaxPayload = 32  // Largest single byte protocol message, after its message byte.
+    BuzzerMaxFrame = 1024  // Largest framed message we accept. Firmware traces are up to 642 bytes.
+    BuzzerMaxBatch = 4096  // We stop adding messages to a single write once it gets this big.
+)
+
+// Buzzer ID layout. Each ID is the team ID, shifted up, and the buzzer's number within its team.
+const (
+    BuzzerTeamShift = 8
+    MaxTeams = 16
+    MaxTeamBuzzers = 1 << BuzzerTeamShift
+)
+
+// Commands we send to buzzers.
+const (
+    CmdModePrefix = 0x20
+    CmdSyncPing = 0x40
+    CmdProbe = 0x41
+    CmdRadio = 0x42
+    CmdTransport = 0x43
+    CmdPressAck = 0x44
+    CmdModeBroadcast = 0x45
+    CmdResumeToken = 0x47
+    CmdHeartbeat = 0x48
+    CmdTraceRequest = 0x49
+    CmdOtaBegin = 0x4A
+    CmdOtaData = 0x4B
+    CmdOtaEnd = 0x4C
+    CmdOtaAbort = 0x4D
+    CmdTeamModeBroadcast = 0x4E
+    CmdRoom = 0x4F
+)
+
+// Mode command bits.
+const (
+    CmdModeLed = 0x01
+    CmdModeBuzzer = 0x02
+    CmdModeArmed = 0x04
+)
+
+// Transport values for CmdTransport.
 const (
-    BuzzerExpectedVersion = 4
+    TransportTcp = 0
+    TransportUdp = 1
 )
 
-// Team letters for printing buzzer IDs.
-// TODO: Use this same definition for command parsing buzzer IDs.
-var _teamLetters = []string{"B", "G", "R", "Y", "x", "x", "x", "x"}
+// Team letters for printing and parsing buzzer and team IDs, in team ID order. The first 4 are the button colours.
+// No command's name is another's followed by a team letter, such as "qn" would be after "q", so a team can never be
+// mistaken for part of a command, or the other way round. Check any new command against these.
+var _teamLetters = []string{"B", "G", "R", "Y", "D", "P", "W", "K", "C", "M", "E", "F", "L", "H", "U", "V"}
 
 
 // Handle outgoing messages.
 // Only returns on connection error. Should be called as a Go routine.
 func (this *Buzzer) processOutgoing() {
+    batch := make([]byte, 0, BuzzerMaxBatch)
+
     // Now process outgoing messages forever.
     for {
-        b := <-this.sends
-        _, err := this.conn.Write(b)
+        batch = this.appendMessage(batch[:0], <-this.sends)
+
+        // Anything else already queued goes in the same write, so can share a packet.
+        for more := true; more && len(batch) < BuzzerMaxBatch; {
+            select {
+            case b := <-this.sends:
+                batch = this.appendMessage(batch, b)
+
+            default:
+                more = false
+            }
+        }
+
+        _, err := this.conn.Write(batch)
         if err != nil {
-            fmt.Printf("Failure to send mode message to buzzer %d, disconnecting\n", this.id)
+            StreamConnect.In(this.room).Printf("Failure to send mode message to buzzer %d, disconnecting\n", this.id)
             this.Disconnect()
             return
         }
@@ -107,6 +360,26 @@ func (this *Buzzer) processOutgoing() {
 
 
 
+// Add the given message to the given batch to send, framing it if need be, and return the extended batch.
+func (this *Buzzer) appendMessage(batch []byte, b []byte) []byte {
+    // Record ping and probe send times as late as possible.
+    switch b[0] {
+    case CmdSyncPing:
+        this.sentLock.Lock()
+        this.syncSent[b[1]] = time.Now().UnixNano() / 1000
+        this.sentLock.Unlock()
+
+    case CmdProbe:
+        this.sentLock.Lock()
+        this.probeSent[b[1]] = time.Now().UnixNano() / 1000
+        this.sentLock.Unlock()
+    }
+
+    if this.framed { batch = append(batch, byte(len(b) >> 8), byte(len(b))) }
+    return append(batch, b...)
+}
+
+
 // Handles incoming requests.
 // Only returns on connection error. Should be called as a Go routine.
 func (this *Buzzer) processIncoming() {
@@ -116,28 +389,114 @@ func (this *Buzzer) processIncoming() {
     // Now process incoming messages forever.
     for {
         // Get the next message byte.
-        b, ok := this.getMessageByte()
+        b, ok := this.nextMessage()
         if !ok { return }
 
-        this.swarm.Received(this.id)
+        recvTime := time.Now()
         msg, _ := this.decodeMessage(b)
+        this.stats.Received(recvTime, msg == MsgHeartbeat)
 
         switch msg {
         case MsgHeartbeat:
             // Nothing to do for a heartbeat.
 
         case MsgButtonPress:
-            // Button press. This needs to be reported.
+            // Untimed button press from a buzzer using the single byte protocol.
+            // The best we can do is to use the time we received it.
             // fmt.Printf("Button press from %s\n", this.ID())
-            this.controller.ButtonPress(this.id)
+            pressTime := time.Now()
+            this.controller.ButtonPress(this.id, pressTime, 0)
+            this.swarm.journal.Press(this.id, pressTime, 0, 0, false)
+
+        case MsgSeqPress:
+            // Sequenced button press. If the buzzer has fallen back to TCP we may already have it via UDP.
+            recvTime := time.Now()
+            payload, ok := this.getMessageBytes(MsgSeqPressSize)
+            if !ok { return }
+
+            if this.newPress(payload[0]) {
+                this.reportPress(payload[1:], recvTime)
+            }
+
+        case MsgSyncPong:
+            // Reply to one of our sync pings.
+            recvTime := time.Now().UnixNano() / 1000
+            payload, ok := this.getMessageBytes(MsgSyncPongSize)
+            if !ok { return }
+
+            this.sentLock.Lock()
+            sendTime := this.syncSent[payload[0]]
+            this.sentLock.Unlock()
+
+            if sendTime != 0 {
+                buzzerRecvTime := int64(binary.BigEndian.Uint64(payload[1:9]))
+                buzzerSendTime := int64(binary.BigEndian.Uint64(payload[9:17]))
+                this.clock.AddSample(sendTime, buzzerRecvTime, buzzerSendTime, recvTime)
+            }
+
+        case MsgProbeReply:
+            // Reply to one of our probes.
+            recvTime := time.Now().UnixNano() / 1000
+            payload, ok := this.getMessageBytes(MsgProbeReplySize)
+            if !ok { return }
+
+            this.sentLock.Lock()
+            sendTime := this.probeSent[payload[0]]
+            this.sentLock.Unlock()
+
+            if sendTime != 0 {
+                this.stats.ProbeReply(time.Duration(recvTime - sendTime) * time.Microsecond)
+            }
+
+        case MsgModeApplied:
+            // Report of when a mode broadcast was applied.
+            payload, ok := this.getMessageBytes(MsgModeAppliedSize)
+            if !ok { return }
+
+            this.reportModeApplied(payload)
+
+        case MsgTelemetry:
+            // Telemetry on the buzzer's health.
+            recvTime := time.Now()
+            payload, ok := this.getMessageBytes(MsgTelemetrySize)
+            if !ok { return }
+
+            this.swarm.Telemetry(this.id, this, ParseTelemetry(payload, recvTime))
+
+        case MsgTrace:
+            // Latency trace we asked for. A count, followed by that many events.
+            count, ok := this.getMessageByte()
+            if !ok { return }
+
+            entries := make([]TraceEntry, count)
+            for i := range entries {
+                payload, ok := this.getMessageBytes(MsgTraceEntrySize)
+                if !ok { return }
+                entries[i] = ParseTraceEntry(payload)
+            }
+
+            PrintTrace(this.room, this.id, entries)
+
+        case MsgOtaStatus:
+            // Progress of a firmware update.
+            payload, ok := this.getMessageBytes(MsgOtaStatusSize)
+            if !ok { return }
+
+            this.swarm.OtaStatus(this.id, this, payload[0], int(binary.BigEndian.Uint32(payload[1:5])))
+
+        case MsgHello:
+            // Hello is only valid during the handshake.
+            if _, ok := this.getMessageBytes(MsgHelloSize); !ok { return }
+            StreamConnect.In(this.room).Printf("Unexpected hello from %s\n", this.ID())
 
         case MsgError:
             // Error message. This needs to be reported.
             // TODO
-            fmt.Printf("Error message received from %s\n", this.ID())
+            StreamConnect.In(this.room).Noisy("error " + this.ID(), "Error message received from %s\n", this.ID())
 
         default:
-            fmt.Printf("Unrecognised message 0x%02X received from %s\n", b, this.ID())
+            StreamConnect.In(this.room).Noisy("unrecognised " + this.ID(),
+                "Unrecognised message 0x%02X received from %s\n", b, this.ID())
         }
     }
 }
@@ -150,39 +509,196 @@ func (this *Buzzer) processHandshake() bool {
     b, ok := this.getMessageByte()
     if !ok { return false }
 
-    this.swarm.Received(this.id)
     msg, value := this.decodeMessage(b)
     if msg != MsgVersion {
-        fmt.Printf("Expected version from new buzzer, got 0x%02X\n", value)
+        StreamConnect.Printf("Expected version from new buzzer, got 0x%02X\n", value)
         return false
     }
 
     this.buzzerVersion = value
 
-    // Next we need an ID.
-    b, ok = this.getMessageByte()
+    var token uint32
+    requested := 0
+    if this.buzzerVersion > BuzzerLegacyVersion {
+        // Everything after the version is framed, starting with a hello giving the ID and resume token.
+        this.framed = true
+        this.id, token, requested, ok = this.processHello()
+    } else {
+        this.id, ok = this.processLegacyHello()
+    }
+
     if !ok { return false }
 
-    msg, value = this.decodeMessage(b)
-    if msg != MsgId {
-        fmt.Printf("Expected ID from new buzzer, got 0x%02X\n", value)
+    // Now we know who this buzzer is, it can join its room.
+    this.room = this.rooms.Assign(this.id, requested)
+    if this.room == nil {
+        StreamConnect.Printf("No room for buzzer %s, disconnecting\n", this.ID())
+        this.Disconnect()
         return false
     }
 
-    this.id = int(value)
+    this.controller = this.room.controller
+    this.swarm = this.room.swarm
 
-    if this.buzzerVersion == BuzzerExpectedVersion {
-        fmt.Printf("Found buzzer %s (v:%d)\n", this.ID(), this.buzzerVersion)
+    if this.buzzerVersion == BuzzerExpectedVersion || this.buzzerVersion == BuzzerLegacyVersion {
+        StreamConnect.In(this.room).Printf("Found buzzer %s (v:%d)\n", this.ID(), this.buzzerVersion)
     } else {
-        fmt.Printf("Found buzzer %s with unexpected version %d\n", this.ID(), this.buzzerVersion)
+        StreamConnect.In(this.room).Printf("Found buzzer %s with unexpected version %d\n", this.ID(),
+            this.buzzerVersion)
+    }
+
+    this.stats = this.swarm.NewBuzzer(this.id, this, token)
+
+    if !this.framed { return true }
+
+    // Select transport. Note that we must register the buzzer with the UDP transport before telling it to use UDP.
+    var transport byte = TransportTcp
+    if this.udp != nil {
+        transport = TransportUdp
+        this.udp.Register(this.id, this)
     }
 
-    this.swarm.NewBuzzer(this.id, this)
+    this.sends <- []byte{CmdTransport, transport}
+    return true
+}
+
+
+// Handle the framed hello message of the handshake.
+// Returns the buzzer's ID, resume token and the room number it asked for, 0 for none, and true on success, false on
+// failure.
+func (this *Buzzer) processHello() (id int, token uint32, room int, ok bool) {
+    b, ok := this.nextMessage()
+    if !ok { return 0, 0, 0, false }
+
+    msg, _ := this.decodeMessage(b)
+    if msg != MsgHello {
+        StreamConnect.Printf("Expected hello from new buzzer, got 0x%02X\n", b)
+        return 0, 0, 0, false
+    }
+
+    payload, ok := this.getMessageBytes(MsgHelloSize)
+    if !ok { return 0, 0, 0, false }
+
+    id = int(binary.BigEndian.Uint16(payload[0:2]))
+    if BuzzerTeam(id) != (id >> BuzzerTeamShift) {
+        StreamConnect.Printf("Buzzer ID 0x%04X from new buzzer out of range\n", id)
+        return 0, 0, 0, false
+    }
+
+    token = binary.BigEndian.Uint32(payload[2:6])
+
+    // The room is an optional extension, which buzzers that don't care about rooms leave out.
+    if this.framePos < this.frameSize {
+        payload, ok = this.getMessageBytes(MsgHelloRoomSize)
+        if !ok { return 0, 0, 0, false }
+        room = int(payload[0])
+    }
+
+    return id, token, room, true
+}
+
+
+// Handle the hello message of the handshake from a buzzer using the single byte protocol.
+// Returns the buzzer's ID, and true on success, false on failure. These buzzers can't resume.
+func (this *Buzzer) processLegacyHello() (id int, ok bool) {
+    b, ok := this.getMessageByte()
+    if !ok { return 0, false }
+
+    msg, value := this.decodeMessage(b)
+    if msg != MsgId {
+        StreamConnect.Printf("Expected ID from new buzzer, got 0x%02X\n", value)
+        return 0, false
+    }
+
+    return BuzzerIdFromLegacy(value), true
+}
 
+
+// Process the given datagram received from this buzzer via UDP.
+// Must only be called from the UDP transport's Go routine.
+func (this *Buzzer) processDatagram(msg []byte, addr *net.UDPAddr, udp *UdpTransport) {
+    recvTime := time.Now()
+    this.stats.Received(recvTime, msg[0] == MsgHeartbeatByte)
+
+    switch msg[0] {
+    case MsgHeartbeatByte:
+        // Nothing to do for a heartbeat.
+
+    case MsgSeqPressByte:
+        // Sequenced press. Always acknowledge, since our last acknowledgement may have been lost.
+        if len(msg) != MsgSeqPressSize + 1 { return }
+
+        udp.SendAck(addr, msg[1])
+        if this.newPress(msg[1]) {
+            this.reportPress(msg[2:], recvTime)
+        }
+
+    case MsgModeAppliedByte:
+        // Report of when a mode broadcast was applied.
+        if len(msg) != MsgModeAppliedSize + 1 { return }
+        this.reportModeApplied(msg[1:])
+
+    default:
+        StreamConnect.In(this.room).Noisy("unrecognised " + this.ID(),
+            "Unrecognised UDP message 0x%02X received from %s\n", msg[0], this.ID())
+    }
+}
+
+
+// Check whether the given press sequence number is for a press we haven't seen yet.
+// May be called from any thread context.
+func (this *Buzzer) newPress(seq byte) bool {
+    this.pressLock.Lock()
+    defer this.pressLock.Unlock()
+
+    if this.anyPress && seq == this.lastPressSeq { return false }  // Duplicate.
+
+    this.anyPress = true
+    this.lastPressSeq = seq
     return true
 }
 
 
+// Report the given timed press to our controller.
+// The payload gives the press time and age, as in a sequenced press message, after its sequence number.
+func (this *Buzzer) reportPress(payload []byte, recvTime time.Time) {
+    deviceTime := int64(binary.BigEndian.Uint64(payload[0:8]))
+    age := time.Duration(binary.BigEndian.Uint32(payload[8:12])) * time.Microsecond
+
+    pressTime, synced := this.clock.ToServerTime(deviceTime)
+    var errorBound time.Duration
+    if synced {
+        errorBound = this.clock.ErrorBound()
+    } else {
+        // We can't convert the buzzer's time yet, so instead we correct our receive time by the age of the press.
+        // This removes any queueing delay in the buzzer, but not network delays.
+        pressTime = recvTime.Add(-age)
+    }
+
+    this.controller.ButtonPress(this.id, pressTime, errorBound)
+
+    // Journal after reporting, so it's never in the way of the press.
+    this.swarm.journal.Press(this.id, pressTime, deviceTime, errorBound, synced)
+}
+
+
+// Report the given mode applied message to our swarm.
+func (this *Buzzer) reportModeApplied(payload []byte) {
+    seq := binary.BigEndian.Uint16(payload[0:2])
+    deviceTime := int64(binary.BigEndian.Uint64(payload[2:10]))
+    applyTime, synced := this.clock.ToServerTime(deviceTime)
+    this.swarm.ModeApplied(this.id, seq, applyTime, synced)
+}
+
+
+// Report the IP address of this buzzer.
+func (this *Buzzer) remoteIP() net.IP {
+    addr, ok := this.conn.RemoteAddr().(*net.TCPAddr)
+    if !ok { return nil }
+    return addr.IP
+}
+
+
 // Decode the given received message byte.
 func (this *Buzzer) decodeMessage(b byte) (msg MsgTypeEnum, param byte) {
     // Check for known messages.
@@ -200,16 +716,49 @@ func (this *Buzzer) decodeMessage(b byte) (msg MsgTypeEnum, param byte) {
         // Button press message.
         return MsgButtonPress, 0
 
-    case b == 0x31:
+    case b == 0x33:
+        // Sync pong message.
+        return MsgSyncPong, 0
+
+    case b == 0x34:
+        // Probe reply message.
+        return MsgProbeReply, 0
+
+    case b == MsgSeqPressByte:
+        // Sequenced button press message.
+        return MsgSeqPress, 0
+
+    case b == MsgModeAppliedByte:
+        // Mode applied message.
+        return MsgModeApplied, 0
+
+    case b == MsgHeartbeatByte:
         // Heartbeat.
         return MsgHeartbeat, 0
 
+    case b == 0x38:
+        // Telemetry message.
+        return MsgTelemetry, 0
+
+    case b == 0x39:
+        // Trace message.
+        return MsgTrace, 0
+
+    case b == 0x3A:
+        // Firmware update status message.
+        return MsgOtaStatus, 0
+
+    case b == 0x3B:
+        // Hello message.
+        return MsgHello, 0
+
     case b == 0x7F:
         // Error message.
         return MsgError, 0
 
     default:
-        fmt.Printf("Unrecognised message 0x%02X from buzzer %s\n", b, this.ID())
+        StreamConnect.In(this.room).Noisy("unrecognised " + this.ID(),
+            "Unrecognised message 0x%02X from buzzer %s\n", b, this.ID())
         return MsgUnknown, b
     }
 }
@@ -219,22 +768,115 @@ const (
     MsgId
     MsgHeartbeat
     MsgButtonPress
+    MsgSeqPress
+    MsgSyncPong
+    MsgProbeReply
+    MsgModeApplied
+    MsgTelemetry
+    MsgTrace
+    MsgOtaStatus
+    MsgHello
     MsgError
     MsgUnknown
 )
 
 type MsgTypeEnum int
 
+// Number of parameter bytes following multi byte message types.
+const (
+    MsgSyncPongSize = 17
+    MsgProbeReplySize = 1
+    MsgSeqPressSize = 13
+    MsgModeAppliedSize = 10
+    MsgTelemetrySize = 18
+    MsgTraceEntrySize = 10  // Per event, after the count.
+    MsgOtaStatusSize = 5
+    MsgHelloSize = 6
+    MsgHelloRoomSize = 1  // Optional, after the rest of the hello.
+)
+
+// Message bytes that may be received via UDP.
+const (
+    MsgHeartbeatByte = 0x31
+    MsgSeqPressByte = 0x35
+    MsgModeAppliedByte = 0x36
+)
+
+
+// Get the next incoming message, waiting until one is received, and return its message byte.
+// For framed buzzers the whole message is received, and its parameters are then read from it.
+func (this *Buzzer) nextMessage() (b byte, ok bool) {
+    if !this.framed { return this.getMessageByte() }
+
+    // The size is read into the frame buffer too, since anything else would be allocated.
+    if _, err := io.ReadFull(this.reader, this.frame[:2]); err != nil {
+        StreamConnect.In(this.room).Printf("Failure receiving from %s\n", this.ID())
+        this.Disconnect()
+        return 0, false
+    }
+
+    this.frameSize = int(binary.BigEndian.Uint16(this.frame[:2]))
+    if this.frameSize == 0 || this.frameSize > BuzzerMaxFrame {
+        StreamConnect.In(this.room).Printf("Bad message size %d from %s, disconnecting\n", this.frameSize, this.ID())
+        this.Disconnect()
+        return 0, false
+    }
+
+    if _, err := io.ReadFull(this.reader, this.frame[:this.frameSize]); err != nil {
+        StreamConnect.In(this.room).Printf("Failure receiving from %s\n", this.ID())
+        this.Disconnect()
+        return 0, false
+    }
+
+    this.framePos = 1
+    return this.frame[0], true
+}
 
-// Get the next incoming message, waiting until one is received.
+
+// Get the next parameter byte for the current message, waiting until it is received.
 func (this *Buzzer) getMessageByte() (b byte, ok bool) {
+    if this.framed {
+        payload, ok := this.getMessageBytes(1)
+        if !ok { return 0, false }
+        return payload[0], true
+    }
+
     // Get the next message byte.
-    _, err := this.conn.Read(this.buffer)
+    b, err := this.reader.ReadByte()
     if err != nil {
-        fmt.Printf("Failure receiving from %s\n", this.ID())
+        StreamConnect.In(this.room).Printf("Failure receiving from %s\n", this.ID())
         this.Disconnect()
         return 0, false
     }
 
-    return this.buffer[0], true
+    return b, true
+}
+
+
+// Get the given number of parameter bytes for the current message, waiting until they are all received.
+// For framed buzzers any parameters beyond those read are ignored, so messages can be extended later.
+// The bytes returned are only valid until the next call.
+func (this *Buzzer) getMessageBytes(count int) (b []byte, ok bool) {
+    if this.framed {
+        if this.framePos + count > this.frameSize {
+            StreamConnect.In(this.room).Printf("Message 0x%02X from %s too short, disconnecting\n", this.frame[0],
+                this.ID())
+            this.Disconnect()
+            return nil, false
+        }
+
+        b = this.frame[this.framePos:this.framePos + count]
+        this.framePos += count
+        return b, true
+    }
+
+    b = this.payload[:count]
+    _, err := io.ReadFull(this.reader, b)
+    if err != nil {
+        StreamConnect.In(this.room).Printf("Failure receiving from %s\n", this.ID())
+        this.Disconnect()
+        return nil, false
+    }
+
+    return b, true
 }
@@ -0,0 +1,87 @@
+/* Tests for the buzzer protocol framing and IDs, using the fake buzzers from replay_test.go. */
+
+package main
+
+import "encoding/binary"
+import "testing"
+import "time"
+
+
+// Check buzzers using the single byte protocol work alongside framed ones, with their IDs converted.
+func TestLegacyAlongsideFramed(t *testing.T) {
+    rig := createMixedRig(t, nil, []int{0x001, 0x101}, []int{0x201, 0x30F})
+    defer rig.Close()
+
+    for _, id := range []int{0x30F, 0x101} {
+        rig.Ask(0x0F)
+        rig.buzzers[id].Press(0)
+
+        if winner := rig.WaitDecision(); winner != id {
+            t.Errorf("Winner %s, expected %s", BuzzerIdToString(winner), BuzzerIdToString(id))
+        }
+
+        rig.controller.commandIdle()
+    }
+}
+
+
+// Check framed buzzers can have IDs and teams beyond those of the single byte protocol.
+func TestWideIds(t *testing.T) {
+    rig := createRig(t, 0x0C8, 0x905)
+    defer rig.Close()
+
+    if s := BuzzerIdToString(0x905); s != "M5" { t.Errorf("ID 0x905 printed as %s, expected M5", s) }
+
+    base := time.Now()
+    winner := rig.Replay(replayQuestion{
+        armTeams: 1 << 9 | 1,
+        presses: []replayPress{
+            { 0x0C8, base.Add(2 * time.Millisecond), 0 },
+            { 0x905, base.Add(1 * time.Millisecond), 0 },
+        },
+    })
+
+    if winner != 0x905 { t.Errorf("Winner %s, expected M5", BuzzerIdToString(winner)) }
+}
+
+
+// Check several framed messages in one write are all handled, skipping any we don't know and any extra parameters.
+func TestBatchedFrames(t *testing.T) {
+    rig := createRig(t, 0x001, 0x101)
+    defer rig.Close()
+
+    rig.Ask(0x0F)
+
+    press := make([]byte, 1 + MsgSeqPressSize)
+    press[0] = MsgSeqPressByte
+    press[1] = 1
+    binary.BigEndian.PutUint64(press[2:10], uint64(time.Now().UnixNano() / 1000))
+    press = append(press, 0xAA, 0xBB)  // Extra parameters from some later version.
+
+    var batch []byte
+    for _, msg := range [][]byte{ {MsgHeartbeatByte}, {0x3F, 1, 2, 3}, press, {MsgHeartbeatByte} } {
+        batch = append(batch, byte(len(msg) >> 8), byte(len(msg)))
+        batch = append(batch, msg...)
+    }
+
+    rig.buzzers[0x101].sendRaw(batch)
+
+    if winner := rig.WaitDecision(); winner != 0x101 {
+        t.Errorf("Winner %s, expected G1", BuzzerIdToString(winner))
+    }
+}
+
+
+// Check our legacy ID conversions match the single byte protocol's layout.
+func TestLegacyIdConversion(t *testing.T) {
+    for legacy := 0; legacy < 0x80; legacy++ {
+        id := BuzzerIdFromLegacy(byte(legacy))
+        back, ok := BuzzerIdToLegacy(id)
+        if !ok || int(back) != legacy {
+            t.Errorf("Legacy ID 0x%02X became %s, then 0x%02X", legacy, BuzzerIdToString(id), back)
+        }
+    }
+
+    if _, ok := BuzzerIdToLegacy(0x010); ok { t.Errorf("ID B16 converted to a legacy ID") }
+    if _, ok := BuzzerIdToLegacy(0x801); ok { t.Errorf("ID C1 converted to a legacy ID") }
+}
@@ -0,0 +1,198 @@
+/* Functions for synchronising with buzzer clocks.
+
+Each buzzer timestamps its button presses using its own clock, which counts microseconds since it booted. To compare
+presses from different buzzers we need to convert these to our own time.
+
+We do this with NTP style pings. We send a ping at t1 (our time), the buzzer receives it at t2 and replies at t3 (its
+time), and we receive the reply at t4 (our time). Assuming the network delay is the same in each direction, the
+buzzer's clock offset is ((t2 - t1) + (t3 - t4)) / 2 and the error in that is at most half the round trip time.
+
+WIFI delays are very variable, so we keep a window of recent samples and only use those with close to the minimum
+round trip time. Buzzer clocks also drift relative to ours, so we fit a straight line through the good samples to get
+both the offset and the drift.
+
+All times here are in microseconds. Server times are since the Unix epoch, buzzer times are since the buzzer booted.
+
+*/
+
+package main
+
+import "fmt"
+import "math"
+import "sync"
+import "time"
+
+
+// External interface.
+
+// Create a clock sync object for a new buzzer connection.
+func CreateClockSync() *ClockSync {
+    var p ClockSync
+    return &p
+}
+
+
+// Add the given ping sample.
+// t1 and t4 are our send and receive times, t2 and t3 are the buzzer's receive and send times.
+// May be called from any thread context.
+func (this *ClockSync) AddSample(t1 int64, t2 int64, t3 int64, t4 int64) {
+    rtt := (t4 - t1) - (t3 - t2)
+    if rtt < 0 { return }  // Nonsense, ignore.
+
+    this.lock.Lock()
+    defer this.lock.Unlock()
+
+    this.samples[this.next] = clockSample{
+        deviceTime: (t2 + t3) / 2,
+        offset: float64((t2 - t1) + (t3 - t4)) / 2,
+        rtt: rtt,
+    }
+
+    this.next = (this.next + 1) % clockSampleCount
+    if this.count < clockSampleCount { this.count++ }
+
+    this.update()
+}
+
+
+// Convert the given buzzer time to our time.
+// Returns false if we have no sync information yet.
+// May be called from any thread context.
+func (this *ClockSync) ToServerTime(deviceTime int64) (serverTime time.Time, ok bool) {
+    this.lock.Lock()
+    defer this.lock.Unlock()
+
+    if this.count == 0 { return time.Time{}, false }
+
+    offset := this.offset + (this.drift * float64(deviceTime - this.refDeviceTime))
+    serverUs := deviceTime - int64(math.Round(offset))
+    return time.Unix(0, serverUs * 1000), true
+}
+
+
+// Report our error bound, ie how far out a converted time could be.
+// Returns 0 if we have no sync information yet.
+// May be called from any thread context.
+func (this *ClockSync) ErrorBound() time.Duration {
+    this.lock.Lock()
+    defer this.lock.Unlock()
+
+    if this.count == 0 { return 0 }
+    return this.errorBound
+}
+
+
+// Describe the sync quality, for stats purposes.
+// May be called from any thread context.
+func (this *ClockSync) String() string {
+    this.lock.Lock()
+    defer this.lock.Unlock()
+
+    if this.count == 0 { return "unsynced" }
+
+    return fmt.Sprintf("err %6.3fms drift %6.1fppm rtt %6.3fms (%2d/%2d)",
+        float64(this.errorBound) / 1e6, this.drift * 1e6, float64(this.minRtt) / 1e3, this.goodCount, this.count)
+}
+
+
+// Clock sync for one buzzer connection.
+type ClockSync struct {
+    lock sync.Mutex  // Samples are added from the buzzer's Go routine, but read from others.
+    samples [clockSampleCount]clockSample  // Circular buffer.
+    next int  // Index to write next sample to.
+    count int  // Number of valid samples.
+
+    // Current model, buzzer offset = offset + (drift * (buzzer time - refDeviceTime)).
+    offset float64
+    drift float64
+    refDeviceTime int64
+    minRtt int64
+    goodCount int  // Number of samples used for the current model.
+    errorBound time.Duration
+}
+
+
+// Internals.
+
+const (
+    clockSampleCount = 64  // Number of samples over which we estimate.
+    clockMinDriftSpan = 10000000  // Minimum span of samples, in us, before we try to estimate drift.
+    clockMaxDrift = 200e-6  // Drift can't be more than this, anything bigger is noise.
+)
+
+// A single ping sample.
+type clockSample struct {
+    deviceTime int64  // Buzzer time at the middle of the ping.
+    offset float64  // Buzzer time - our time.
+    rtt int64
+}
+
+
+// Recalculate our model from our current samples.
+// Must be called with our lock held.
+func (this *ClockSync) update() {
+    // Find minimum round trip time.
+    this.minRtt = math.MaxInt64
+    for i := 0; i < this.count; i++ {
+        if this.samples[i].rtt < this.minRtt {
+            this.minRtt = this.samples[i].rtt
+        }
+    }
+
+    // Samples with round trip times near the minimum are the good ones.
+    threshold := this.minRtt + (this.minRtt / 2)
+    if threshold < this.minRtt + 200 { threshold = this.minRtt + 200 }
+
+    // Fit a line through the good samples.
+    var sumD, sumO float64
+    minD := int64(math.MaxInt64)
+    maxD := int64(math.MinInt64)
+    n := 0
+
+    for i := 0; i < this.count; i++ {
+        s := &this.samples[i]
+        if s.rtt > threshold { continue }
+
+        sumD += float64(s.deviceTime)
+        sumO += s.offset
+        if s.deviceTime < minD { minD = s.deviceTime }
+        if s.deviceTime > maxD { maxD = s.deviceTime }
+        n++
+    }
+
+    meanD := sumD / float64(n)
+    meanO := sumO / float64(n)
+
+    var covDO, varD float64
+    for i := 0; i < this.count; i++ {
+        s := &this.samples[i]
+        if s.rtt > threshold { continue }
+
+        d := float64(s.deviceTime) - meanD
+        covDO += d * (s.offset - meanO)
+        varD += d * d
+    }
+
+    drift := 0.0
+    if (maxD - minD) >= clockMinDriftSpan && varD > 0 {
+        drift = covDO / varD
+        drift = math.Max(-clockMaxDrift, math.Min(clockMaxDrift, drift))
+    }
+
+    this.refDeviceTime = int64(meanD)
+    this.offset = meanO
+    this.drift = drift
+    this.goodCount = n
+
+    // Our error is bounded by half the round trip time, plus however far the good samples stray from our line.
+    maxResidual := 0.0
+    for i := 0; i < this.count; i++ {
+        s := &this.samples[i]
+        if s.rtt > threshold { continue }
+
+        residual := math.Abs(s.offset - (meanO + (drift * (float64(s.deviceTime) - meanD))))
+        maxResidual = math.Max(maxResidual, residual)
+    }
+
+    this.errorBound = time.Duration((float64(this.minRtt) / 2) + maxResidual) * time.Microsecond
+}
@@ -0,0 +1,80 @@
+/* Tests for clock sync, using synthetic pings to a buzzer whose clock has a known offset and drift. */
+
+package main
+
+import "math"
+import "testing"
+import "time"
+
+
+// Check the offset and drift fitted through synthetic pings, and the conversions they give.
+func TestClockSync(t *testing.T) {
+    tests := []struct {
+        name string
+        drift float64  // Of the buzzer's clock.
+        span time.Duration  // Over which pings are sent.
+        slowEvery int  // Every this many pings is delayed on its way back, so has a long round trip. 0 for none.
+        expectedDrift float64  // That we should fit.
+    }{
+        { "no drift", 0, 30 * time.Second, 0, 0 },
+        { "drift", 50e-6, 30 * time.Second, 0, 50e-6 },
+        { "drift, short span", 50e-6, 5 * time.Second, 0, 0 },
+        { "drift, just long enough span", 50e-6, 11 * time.Second, 0, 50e-6 },
+        { "drift, noisy", -80e-6, 30 * time.Second, 3, -80e-6 },
+        { "drift above clamp", 500e-6, 30 * time.Second, 0, clockMaxDrift },
+        { "drift below clamp", -500e-6, 30 * time.Second, 0, -clockMaxDrift },
+    }
+
+    const delay = 2000  // One way network delay, in us.
+    const slowDelay = 30000  // Extra delay of slow replies, in us.
+    const turnaround = 100  // Buzzer time between receiving a ping and replying, in us.
+    const offset = 5000000  // Buzzer time at serverBase, in us.
+    serverBase := time.Now().UnixNano() / 1000
+
+    for _, test := range tests {
+        // The buzzer's clock, for the given server time.
+        device := func(server int64) int64 {
+            return offset + int64(math.Round(float64(server - serverBase) * (1 + test.drift)))
+        }
+
+        sync := CreateClockSync()
+        if _, ok := sync.ToServerTime(0); ok { t.Errorf("%s: converted time before any pings", test.name) }
+
+        pings := clockSampleCount
+        interval := int64(test.span / time.Microsecond) / int64(pings - 1)
+        for i := 0; i < pings; i++ {
+            t1 := serverBase + (int64(i) * interval)
+            t2 := device(t1 + delay)
+            t3 := t2 + turnaround
+            back := int64(delay)
+            if test.slowEvery != 0 && (i % test.slowEvery) == 0 { back += slowDelay }
+            t4 := t1 + delay + turnaround + back
+            sync.AddSample(t1, t2, t3, t4)
+        }
+
+        if math.Abs(sync.drift - test.expectedDrift) > 1e-6 {
+            t.Errorf("%s: drift %.1fppm, expected %.1fppm", test.name, sync.drift * 1e6, test.expectedDrift * 1e6)
+        }
+
+        // With the buzzer's drift fitted, the error bound is half the round trip, and conversions are good to within it
+        // anywhere in the span. Otherwise the bound is wider, and conversions are only good in the middle.
+        bound := sync.ErrorBound()
+        fitted := (test.expectedDrift == test.drift)
+        if fitted && (bound < delay * time.Microsecond || bound > (delay + 100) * time.Microsecond) {
+            t.Errorf("%s: error bound %v, expected about %dus", test.name, bound, delay)
+        }
+
+        checks := []int64{int64(test.span / time.Microsecond) / 2}
+        if fitted { checks = append(checks, 0, int64(test.span / time.Microsecond)) }
+
+        for _, at := range checks {
+            server := serverBase + at
+            converted, ok := sync.ToServerTime(device(server))
+            if !ok { t.Fatalf("%s: cannot convert time", test.name) }
+
+            if err := converted.Sub(time.Unix(0, server * 1000)); err < -bound || err > bound {
+                t.Errorf("%s: time %dus into span converted %v out, error bound %v", test.name, at, err, bound)
+            }
+        }
+    }
+}
@@ -1,7 +1,8 @@
 /* Functions to handle console commands.
 
 At any time the user can enter commands at the console. These are parsed according to preset schema and cause
-functions to be executed
+functions to be executed. Each room has its own command processor, and the console picks which each line goes to, see
+room.go.
 
 Each command is made up of a fixed string followed by simple lexical tokens, some of which produce a value. The
 tokens are:
@@ -11,6 +12,7 @@ tokens are:
   * Team identifier. Team ID.
   * Buzzer identifier. Buzzer ID.
   * Got. No value.
+  * Team list. Any number of team identifiers, to the end of the line, which may be none. Bitmask of team IDs.
 
 Whitespace between tokens is permitted and ignored, but not required.
 
@@ -24,16 +26,11 @@ superstring of the initial string of an earlier command.
 
 package main
 
-import "bufio"
-import "fmt"
-import "os"
 import "strings"
 
 
 // Create a command processor.
 func CreateCommandProcessor() *CommandProcessor {
-    fmt.Printf("? to show usage\n")
-
     var p CommandProcessor
     p.commands = make([]*cmdInfo, 0)
 
@@ -63,6 +60,7 @@ const (
     LEX_TEAM
     LEX_BUZ_ID
     LEX_DOT
+    LEX_TEAMS
 )
 
 type LexType int
@@ -74,7 +72,7 @@ type CmdFn func(values ...int)
 
 // Print a usage message for our commands.
 func (this *CommandProcessor) Usage(values ...int) {
-    fmt.Printf("Usage:\n")
+    StreamInput.Printf("Usage:\n")
 
     for _, cmd := range this.commands {
         s := cmd.initialString
@@ -86,27 +84,11 @@ func (this *CommandProcessor) Usage(values ...int) {
             case LEX_TEAM:    s += " {team_id}"
             case LEX_BUZ_ID:  s += " {buzzer_id}"
             case LEX_DOT:     s += "."
+            case LEX_TEAMS:   s += " {team_ids}"
             }
         }
 
-        fmt.Printf("  %s %s\n", s, cmd.helpText)
-    }
-}
-
-
-// Read stdin and process all resulting commands.
-// Never returns.
-func (this *CommandProcessor) ProcessStdin() {
-    stdin := bufio.NewReader(os.Stdin)
-
-    for {
-        text, _ := stdin.ReadString('\n')
-        text = strings.TrimSpace(text)
-
-        // Ignore blank lines.
-        if text != "" {
-            this.process(text)
-        }
+        StreamInput.Printf("  %s %s\n", s, cmd.helpText)
     }
 }
 
@@ -147,7 +129,7 @@ func (this *CommandProcessor) process(cmdLine string) {
         }
     }
 
-    fmt.Printf("Unrecognised command\n")
+    StreamInput.Printf("Unrecognised command\n")
 }
 
 
@@ -165,8 +147,24 @@ func (this *cmdInfo) match(cmdLine string) (values []int, match bool) {
 
     for _, token := range this.lexTokens {
         cmdLine = strings.TrimLeft(cmdLine, " ")
+
+        if token == LEX_TEAMS {
+            // Take team identifiers until the end of the line. There may be none.
+            teams := 0
+            for cmdLine != "" {
+                team, ok := expectTeam(&cmdLine, "team")
+                if !ok { return nil, true }  // Error already reported.
+
+                teams |= 1 << uint(team)
+                cmdLine = strings.TrimLeft(cmdLine, " ")
+            }
+
+            values = append(values, teams)
+            continue
+        }
+
         if cmdLine == "" {
-            fmt.Printf("Bad command, unexpected termination\n")
+            StreamInput.Printf("Bad command, unexpected termination\n")
             return nil, true
         }
 
@@ -186,7 +184,7 @@ func (this *cmdInfo) match(cmdLine string) (values []int, match bool) {
             values = append(values, digitValue)
 
         case LEX_TEAM:
-            // Just take the next character, which must be a team identifier, ie B, G, R or Y.
+            // Just take the next character, which must be a team identifier, eg B, G, R or Y.
             team, ok := expectTeam(&cmdLine, "team")
             if !ok { return nil, true }  // Error already reported.
             values = append(values, team)
@@ -200,7 +198,12 @@ func (this *cmdInfo) match(cmdLine string) (values []int, match bool) {
             value, ok := expectUint(&cmdLine, "buzzer")
             if !ok { return nil, true }  // Error already reported.
 
-            buzzer := (16 * team) + value
+            if value >= MaxTeamBuzzers {
+                StreamInput.Printf("Bad command, buzzer number %d too big\n", value)
+                return nil, true
+            }
+
+            buzzer := (team << BuzzerTeamShift) | value
             values = append(values, buzzer)
 
         case LEX_DOT:
@@ -231,7 +234,7 @@ func expectUint(cmdLine *string, expected string) (value int, ok bool) {
 
     // Check we found any valid digits.
     if digitCount == 0 {
-        fmt.Printf("Bad command, expected %s, got \"%s\"\n", expected, (*cmdLine)[0:1])
+        StreamInput.Printf("Bad command, expected %s, got \"%s\"\n", expected, (*cmdLine)[0:1])
         return 0, false
     }
 
@@ -249,7 +252,7 @@ func expectChar(cmdLine *string, expected string, min byte, max byte) (char byte
     char = (*cmdLine)[0]
 
     if (char < min) || (char > max) {
-        fmt.Printf("Bad command, expected %s, got \"%s\"\n", expected, (*cmdLine)[0:1])
+        StreamInput.Printf("Bad command, expected %s, got \"%s\"\n", expected, (*cmdLine)[0:1])
         return 0, false
     }
 
@@ -266,7 +269,7 @@ func expectTeam(cmdLine *string, expected string) (team int, ok bool) {
     team, ok = decodeTeam(id)
 
     if !ok {
-        fmt.Printf("Bad command, expected %s, got \"%s\"\n", expected, id)
+        StreamInput.Printf("Bad command, expected %s, got \"%s\"\n", expected, id)
         return 0, false
     }
 
@@ -277,15 +280,11 @@ func expectTeam(cmdLine *string, expected string) (team int, ok bool) {
 
 // Decode the given string into a team number.
 func decodeTeam(id string) (team int, ok bool) {
-    switch id {
-    case "b", "B":  return 0, true  // Blue.
-    case "g", "G":  return 1, true  // Green.
-    case "r", "R":  return 2, true  // Red.
-    case "y", "Y":  return 3, true  // Yellow.
-
-    default:
-        // Unrecognised team ID.
-        return 0, false
+    for team, letter := range _teamLetters {
+        if strings.EqualFold(id, letter) { return team, true }
     }
+
+    // Unrecognised team ID.
+    return 0, false
 }
 
@@ -0,0 +1,32 @@
+/* Tests for console command parsing. */
+
+package main
+
+import "testing"
+
+
+// Check no command's name is another's followed by a team letter, so teams and commands can't be mistaken for each
+// other.
+func TestTeamLettersUnambiguous(t *testing.T) {
+    rig := createRig(t)
+    defer rig.Close()
+
+    commands := rig.rooms.rooms[0].cmdProc.commands
+    for _, command := range commands {
+        if len(command.lexTokens) == 0 { continue }
+
+        first := command.lexTokens[0]
+        if first != LEX_TEAM && first != LEX_BUZ_ID && first != LEX_TEAMS { continue }
+
+        for _, other := range commands {
+            name := other.initialString
+            if len(name) <= len(command.initialString) || name[:len(command.initialString)] != command.initialString {
+                continue
+            }
+
+            if _, ok := decodeTeam(name[len(command.initialString):][:1]); ok {
+                t.Errorf("Command \"%s\" could be \"%s\" with a team", name, command.initialString)
+            }
+        }
+    }
+}
@@ -6,66 +6,130 @@ the answer given was correct or not. If it was correct, the answering team is gi
 the buzzers are asked again, but the team that gave the incorrect answer may not answer again. If a second team
 answers incorrectly, they also may not answer, and so on.
 
+Presses don't necessarily reach us in the order they were made, due to WIFI retransmits, buffering, etc. To be fair,
+each press carries the time it was made, converted to our time using the buzzer's clock sync, and, if an arbitration
+window is set, we wait that long after the first press before picking the earliest. The winning margin is reported,
+along with how accurate the clock sync was, to settle any disputes.
+
+While waiting for an answer, buzzers of teams allowed to answer are armed. An armed buzzer latches the first press
+and lights its own LED immediately, without waiting for us. We remain the authority on who won, so once we've decided
+we confirm the winner and cancel everyone else.
+
+Presses from other teams still allowed to answer are kept, ranked by press time, rather than thrown away. If an answer
+is wrong, the question passes straight to the next ranked team, without anyone having to press again. Only once no
+ranked presses are left are the buzzers armed again.
+
+In a bonus round every team answers. Each team's first press locks in that team, in parallel, and the order teams
+locked in is reported. The quizmaster then marks all the teams that were right with a single command, and the points,
+including double marks, are added to the scoreboard in one go.
+
+Button presses arrive on their own channel, which is always checked before other requests, so a backlog of other
+traffic can't delay them.
+
 */
 
 package main
 
 import "fmt"
+import "quiz/journal"
+import "sort"
+import "time"
 
 
-// Create a scoreboard.
-func CreateController(cmdProc *CommandProcessor, scoreboard *Scoreboard) *Controller {
+// Create a controller for the given room.
+// State changes are recorded in the room's journal, if it has one.
+func CreateController(room *Room, scoreboard *Scoreboard) *Controller {
     var p Controller
+    p.room = room
+    p.journal = room.journal
     p.state = ConStIdle
     p.scoreboard = scoreboard
+    p.arbWindow = DefaultArbitrationWindow
     p.requests = make(chan func(), 1000)
+    p.presses = make(chan buttonPress, 1000)
 
+    cmdProc := room.cmdProc
     cmdProc.AddCommand(p.commandIdle, "Enter idle mode", "idle")
     cmdProc.AddCommand(p.commandTest, "Enter test mode", "test")
     cmdProc.AddCommand(p.commandAskNoDouble, "Ask a question with no double marks", "qn")
     cmdProc.AddCommand(p.commandAsk, "Ask a question with double marks for the specified team", "q", LEX_TEAM)
+    cmdProc.AddCommand(p.commandBonusNoDouble, "Ask a bonus question with no double marks", "bonusn")
+    cmdProc.AddCommand(p.commandBonus, "Ask a bonus question with double marks for the specified team", "bonus",
+        LEX_TEAM)
+    cmdProc.AddCommand(p.commandBonusMark, "Mark the specified teams as right for the bonus question", "b",
+        LEX_TEAMS)
     cmdProc.AddCommand(p.commandCorrect, "The last answer given was correct", "y")
     cmdProc.AddCommand(p.commandIncorrect, "The last answer given was wrong", "n")
+    cmdProc.AddCommand(p.commandWindow, "Set answer arbitration window in ms, 0 to take first press received",
+        "window", LEX_UINT)
 
     return &p
 }
 
 
-// Set the swarm for this controller and start processing.
-func (this *Controller) Run(swarm *Swarm) {
+// Set the swarm and firmware updater for this controller and start processing.
+// Firmware updates are paused while a question is open. The updater may be nil.
+func (this *Controller) Run(swarm *Swarm, ota *Ota) {
     this.swarm = swarm
+    this.ota = ota
     go this.run()
 }
 
 
 // Receive a button press from the specified buzzer.
-func (this *Controller) ButtonPress(buzzerId int) {
-    this.requests <- func() {
-        // What we do depends on our current state.
-        switch this.state {
-        case ConStTest:
-            this.testPress(buzzerId)
+// The press time is our best estimate of when the button was pressed, in our own time, and the error bound is how far
+// out that could be. An error bound of 0 means unknown.
+func (this *Controller) ButtonPress(buzzerId int, pressTime time.Time, errorBound time.Duration) {
+    this.presses <- buttonPress{buzzerId, pressTime, errorBound, time.Now()}
+}
 
-        case ConStAsked:
-            this.recvAnswer(buzzerId)
 
-        default:
-            // In all other modes we can ignore button presses.
+// Take a copy of our metrics. Returns false if we're too busy to answer.
+// May be called from any thread context.
+func (this *Controller) Metrics() (controllerMetrics, bool) {
+    response := make(chan controllerMetrics, 1)
+
+    this.requests <- func() {
+        response <- controllerMetrics{
+            state: this.state,
+            pressToDecision: this.pressToDecision,
+            receiveToDecision: this.receiveToDecision,
         }
     }
+
+    select {
+    case m := <-response:
+        return m, true
+
+    case <-time.After(MetricsTimeout):
+        return controllerMetrics{}, false
+    }
 }
 
 
 // Quiz controller.
 type Controller struct {
+    room *Room
     state ConStTypeEnum
     testState map[int]bool  // Buzzer state when in test mode. Buzzer ID => on state.
     swarm *Swarm
+    ota *Ota  // nil for none.
     scoreboard *Scoreboard
+    journal *journal.Writer  // nil for none.
     doubleTeam int  // The ID of the team that scores double for the current question. <0 for none.
     lastAnswerTeam int  // ID of the team that last answered a question.
+    lastAnswerBuzzer int  // ID of the buzzer that last answered a question.
     teamsAllowed []bool  // Whether each team is allowed to answer. Indexed by team ID.
-    presses chan int  // BUtton presses received from buzzers. Value sent is buzzer ID.
+    arbWindow time.Duration  // How long to wait after the first press for earlier presses. 0 for no waiting.
+    candidates []buttonPress  // Presses received within the current arbitration window.
+    ranked []buttonPress  // Next teams to answer, in press time order. At most one press per team.
+    bonusPending [][]buttonPress  // Presses from each team in a bonus round, until it locks in. Indexed by team ID.
+    bonusPendingCount int  // Total number of presses in bonusPending.
+    bonusLocked []buttonPress  // Press that locked in each team in a bonus round. Indexed by team ID.
+    arbGeneration int  // Incremented on each state change, to spot stale arbitration timers.
+    pressToDecision Histogram  // Time from each winning press to our decision.
+    receiveToDecision Histogram  // Time from receiving the first press of each question to our decision.
+    presses chan buttonPress  // Button presses received from buzzers, handled ahead of requests.
     requests chan func()  // All requests are handling in the central Go routine.
 }
 
@@ -77,17 +141,49 @@ const (
     ConStTest  // Testing buzzers.
     ConStAsked  // Question has been asked, waiting for an answer.
     ConStAnswered  // Answer has been given.
+    ConStBonus  // Bonus question has been asked, all teams may answer.
 )
 
 type ConStTypeEnum int
 
+// Default arbitration window.
+const (
+    DefaultArbitrationWindow = 50 * time.Millisecond
+)
+
+// Heartbeat periods for our states, other than the default.
+const (
+    IdleHeartbeat = 3 * time.Second
+    AskedHeartbeat = 150 * time.Millisecond
+)
+
+// A button press received from a buzzer.
+type buttonPress struct {
+    buzzerId int
+    pressTime time.Time
+    errorBound time.Duration  // 0 for unknown.
+    received time.Time  // When we received the press.
+}
+
 
 // Handles requests in a single thread.
 // Never returns. Should be called as a Go routine.
 func (this *Controller) run() {
     // Process incoming messages forever.
     for {
+        // Presses take priority over everything else.
+        select {
+        case press := <-this.presses:
+            this.handlePress(press)
+            continue
+
+        default:
+        }
+
         select {
+        case press := <-this.presses:
+            this.handlePress(press)
+
         case request := <-this.requests:
             request()
         }
@@ -95,38 +191,101 @@ func (this *Controller) run() {
 }
 
 
+// Handle a button press.
+func (this *Controller) handlePress(press buttonPress) {
+    // What we do depends on our current state.
+    switch this.state {
+    case ConStTest:
+        this.testPress(press.buzzerId)
+
+    case ConStAsked:
+        this.recvAnswer(press)
+
+    case ConStAnswered:
+        // Another team may still get to answer, if this one is wrong.
+        if this.teamsAllowed[BuzzerTeam(press.buzzerId)] { this.rankPress(press) }
+
+    case ConStBonus:
+        this.recvBonusAnswer(press)
+
+    default:
+        // In all other modes we can ignore button presses.
+    }
+}
+
+
 // Transition to the specified state.
 func (this *Controller) changeState(newState ConStTypeEnum) {
     // We always need to disable outputs for all buzzers.
 
 
+    // Any arbitration in progress is abandoned, as are ranked presses.
+    this.arbGeneration++
+    this.candidates = nil
+    this.ranked = nil
+    this.journal.State(int(newState))
+
     // What to do depends on the state we're going into.
     switch newState {
     case ConStIdle:
-        fmt.Printf("Idle mode\n")
+        StreamControl.In(this.room).Printf("Idle mode\n")
         this.swarm.SetModeAll(false, false)
+        this.swarm.SetRadioAll(false)
+        this.swarm.SetHeartbeatAll(IdleHeartbeat)
 
     case ConStTest:
         // Reset buzzer states.
-        fmt.Printf("Test mode\n")
+        StreamControl.In(this.room).Printf("Test mode\n")
         this.testState = make(map[int]bool)
         this.swarm.SetModeAll(false, false)
+        this.swarm.SetHeartbeatAll(DefaultHeartbeat)
 
     case ConStAsked:
-        fmt.Printf("Waiting for button answer\n")
-        this.swarm.SetModeAll(false, false)
+        // Buzzers that may answer are armed, so players see their press straight away.
+        this.warnSuspects()
+        StreamControl.In(this.room).Printf("Waiting for button answer\n")
+        this.swarm.ArmAll(this.teamsAllowed)
+        this.swarm.SetRadioAll(true)
+        this.swarm.SetHeartbeatAll(AskedHeartbeat)
 
     case ConStAnswered:
         // Nothing to do.
 
+    case ConStBonus:
+        // As for a normal question, except that every team gets to answer.
+        this.warnSuspects()
+        StreamControl.In(this.room).Printf("Waiting for bonus answers\n")
+        this.bonusPending = make([][]buttonPress, MaxTeams)
+        this.bonusPendingCount = 0
+        this.bonusLocked = make([]buttonPress, MaxTeams)
+        for team := range this.bonusLocked { this.bonusLocked[team].buzzerId = -1 }
+        this.swarm.ArmAll(this.teamsAllowed)
+        this.swarm.SetRadioAll(true)
+        this.swarm.SetHeartbeatAll(AskedHeartbeat)
+
     default:
         // Nothing to do in any other states.
     }
 
+    // Firmware updates would get in the way of answers, and stall the buzzers.
+    this.ota.SetPaused(newState == ConStAsked || newState == ConStAnswered || newState == ConStBonus)
     this.state = newState
 }
 
 
+// Warn about any buzzers in teams that may answer that look unhealthy, since their presses may not get through.
+func (this *Controller) warnSuspects() {
+    warning := ""
+    for _, id := range this.swarm.Suspects() {
+        if this.teamsAllowed[BuzzerTeam(id)] { warning += " " + BuzzerIdToString(id) }
+    }
+
+    if warning != "" {
+        StreamControl.In(this.room).Printf("Warning, buzzers may not be working:%s\n", warning)
+    }
+}
+
+
 // Handle a button press in test mode.
 func (this *Controller) testPress(buzzerId int) {
     // We toggle outputs on/off with each button press.
@@ -143,22 +302,224 @@ func (this *Controller) testPress(buzzerId int) {
 
 
 // Handle a button press in response to a question.
-func (this *Controller) recvAnswer(buzzerId int) {
+func (this *Controller) recvAnswer(press buttonPress) {
     // Check if the buzzer's team is allowed to answer.
-    team := buzzerId >> 4
+    team := BuzzerTeam(press.buzzerId)
 
     if !this.teamsAllowed[team] {
         // Team is not allowed to answer, ignore press.
         return
     }
 
-    this.lastAnswerTeam = team
+    this.candidates = append(this.candidates, press)
+
+    if this.arbWindow == 0 {
+        // No arbitration, the first press wins.
+        this.decideAnswer()
+        return
+    }
+
+    if len(this.candidates) == 1 {
+        // First press, wait for any earlier ones still on their way.
+        generation := this.arbGeneration
+        time.AfterFunc(this.arbWindow, func() {
+            this.requests <- func() {
+                if this.arbGeneration != generation { return }  // State has changed since, nothing to do.
+                this.decideAnswer()
+            }
+        })
+    }
+}
+
+
+// Pick the earliest of the presses received and let that buzzer answer.
+func (this *Controller) decideAnswer() {
+    firstReceived := this.candidates[0].received  // Candidates are still in the order received.
+
+    sort.SliceStable(this.candidates, func(i, j int) bool {
+        return this.candidates[i].pressTime.Before(this.candidates[j].pressTime)
+    })
+
+    // The margin that matters is over the nearest other team.
+    winner := this.candidates[0]
+    margin := ""
+    for _, second := range this.candidates[1:] {
+        if BuzzerTeam(second.buzzerId) != BuzzerTeam(winner.buzzerId) {
+            margin = fmt.Sprintf(", %.3fms ahead of %s", float64(second.pressTime.Sub(winner.pressTime)) / 1e6,
+                BuzzerIdToString(second.buzzerId))
+
+            if winner.errorBound != 0 && second.errorBound != 0 {
+                margin += fmt.Sprintf(" (+/-%.3fms)", float64(winner.errorBound + second.errorBound) / 1e6)
+            } else {
+                margin += " (unsynced)"
+            }
+            break
+        }
+    }
 
-    // Turn on just that one buzzer.
+    this.lastAnswerTeam = BuzzerTeam(winner.buzzerId)
+    this.lastAnswerBuzzer = winner.buzzerId
+
+    // Turn on just that one buzzer. Any others that latched a press locally are cancelled.
+    others := this.candidates[1:]
     this.changeState(ConStAnswered)
-    this.swarm.SetMode(buzzerId, true, true)
+    this.swarm.SetModeAllExcept(false, false, winner.buzzerId)
+    this.swarm.SetMode(winner.buzzerId, true, true)
+
+    // The decision is made once the winner's mode is on its way.
+    now := time.Now()
+    this.pressToDecision.Add(now.Sub(winner.pressTime))
+    this.receiveToDecision.Add(now.Sub(firstReceived))
+
+    // The other teams' presses are next in line.
+    for _, press := range others {
+        this.rankPress(press)
+    }
+
+    StreamControl.In(this.room).Printf("Answer from %s%s\n", BuzzerIdToString(winner.buzzerId), margin)
+}
+
+
+// Handle a button press in response to a bonus question.
+// Each team is locked in by its earliest press. As for a normal question, once a press arrives we wait our arbitration
+// window for any earlier ones still on their way, then lock in every team that's pressed, in press time order. Any
+// later presses from a team that's locked in are cancelled.
+func (this *Controller) recvBonusAnswer(press buttonPress) {
+    team := BuzzerTeam(press.buzzerId)
+    if !this.teamsAllowed[team] { return }
 
-    fmt.Printf("Answer from %s\n", BuzzerIdToString(buzzerId))
+    locked := this.bonusLocked[team].buzzerId
+    if locked == press.buzzerId { return }  // Duplicate, nothing to do.
+
+    if locked >= 0 {
+        // A teammate beat this buzzer to it. It may have latched the press locally, so cancel that.
+        this.swarm.SetMode(press.buzzerId, false, false)
+        return
+    }
+
+    for _, pending := range this.bonusPending[team] {
+        if pending.buzzerId == press.buzzerId { return }  // Duplicate, nothing to do.
+    }
+
+    this.bonusPending[team] = append(this.bonusPending[team], press)
+    this.bonusPendingCount++
+
+    if this.arbWindow == 0 {
+        // No arbitration, the first press wins.
+        this.lockBonusTeams()
+        return
+    }
+
+    if this.bonusPendingCount == 1 {
+        // First press since we last locked teams in, wait for any earlier ones still on their way.
+        generation := this.arbGeneration
+        time.AfterFunc(this.arbWindow, func() {
+            this.requests <- func() {
+                if this.arbGeneration != generation { return }  // State has changed since, nothing to do.
+                this.lockBonusTeams()
+            }
+        })
+    }
+}
+
+
+// Lock in every team with presses pending to the bonus round, each with its earliest press, cancelling the others.
+func (this *Controller) lockBonusTeams() {
+    var winners []buttonPress
+    for team, pending := range this.bonusPending {
+        if len(pending) == 0 { continue }
+
+        winner := pending[0]
+        for _, press := range pending[1:] {
+            if press.pressTime.Before(winner.pressTime) { winner = press }
+        }
+
+        // Teammates that lost may have latched their press locally, so cancel that.
+        for _, press := range pending {
+            if press.buzzerId != winner.buzzerId { this.swarm.SetMode(press.buzzerId, false, false) }
+        }
+
+        winners = append(winners, winner)
+        this.bonusPending[team] = nil
+    }
+
+    this.bonusPendingCount = 0
+
+    sort.SliceStable(winners, func(i, j int) bool { return winners[i].pressTime.Before(winners[j].pressTime) })
+
+    for _, winner := range winners {
+        team := BuzzerTeam(winner.buzzerId)
+        this.bonusLocked[team] = winner
+        this.swarm.SetMode(winner.buzzerId, true, false)
+
+        // Our position is one more than the number of teams locked in that pressed before us.
+        position := 1
+        for _, other := range this.bonusLocked {
+            if other.buzzerId >= 0 && other.pressTime.Before(winner.pressTime) { position++ }
+        }
+
+        StreamControl.In(this.room).Printf("%s locked in by %s (%s)\n", TeamIdToString(team),
+            BuzzerIdToString(winner.buzzerId), ordinal(position))
+    }
+}
+
+
+// Convert the given position to an ordinal string, eg 1st.
+func ordinal(n int) string {
+    suffix := "th"
+    switch {
+    case (n % 100) >= 11 && (n % 100) <= 13:  // 11th, 12th and 13th.
+    case (n % 10) == 1:  suffix = "st"
+    case (n % 10) == 2:  suffix = "nd"
+    case (n % 10) == 3:  suffix = "rd"
+    }
+
+    return fmt.Sprintf("%d%s", n, suffix)
+}
+
+
+// Add the given press to our ranked presses, in press time order.
+// Presses from the answering team, or from teams that already have an earlier ranked press, are ignored.
+func (this *Controller) rankPress(press buttonPress) {
+    team := BuzzerTeam(press.buzzerId)
+    if team == this.lastAnswerTeam { return }
+
+    for i, ranked := range this.ranked {
+        if BuzzerTeam(ranked.buzzerId) == team {
+            if !press.pressTime.Before(ranked.pressTime) { return }  // Already have an earlier one.
+
+            // This one's earlier, replace it.
+            this.ranked = append(this.ranked[:i], this.ranked[i + 1:]...)
+            break
+        }
+    }
+
+    i := sort.Search(len(this.ranked), func(i int) bool { return press.pressTime.Before(this.ranked[i].pressTime) })
+    this.ranked = append(this.ranked, buttonPress{})
+    copy(this.ranked[i + 1:], this.ranked[i:])
+    this.ranked[i] = press
+}
+
+
+// Pass the question to the next ranked team that's still allowed to answer.
+// Returns false if there isn't one.
+func (this *Controller) passAnswer() bool {
+    for len(this.ranked) > 0 {
+        next := this.ranked[0]
+        this.ranked = this.ranked[1:]
+        if !this.teamsAllowed[BuzzerTeam(next.buzzerId)] { continue }
+
+        // Everyone else is already off, so only the last answerer needs to change.
+        this.swarm.SetMode(this.lastAnswerBuzzer, false, false)
+        this.swarm.SetMode(next.buzzerId, true, true)
+
+        this.lastAnswerTeam = BuzzerTeam(next.buzzerId)
+        this.lastAnswerBuzzer = next.buzzerId
+        StreamControl.In(this.room).Printf("Answer passes to %s\n", BuzzerIdToString(next.buzzerId))
+        return true
+    }
+
+    return false
 }
 
 
@@ -171,6 +532,15 @@ func (this *Controller) commandIdle(value ...int) {
 }
 
 
+// Report which teams may answer at the start of a question, indexed by team ID.
+// That's those on the scoreboard.
+func (this *Controller) allTeams() []bool {
+    allowed := make([]bool, MaxTeams)
+    for team := 0; team < this.scoreboard.Teams(); team++ { allowed[team] = true }
+    return allowed
+}
+
+
 // Command handler for entering test mode.
 // May be called from any thread context.
 func (this *Controller) commandTest(value ...int) {
@@ -184,9 +554,9 @@ func (this *Controller) commandTest(value ...int) {
 // May be called from any thread context.
 func (this *Controller) commandAsk(value ...int) {
     this.requests <- func() {
-        this.changeState(ConStAsked)
         this.doubleTeam = value[0]
-        this.teamsAllowed = []bool{true, true, true, true, false, false, false, false}
+        this.teamsAllowed = this.allTeams()
+        this.changeState(ConStAsked)
     }
 }
 
@@ -195,9 +565,60 @@ func (this *Controller) commandAsk(value ...int) {
 // May be called from any thread context.
 func (this *Controller) commandAskNoDouble(value ...int) {
     this.requests <- func() {
+        this.doubleTeam = -1
+        this.teamsAllowed = this.allTeams()
         this.changeState(ConStAsked)
+    }
+}
+
+
+// Command handler for entering bonus question mode.
+// May be called from any thread context.
+func (this *Controller) commandBonus(value ...int) {
+    this.requests <- func() {
+        this.doubleTeam = value[0]
+        this.teamsAllowed = this.allTeams()
+        this.changeState(ConStBonus)
+    }
+}
+
+
+// Command handler for entering bonus question mode with no double team.
+// May be called from any thread context.
+func (this *Controller) commandBonusNoDouble(value ...int) {
+    this.requests <- func() {
         this.doubleTeam = -1
-        this.teamsAllowed = []bool{true, true, true, true, false, false, false, false}
+        this.teamsAllowed = this.allTeams()
+        this.changeState(ConStBonus)
+    }
+}
+
+
+// Command handler for marking the teams that got a bonus question right, given as a bitmask of team IDs.
+// All the points are added at once, and the bonus round ends.
+// May be called from any thread context.
+func (this *Controller) commandBonusMark(value ...int) {
+    this.requests <- func() {
+        if this.state != ConStBonus {
+            StreamInput.In(this.room).Printf("Not in a bonus round\n")
+            return
+        }
+
+        points := make([]int, len(this.teamsAllowed))
+        marks := ""
+        for team := range points {
+            if (value[0] & (1 << uint(team))) == 0 || !this.teamsAllowed[team] { continue }
+
+            points[team] = 1
+            if team == this.doubleTeam { points[team] = 2 }
+            marks += fmt.Sprintf(" %s %d", TeamIdToString(team), points[team])
+        }
+
+        if marks == "" { marks = " none" }
+        StreamScore.In(this.room).Printf("Bonus marks:%s\n", marks)
+
+        this.scoreboard.AddBatch(points)
+        this.changeState(ConStIdle)
     }
 }
 
@@ -208,11 +629,11 @@ func (this *Controller) commandCorrect(value ...int) {
     this.requests <- func() {
         if this.doubleTeam == this.lastAnswerTeam {
             // Double marks.
-            fmt.Printf("Double marks to %s\n", TeamIdToString(this.lastAnswerTeam))
+            StreamScore.In(this.room).Printf("Double marks to %s\n", TeamIdToString(this.lastAnswerTeam))
             this.scoreboard.Add(this.lastAnswerTeam, 2)
         } else {
             // Normal marks.
-            fmt.Printf("1 mark to %s\n", TeamIdToString(this.lastAnswerTeam))
+            StreamScore.In(this.room).Printf("1 mark to %s\n", TeamIdToString(this.lastAnswerTeam))
             this.scoreboard.Add(this.lastAnswerTeam, 1)
         }
     }
@@ -223,8 +644,26 @@ func (this *Controller) commandCorrect(value ...int) {
 // May be called from any thread context.
 func (this *Controller) commandIncorrect(value ...int) {
     this.requests <- func() {
-        // We ask again, with the answering team disabled.
+        if this.state != ConStAnswered && this.state != ConStAsked {
+            StreamInput.In(this.room).Printf("No question to answer\n")
+            return
+        }
+
+        // The answering team may not answer again. If another team has already pressed, it answers next, otherwise
+        // we ask again.
         this.teamsAllowed[this.lastAnswerTeam] = false
+        if this.state == ConStAnswered && this.passAnswer() { return }
+
         this.changeState(ConStAsked)
     }
 }
+
+
+// Command handler for setting the arbitration window.
+// May be called from any thread context.
+func (this *Controller) commandWindow(value ...int) {
+    this.requests <- func() {
+        this.arbWindow = time.Duration(value[0]) * time.Millisecond
+        StreamControl.In(this.room).Printf("Arbitration window %v\n", this.arbWindow)
+    }
+}
@@ -0,0 +1,131 @@
+/* Fixed bucket latency histograms.
+
+Recording a value is cheap and never allocates, so histograms can be updated for every message. Percentiles are
+estimated from the buckets, so are only as accurate as the bucket spacing, but the maximum is exact.
+
+*/
+
+package main
+
+import "fmt"
+import "time"
+
+
+// External interface.
+
+// Record the given duration.
+func (this *Histogram) Add(d time.Duration) {
+    this.counts[histogramBucket(d)]++
+    this.count++
+    this.sum += d
+    if d > this.max { this.max = d }
+}
+
+
+// Add all the values recorded in the given histogram to this one.
+func (this *Histogram) Merge(other *Histogram) {
+    for i := range this.counts {
+        this.counts[i] += other.counts[i]
+    }
+
+    this.count += other.count
+    this.sum += other.sum
+    if other.max > this.max { this.max = other.max }
+}
+
+
+// Clear all recorded values.
+func (this *Histogram) Reset() {
+    *this = Histogram{}
+}
+
+
+// Report the number of values recorded.
+func (this *Histogram) Count() uint64 {
+    return this.count
+}
+
+
+// Report the total of all values recorded.
+func (this *Histogram) Sum() time.Duration {
+    return this.sum
+}
+
+
+// Report the maximum value recorded.
+func (this *Histogram) Max() time.Duration {
+    return this.max
+}
+
+
+// Estimate the given percentile, 0 to 100, of the values recorded.
+// The estimate is the upper bound of the bucket the percentile falls in, so errs on the slow side.
+func (this *Histogram) Percentile(percent float64) time.Duration {
+    if this.count == 0 { return 0 }
+
+    // Find the bucket containing the requested rank.
+    rank := uint64((percent / 100) * float64(this.count))
+    if rank >= this.count { rank = this.count - 1 }
+
+    var seen uint64
+    for i, count := range this.counts {
+        seen += count
+        if seen > rank {
+            if i >= len(histogramBounds) || histogramBounds[i] > this.max { return this.max }
+            return histogramBounds[i]
+        }
+    }
+
+    return this.max
+}
+
+
+// Summarise this histogram as p50, p95, p99 and max, in ms.
+func (this *Histogram) String() string {
+    if this.count == 0 { return "     -      -      -      -" }
+
+    return fmt.Sprintf("%6.1f %6.1f %6.1f %6.1f", durationMs(this.Percentile(50)), durationMs(this.Percentile(95)),
+        durationMs(this.Percentile(99)), durationMs(this.max))
+}
+
+
+// Latency histogram.
+type Histogram struct {
+    counts [histogramBucketCount]uint64
+    count uint64
+    sum time.Duration
+    max time.Duration
+}
+
+
+// Internals.
+
+// Upper bounds of our buckets. There's one more bucket than bounds, for everything bigger.
+var histogramBounds = []time.Duration{
+    1 * time.Millisecond, 2 * time.Millisecond, 3 * time.Millisecond, 5 * time.Millisecond,
+    7 * time.Millisecond, 10 * time.Millisecond, 15 * time.Millisecond, 20 * time.Millisecond,
+    30 * time.Millisecond, 50 * time.Millisecond, 70 * time.Millisecond, 100 * time.Millisecond,
+    150 * time.Millisecond, 200 * time.Millisecond, 300 * time.Millisecond, 500 * time.Millisecond,
+    700 * time.Millisecond, 1000 * time.Millisecond, 1100 * time.Millisecond, 1250 * time.Millisecond,
+    1500 * time.Millisecond, 2000 * time.Millisecond, 3000 * time.Millisecond, 5000 * time.Millisecond,
+}
+
+const (
+    histogramBucketCount = 25
+)
+
+
+// Find the bucket for the given duration.
+func histogramBucket(d time.Duration) int {
+    for i, bound := range histogramBounds {
+        if d <= bound { return i }
+    }
+
+    return len(histogramBounds)
+}
+
+
+// Convert the given duration to ms, for printing.
+func durationMs(d time.Duration) float64 {
+    return float64(d) / float64(time.Millisecond)
+}
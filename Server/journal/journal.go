@@ -0,0 +1,186 @@
+/* Binary journal of quiz events.
+
+Every press, mode change, controller state change and score change is recorded, so what happened during a quiz can
+be checked afterwards, and the scores rebuilt if need be. The journal is written by the quiz server and read by the
+journalread tool.
+
+A journal file is a header followed by fixed size records. All values are big endian. Each time the server starts it
+appends a new header, so a file may hold several sessions.
+
+Header:
+  "QJNL"  Magic
+  v       Format version, 2
+  t[8]    Time the journal was started, in ns since the Unix epoch
+
+Record:
+  k       Kind of record, see below
+  i[2]    Buzzer or team ID, depending on the kind
+  t[8]    Server time, in ns since the Unix epoch
+  d[8]    Device time, in us since the buzzer booted, 0 if none
+  v[4]    Value, depending on the kind
+  x[4]    Extra value, depending on the kind
+
+Kinds of record:
+  Press   i = buzzer, t = press time, d = press time on the buzzer, v = error bound in us (0 for unknown),
+          x = 1 if the press time came from clock sync, 0 if it was estimated from the receive time
+  Mode    i = buzzer, or AllBuzzers, t = time sent, v = mode command. For AllBuzzers the low 16 bits of x are a
+          bitmask of the teams armed, and the high 16 bits are the ID of the buzzer left out, AllBuzzers for none
+  State   t = time of change, v = new controller state, i unused
+  Score   i = team, t = time of change, v = points added (may be negative)
+
+Buzzer IDs are the server's, with the team ID in the top byte. Version 1 journals, from before that, held the 7 bit IDs
+of the single byte protocol, with the team ID in bits 4 to 6, and only 8 teams. The reader converts those as it goes.
+
+*/
+
+package journal
+
+import "bufio"
+import "encoding/binary"
+import "errors"
+import "fmt"
+import "io"
+import "time"
+
+
+// External interface.
+
+// Kinds of record.
+const (
+    KindStart = 'Q'  // Start of a session, from a header. Headers begin with the magic, so this is its first byte.
+    KindPress = 1
+    KindMode = 2
+    KindState = 3
+    KindScore = 4
+)
+
+// ID meaning all buzzers.
+const (
+    AllBuzzers = 0xFFFF
+)
+
+// Format constants.
+const (
+    Magic = "QJNL"
+    FormatVersion = 2
+    FormatVersionLegacyIds = 1
+    HeaderSize = 13
+    RecordSize = 27
+)
+
+
+// A single journal record.
+type Record struct {
+    Kind byte
+    Id int
+    Time time.Time
+    DeviceTime int64
+    Value int32
+    Extra int32
+}
+
+
+// Create a reader for the given journal.
+func CreateReader(r io.Reader) *Reader {
+    return &Reader{ in: bufio.NewReader(r) }
+}
+
+
+// Read the next record from our journal.
+// Each header becomes a KindStart record, with the time the server started. Returns io.EOF at the end of the
+// journal. A partial record at the end, from the server stopping mid write, also counts as the end.
+func (this *Reader) Next() (Record, error) {
+    kind, err := this.in.ReadByte()
+    if err != nil { return Record{}, err }
+
+    if kind == KindStart {
+        var b [HeaderSize]byte
+        b[0] = kind
+        if err := this.readRest(b[:]); err != nil { return Record{}, err }
+
+        if string(b[0:4]) != Magic { return Record{}, errors.New("not a journal") }
+        if b[4] != FormatVersion && b[4] != FormatVersionLegacyIds {
+            return Record{}, fmt.Errorf("unsupported journal version %d", b[4])
+        }
+
+        this.version = b[4]
+
+        return Record{ Kind: KindStart, Time: time.Unix(0, int64(binary.BigEndian.Uint64(b[5:13]))) }, nil
+    }
+
+    var b [RecordSize]byte
+    b[0] = kind
+    if err := this.readRest(b[:]); err != nil { return Record{}, err }
+
+    var p Record
+    p.Kind = b[0]
+    p.Id = int(binary.BigEndian.Uint16(b[1:3]))
+    p.Time = time.Unix(0, int64(binary.BigEndian.Uint64(b[3:11])))
+    p.DeviceTime = int64(binary.BigEndian.Uint64(b[11:19]))
+    p.Value = int32(binary.BigEndian.Uint32(b[19:23]))
+    p.Extra = int32(binary.BigEndian.Uint32(b[23:27]))
+
+    if this.version == FormatVersionLegacyIds { p.convertLegacyIds() }
+    return p, nil
+}
+
+
+// Journal reader.
+type Reader struct {
+    in *bufio.Reader
+    version byte  // Format version of the session we're reading.
+}
+
+
+// Internals.
+
+// Read the rest of a header or record into the given buffer, after its first byte.
+func (this *Reader) readRest(b []byte) error {
+    _, err := io.ReadFull(this.in, b[1:])
+    if err == io.ErrUnexpectedEOF { err = io.EOF }
+    return err
+}
+
+
+// Convert the buzzer IDs in this record, read from a version 1 journal, to current IDs.
+func (this *Record) convertLegacyIds() {
+    if this.Kind != KindPress && this.Kind != KindMode { return }
+
+    if this.Id != AllBuzzers {
+        this.Id = legacyId(this.Id)
+        return
+    }
+
+    if this.Kind == KindMode {
+        except := int(uint32(this.Extra) >> 16)
+        if except != AllBuzzers { except = legacyId(except) }
+        this.Extra = int32(uint32(except) << 16 | uint32(this.Extra) & 0xFF)
+    }
+}
+
+
+// Convert the given 7 bit buzzer ID, from a version 1 journal, to a current ID.
+func legacyId(id int) int {
+    return (id >> 4) << 8 | (id & 15)
+}
+
+
+// Encode the journal header for the given start time.
+func encodeHeader(start time.Time) []byte {
+    header := make([]byte, HeaderSize)
+    copy(header[0:4], Magic)
+    header[4] = FormatVersion
+    binary.BigEndian.PutUint64(header[5:13], uint64(start.UnixNano()))
+    return header
+}
+
+
+// Encode this record into the given buffer, which must be RecordSize long.
+func (this *Record) encode(b []byte) {
+    b[0] = this.Kind
+    binary.BigEndian.PutUint16(b[1:3], uint16(this.Id))
+    binary.BigEndian.PutUint64(b[3:11], uint64(this.Time.UnixNano()))
+    binary.BigEndian.PutUint64(b[11:19], uint64(this.DeviceTime))
+    binary.BigEndian.PutUint32(b[19:23], uint32(this.Value))
+    binary.BigEndian.PutUint32(b[23:27], uint32(this.Extra))
+}
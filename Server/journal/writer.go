@@ -0,0 +1,195 @@
+/* Journal writer.
+
+Records are added from whichever goroutine sees the event, including the buzzer goroutines on the press path, so
+adding one must never block. Each is put in a fixed size lock free ring, and a single background goroutine takes them
+out and writes them to the file. If the writer falls so far behind that the ring fills, records are dropped and
+counted rather than making anyone wait.
+
+The ring is a bounded multi producer queue. Each slot has a sequence number, telling producers whether the slot is
+free for the position they've claimed and telling the writer whether the slot at its position has been filled yet.
+
+All methods may be called on a nil Writer, and do nothing, so journaling can be turned off.
+
+*/
+
+package journal
+
+import "bufio"
+import "fmt"
+import "os"
+import "sync/atomic"
+import "time"
+
+
+// External interface.
+
+// Create a journal writer, writing to the given file.
+// Any existing file is appended to, under a new header. Returns nil on error.
+func Create(path string) *Writer {
+    file, err := os.OpenFile(path, os.O_WRONLY | os.O_CREATE | os.O_APPEND, 0644)
+    if err != nil {
+        fmt.Printf("Cannot open journal %s: %v\n", path, err)
+        return nil
+    }
+
+    var p Writer
+    p.file = file
+    p.out = bufio.NewWriter(file)
+    p.wake = make(chan struct{}, 1)
+
+    for i := range p.slots { p.slots[i].seq = uint64(i) }
+
+    if _, err := p.out.Write(encodeHeader(time.Now())); err != nil {
+        fmt.Printf("Cannot write journal %s: %v\n", path, err)
+        file.Close()
+        return nil
+    }
+
+    go p.process()
+    return &p
+}
+
+
+// Record a button press.
+// deviceTime is the press time on the buzzer's clock, in us, 0 if unknown. errorBound is 0 if unknown.
+func (this *Writer) Press(buzzerId int, pressTime time.Time, deviceTime int64, errorBound time.Duration,
+    synced bool) {
+    var extra int32
+    if synced { extra = 1 }
+    this.add(Record{ Kind: KindPress, Id: buzzerId, Time: pressTime, DeviceTime: deviceTime,
+        Value: int32(errorBound.Microseconds()), Extra: extra })
+}
+
+
+// Record a mode sent to a single buzzer.
+func (this *Writer) Mode(buzzerId int, mode byte) {
+    this.add(Record{ Kind: KindMode, Id: buzzerId, Time: time.Now(), Value: int32(mode) })
+}
+
+
+// Record a mode sent to all buzzers.
+// armTeams is a bitmask of teams armed, except is the buzzer left out or AllBuzzers.
+func (this *Writer) ModeAll(mode byte, armTeams uint16, except int) {
+    this.add(Record{ Kind: KindMode, Id: AllBuzzers, Time: time.Now(), Value: int32(mode),
+        Extra: int32(uint32(except) << 16 | uint32(armTeams)) })
+}
+
+
+// Record a change of controller state.
+func (this *Writer) State(state int) {
+    this.add(Record{ Kind: KindState, Time: time.Now(), Value: int32(state) })
+}
+
+
+// Record points added to a team.
+func (this *Writer) Score(team int, delta int) {
+    this.add(Record{ Kind: KindScore, Id: team, Time: time.Now(), Value: int32(delta) })
+}
+
+
+// Report the number of records dropped because the ring was full.
+func (this *Writer) Dropped() uint64 {
+    if this == nil { return 0 }
+    return atomic.LoadUint64(&this.dropped)
+}
+
+
+// A journal writer.
+type Writer struct {
+    head uint64  // Next ring position for producers to claim. Atomic, first for 64 bit alignment.
+    dropped uint64  // Records dropped. Atomic.
+    tail uint64  // Next ring position for the writer to take. Only used by the writer goroutine.
+    slots [RingSize]ringSlot
+    wake chan struct{}  // Nudges the writer goroutine when records are added.
+    file *os.File
+    out *bufio.Writer
+}
+
+
+// Internals.
+
+// Ring constants.
+const (
+    RingSize = 1024  // Must be a power of 2.
+    RingMask = RingSize - 1
+    FlushPeriod = 1 * time.Second  // How often to flush the file while records are arriving.
+)
+
+
+// A single ring slot.
+// seq is the position the slot is free for, or that position + 1 once it has been filled.
+type ringSlot struct {
+    seq uint64  // Atomic.
+    rec Record
+}
+
+
+// Add the given record to the ring, for the writer goroutine.
+func (this *Writer) add(rec Record) {
+    if this == nil { return }
+
+    for {
+        pos := atomic.LoadUint64(&this.head)
+        slot := &this.slots[pos & RingMask]
+        seq := atomic.LoadUint64(&slot.seq)
+
+        if seq == pos {
+            // Slot is free, try to claim it.
+            if atomic.CompareAndSwapUint64(&this.head, pos, pos + 1) {
+                slot.rec = rec
+                atomic.StoreUint64(&slot.seq, pos + 1)
+                break
+            }
+        } else if seq < pos {
+            // Ring is full.
+            atomic.AddUint64(&this.dropped, 1)
+            return
+        }
+
+        // Another producer claimed this position first, try again.
+    }
+
+    select {
+    case this.wake <- struct{}{}:
+    default:
+    }
+}
+
+
+// Writer goroutine. Takes records out of the ring and writes them to the file.
+func (this *Writer) process() {
+    var b [RecordSize]byte
+    flushed := time.Now()
+
+    for {
+        slot := &this.slots[this.tail & RingMask]
+
+        if atomic.LoadUint64(&slot.seq) != this.tail + 1 {
+            // Ring is empty. Flush what we have and wait for more.
+            this.flush()
+            <-this.wake
+            flushed = time.Now()
+            continue
+        }
+
+        rec := slot.rec
+        atomic.StoreUint64(&slot.seq, this.tail + RingSize)
+        this.tail++
+
+        rec.encode(b[:])
+        if _, err := this.out.Write(b[:]); err != nil { fmt.Printf("Journal write failed: %v\n", err) }
+
+        // Don't let a steady stream of records keep everything in our buffer.
+        if time.Since(flushed) > FlushPeriod {
+            this.flush()
+            flushed = time.Now()
+        }
+    }
+}
+
+
+// Flush buffered records to the file.
+func (this *Writer) flush() {
+    if this.out.Buffered() == 0 { return }
+    if err := this.out.Flush(); err != nil { fmt.Printf("Journal flush failed: %v\n", err) }
+}
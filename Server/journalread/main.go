@@ -0,0 +1,148 @@
+/* Journal reader.
+
+Prints the events recorded in a quiz journal and rebuilds the scoreboard from the score changes, in case the server's
+own scores are lost or disputed. Scores start again from 0 each time the server started, as the server's do.
+
+Usage: journalread [-events] [file]
+
+*/
+
+package main
+
+import "flag"
+import "fmt"
+import "io"
+import "os"
+import "quiz/journal"
+import "time"
+
+
+func main() {
+    events := flag.Bool("events", false, "Print every event, not just the scores")
+    flag.Parse()
+
+    path := "quiz.journal"
+    if flag.NArg() > 0 { path = flag.Arg(0) }
+
+    file, err := os.Open(path)
+    if err != nil {
+        fmt.Printf("Cannot open journal: %v\n", err)
+        os.Exit(1)
+    }
+
+    defer file.Close()
+
+    reader := journal.CreateReader(file)
+    var start time.Time
+    var scores []int
+
+    for {
+        rec, err := reader.Next()
+        if err == io.EOF { break }
+        if err != nil {
+            fmt.Printf("Cannot read journal: %v\n", err)
+            os.Exit(1)
+        }
+
+        switch rec.Kind {
+        case journal.KindStart:
+            // New session, the server starts its scores again.
+            if scores != nil { printScores(start, scores) }
+            start = rec.Time
+            scores = make([]int, 4)  // The server's default. Any more teams appear as they score.
+
+        case journal.KindScore:
+            for rec.Id >= len(scores) { scores = append(scores, 0) }
+            scores[rec.Id] += int(rec.Value)
+        }
+
+        if *events { printRecord(start, &rec) }
+    }
+
+    if scores == nil {
+        fmt.Printf("Journal is empty\n")
+        os.Exit(1)
+    }
+
+    printScores(start, scores)
+}
+
+
+// Team letters, in the order of team IDs. Must match the server's.
+var _teamLetters = []string{ "B", "G", "R", "Y", "D", "P", "W", "K", "C", "M", "E", "F", "L", "H", "U", "V" }
+
+// Controller state names, in the order of the server's ConSt values.
+var _stateNames = []string{ "idle", "test", "asked", "answered", "bonus" }
+
+
+// Convert the given buzzer ID to a string.
+func buzzerIdToString(id int) string {
+    if id == journal.AllBuzzers { return "all" }
+    return fmt.Sprintf("%s%d", _teamLetters[(id >> 8) & 15], id & 0xFF)
+}
+
+
+// Print the given record, with times relative to the given session start.
+func printRecord(start time.Time, rec *journal.Record) {
+    at := rec.Time.Sub(start).Seconds()
+
+    switch rec.Kind {
+    case journal.KindStart:
+        fmt.Printf("Session started %s\n", rec.Time.Format(time.RFC3339))
+
+    case journal.KindPress:
+        source := "estimated"
+        if rec.Extra != 0 { source = "synced" }
+        fmt.Printf("%10.6f Press %s, device time %dus, %s, error bound %dus\n", at, buzzerIdToString(rec.Id),
+            rec.DeviceTime, source, rec.Value)
+
+    case journal.KindMode:
+        fmt.Printf("%10.6f Mode %s 0x%02X", at, buzzerIdToString(rec.Id), rec.Value)
+        if rec.Id == journal.AllBuzzers {
+            fmt.Printf(", armed teams 0x%04X", rec.Extra & 0xFFFF)
+            except := int(uint32(rec.Extra) >> 16)
+            if except != journal.AllBuzzers { fmt.Printf(", except %s", buzzerIdToString(except)) }
+        }
+        fmt.Printf("\n")
+
+    case journal.KindState:
+        name := fmt.Sprintf("%d", rec.Value)
+        if int(rec.Value) < len(_stateNames) { name = _stateNames[rec.Value] }
+        fmt.Printf("%10.6f State %s\n", at, name)
+
+    case journal.KindScore:
+        fmt.Printf("%10.6f Score %s %+d\n", at, _teamLetters[rec.Id & 15], rec.Value)
+
+    default:
+        fmt.Printf("%10.6f Unknown record kind %d\n", at, rec.Kind)
+    }
+}
+
+
+// Print the given scores, for the session started at the given time.
+func printScores(start time.Time, scores []int) {
+    fmt.Printf("Scores for session started %s:\n", start.Format(time.RFC3339))
+
+    for team, score := range scores {
+        position := 1
+        for _, other := range scores {
+            if other > score { position++ }
+        }
+
+        fmt.Printf("%s: %3d (%s)\n", _teamLetters[team & 15], score, ordinal(position))
+    }
+}
+
+
+// Convert the given position to an ordinal string, eg 1st.
+func ordinal(n int) string {
+    suffix := "th"
+    switch {
+    case (n % 100) >= 11 && (n % 100) <= 13:  // 11th, 12th and 13th.
+    case (n % 10) == 1:  suffix = "st"
+    case (n % 10) == 2:  suffix = "nd"
+    case (n % 10) == 3:  suffix = "rd"
+    }
+
+    return fmt.Sprintf("%d%s", n, suffix)
+}
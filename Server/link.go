@@ -0,0 +1,239 @@
+/* Link timing stats for a single buzzer.
+
+These are updated for every message received from the buzzer, so to keep that cheap they're updated directly by the
+buzzer's Go routines, under a lock, rather than by sending requests to the Swarm. Nothing here allocates.
+
+Any message shows the buzzer is still there, but only the gaps between heartbeats are recorded. Everything else
+arrives when something happens, often together, such as a pong batched with a heartbeat, so including it would make
+the gaps look shorter and far less steady than the link really is.
+
+As with the rest of the buzzer's record, we keep stats for both the current session and the total duration of this
+program.
+
+The gaps between heartbeats also drive a phi accrual failure detector. Rather than a fixed timeout, we keep the mean and
+variance of recent gaps, and from those work out how unlikely the current silence is. Phi is -log10 of the
+probability that a healthy buzzer would be this quiet, so phi 3 means a 1 in 1000 chance. A buzzer with steady gaps is
+noticed quickly when it goes quiet, while one that regularly has longer gaps is given more leeway.
+
+*/
+
+package main
+
+import "math"
+import "sync"
+import "time"
+
+
+// External interface.
+
+// Create a link stats object for the given buzzer, in the given room.
+func createLinkStats(id int, room *Room) *linkStats {
+    var p linkStats
+    p.id = id
+    p.room = room
+    p.expectedGap = LinkDefaultGap
+    return &p
+}
+
+
+// Report that a message has been received from the buzzer at the given time, and whether it was a heartbeat.
+// May be called from any thread context.
+func (this *linkStats) Received(now time.Time, heartbeat bool) {
+    this.lock.Lock()
+    this.lastMsgTime = now
+    if !heartbeat {
+        this.lock.Unlock()
+        return
+    }
+
+    gap := now.Sub(this.lastHeartbeatTime)
+    late := gap - this.expectedGap
+    this.lastHeartbeatTime = now
+    this.gapSession.Add(gap)
+    this.gapTotal.Add(gap)
+    this.addRecentGap(gap)
+    this.lock.Unlock()
+
+    if late > SlowHeartbeatLate {
+        StreamConnect.In(this.room).Noisy("slow " + BuzzerIdToString(this.id), "Slow heartbeat from %s %v\n",
+            BuzzerIdToString(this.id), gap)
+    }
+}
+
+
+// Report the round trip time of a probe to the buzzer.
+// May be called from any thread context.
+func (this *linkStats) ProbeReply(rtt time.Duration) {
+    this.lock.Lock()
+    defer this.lock.Unlock()
+
+    this.rttSession.Add(rtt)
+    this.rttTotal.Add(rtt)
+}
+
+
+// Start a new session, clearing session stats.
+// May be called from any thread context.
+func (this *linkStats) NewSession(now time.Time) {
+    this.lock.Lock()
+    defer this.lock.Unlock()
+
+    this.lastMsgTime = now
+    this.lastHeartbeatTime = now
+    this.gapSession.Reset()
+    this.rttSession.Reset()
+    this.clearRecentGaps()
+}
+
+
+// Resume the current session after reconnecting, keeping session stats.
+// The gap while disconnected isn't counted as a gap between heartbeats.
+// May be called from any thread context.
+func (this *linkStats) Resume(now time.Time) {
+    this.lock.Lock()
+    defer this.lock.Unlock()
+
+    this.lastMsgTime = now
+    this.lastHeartbeatTime = now
+}
+
+
+// Set the gap we now expect between heartbeats, discarding the recent gaps the failure detector has seen.
+// Until enough new gaps have been seen, the failure detector assumes this.
+// May be called from any thread context.
+func (this *linkStats) ExpectGap(gap time.Duration) {
+    this.lock.Lock()
+    defer this.lock.Unlock()
+
+    this.expectedGap = gap
+    this.clearRecentGaps()
+}
+
+
+// Report when we last heard from the buzzer.
+// May be called from any thread context.
+func (this *linkStats) LastMsgTime() time.Time {
+    this.lock.Lock()
+    defer this.lock.Unlock()
+
+    return this.lastMsgTime
+}
+
+
+// Report the suspicion level phi for the buzzer at the given time, and how long it's been quiet.
+// May be called from any thread context.
+func (this *linkStats) Phi(now time.Time) (phi float64, quiet time.Duration) {
+    this.lock.Lock()
+    defer this.lock.Unlock()
+
+    quiet = now.Sub(this.lastMsgTime)
+
+    // Until we've seen enough gaps, assume they're what we've been told to expect.
+    mean := float64(this.expectedGap)
+    stdDev := float64(this.expectedGap) / 4
+
+    if this.recentCount >= LinkMinGaps {
+        n := float64(this.recentCount)
+        mean = this.recentSum / n
+        stdDev = math.Sqrt(math.Max(0, (this.recentSumSq / n) - (mean * mean)))
+    }
+
+    stdDev = math.Max(stdDev, float64(LinkMinStdDev))
+
+    // Logistic approximation of the normal distribution, as used by Akka's phi accrual detector.
+    y := (float64(quiet) - mean) / stdDev
+    e := math.Exp(-y * (1.5976 + (0.070566 * y * y)))
+    if float64(quiet) > mean {
+        phi = -math.Log10(e / (1 + e))
+    } else {
+        phi = -math.Log10(1 - (1 / (1 + e)))
+    }
+
+    return phi, quiet
+}
+
+
+// Take a copy of the current stats, so they can be reported without holding our lock.
+// May be called from any thread context.
+func (this *linkStats) Snapshot() linkSnapshot {
+    this.lock.Lock()
+    defer this.lock.Unlock()
+
+    return linkSnapshot{this.gapSession, this.gapTotal, this.rttSession, this.rttTotal}
+}
+
+
+// Link stats for a buzzer.
+type linkStats struct {
+    id int
+    room *Room
+    lock sync.Mutex
+    lastMsgTime time.Time  // When we last received any message.
+    lastHeartbeatTime time.Time
+    gapSession Histogram  // Gaps between heartbeats received.
+    gapTotal Histogram
+    rttSession Histogram  // Probe round trip times.
+    rttTotal Histogram
+    recentGaps [LinkRecentGaps]float64  // Recent gaps between heartbeats, in ns, for the failure detector. Circular.
+    recentNext int  // Index to write next gap to.
+    recentCount int  // Number of valid recent gaps.
+    recentSum float64  // Sum of valid recent gaps.
+    recentSumSq float64  // Sum of squares of valid recent gaps.
+    expectedGap time.Duration  // Gap to assume until we have enough recent gaps.
+}
+
+
+// Copy of link stats.
+type linkSnapshot struct {
+    gapSession Histogram
+    gapTotal Histogram
+    rttSession Histogram
+    rttTotal Histogram
+}
+
+
+// Internals.
+
+// Heartbeats this much later than expected are reported.
+const (
+    SlowHeartbeatLate = 2 * time.Second
+)
+
+// Failure detector settings.
+const (
+    LinkRecentGaps = 100  // Number of recent gaps we estimate from.
+    LinkMinGaps = 10  // Until we have this many gaps we assume a default.
+    LinkDefaultGap = time.Second  // Assumed mean gap until we have enough of our own, unless told otherwise.
+    LinkMinStdDev = 200 * time.Millisecond  // Floor on gap variation, so very steady buzzers aren't hair triggered.
+)
+
+
+// Discard our recent gaps.
+// Must be called with our lock held.
+func (this *linkStats) clearRecentGaps() {
+    this.recentCount = 0
+    this.recentNext = 0
+    this.recentSum = 0
+    this.recentSumSq = 0
+}
+
+
+// Add the given gap to our recent gaps.
+// Must be called with our lock held.
+func (this *linkStats) addRecentGap(gap time.Duration) {
+    g := float64(gap)
+
+    if this.recentCount == LinkRecentGaps {
+        // Window is full, drop the oldest.
+        old := this.recentGaps[this.recentNext]
+        this.recentSum -= old
+        this.recentSumSq -= old * old
+    } else {
+        this.recentCount++
+    }
+
+    this.recentGaps[this.recentNext] = g
+    this.recentNext = (this.recentNext + 1) % LinkRecentGaps
+    this.recentSum += g
+    this.recentSumSq += g * g
+}
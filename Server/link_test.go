@@ -0,0 +1,71 @@
+/* Tests for the link stats and failure detector. */
+
+package main
+
+import "math"
+import "testing"
+import "time"
+
+
+// Check only the gaps between heartbeats are recorded, though any message counts as hearing from the buzzer.
+func TestLinkGapsBetweenHeartbeats(t *testing.T) {
+    stats := createLinkStats(0x001, nil)
+    base := time.Now()
+    stats.NewSession(base)
+
+    // A heartbeat every second, with a pong batched with each, and a press in between.
+    for i := 1; i <= 3; i++ {
+        at := base.Add(time.Duration(i) * time.Second)
+        stats.Received(at, true)
+        stats.Received(at, false)
+        stats.Received(at.Add(300 * time.Millisecond), false)
+    }
+
+    snapshot := stats.Snapshot()
+    if n := snapshot.gapSession.Count(); n != 3 { t.Errorf("Recorded %d gaps, expected 3", n) }
+    if sum := snapshot.gapSession.Sum(); sum != 3 * time.Second { t.Errorf("Gaps total %v, expected 3s", sum) }
+    if last := stats.LastMsgTime(); !last.Equal(base.Add(3300 * time.Millisecond)) {
+        t.Errorf("Last heard from at %v, expected 3.3s", last.Sub(base))
+    }
+}
+
+
+// Check the failure detector's suspicion for given gaps between heartbeats, and silence since the last.
+func TestLinkPhi(t *testing.T) {
+    steady := []time.Duration{time.Second}
+    unsteady := []time.Duration{500 * time.Millisecond, 1500 * time.Millisecond}
+
+    tests := []struct {
+        name string
+        gaps []time.Duration  // Repeated in turn.
+        count int  // Number of gaps.
+        quiet time.Duration
+        minPhi float64
+        maxPhi float64
+    }{
+        { "steady, early", steady, 20, 500 * time.Millisecond, 0, 0.01 },
+        { "steady, on time", steady, 20, time.Second, 0.29, 0.31 },
+        { "steady, late", steady, 20, 1600 * time.Millisecond, 2.8, 3.0 },
+        { "steady, gone", steady, 20, 2500 * time.Millisecond, DeadPhi, math.Inf(1) },
+        { "unsteady, late", unsteady, 20, 2500 * time.Millisecond, 2.8, 3.0 },
+        { "too few gaps", []time.Duration{100 * time.Millisecond}, LinkMinGaps - 1, 800 * time.Millisecond, 0, 0.3 },
+    }
+
+    for _, test := range tests {
+        stats := createLinkStats(0x001, nil)
+        stats.ExpectGap(time.Second)
+        now := time.Now()
+        stats.NewSession(now)
+
+        for i := 0; i < test.count; i++ {
+            now = now.Add(test.gaps[i % len(test.gaps)])
+            stats.Received(now, true)
+        }
+
+        phi, quiet := stats.Phi(now.Add(test.quiet))
+        if quiet != test.quiet { t.Errorf("%s: quiet for %v, expected %v", test.name, quiet, test.quiet) }
+        if phi < test.minPhi || phi > test.maxPhi {
+            t.Errorf("%s: phi %.3f, expected %.3f to %.3f", test.name, phi, test.minPhi, test.maxPhi)
+        }
+    }
+}
@@ -0,0 +1,305 @@
+/* Live metrics, served over HTTP in Prometheus text format.
+
+This gives a dashboard the same view of the swarm as the stats command, continuously, so RF health at a venue can be
+watched during a quiz:
+  Per buzzer: connection state, failure detector suspicion, connects and resumes, gap between heartbeats and probe round
+    trip time histograms, clock sync error, send queue backlog, and the latest telemetry.
+  Mode broadcast latency and spread histograms, and broadcasts missed.
+  Press to decision latency histograms.
+  Lengths of the request queues of each of our central Go routines, and of our output streams.
+
+While there's more than one room, see room.go, everything specific to a room is labelled with the room's name.
+
+Histograms and counters are for the whole run of this program, never reset, as Prometheus expects. Queue lengths are
+read directly, so they're still reported when a Go routine is too busy to answer. Anything that has to be asked for
+is left out of that scrape if it takes too long to come back.
+
+We write the text format ourselves, rather than using a client library, since what we need from it is small.
+
+*/
+
+package main
+
+import "bytes"
+import "fmt"
+import "net/http"
+import "time"
+
+
+// External interface.
+
+// Serve metrics for the given rooms over HTTP on the given address, at /metrics.
+// Returns immediately. Errors are reported on the connect stream.
+func ServeMetrics(address string, rooms *Rooms) {
+    p := &metricsServer{ rooms: rooms }
+
+    mux := http.NewServeMux()
+    mux.HandleFunc("/metrics", p.handle)
+
+    go func() {
+        StreamConnect.Printf("Serving metrics on %s\n", address)
+        if err := http.ListenAndServe(address, mux); err != nil {
+            StreamConnect.Printf("Error serving metrics: %v\n", err)
+        }
+    }()
+}
+
+
+// Internals.
+
+// How long to wait for a Go routine to hand over its metrics.
+const (
+    MetricsTimeout = 500 * time.Millisecond
+)
+
+
+// Metrics taken from the controller.
+type controllerMetrics struct {
+    state ConStTypeEnum
+    pressToDecision Histogram
+    receiveToDecision Histogram
+}
+
+
+// Metrics taken from the swarm.
+type swarmMetrics struct {
+    buzzers []buzzerMetrics  // In ID order.
+    broadcastLatency Histogram
+    broadcastSpread Histogram
+    broadcastMissed int
+}
+
+
+// Metrics for a single buzzer.
+type buzzerMetrics struct {
+    id int
+    room string  // Label for the buzzer's room. Empty for none.
+    connected bool
+    suspect bool
+    connects int
+    resumes int
+    stats linkSnapshot
+    phi float64  // 0 if not connected.
+    sendQueue int  // Messages waiting to be sent. 0 if not connected.
+    clockError time.Duration  // Clock sync error bound. 0 if unsynced.
+    telemetry *Telemetry  // nil if none.
+}
+
+
+// HTTP server for our metrics.
+type metricsServer struct {
+    rooms *Rooms
+}
+
+
+// Builds up metrics in Prometheus text format.
+type metricsWriter struct {
+    bytes.Buffer
+}
+
+
+// Handle a request for our metrics.
+func (this *metricsServer) handle(w http.ResponseWriter, r *http.Request) {
+    var m metricsWriter
+    rooms := this.rooms.All()
+
+    // Queue lengths first, since they need nobody's help.
+    m.family("quiz_request_queue", "gauge", "Requests waiting for each central Go routine")
+    for _, room := range rooms {
+        m.value("quiz_request_queue", joinLabels(room.label, `actor="swarm"`), float64(len(room.swarm.requests)))
+        m.value("quiz_request_queue", joinLabels(room.label, `actor="controller"`),
+            float64(len(room.controller.requests)))
+        m.value("quiz_request_queue", joinLabels(room.label, `actor="scoreboard"`),
+            float64(len(room.scoreboard.requests)))
+    }
+
+    m.family("quiz_press_queue", "gauge", "Button presses waiting for the controller")
+    for _, room := range rooms { m.value("quiz_press_queue", room.label, float64(len(room.controller.presses))) }
+
+    m.family("quiz_output_queue", "gauge", "Lines waiting to be written to each output stream")
+    for stream := OutputStream(0); stream < StreamCount; stream++ {
+        m.value("quiz_output_queue", fmt.Sprintf(`stream="%s"`, stream.Name()), float64(len(_streams[stream].lines)))
+    }
+
+    // Rooms that don't answer in time are left out.
+    controllers := make([]*controllerMetrics, len(rooms))
+    swarms := make([]*swarmMetrics, len(rooms))
+    for i, room := range rooms {
+        if c, ok := room.controller.Metrics(); ok { controllers[i] = &c }
+        if s, ok := room.swarm.Metrics(); ok { swarms[i] = &s }
+    }
+
+    this.writeControllers(&m, rooms, controllers)
+    this.writeSwarms(&m, rooms, swarms)
+
+    w.Header().Set("Content-Type", "text/plain; version=0.0.4")
+    w.Write(m.Bytes())
+}
+
+
+// Write the given controller metrics, from each of the given rooms. Those that are nil are skipped.
+func (this *metricsServer) writeControllers(m *metricsWriter, rooms []*Room, controllers []*controllerMetrics) {
+    m.family("quiz_state", "gauge", "Controller state: 0 idle, 1 test, 2 asked, 3 answered, 4 bonus")
+    for i, c := range controllers {
+        if c != nil { m.value("quiz_state", rooms[i].label, float64(c.state)) }
+    }
+
+    m.family("quiz_press_to_decision_seconds", "histogram",
+        "Time from each winning press, by its press time, to its buzzer being told it won")
+    for i, c := range controllers {
+        if c != nil { m.histogram("quiz_press_to_decision_seconds", rooms[i].label, &c.pressToDecision) }
+    }
+
+    m.family("quiz_receive_to_decision_seconds", "histogram",
+        "Time from receiving the first press of a question to deciding its answer, including arbitration")
+    for i, c := range controllers {
+        if c != nil { m.histogram("quiz_receive_to_decision_seconds", rooms[i].label, &c.receiveToDecision) }
+    }
+}
+
+
+// Write the given swarm metrics, from each of the given rooms. Those that are nil are skipped.
+func (this *metricsServer) writeSwarms(m *metricsWriter, rooms []*Room, swarms []*swarmMetrics) {
+    m.family("quiz_mode_broadcast_latency_seconds", "histogram",
+        "Time from sending each mode broadcast to the last buzzer applying it")
+    for i, s := range swarms {
+        if s != nil { m.histogram("quiz_mode_broadcast_latency_seconds", rooms[i].label, &s.broadcastLatency) }
+    }
+
+    m.family("quiz_mode_broadcast_spread_seconds", "histogram",
+        "Time from the first buzzer applying each mode broadcast to the last")
+    for i, s := range swarms {
+        if s != nil { m.histogram("quiz_mode_broadcast_spread_seconds", rooms[i].label, &s.broadcastSpread) }
+    }
+
+    m.family("quiz_mode_broadcasts_missed_total", "counter", "Times buzzers haven't reported applying a broadcast")
+    for i, s := range swarms {
+        if s != nil { m.value("quiz_mode_broadcasts_missed_total", rooms[i].label, float64(s.broadcastMissed)) }
+    }
+
+    // Each family must be written together, so we gather every room's buzzers, and run through them once for each.
+    var buzzers []buzzerMetrics
+    for i, s := range swarms {
+        if s == nil { continue }
+
+        for _, b := range s.buzzers {
+            b.room = rooms[i].label
+            buzzers = append(buzzers, b)
+        }
+    }
+
+    m.family("quiz_buzzer_connected", "gauge", "Whether each buzzer is connected")
+    for _, b := range buzzers { m.value("quiz_buzzer_connected", b.label(), boolMetric(b.connected)) }
+
+    m.family("quiz_buzzer_suspect", "gauge", "Whether the failure detector suspects each buzzer")
+    for _, b := range buzzers { m.value("quiz_buzzer_suspect", b.label(), boolMetric(b.suspect)) }
+
+    m.family("quiz_buzzer_phi", "gauge", "Failure detector suspicion level of each connected buzzer")
+    for _, b := range buzzers {
+        if b.connected { m.value("quiz_buzzer_phi", b.label(), b.phi) }
+    }
+
+    m.family("quiz_buzzer_connects_total", "counter", "Connections from each buzzer")
+    for _, b := range buzzers { m.value("quiz_buzzer_connects_total", b.label(), float64(b.connects)) }
+
+    m.family("quiz_buzzer_resumes_total", "counter", "Connections from each buzzer that resumed its session")
+    for _, b := range buzzers { m.value("quiz_buzzer_resumes_total", b.label(), float64(b.resumes)) }
+
+    m.family("quiz_buzzer_send_queue", "gauge", "Messages waiting to be sent to each connected buzzer")
+    for _, b := range buzzers {
+        if b.connected { m.value("quiz_buzzer_send_queue", b.label(), float64(b.sendQueue)) }
+    }
+
+    m.family("quiz_buzzer_clock_error_seconds", "gauge", "Clock sync error bound for each synced buzzer")
+    for _, b := range buzzers {
+        if b.clockError != 0 { m.value("quiz_buzzer_clock_error_seconds", b.label(), b.clockError.Seconds()) }
+    }
+
+    m.family("quiz_buzzer_gap_seconds", "histogram", "Gaps between heartbeats received from each buzzer")
+    for _, b := range buzzers { m.histogram("quiz_buzzer_gap_seconds", b.label(), &b.stats.gapTotal) }
+
+    m.family("quiz_buzzer_rtt_seconds", "histogram", "Probe round trip times to each buzzer")
+    for _, b := range buzzers { m.histogram("quiz_buzzer_rtt_seconds", b.label(), &b.stats.rttTotal) }
+
+    // Telemetry, for those buzzers that have sent any.
+    m.family("quiz_buzzer_rssi_dbm", "gauge", "Signal strength of each buzzer's AP, from its telemetry")
+    for _, b := range buzzers {
+        if b.telemetry != nil && b.telemetry.rssi != 0 {
+            m.value("quiz_buzzer_rssi_dbm", b.label(), float64(b.telemetry.rssi))
+        }
+    }
+
+    m.family("quiz_buzzer_battery_volts", "gauge", "Battery voltage of each buzzer, from its telemetry")
+    for _, b := range buzzers {
+        if b.telemetry != nil && b.telemetry.batteryMv != 0 {
+            m.value("quiz_buzzer_battery_volts", b.label(), float64(b.telemetry.batteryMv) / 1000)
+        }
+    }
+
+    m.family("quiz_buzzer_wifi_connects", "gauge", "WIFI connections since each buzzer booted, from its telemetry")
+    for _, b := range buzzers {
+        if b.telemetry != nil { m.value("quiz_buzzer_wifi_connects", b.label(), float64(b.telemetry.wifiConnects)) }
+    }
+
+    m.family("quiz_buzzer_send_failures", "gauge", "Failed sends since each buzzer booted, from its telemetry")
+    for _, b := range buzzers {
+        if b.telemetry != nil { m.value("quiz_buzzer_send_failures", b.label(), float64(b.telemetry.sendFailures)) }
+    }
+}
+
+
+// Report the labels identifying this buzzer.
+func (this *buzzerMetrics) label() string {
+    return joinLabels(this.room, fmt.Sprintf(`buzzer="%s"`, BuzzerIdToString(this.id)))
+}
+
+
+// Combine the given labels, either of which may be empty.
+func joinLabels(a string, b string) string {
+    if a == "" { return b }
+    if b == "" { return a }
+    return a + "," + b
+}
+
+
+// Write the header for a metric family.
+func (this *metricsWriter) family(name string, kind string, help string) {
+    fmt.Fprintf(this, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, kind)
+}
+
+
+// Write a single value, with the given labels, which may be empty.
+func (this *metricsWriter) value(name string, labels string, v float64) {
+    if labels == "" {
+        fmt.Fprintf(this, "%s %g\n", name, v)
+    } else {
+        fmt.Fprintf(this, "%s{%s} %g\n", name, labels, v)
+    }
+}
+
+
+// Write the given histogram, with the given labels, which may be empty.
+func (this *metricsWriter) histogram(name string, labels string, h *Histogram) {
+    sep := ""
+    if labels != "" { sep = "," }
+
+    var seen uint64
+    for i, bound := range histogramBounds {
+        seen += h.counts[i]
+        fmt.Fprintf(this, "%s_bucket{%s%sle=\"%g\"} %d\n", name, labels, sep, bound.Seconds(), seen)
+    }
+
+    fmt.Fprintf(this, "%s_bucket{%s%sle=\"+Inf\"} %d\n", name, labels, sep, h.Count())
+
+    labels = "{" + labels + "}"
+    if labels == "{}" { labels = "" }
+    fmt.Fprintf(this, "%s_sum%s %g\n", name, labels, h.Sum().Seconds())
+    fmt.Fprintf(this, "%s_count%s %d\n", name, labels, h.Count())
+}
+
+
+// Convert the given flag to a metric value.
+func boolMetric(b bool) float64 {
+    if b { return 1 }
+    return 0
+}
@@ -0,0 +1,498 @@
+/* Firmware updates over the air.
+
+A firmware image is streamed to buzzers over their TCP connections, see Protocol.txt. Any number of buzzers can be
+updated in one rollout, but only a few are sent to at once, so the quiz WIFI isn't swamped. The rest wait their turn.
+Each buzzer being sent to has only a small window of chunks in flight, unacknowledged, so it never has more than that
+queued ahead of other messages to it.
+
+Updates are paused while a question is open, so the WIFI is free for presses and no buzzer stalls writing flash, or
+restarts into new firmware, mid question. Chunks already in flight are still acknowledged, but nothing more is sent
+until the question is over. Time paused doesn't count towards timeouts or throughput.
+
+Progress and throughput of each buzzer being updated are reported regularly. An update that fails, or gets no reply
+in time, is abandoned, and that buzzer keeps its current firmware. Verified buzzers restart into their new firmware,
+which rolls itself back if it can't reach us.
+
+The image is read from its file at the start of each rollout, so it can be replaced without restarting us.
+
+*/
+
+package main
+
+import "crypto/sha256"
+import "fmt"
+import "io/ioutil"
+import "sort"
+import "time"
+
+
+// External interface.
+
+// Create a firmware updater for the given room, for buzzers in its swarm, with the image in the given file.
+func CreateOta(room *Room, swarm *Swarm, imagePath string) *Ota {
+    var p Ota
+    p.room = room
+    p.swarm = swarm
+    p.imagePath = imagePath
+    p.jobs = make(map[int]*otaJob)
+    p.epoch = time.Now()
+    p.requests = make(chan func(), 1000)
+
+    swarm.SetOta(&p)
+    go p.run()
+
+    cmdProc := room.cmdProc
+    cmdProc.AddCommand(p.commandStop, "Abandon all firmware updates", "otastop")
+    cmdProc.AddCommand(p.commandStatus, "Show firmware update progress", "otastat")
+    cmdProc.AddCommand(p.commandAll, "Update firmware on all connected buzzers", "otaall")
+    cmdProc.AddCommand(p.commandOne, "Update firmware on 1 buzzer", "ota", LEX_BUZ_ID)
+
+    return &p
+}
+
+
+// Update the firmware on the given buzzers.
+// Buzzers already being updated, or whose firmware can't be updated, are skipped.
+func (this *Ota) Start(buzzers []*Buzzer) {
+    this.requests <- func() {
+        this.start(buzzers)
+    }
+}
+
+
+// Pause or resume updates.
+// Does nothing if this is nil.
+func (this *Ota) SetPaused(paused bool) {
+    if this == nil { return }
+
+    this.requests <- func() {
+        if paused == this.paused { return }  // No change.
+
+        now := time.Now()
+        this.paused = paused
+
+        if paused {
+            this.pausedAt = now
+            if len(this.jobs) > 0 { StreamConnect.In(this.room).Printf("Firmware updates paused\n") }
+            return
+        }
+
+        this.pausedTotal += now.Sub(this.pausedAt)
+        if len(this.jobs) > 0 { StreamConnect.In(this.room).Printf("Firmware updates resumed\n") }
+
+        // Timeouts start again, and whatever was held back can go now.
+        for _, job := range this.jobs {
+            if job.state != otaWaiting {
+                job.waitingSince = now
+                this.sendNext(job)
+            }
+        }
+
+        this.startJobs()
+    }
+}
+
+
+// Report update status from a buzzer, with the number of image bytes it's written.
+// Does nothing if this is nil.
+func (this *Ota) Status(id int, buzzer *Buzzer, status byte, written int) {
+    if this == nil { return }
+
+    this.requests <- func() {
+        this.handleStatus(id, buzzer, status, written)
+    }
+}
+
+
+// Report disconnection from a buzzer.
+// Does nothing if this is nil.
+func (this *Ota) Disconnected(id int, buzzer *Buzzer) {
+    if this == nil { return }
+
+    this.requests <- func() {
+        job, ok := this.jobs[id]
+        if !ok || job.buzzer != buzzer { return }
+
+        this.fail(job, "disconnected", false)
+    }
+}
+
+
+// Firmware updater.
+type Ota struct {
+    room *Room
+    swarm *Swarm
+    imagePath string
+    image []byte  // Image for the current rollout.
+    sha [32]byte  // SHA-256 of the image.
+    jobs map[int]*otaJob  // Buzzers being updated or waiting their turn, indexed by ID.
+    queue []*otaJob  // Jobs waiting their turn, in order.
+    paused bool
+    epoch time.Time  // When we started, for measuring time not paused.
+    pausedAt time.Time  // When we were last paused.
+    pausedTotal time.Duration  // Total time paused, not including any current pause.
+    requests chan func()  // All requests are handling in the central Go routine.
+}
+
+
+// Internals.
+
+// Update settings.
+const (
+    OtaConcurrency = 4  // Buzzers sent to at once.
+    OtaChunkSize = 1024  // Largest chunk the buzzers accept.
+    OtaWindow = 4  // Chunks in flight to each buzzer.
+    OtaBeginTimeout = 30 * time.Second  // Buzzers erase flash before replying to begin.
+    OtaChunkTimeout = 10 * time.Second
+    OtaEndTimeout = 30 * time.Second  // Buzzers read back and check the whole image before replying to end.
+    OtaCheckInterval = time.Second  // How often we check for timeouts.
+    OtaReportInterval = 5 * time.Second  // How often we report progress.
+)
+
+// Status values from buzzers.
+const (
+    OtaStatusOk = 0
+    OtaStatusDone = 1
+    OtaStatusBeginFailed = 2
+    OtaStatusWriteFailed = 3
+    OtaStatusVerifyFailed = 4
+)
+
+// States of each buzzer's update.
+const (
+    otaWaiting = iota  // Waiting for its turn.
+    otaStarting  // Begin sent, waiting for the buzzer to be ready.
+    otaSending  // Sending the image.
+    otaFinishing  // End sent, waiting for the buzzer to verify the image.
+)
+
+type otaJobState int
+
+
+// The update of a single buzzer.
+type otaJob struct {
+    id int
+    buzzer *Buzzer
+    state otaJobState
+    sent int  // Bytes of image sent.
+    written int  // Bytes of image the buzzer reports it has written.
+    started time.Time  // When we sent begin.
+    sendingFrom time.Duration  // Time not paused when we started sending the image.
+    waitingSince time.Time  // When we started waiting for the buzzer's current reply.
+}
+
+
+// Handles requests in a single thread.
+// Never returns. Should be called as a Go routine.
+func (this *Ota) run() {
+    checkTicker := time.NewTicker(OtaCheckInterval)
+    reportTicker := time.NewTicker(OtaReportInterval)
+
+    // Process incoming messages forever.
+    for {
+        select {
+        case request := <-this.requests:
+            request()
+
+        case <-checkTicker.C:
+            this.checkTimeouts()
+
+        case <-reportTicker.C:
+            if len(this.jobs) > 0 { this.report() }
+        }
+    }
+}
+
+
+// Update the firmware on the given buzzers.
+func (this *Ota) start(buzzers []*Buzzer) {
+    if len(this.jobs) == 0 && !this.loadImage() { return }
+
+    added := 0
+    for _, buzzer := range buzzers {
+        if !buzzer.framed {
+            StreamInput.In(this.room).Printf("Buzzer %s firmware can't be updated over the air\n", buzzer.ID())
+            continue
+        }
+
+        if _, ok := this.jobs[buzzer.id]; ok {
+            StreamInput.In(this.room).Printf("Buzzer %s already being updated\n", buzzer.ID())
+            continue
+        }
+
+        job := &otaJob{ id: buzzer.id, buzzer: buzzer, state: otaWaiting }
+        this.jobs[job.id] = job
+        this.queue = append(this.queue, job)
+        added++
+    }
+
+    if added == 0 { return }
+
+    StreamConnect.In(this.room).Printf("Updating firmware on %d buzzers, %d at a time, %d bytes\n", added,
+        OtaConcurrency, len(this.image))
+    if this.paused { StreamConnect.In(this.room).Printf("Firmware updates paused until the question is over\n") }
+
+    this.startJobs()
+}
+
+
+// Load our image for a new rollout.
+// Returns false on error, which has been reported.
+func (this *Ota) loadImage() bool {
+    image, err := ioutil.ReadFile(this.imagePath)
+    if err != nil {
+        StreamInput.In(this.room).Printf("Cannot read firmware image: %v\n", err)
+        return false
+    }
+
+    if len(image) == 0 {
+        StreamInput.In(this.room).Printf("Firmware image %s is empty\n", this.imagePath)
+        return false
+    }
+
+    this.image = image
+    this.sha = sha256.Sum256(image)
+    return true
+}
+
+
+// Start waiting jobs, as far as our concurrency allows.
+func (this *Ota) startJobs() {
+    if this.paused { return }
+
+    running := len(this.jobs) - len(this.queue)
+    now := time.Now()
+
+    for running < OtaConcurrency && len(this.queue) > 0 {
+        job := this.queue[0]
+        this.queue = this.queue[1:]
+
+        job.state = otaStarting
+        job.started = now
+        job.waitingSince = now
+        job.buzzer.SendOtaBegin(len(this.image), this.sha)
+        running++
+    }
+}
+
+
+// Send the given job whatever it's ready for, up to its window: chunks of image, then the end once the buzzer has
+// written it all.
+func (this *Ota) sendNext(job *otaJob) {
+    if this.paused || job.state != otaSending { return }
+
+    for job.sent < len(this.image) && (job.sent - job.written) < (OtaWindow * OtaChunkSize) {
+        end := job.sent + OtaChunkSize
+        if end > len(this.image) { end = len(this.image) }
+
+        job.buzzer.SendOtaData(job.sent, this.image[job.sent:end])
+        job.sent = end
+    }
+
+    if job.written == len(this.image) {
+        job.state = otaFinishing
+        job.waitingSince = time.Now()
+        job.buzzer.SendOtaEnd()
+    }
+}
+
+
+// Handle update status from a buzzer.
+func (this *Ota) handleStatus(id int, buzzer *Buzzer, status byte, written int) {
+    job, ok := this.jobs[id]
+    if !ok || job.buzzer != buzzer || job.state == otaWaiting { return }  // Not ours, ignore.
+
+    now := time.Now()
+
+    switch status {
+    case OtaStatusOk:
+        if job.state == otaFinishing || written < job.written || written > job.sent {
+            this.fail(job, fmt.Sprintf("unexpected progress %d bytes", written), true)
+            return
+        }
+
+        if job.state == otaStarting {
+            job.state = otaSending
+            job.sendingFrom = this.active(now)
+        }
+
+        job.written = written
+        job.waitingSince = now
+        this.sendNext(job)
+
+    case OtaStatusDone:
+        if job.state != otaFinishing {
+            this.fail(job, "unexpected completion", true)
+            return
+        }
+
+        StreamConnect.In(this.room).Printf("Buzzer %s firmware updated in %.1fs, %.1fKB/s, restarting\n",
+            BuzzerIdToString(id), now.Sub(job.started).Seconds(), this.throughput(job, now))
+        this.finish(job)
+
+    case OtaStatusBeginFailed:
+        this.fail(job, "buzzer couldn't start update", false)
+
+    case OtaStatusWriteFailed:
+        this.fail(job, fmt.Sprintf("buzzer couldn't write after %d bytes", written), false)
+
+    case OtaStatusVerifyFailed:
+        this.fail(job, "image failed verification", false)
+
+    default:
+        this.fail(job, fmt.Sprintf("unknown status %d", status), true)
+    }
+}
+
+
+// Abandon the given job, for the given reason, telling the buzzer to abandon it too if asked.
+func (this *Ota) fail(job *otaJob, reason string, abort bool) {
+    StreamConnect.In(this.room).Printf("Buzzer %s firmware update failed, %s\n", BuzzerIdToString(job.id), reason)
+    if abort && job.state != otaWaiting { job.buzzer.SendOtaAbort() }
+    this.finish(job)
+}
+
+
+// Remove the given job, which has finished one way or another, and start the next.
+func (this *Ota) finish(job *otaJob) {
+    delete(this.jobs, job.id)
+
+    for i, waiting := range this.queue {
+        if waiting == job {
+            this.queue = append(this.queue[:i], this.queue[i + 1:]...)
+            break
+        }
+    }
+
+    if len(this.jobs) == 0 { StreamConnect.In(this.room).Printf("Firmware updates finished\n") }
+    this.startJobs()
+}
+
+
+// Abandon any jobs whose buzzers haven't replied in time.
+func (this *Ota) checkTimeouts() {
+    if this.paused { return }  // Time paused doesn't count.
+
+    now := time.Now()
+    for _, job := range this.jobs {
+        timeout := OtaChunkTimeout
+        switch job.state {
+        case otaWaiting:   continue
+        case otaStarting:  timeout = OtaBeginTimeout
+        case otaFinishing: timeout = OtaEndTimeout
+        }
+
+        if now.Sub(job.waitingSince) >= timeout {
+            this.fail(job, fmt.Sprintf("no reply for %v", timeout), true)
+        }
+    }
+}
+
+
+// Print the progress of each buzzer being updated, in ID order.
+func (this *Ota) report() {
+    ids := make([]int, 0, len(this.jobs))
+    for id := range this.jobs {
+        ids = append(ids, id)
+    }
+    sort.Ints(ids)
+
+    out := StreamConnect.In(this.room)
+    now := time.Now()
+    total := 0.0
+    for _, id := range ids {
+        job := this.jobs[id]
+        switch job.state {
+        case otaWaiting:
+            // Summarised below.
+
+        case otaStarting:
+            out.Printf("%3s: starting\n", BuzzerIdToString(id))
+
+        case otaSending, otaFinishing:
+            rate := this.throughput(job, now)
+            total += rate
+            out.Printf("%3s: %3d%% %7d/%d bytes %6.1fKB/s\n", BuzzerIdToString(id),
+                job.written * 100 / len(this.image), job.written, len(this.image), rate)
+        }
+    }
+
+    paused := ""
+    if this.paused { paused = ", paused" }
+    out.Printf("Firmware updates: %d running, %d waiting, %.1fKB/s%s\n", len(this.jobs) - len(this.queue),
+        len(this.queue), total, paused)
+}
+
+
+// Report the time we've spent not paused, up to the given time.
+func (this *Ota) active(now time.Time) time.Duration {
+    active := now.Sub(this.epoch) - this.pausedTotal
+    if this.paused { active -= now.Sub(this.pausedAt) }
+    return active
+}
+
+
+// Report the throughput of the given job, in KB written per second not paused.
+func (this *Ota) throughput(job *otaJob, now time.Time) float64 {
+    if job.state != otaSending && job.state != otaFinishing { return 0 }
+
+    elapsed := (this.active(now) - job.sendingFrom).Seconds()
+    if elapsed <= 0 { return 0 }
+    return float64(job.written) / 1024 / elapsed
+}
+
+
+// Command handler for updating all connected buzzers.
+func (this *Ota) commandAll(value ...int) {
+    var buzzers []*Buzzer
+    for _, buzzer := range this.swarm.Buzzers() {
+        if buzzer.framed { buzzers = append(buzzers, buzzer) }
+    }
+
+    if len(buzzers) == 0 {
+        StreamInput.In(this.room).Printf("No connected buzzers can be updated\n")
+        return
+    }
+
+    sort.Slice(buzzers, func(i, j int) bool { return buzzers[i].id < buzzers[j].id })
+    this.Start(buzzers)
+}
+
+
+// Command handler for updating one buzzer.
+func (this *Ota) commandOne(value ...int) {
+    buzzer, ok := this.swarm.Buzzers()[value[0]]
+    if !ok {
+        StreamInput.In(this.room).Printf("Buzzer %s not connected\n", BuzzerIdToString(value[0]))
+        return
+    }
+
+    this.Start([]*Buzzer{buzzer})
+}
+
+
+// Command handler for showing update progress.
+func (this *Ota) commandStatus(value ...int) {
+    this.requests <- func() {
+        if len(this.jobs) == 0 {
+            StreamInput.In(this.room).Printf("No firmware updates in progress\n")
+            return
+        }
+
+        this.report()
+    }
+}
+
+
+// Command handler for abandoning all updates.
+func (this *Ota) commandStop(value ...int) {
+    this.requests <- func() {
+        for _, job := range this.jobs {
+            if job.state != otaWaiting { job.buzzer.SendOtaAbort() }
+        }
+
+        if len(this.jobs) > 0 { StreamConnect.In(this.room).Printf("Abandoned %d firmware updates\n", len(this.jobs)) }
+        this.jobs = make(map[int]*otaJob)
+        this.queue = nil
+    }
+}
@@ -0,0 +1,98 @@
+/* Tests for firmware updates, using the fake buzzers from replay_test.go. */
+
+package main
+
+import "bytes"
+import "io/ioutil"
+import "testing"
+import "time"
+
+
+// Check a rollout to more buzzers than we update at once reaches them all, never exceeding our concurrency.
+func TestOtaRollout(t *testing.T) {
+    ids := []int{0x001, 0x002, 0x101, 0x102, 0x201, 0x202}
+    rig := createRig(t, ids...)
+    defer rig.Close()
+
+    image := writeOtaImage(t, rig, 10 * OtaChunkSize + 100)
+    rig.ota.commandAll()
+
+    running := make(map[int]bool)
+    updated := make(map[int]bool)
+    timeout := time.After(ReplayTimeout)
+
+    for len(updated) < len(ids) {
+        select {
+        case u := <-rig.updates:
+            switch u.cmd {
+            case CmdOtaBegin:
+                running[u.id] = true
+                if len(running) > OtaConcurrency {
+                    t.Fatalf("%d buzzers updating at once, limit %d", len(running), OtaConcurrency)
+                }
+
+            case CmdOtaEnd:
+                delete(running, u.id)
+                if !u.verified || !bytes.Equal(u.image, image) {
+                    t.Fatalf("Buzzer %s got a bad image", BuzzerIdToString(u.id))
+                }
+                updated[u.id] = true
+
+            case CmdOtaAbort:
+                t.Fatalf("Buzzer %s update abandoned", BuzzerIdToString(u.id))
+            }
+
+        case <-timeout:
+            t.Fatalf("Only %d of %d buzzers updated", len(updated), len(ids))
+        }
+    }
+}
+
+
+// Check nothing is sent while a question is open, and the update goes ahead once it's over.
+func TestOtaPausedDuringQuestion(t *testing.T) {
+    rig := createRig(t, 0x001, 0x101)
+    defer rig.Close()
+
+    image := writeOtaImage(t, rig, 3 * OtaChunkSize)
+    rig.Ask(0x0F)
+    rig.ota.commandOne(0x001)
+
+    select {
+    case u := <-rig.updates:
+        t.Fatalf("Buzzer %s sent update message 0x%02X during a question", BuzzerIdToString(u.id), u.cmd)
+
+    case <-time.After(200 * time.Millisecond):
+    }
+
+    rig.controller.commandIdle()
+
+    timeout := time.After(ReplayTimeout)
+    for {
+        select {
+        case u := <-rig.updates:
+            if u.cmd != CmdOtaEnd { continue }
+
+            if u.id != 0x001 || !u.verified || !bytes.Equal(u.image, image) {
+                t.Fatalf("Buzzer %s got a bad image", BuzzerIdToString(u.id))
+            }
+            return
+
+        case <-timeout:
+            t.Fatalf("Update never finished")
+        }
+    }
+}
+
+
+// Write a firmware image of the given size for the given rig's updater, and return it.
+func writeOtaImage(t *testing.T, rig *testRig, size int) []byte {
+    image := make([]byte, size)
+    for i := range image { image[i] = byte(i * 7) }
+
+    if err := ioutil.WriteFile(rig.otaImagePath, image, 0644); err != nil {
+        t.Fatalf("Cannot write firmware image: %v", err)
+    }
+
+    return image
+}
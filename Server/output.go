@@ -0,0 +1,351 @@
+/* Output streams.
+
+All our output goes to one of a few streams, so that each can be sent somewhere different:
+  connect  Connectivity: buzzers coming and going, slow or unhealthy links, link stats and traces.
+  score    Scoring: marks given and the scoreboard.
+  control  Quiz control: questions, answers and modes.
+  input    Operator input: usage and command errors.
+
+By default all streams go to the console. Any can instead go to a file, a terminal pane (a file such as /dev/pts/3 or
+a named pipe), or a socket, given as tcp:host:port or unix:path. Lines not sent to the console are timestamped.
+
+Output is asynchronous. Each stream has its own queue and Go routine, so a slow destination only holds up its own
+stream, and the code producing the output never waits for it. Scoring, control and input lines are never dropped; if
+their queue somehow fills, the producer waits. Connectivity lines are dropped rather than wait, and counted, except
+for those the operator asked for, such as stats, which wait like the others.
+
+When several rooms share this server, see room.go, each writes to the same streams, with every line prefixed by the
+room's name.
+
+Connectivity output can get noisy when many buzzers misbehave at once, so noisy events are coalesced and rate
+limited. The first event with a given key is shown straight away, and any more with the same key within a period are
+counted and summarised at the end of it. Noisy events beyond a rate limit are counted and summarised too.
+
+*/
+
+package main
+
+import "fmt"
+import "io"
+import "net"
+import "os"
+import "strings"
+import "sync"
+import "sync/atomic"
+import "time"
+
+
+// External interface.
+
+// Output streams.
+const (
+    StreamConnect OutputStream = iota
+    StreamScore
+    StreamControl
+    StreamInput
+    StreamCount
+)
+
+type OutputStream int
+
+
+// Write the given formatted output to this stream.
+func (this OutputStream) Printf(format string, a ...interface{}) {
+    _streams[this].add(outputLine{ text: fmt.Sprintf(format, a...) })
+}
+
+
+// Write the given formatted output to this stream as a noisy event, coalesced with others with the same key.
+func (this OutputStream) Noisy(key string, format string, a ...interface{}) {
+    _streams[this].add(outputLine{ text: fmt.Sprintf(format, a...), key: key })
+}
+
+
+// Report this stream, for output from the given room, which may be nil. If the room shares this server with others,
+// each line is prefixed with its name.
+func (this OutputStream) In(room *Room) RoomStream {
+    p := RoomStream{ stream: this }
+    if room != nil { p.prefix = room.prefix }
+    return p
+}
+
+
+// Write the given formatted output to this stream, prefixing each line with our room's name, if any.
+func (this RoomStream) Printf(format string, a ...interface{}) {
+    _streams[this.stream].add(outputLine{ text: prefixLines(this.prefix, fmt.Sprintf(format, a...)) })
+}
+
+
+// Write the given formatted output to this stream as a noisy event, coalesced with others from our room with the same
+// key.
+func (this RoomStream) Noisy(key string, format string, a ...interface{}) {
+    _streams[this.stream].add(outputLine{ text: prefixLines(this.prefix, fmt.Sprintf(format, a...)),
+        key: this.prefix + key })
+}
+
+
+// Write the given formatted output, which the operator asked for, to this stream, prefixing each line with our
+// room's name, if any. Waits rather than drop it, even on a lossy stream.
+func (this RoomStream) Requested(format string, a ...interface{}) {
+    _streams[this.stream].add(outputLine{ text: prefixLines(this.prefix, fmt.Sprintf(format, a...)), requested: true })
+}
+
+
+// An output stream, as used by a single room.
+type RoomStream struct {
+    stream OutputStream
+    prefix string  // Added to the start of every line. Empty for none.
+}
+
+
+// Report the name of this stream.
+func (this OutputStream) Name() string {
+    return _streams[this].name
+}
+
+
+// Send this stream to the given destination: a file path, tcp:host:port, unix:path, or empty for the console.
+// Returns false on error, in which case the stream is left as it was.
+func (this OutputStream) SetOutput(dest string) bool {
+    var out io.Writer
+    var err error
+
+    switch {
+    case dest == "":
+        out = os.Stdout
+
+    case strings.HasPrefix(dest, "tcp:"):
+        out, err = net.Dial("tcp", dest[4:])
+
+    case strings.HasPrefix(dest, "unix:"):
+        out, err = net.Dial("unix", dest[5:])
+
+    default:
+        out, err = os.OpenFile(dest, os.O_WRONLY | os.O_CREATE | os.O_APPEND, 0644)
+    }
+
+    if err != nil {
+        fmt.Printf("Cannot open %s output %s: %v\n", this.Name(), dest, err)
+        return false
+    }
+
+    _streams[this].setWriter(out, dest != "")
+    return true
+}
+
+
+// Send this stream to the given writer, without timestamps. For tests.
+func (this OutputStream) SetWriter(out io.Writer) {
+    _streams[this].setWriter(out, false)
+}
+
+
+// Wait until all output queued so far on all streams has been written.
+// Call before exiting, so nothing is lost.
+func FlushOutput() {
+    for _, stream := range _streams {
+        done := make(chan struct{})
+        stream.lines <- outputLine{ flushed: done }
+        <-done
+    }
+}
+
+
+// Internals.
+
+// Output settings.
+const (
+    OutputQueueSize = 1000  // Lines each stream can queue before dropping or waiting.
+    CoalescePeriod = time.Second  // How long repeats of a noisy event are gathered before being summarised.
+    NoisyRate = 10  // Noisy events shown per second, after the burst.
+    NoisyBurst = 20  // Noisy events that can be shown at once.
+)
+
+
+// A single queued piece of output.
+type outputLine struct {
+    text string
+    key string  // Coalescing key for noisy events. Empty for normal output.
+    requested bool  // Whether the operator asked for this, so it must not be dropped.
+    flushed chan struct{}  // If not nil, this isn't output but a request to close this once all before it is written.
+}
+
+
+// Repeats of a noisy event, gathered during a coalescing period.
+type coalesced struct {
+    until time.Time  // End of the period.
+    repeats int  // Events with this key since the first, not yet shown.
+    last string  // Text of the last of them.
+}
+
+
+// A single output stream, with its own queue and Go routine.
+type outputSink struct {
+    name string
+    lossy bool  // Whether to drop output, rather than wait, when our queue is full.
+    lines chan outputLine
+    dropped uint64  // Lines dropped when our queue was full, not yet reported. Atomic.
+    lock sync.Mutex  // Protects our destination.
+    out io.Writer
+    timestamps bool  // Whether to timestamp each line.
+    recent map[string]*coalesced  // Noisy events in their coalescing period, by key. Owned by our Go routine.
+    tokens float64  // Noisy events we may show now, for rate limiting. Owned by our Go routine.
+    refilled time.Time  // When tokens was last topped up.
+    suppressed int  // Noisy events dropped by rate limiting, not yet reported. Owned by our Go routine.
+}
+
+
+// Our streams, indexed by OutputStream.
+var _streams = []*outputSink{
+    createSink("connect", true),
+    createSink("score", false),
+    createSink("control", false),
+    createSink("input", false),
+}
+
+
+// Create an output stream, writing to the console, and start processing it.
+func createSink(name string, lossy bool) *outputSink {
+    var p outputSink
+    p.name = name
+    p.lossy = lossy
+    p.lines = make(chan outputLine, OutputQueueSize)
+    p.out = os.Stdout
+    p.recent = make(map[string]*coalesced)
+    p.tokens = NoisyBurst
+    p.refilled = time.Now()
+
+    go p.run()
+    return &p
+}
+
+
+// Queue the given line.
+// May be called from any thread context.
+func (this *outputSink) add(line outputLine) {
+    if !this.lossy || line.requested {
+        this.lines <- line
+        return
+    }
+
+    select {
+    case this.lines <- line:
+    default:
+        atomic.AddUint64(&this.dropped, 1)
+    }
+}
+
+
+// Change where this stream goes.
+// May be called from any thread context.
+func (this *outputSink) setWriter(out io.Writer, timestamps bool) {
+    this.lock.Lock()
+    old := this.out
+    this.out = out
+    this.timestamps = timestamps
+    this.lock.Unlock()
+
+    if closer, ok := old.(io.Closer); ok && old != os.Stdout { closer.Close() }
+}
+
+
+// Handles queued output in a single thread.
+// Never returns. Should be called as a Go routine.
+func (this *outputSink) run() {
+    ticker := time.NewTicker(CoalescePeriod / 4)
+
+    for {
+        select {
+        case line := <-this.lines:
+            switch {
+            case line.flushed != nil:
+                close(line.flushed)
+
+            case line.key != "":
+                this.noisy(line)
+
+            default:
+                this.write(line.text)
+            }
+
+        case now := <-ticker.C:
+            this.summarise(now)
+        }
+    }
+}
+
+
+// Handle the given noisy event.
+// Must only be called from our Go routine.
+func (this *outputSink) noisy(line outputLine) {
+    now := time.Now()
+
+    if rec, ok := this.recent[line.key]; ok {
+        // Already shown this period, save it for the summary.
+        rec.repeats++
+        rec.last = line.text
+        return
+    }
+
+    this.recent[line.key] = &coalesced{ until: now.Add(CoalescePeriod) }
+
+    // Top up our rate limit.
+    this.tokens += now.Sub(this.refilled).Seconds() * NoisyRate
+    if this.tokens > NoisyBurst { this.tokens = NoisyBurst }
+    this.refilled = now
+
+    if this.tokens < 1 {
+        this.suppressed++
+        return
+    }
+
+    this.tokens--
+    this.write(line.text)
+}
+
+
+// Summarise noisy events whose coalescing periods have ended, and any output we've had to drop.
+// Must only be called from our Go routine.
+func (this *outputSink) summarise(now time.Time) {
+    for key, rec := range this.recent {
+        if now.Before(rec.until) { continue }
+
+        if rec.repeats > 0 {
+            this.write(fmt.Sprintf("%s (and %d more like it in %v)\n", strings.TrimSuffix(rec.last, "\n"),
+                rec.repeats, CoalescePeriod))
+        }
+
+        delete(this.recent, key)
+    }
+
+    if this.suppressed > 0 {
+        this.write(fmt.Sprintf("%d noisy %s messages suppressed\n", this.suppressed, this.name))
+        this.suppressed = 0
+    }
+
+    if dropped := atomic.SwapUint64(&this.dropped, 0); dropped > 0 {
+        this.write(fmt.Sprintf("%d %s messages dropped, output too slow\n", dropped, this.name))
+    }
+}
+
+
+// Add the given prefix to the start of each line of the given text.
+func prefixLines(prefix string, text string) string {
+    if prefix == "" { return text }
+
+    body := strings.TrimSuffix(text, "\n")
+    return prefix + strings.Replace(body, "\n", "\n" + prefix, -1) + text[len(body):]
+}
+
+
+// Write the given text to our destination.
+// Must only be called from our Go routine.
+func (this *outputSink) write(text string) {
+    this.lock.Lock()
+    defer this.lock.Unlock()
+
+    if this.timestamps { text = time.Now().Format("15:04:05.000 ") + text }
+
+    // There's nowhere to report a failure to write output, so we just lose it.
+    io.WriteString(this.out, text)
+}
@@ -0,0 +1,97 @@
+/* Tests for output streams. */
+
+package main
+
+import "strings"
+import "sync"
+import "sync/atomic"
+import "testing"
+import "time"
+
+
+// Check repeats of a noisy event are shown once, then summarised at the end of the coalescing period.
+func TestNoisyCoalesced(t *testing.T) {
+    var out lockedBuffer
+    sink := createSink("test", true)
+    sink.setWriter(&out, false)
+
+    for i := 0; i < 5; i++ {
+        sink.add(outputLine{ text: "Slow message from B1\n", key: "slow B1" })
+    }
+
+    sink.add(outputLine{ text: "Other\n" })
+    time.Sleep(CoalescePeriod + CoalescePeriod / 2)
+
+    want := "Slow message from B1\nOther\nSlow message from B1 (and 4 more like it in 1s)\n"
+    if got := out.String(); got != want { t.Errorf("Got %q, expected %q", got, want) }
+}
+
+
+// Check noisy events with different keys beyond the rate limit are suppressed and counted.
+func TestNoisyRateLimited(t *testing.T) {
+    var out lockedBuffer
+    sink := createSink("test", true)
+    sink.setWriter(&out, false)
+
+    for i := 0; i < NoisyBurst + 5; i++ {
+        sink.add(outputLine{ text: "Slow\n", key: string(rune('A' + i)) })
+    }
+
+    time.Sleep(CoalescePeriod / 2)
+
+    got := out.String()
+    if n := strings.Count(got, "Slow\n"); n > NoisyBurst + 1 { t.Errorf("%d noisy lines shown, limit %d", n, NoisyBurst) }
+    if !strings.Contains(got, "messages suppressed") { t.Errorf("No suppressed count in %q", got) }
+}
+
+
+// Check lines the operator asked for wait for room, rather than being dropped, even on a lossy stream.
+func TestRequestedNotDropped(t *testing.T) {
+    var out lockedBuffer
+    out.lock.Lock()  // Hold up the sink's first write, so its queue fills.
+    sink := createSink("test", true)
+    sink.setWriter(&out, false)
+
+    count := OutputQueueSize * 2
+    queued := make(chan struct{})
+    go func() {
+        for i := 0; i < count; i++ {
+            sink.add(outputLine{ text: "Stats\n", requested: true })
+        }
+        close(queued)
+    }()
+
+    time.Sleep(50 * time.Millisecond)
+    out.lock.Unlock()
+    <-queued
+
+    done := make(chan struct{})
+    sink.lines <- outputLine{ flushed: done }
+    <-done
+
+    if n := strings.Count(out.String(), "Stats\n"); n != count {
+        t.Errorf("%d requested lines shown, expected %d", n, count)
+    }
+    if dropped := atomic.LoadUint64(&sink.dropped); dropped != 0 { t.Errorf("%d lines dropped", dropped) }
+}
+
+
+// A strings.Builder safe to read while our sink is writing to it.
+type lockedBuffer struct {
+    lock sync.Mutex
+    b strings.Builder
+}
+
+
+func (this *lockedBuffer) Write(p []byte) (int, error) {
+    this.lock.Lock()
+    defer this.lock.Unlock()
+    return this.b.Write(p)
+}
+
+
+func (this *lockedBuffer) String() string {
+    this.lock.Lock()
+    defer this.lock.Unlock()
+    return this.b.String()
+}
@@ -48,46 +48,100 @@ Q3 ...
 
 package main
 
+import "flag"
 import "fmt"
 import "net"
 import "os"
+import "path/filepath"
+import "quiz/journal"
+import "strings"
 
 
 func main() {
-    cmdProc := CreateCommandProcessor()
-    scoreboard := CreateScoreboard(cmdProc)
-    controller := CreateController(cmdProc, scoreboard)
-    swarm := CreateSwarm(cmdProc, controller)
-    controller.Run(swarm)
+    useUdp := flag.Bool("udp", true, "Tell buzzers that support it to send presses and heartbeats by UDP")
+    broadcast := flag.String("broadcast", "192.168.2.255:9755", "Address to broadcast mode changes to, empty for none")
+    metrics := flag.String("metrics", ":9754", "Address to serve Prometheus metrics on, empty for none")
+    journalPath := flag.String("journal", "quiz.journal", "File to record presses, modes and scores in, empty for none")
+    firmware := flag.String("firmware", "firmware.bin", "Firmware image to update buzzers with, read at each rollout")
+    teams := flag.Int("teams", 4, fmt.Sprintf("Number of teams in each quiz, up to %d", MaxTeams))
+    roomSpec := flag.String("rooms", "", "Rooms to run quizzes in, as NAME:FIRST-LAST,... giving the buzzer numbers " +
+        "in each team that belong to each room. Each room journals to its own file, named after it. Empty for 1 room")
+
+    outputs := make([]*string, StreamCount)
+    for stream := OutputStream(0); stream < StreamCount; stream++ {
+        outputs[stream] = flag.String("out-" + stream.Name(), "", fmt.Sprintf("Where to send %s output: a file, " +
+            "tcp:host:port or unix:path. Empty for the console", stream.Name()))
+    }
+
+    flag.Parse()
+
+    if *teams < 1 || *teams > MaxTeams {
+        fmt.Fprintf(os.Stderr, "Number of teams must be from 1 to %d\n", MaxTeams)
+        os.Exit(1)
+    }
+
+    configs, ok := ParseRoomSpec(*roomSpec)
+    if !ok { os.Exit(1) }
+
+    for stream, dest := range outputs {
+        if !OutputStream(stream).SetOutput(*dest) { os.Exit(1) }
+    }
+
+    udp := ListenUdp(":9753", *broadcast)
+
+    for i := range configs {
+        configs[i].teams = *teams
+        configs[i].firmware = *firmware
+        if *journalPath != "" { configs[i].journal = journal.Create(roomJournalPath(*journalPath, configs, i)) }
+    }
+
+    rooms := CreateRooms(configs, udp)
+
+    if *metrics != "" { ServeMetrics(*metrics, rooms) }
+
+    // Buzzers are only told to use UDP if asked, but we still need our UDP transport for broadcasts.
+    buzzerUdp := udp
+    if !*useUdp { buzzerUdp = nil }
+
+    go listen(rooms, buzzerUdp)
+
+    rooms.ProcessStdin()
+}
+
 
-    go listen(controller, swarm)
+// Report the journal file for the room with the given index, for the given journal path.
+// With more than 1 room, each room's name is added to the path, so quiz.journal becomes quiz-NAME.journal.
+func roomJournalPath(path string, configs []RoomConfig, index int) string {
+    if len(configs) == 1 { return path }
 
-    cmdProc.ProcessStdin()
+    ext := filepath.Ext(path)
+    return strings.TrimSuffix(path, ext) + "-" + configs[index].name + ext
 }
 
 
-func listen(controller *Controller, swarm *Swarm) {
+func listen(rooms *Rooms, udp *UdpTransport) {
     // Listen for incoming connections.
     listener, err := net.Listen("tcp", ":9753")
     if err != nil {
-        fmt.Println("Error listening:", err.Error())
+        StreamConnect.Printf("Error listening: %v\n", err)
+        FlushOutput()
         os.Exit(1)
     }
 
     // Close the listener when the application closes.
     defer listener.Close()
-    fmt.Printf("Listening for buzzers\n")
+    StreamConnect.Printf("Listening for buzzers\n")
 
     for {
         // Listen for an incoming connection.
         conn, err := listener.Accept()
         if err != nil {
-            fmt.Println("Error accepting: ", err.Error())
+            StreamConnect.Printf("Error accepting: %v\n", err)
             listener.Close()
             return
         }
 
         // Handle connections in a new goroutine.
-        HandleNode(conn, controller, swarm)
+        HandleNode(conn, rooms, udp)
     }
 }
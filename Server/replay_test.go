@@ -0,0 +1,853 @@
+/* Replay driver, for testing the controller, swarm and scoreboard without any real buzzers.
+
+Each fake buzzer talks the buzzer protocol over an in-memory pipe, so the real Buzzer code handles it exactly as it
+would a network connection. Fakes are framed unless made with createMixedRig(), which can also make fakes using the
+single byte protocol. Rigs made with createRoomsRig() run several rooms, see room.go, with fakes connected afterwards. The fakes record every mode they're sent, which is how we see what the controller decided.
+
+Questions can be given as synthetic press traces, or taken from a recorded journal. Presses are fed straight into the
+controller with their recorded press times, so arbitration sees the same times every run regardless of scheduling.
+
+To replay a journal from a real quiz, checking each question gets the same answer it did on the night:
+  go test -run TestReplayJournal -journal quiz.journal
+
+*/
+
+package main
+
+import "crypto/sha256"
+import "encoding/binary"
+import "flag"
+import "io"
+import "net"
+import "os"
+import "path/filepath"
+import "quiz/journal"
+import "reflect"
+import "sync"
+import "testing"
+import "time"
+
+
+// Journal to replay in TestReplayJournal.
+var _replayJournal = flag.String("journal", "", "Journal to replay")
+
+
+// Run our tests, with all output discarded unless verbose.
+func TestMain(m *testing.M) {
+    flag.Parse()
+
+    if !testing.Verbose() {
+        for stream := OutputStream(0); stream < StreamCount; stream++ { stream.SetWriter(io.Discard) }
+    }
+
+    os.Exit(m.Run())
+}
+
+
+// Check the earliest press wins, including one that arrives after a later press.
+func TestArbitrationEarliestWins(t *testing.T) {
+    rig := createRig(t, 0x001, 0x101, 0x201, 0x301)
+    defer rig.Close()
+
+    base := time.Now()
+    winner := rig.Replay(replayQuestion{
+        armTeams: 0x0F,
+        presses: []replayPress{
+            { 0x101, base.Add(20 * time.Millisecond), 0 },
+            { 0x001, base.Add(10 * time.Millisecond), 0 },  // Received second, pressed first.
+            { 0x201, base.Add(30 * time.Millisecond), 0 },
+        },
+    })
+
+    if winner != 0x001 { t.Errorf("Winner %s, expected B1", BuzzerIdToString(winner)) }
+}
+
+
+// Check presses from teams not allowed to answer are ignored.
+func TestArbitrationTeamNotAllowed(t *testing.T) {
+    rig := createRig(t, 0x001, 0x101)
+    defer rig.Close()
+
+    base := time.Now()
+    winner := rig.Replay(replayQuestion{
+        armTeams: 0x02,  // Green only.
+        presses: []replayPress{
+            { 0x001, base, 0 },
+            { 0x101, base.Add(5 * time.Millisecond), 0 },
+        },
+    })
+
+    if winner != 0x101 { t.Errorf("Winner %s, expected G1", BuzzerIdToString(winner)) }
+}
+
+
+// Check the earliest buzzer within a team is the one that answers.
+func TestArbitrationSameTeam(t *testing.T) {
+    rig := createRig(t, 0x001, 0x002, 0x101)
+    defer rig.Close()
+
+    base := time.Now()
+    winner := rig.Replay(replayQuestion{
+        armTeams: 0x0F,
+        presses: []replayPress{
+            { 0x001, base.Add(3 * time.Millisecond), 0 },
+            { 0x002, base.Add(1 * time.Millisecond), 0 },
+            { 0x101, base.Add(2 * time.Millisecond), 0 },
+        },
+    })
+
+    if winner != 0x002 { t.Errorf("Winner %s, expected B2", BuzzerIdToString(winner)) }
+}
+
+
+// Check a wrong answer passes to the other teams that pressed, earliest first, including presses received after the
+// decision, and never back to the team that answered.
+func TestArbitrationPassOn(t *testing.T) {
+    rig := createRig(t, 0x001, 0x002, 0x101, 0x201, 0x301)
+    defer rig.Close()
+
+    base := time.Now()
+    winner := rig.Replay(replayQuestion{
+        armTeams: 0x0F,
+        presses: []replayPress{
+            { 0x101, base.Add(10 * time.Millisecond), 0 },
+            { 0x201, base.Add(30 * time.Millisecond), 0 },
+            { 0x001, base.Add(20 * time.Millisecond), 0 },
+        },
+    })
+
+    if winner != 0x101 { t.Errorf("Winner %s, expected G1", BuzzerIdToString(winner)) }
+
+    // Late presses still join the queue, in press time order, but only the earliest from each team is kept.
+    rig.controller.ButtonPress(0x301, base.Add(25 * time.Millisecond), 0)
+    rig.controller.ButtonPress(0x002, base.Add(40 * time.Millisecond), 0)
+    rig.controller.ButtonPress(0x102, base.Add(5 * time.Millisecond), 0)  // The answering team.
+
+    for _, expected := range []int{0x001, 0x301, 0x201} {
+        rig.controller.commandIncorrect()
+        if next := rig.WaitDecision(); next != expected {
+            t.Errorf("Answer passed to %s, expected %s", BuzzerIdToString(next), BuzzerIdToString(expected))
+        }
+    }
+}
+
+
+// Check that once every team that pressed has answered wrongly, the question is asked again of the teams left.
+func TestArbitrationPassOnExhausted(t *testing.T) {
+    rig := createRig(t, 0x001, 0x101, 0x201)
+    defer rig.Close()
+
+    base := time.Now()
+    winner := rig.Replay(replayQuestion{
+        armTeams: 0x07,
+        presses: []replayPress{
+            { 0x001, base, 0 },
+            { 0x101, base.Add(5 * time.Millisecond), 0 },
+        },
+    })
+
+    if winner != 0x001 { t.Errorf("Winner %s, expected B1", BuzzerIdToString(winner)) }
+
+    rig.controller.commandIncorrect()
+    if next := rig.WaitDecision(); next != 0x101 {
+        t.Errorf("Answer passed to %s, expected G1", BuzzerIdToString(next))
+    }
+
+    rig.controller.commandIncorrect()
+    if state := rig.State(); state != ConStAsked { t.Fatalf("State %d, expected asked", state) }
+
+    // Teams that have answered can't press again.
+    later := time.Now()
+    rig.controller.ButtonPress(0x001, later, 0)
+    rig.controller.ButtonPress(0x201, later.Add(5 * time.Millisecond), 0)
+    if next := rig.WaitDecision(); next != 0x201 { t.Errorf("Winner %s, expected R1", BuzzerIdToString(next)) }
+}
+
+
+// Check a bonus round locks in the earliest pressed buzzer of each team, even if its press arrives later, cancels its
+// teammates, and scores every team marked right at once, with double marks for the double team.
+func TestBonusRound(t *testing.T) {
+    rig := createRig(t, 0x001, 0x002, 0x101, 0x301)
+    defer rig.Close()
+    rig.drainModes()
+
+    rig.controller.commandBonus(1)
+    if state := rig.State(); state != ConStBonus { t.Fatalf("State %d, expected bonus", state) }
+    rig.drainModes()
+
+    now := time.Now()
+    rig.controller.ButtonPress(0x001, now, 0)
+    rig.controller.ButtonPress(0x101, now, 0)
+    rig.controller.ButtonPress(0x002, now.Add(-5 * time.Millisecond), 0)  // Received later, but pressed first.
+    rig.controller.ButtonPress(0x001, now, 0)
+
+    modes := modesById(rig.drainModes())
+    expected := map[int][]byte{
+        0x001: {ModeCommand(false, false)},
+        0x002: {ModeCommand(true, false)},
+        0x101: {ModeCommand(true, false)},
+    }
+
+    if !reflect.DeepEqual(modes, expected) { t.Errorf("Buzzers sent modes %v, expected %v", modes, expected) }
+
+    // Once a team is locked in, its teammates' presses are cancelled straight away.
+    rig.controller.ButtonPress(0x001, time.Now(), 0)
+    modes = modesById(rig.drainModes())
+    expected = map[int][]byte{ 0x001: {ModeCommand(false, false)} }
+    if !reflect.DeepEqual(modes, expected) { t.Errorf("Buzzers sent modes %v, expected %v", modes, expected) }
+
+    // Marking an answer wrong means nothing in a bonus round.
+    rig.controller.commandIncorrect()
+    if state := rig.State(); state != ConStBonus { t.Fatalf("State %d, expected bonus", state) }
+
+    // Team R didn't press, but was right, and team Y pressed, but was wrong.
+    rig.controller.commandBonusMark(0x07)
+    if state := rig.State(); state != ConStIdle { t.Errorf("State %d, expected idle", state) }
+
+    scores := rig.Scores()
+    if len(scores) != 4 || scores[0] != 1 || scores[1] != 2 || scores[2] != 1 || scores[3] != 0 {
+        t.Errorf("Scores %v, expected [1 2 1 0]", scores)
+    }
+}
+
+
+// Check a press sent over the fake network reaches a decision, with the age in the press correcting its time.
+func TestPressOverPipe(t *testing.T) {
+    rig := createRig(t, 0x001, 0x101)
+    defer rig.Close()
+
+    rig.Ask(0x0F)
+    rig.buzzers[0x101].Press(0)
+    rig.buzzers[0x001].Press(20 * time.Millisecond)  // Sent second, but pressed 20ms ago.
+
+    if winner := rig.WaitDecision(); winner != 0x001 {
+        t.Errorf("Winner %s, expected B1", BuzzerIdToString(winner))
+    }
+}
+
+
+// Check that a journal written while running questions holds the same answers and scores, and replays to them.
+func TestJournalRoundTrip(t *testing.T) {
+    path := filepath.Join(t.TempDir(), "test.journal")
+    jnl := journal.Create(path)
+    if jnl == nil { t.Fatalf("Cannot create journal") }
+
+    rig := createRigWithJournal(t, jnl, 0x001, 0x101, 0x201, 0x301)
+
+    base := time.Now()
+    questions := []replayQuestion{
+        { armTeams: 0x0F, presses: []replayPress{ { 0x201, base.Add(2 * time.Millisecond), 0 },
+            { 0x101, base.Add(1 * time.Millisecond), 0 } } },
+        { armTeams: 0x0E, presses: []replayPress{ { 0x001, base.Add(3 * time.Millisecond), 0 },
+            { 0x301, base.Add(4 * time.Millisecond), 0 } } },
+    }
+
+    var winners []int
+    for _, q := range questions {
+        winner := rig.Replay(q)
+        winners = append(winners, winner)
+        rig.scoreboard.Add(BuzzerTeam(winner), 1)
+    }
+
+    scores := rig.Scores()
+    rig.Close()
+    waitJournalFlushed(t, path)
+
+    loaded, loadedScores := loadJournal(t, path)
+    if len(loaded) != len(questions) {
+        t.Fatalf("Journal has %d questions, expected %d", len(loaded), len(questions))
+    }
+
+    for team, score := range scores {
+        if loadedScores[team] != score {
+            t.Errorf("Team %s journal score %d, scoreboard %d", TeamIdToString(team), loadedScores[team], score)
+        }
+    }
+
+    // Replay what was journaled into a fresh rig.
+    replayRig := createRig(t, 0x001, 0x101, 0x201, 0x301)
+    defer replayRig.Close()
+
+    for i, q := range loaded {
+        if q.winner != winners[i] {
+            t.Errorf("Question %d journaled winner %s, expected %s", i + 1, BuzzerIdToString(q.winner),
+                BuzzerIdToString(winners[i]))
+        }
+
+        if winner := replayRig.Replay(q); winner != winners[i] {
+            t.Errorf("Question %d replayed winner %s, expected %s", i + 1, BuzzerIdToString(winner),
+                BuzzerIdToString(winners[i]))
+        }
+    }
+}
+
+
+// Replay the journal given with -journal, checking every question gets the same answer.
+func TestReplayJournal(t *testing.T) {
+    if *_replayJournal == "" { t.Skip("No journal given, use -journal") }
+
+    questions, _ := loadJournal(t, *_replayJournal)
+
+    // We need a fake for every buzzer that pressed.
+    ids := make(map[int]bool)
+    for _, q := range questions {
+        for _, p := range q.presses { ids[p.buzzerId] = true }
+    }
+
+    var idList []int
+    for id := range ids { idList = append(idList, id) }
+
+    rig := createRig(t, idList...)
+    defer rig.Close()
+
+    for i, q := range questions {
+        if q.winner < 0 { continue }  // No answer recorded, so nothing to check.
+
+        if winner := rig.Replay(q); winner != q.winner {
+            t.Errorf("Question %d answered by %s, journal says %s", i + 1, BuzzerIdToString(winner),
+                BuzzerIdToString(q.winner))
+        }
+    }
+}
+
+
+// A single press in a replayed question.
+type replayPress struct {
+    buzzerId int
+    pressTime time.Time
+    errorBound time.Duration
+}
+
+
+// A question to replay.
+type replayQuestion struct {
+    armTeams uint16  // Bitmask of the teams allowed to answer.
+    presses []replayPress  // In the order they were received.
+    winner int  // Buzzer that answered, as recorded. <0 if unknown.
+}
+
+
+// A mode sent to one of our fake buzzers.
+type fakeMode struct {
+    id int
+    mode byte
+}
+
+
+// A firmware update message received by a fake buzzer.
+type fakeUpdate struct {
+    id int
+    cmd byte
+    image []byte  // For an end, the image written.
+    verified bool  // For an end, whether the image matched the size and SHA-256 from the begin.
+}
+
+
+// A set of fake buzzers connected to a real controller, swarm and scoreboard.
+// With several rooms, the controller, swarm, etc are those of the first room.
+type testRig struct {
+    t testing.TB
+    journal *journal.Writer
+    rooms *Rooms
+    scoreboard *Scoreboard
+    controller *Controller
+    swarm *Swarm
+    ota *Ota
+    otaImagePath string  // Where tests should put the firmware image for ota.
+    buzzers map[int]*fakeBuzzer
+    modes chan fakeMode  // Every mode sent to any fake, in order.
+    updates chan fakeUpdate  // Every firmware update message received by any fake, in order.
+}
+
+
+// Create a test rig, with fake buzzers with the given IDs connected.
+func createRig(t testing.TB, ids ...int) *testRig {
+    return createRigWithJournal(t, nil, ids...)
+}
+
+
+// Create a test rig recording to the given journal, which may be nil, with fake buzzers with the given IDs connected.
+func createRigWithJournal(t testing.TB, jnl *journal.Writer, ids ...int) *testRig {
+    return createMixedRig(t, jnl, ids, nil)
+}
+
+
+// Create a test rig recording to the given journal, which may be nil, with framed fake buzzers with the given IDs
+// connected, and fakes using the single byte protocol with the given legacy IDs.
+func createMixedRig(t testing.TB, jnl *journal.Writer, ids []int, legacyIds []int) *testRig {
+    p := createRoomsRig(t, []RoomConfig{ { name: DefaultRoom, first: 0, last: MaxTeamBuzzers - 1, journal: jnl } })
+    p.journal = jnl
+
+    for _, id := range ids {
+        p.buzzers[id] = createFakeBuzzer(p, id, true, 0)
+    }
+
+    for _, id := range legacyIds {
+        p.buzzers[id] = createFakeBuzzer(p, id, false, 0)
+    }
+
+    for _, buzzer := range p.buzzers { buzzer.WaitReady() }
+
+    return p
+}
+
+
+// Create a test rig with the given rooms, each with 4 teams, and no fake buzzers yet.
+func createRoomsRig(t testing.TB, configs []RoomConfig) *testRig {
+    var p testRig
+    p.t = t
+    p.modes = make(chan fakeMode, 10000)
+    p.updates = make(chan fakeUpdate, 10000)
+    p.buzzers = make(map[int]*fakeBuzzer)
+    p.otaImagePath = filepath.Join(t.TempDir(), "firmware.bin")
+
+    for i := range configs {
+        configs[i].teams = 4
+        configs[i].firmware = p.otaImagePath
+    }
+
+    p.rooms = CreateRooms(configs, nil)
+    room := p.rooms.All()[0]
+    p.scoreboard = room.scoreboard
+    p.controller = room.controller
+    p.swarm = room.swarm
+    p.ota = room.ota
+
+    return &p
+}
+
+
+// Connect a framed fake buzzer with the given ID, asking for the given room number, 0 for none.
+// Doesn't wait for the buzzer to be accepted, since it may not be.
+func (this *testRig) Connect(id int, room byte) *fakeBuzzer {
+    buzzer := createFakeBuzzer(this, id, true, room)
+    this.buzzers[id] = buzzer
+    return buzzer
+}
+
+
+// Disconnect all our fake buzzers.
+func (this *testRig) Close() {
+    for _, buzzer := range this.buzzers { buzzer.Close() }
+}
+
+
+// Ask a question that the given teams may answer, and wait until all their buzzers are armed.
+// Fakes using the single byte protocol can't arm, so for them any mode will do.
+func (this *testRig) Ask(armTeams uint16) {
+    // Presses are handled ahead of requests, so we must know the question's been asked before any arrive.
+    done := make(chan struct{})
+    this.controller.requests <- func() {
+        this.controller.doubleTeam = -1
+        this.controller.teamsAllowed = make([]bool, MaxTeams)
+        for team := range this.controller.teamsAllowed {
+            this.controller.teamsAllowed[team] = (armTeams & (1 << uint(team))) != 0
+        }
+
+        this.controller.changeState(ConStAsked)
+        close(done)
+    }
+
+    <-done
+
+    waiting := make(map[int]bool)
+    for id := range this.buzzers {
+        if (armTeams & (1 << uint(BuzzerTeam(id)))) != 0 { waiting[id] = true }
+    }
+
+    timeout := time.After(ReplayTimeout)
+    for len(waiting) > 0 {
+        select {
+        case m := <-this.modes:
+            if (m.mode & CmdModeArmed) != 0 || !this.buzzers[m.id].framed { delete(waiting, m.id) }
+
+        case <-timeout:
+            this.t.Fatalf("Buzzers never set for question")
+        }
+    }
+}
+
+
+// Wait for the controller to pick a buzzer to answer, and return its ID.
+func (this *testRig) WaitDecision() int {
+    timeout := time.After(ReplayTimeout)
+    for {
+        select {
+        case m := <-this.modes:
+            if (m.mode & CmdModeLed) != 0 { return m.id }
+
+        case <-timeout:
+            this.t.Fatalf("No answer decided")
+            return -1
+        }
+    }
+}
+
+
+// Ask the given question, feed in its presses and return the ID of the buzzer the controller picks.
+// Presses are journaled as our buzzers would have.
+func (this *testRig) Replay(q replayQuestion) int {
+    this.Ask(q.armTeams)
+
+    for _, press := range q.presses {
+        this.controller.ButtonPress(press.buzzerId, press.pressTime, press.errorBound)
+        this.journal.Press(press.buzzerId, press.pressTime, 0, press.errorBound, press.errorBound != 0)
+    }
+
+    return this.WaitDecision()
+}
+
+
+// Report the controller's state, once it's handled everything sent to it so far.
+func (this *testRig) State() ConStTypeEnum {
+    response := make(chan ConStTypeEnum, 1)
+    this.controller.requests <- func() {
+        response <- this.controller.state
+    }
+
+    return <-response
+}
+
+
+// Report the current scores.
+func (this *testRig) Scores() []int {
+    response := make(chan []int, 1)
+    this.scoreboard.requests <- func() {
+        response <- append([]int(nil), this.scoreboard.scores...)
+    }
+
+    return <-response
+}
+
+
+// Report whether our swarm has the buzzer with the given ID connected.
+func (this *testRig) Connected(id int) bool {
+    response := make(chan bool, 1)
+    this.swarm.requests <- func() {
+        buzzer, ok := this.swarm.buzzers[id]
+        response <- (ok && buzzer.buzzer != nil)
+    }
+
+    return <-response
+}
+
+
+// A fake buzzer, connected via an in-memory pipe.
+type fakeBuzzer struct {
+    rig *testRig
+    id int
+    framed bool  // Whether we frame our messages, otherwise we use the single byte protocol.
+    conn net.Conn  // Our end of the pipe.
+    room byte  // Room number we ask for in our hello, 0 for none.
+    ready chan struct{}  // Closed once the server has accepted our handshake.
+    rooms chan byte  // Room numbers the server has told us we're in.
+    gone chan struct{}  // Closed once our connection has gone.
+    lock sync.Mutex  // Protects everything below.
+    pressSeq byte
+    closed bool
+    otaSize int  // Size of the image being written, from its begin.
+    otaSha [32]byte  // SHA-256 of the image being written, from its begin.
+    otaImage []byte  // The image written so far.
+}
+
+
+// Create a fake buzzer with the given ID, framed or using the single byte protocol, and connect it to the given rig.
+// Framed fakes ask for the given room number in their hello, unless it's 0.
+func createFakeBuzzer(rig *testRig, id int, framed bool, room byte) *fakeBuzzer {
+    var p fakeBuzzer
+    p.rig = rig
+    p.id = id
+    p.framed = framed
+    p.room = room
+    p.ready = make(chan struct{})
+    p.rooms = make(chan byte, 10)
+    p.gone = make(chan struct{})
+
+    server, conn := net.Pipe()
+    p.conn = conn
+    HandleNode(server, rig.rooms, nil)
+
+    go p.processIncoming()
+
+    if framed {
+        // Version, then hello with ID and no resume token.
+        hello := []byte{0x3B, byte(id >> 8), byte(id), 0, 0, 0, 0}
+        if room != 0 { hello = append(hello, room) }
+        p.sendRaw([]byte{BuzzerExpectedVersion})
+        p.send(hello)
+    } else {
+        // Version, then ID.
+        legacy, ok := BuzzerIdToLegacy(id)
+        if !ok { rig.t.Fatalf("Buzzer %s has no legacy ID", BuzzerIdToString(id)) }
+        p.sendRaw([]byte{BuzzerLegacyVersion, 0x80 | legacy})
+    }
+
+    go p.sendHeartbeats()
+
+    return &p
+}
+
+
+// Wait for the server to accept our handshake.
+func (this *fakeBuzzer) WaitReady() {
+    if !this.framed {
+        // The server doesn't send anything at the end of the single byte protocol's handshake, so watch for our swarm
+        // knowing us instead.
+        for deadline := time.Now().Add(ReplayTimeout); !this.rig.Connected(this.id); time.Sleep(time.Millisecond) {
+            if time.Now().After(deadline) { this.rig.t.Fatalf("Buzzer %s never connected", BuzzerIdToString(this.id)) }
+        }
+
+        return
+    }
+
+    select {
+    case <-this.ready:
+    case <-time.After(ReplayTimeout):
+        this.rig.t.Fatalf("Buzzer %s never connected", BuzzerIdToString(this.id))
+    }
+}
+
+
+// Send a sequenced press that happened the given time ago.
+// Fakes using the single byte protocol can't say when they were pressed, so send an untimed press, ignoring the age.
+func (this *fakeBuzzer) Press(age time.Duration) {
+    if !this.framed {
+        this.send([]byte{0x30})
+        return
+    }
+
+    this.lock.Lock()
+    this.pressSeq++
+    msg := make([]byte, 1 + MsgSeqPressSize)
+    msg[0] = MsgSeqPressByte
+    msg[1] = this.pressSeq
+    this.lock.Unlock()
+
+    binary.BigEndian.PutUint64(msg[2:10], uint64(time.Now().UnixNano() / 1000))
+    binary.BigEndian.PutUint32(msg[10:14], uint32(age / time.Microsecond))
+    this.send(msg)
+}
+
+
+// Report that the server is expected to disconnect us, so failing to send isn't an error.
+func (this *fakeBuzzer) ExpectDisconnect() {
+    this.lock.Lock()
+    this.closed = true
+    this.lock.Unlock()
+}
+
+
+// Disconnect this buzzer.
+func (this *fakeBuzzer) Close() {
+    this.lock.Lock()
+    this.closed = true
+    this.lock.Unlock()
+    this.conn.Close()
+}
+
+
+// Send the given message to the server, framed if we are. Errors after we've been closed are expected, and ignored.
+func (this *fakeBuzzer) send(msg []byte) bool {
+    if !this.framed { return this.sendRaw(msg) }
+
+    frame := make([]byte, 2 + len(msg))
+    binary.BigEndian.PutUint16(frame, uint16(len(msg)))
+    copy(frame[2:], msg)
+    return this.sendRaw(frame)
+}
+
+
+// Send the given bytes to the server, as they are. Errors after we've been closed are expected, and ignored.
+func (this *fakeBuzzer) sendRaw(msg []byte) bool {
+    if _, err := this.conn.Write(msg); err != nil {
+        this.lock.Lock()
+        closed := this.closed
+        this.lock.Unlock()
+
+        if !closed { this.rig.t.Errorf("Buzzer %s send failed: %v", BuzzerIdToString(this.id), err) }
+        return false
+    }
+
+    return true
+}
+
+
+// Send a firmware update status to the server, with the number of bytes we've written.
+func (this *fakeBuzzer) sendOtaStatus(status byte) {
+    msg := []byte{0x3A, status, 0, 0, 0, 0}
+    binary.BigEndian.PutUint32(msg[2:], uint32(len(this.otaImage)))
+    this.send(msg)
+}
+
+
+// Send heartbeats often enough to keep the failure detector happy, until we're closed.
+func (this *fakeBuzzer) sendHeartbeats() {
+    for {
+        time.Sleep(ReplayHeartbeat)
+        if !this.send([]byte{MsgHeartbeatByte}) { return }
+    }
+}
+
+
+// Handle messages from the server, recording modes, until we're closed.
+func (this *fakeBuzzer) processIncoming() {
+    defer close(this.gone)
+
+    for {
+        b, ok := this.receive()
+        if !ok { return }
+
+        switch {
+        case (b[0] & 0xF8) == CmdModePrefix:
+            this.rig.modes <- fakeMode{this.id, b[0]}
+
+        case b[0] == CmdTransport:
+            // Last part of the handshake.
+            close(this.ready)
+
+        case b[0] == CmdRoom:
+            this.rooms <- b[1]
+
+        case b[0] == CmdOtaBegin:
+            this.otaSize = int(binary.BigEndian.Uint32(b[1:5]))
+            copy(this.otaSha[:], b[5:37])
+            this.otaImage = nil
+            this.rig.updates <- fakeUpdate{ id: this.id, cmd: b[0] }
+            this.sendOtaStatus(OtaStatusOk)
+
+        case b[0] == CmdOtaData:
+            // The data follows the header.
+            data := b[7:7 + binary.BigEndian.Uint16(b[5:7])]
+            this.rig.updates <- fakeUpdate{ id: this.id, cmd: b[0] }
+            if int(binary.BigEndian.Uint32(b[1:5])) != len(this.otaImage) {
+                this.sendOtaStatus(OtaStatusWriteFailed)
+                continue
+            }
+
+            this.otaImage = append(this.otaImage, data...)
+            this.sendOtaStatus(OtaStatusOk)
+
+        case b[0] == CmdOtaEnd:
+            verified := (len(this.otaImage) == this.otaSize && sha256.Sum256(this.otaImage) == this.otaSha)
+            this.rig.updates <- fakeUpdate{ id: this.id, cmd: b[0], image: this.otaImage, verified: verified }
+
+            if verified {
+                this.sendOtaStatus(OtaStatusDone)
+            } else {
+                this.sendOtaStatus(OtaStatusVerifyFailed)
+            }
+
+        case b[0] == CmdOtaAbort:
+            this.otaImage = nil
+            this.rig.updates <- fakeUpdate{ id: this.id, cmd: b[0] }
+        }
+    }
+}
+
+
+// Receive the next message from the server, waiting until it's all here.
+// Returns false once we're closed, or if the message isn't one we know.
+func (this *fakeBuzzer) receive() ([]byte, bool) {
+    if this.framed {
+        var size [2]byte
+        if _, err := io.ReadFull(this.conn, size[:]); err != nil { return nil, false }
+
+        b := make([]byte, binary.BigEndian.Uint16(size[:]))
+        if _, err := io.ReadFull(this.conn, b); err != nil { return nil, false }
+        return b, true
+    }
+
+    // The single byte protocol only has modes.
+    b := make([]byte, 1)
+    if _, err := io.ReadFull(this.conn, b); err != nil { return nil, false }
+
+    if (b[0] & 0xF8) != CmdModePrefix {
+        this.rig.t.Errorf("Buzzer %s got unknown command 0x%02X", BuzzerIdToString(this.id), b[0])
+        return nil, false
+    }
+
+    return b, true
+}
+
+
+// Replay settings.
+const (
+    ReplayTimeout = 5 * time.Second  // How long to wait for anything before failing.
+    ReplayHeartbeat = 100 * time.Millisecond
+)
+
+
+// Load the questions and final scores from the given journal.
+// Only the last session's scores are returned.
+func loadJournal(t testing.TB, path string) ([]replayQuestion, []int) {
+    file, err := os.Open(path)
+    if err != nil { t.Fatalf("Cannot open journal: %v", err) }
+    defer file.Close()
+
+    reader := journal.CreateReader(file)
+    var questions []replayQuestion
+    var q *replayQuestion  // Question currently being asked, nil if none.
+    answered := false  // Whether q has been answered.
+    scores := make([]int, MaxTeams)
+
+    for {
+        rec, err := reader.Next()
+        if err == io.EOF { break }
+        if err != nil { t.Fatalf("Cannot read journal: %v", err) }
+
+        switch rec.Kind {
+        case journal.KindStart:
+            scores = make([]int, MaxTeams)
+            q = nil
+
+        case journal.KindState:
+            switch ConStTypeEnum(rec.Value) {
+            case ConStAsked:
+                questions = append(questions, replayQuestion{ winner: -1 })
+                q = &questions[len(questions) - 1]
+                answered = false
+
+            case ConStAnswered:
+                answered = true
+
+            default:
+                q = nil
+            }
+
+        case journal.KindMode:
+            if q == nil { break }
+
+            if rec.Id == journal.AllBuzzers {
+                // The question's arming tells us who may answer.
+                if !answered { q.armTeams = uint16(rec.Extra) }
+            } else if answered && q.winner < 0 && (rec.Value & CmdModeLed) != 0 {
+                q.winner = rec.Id
+            }
+
+        case journal.KindPress:
+            // Presses after the answer was decided didn't take part.
+            if q != nil && q.winner < 0 {
+                q.presses = append(q.presses, replayPress{ rec.Id, rec.Time, time.Duration(rec.Value) *
+                    time.Microsecond })
+            }
+
+        case journal.KindScore:
+            scores[rec.Id & (MaxTeams - 1)] += int(rec.Value)
+        }
+    }
+
+    return questions, scores
+}
+
+
+// Wait until the journal at the given path has stopped growing, so everything recorded has been written.
+func waitJournalFlushed(t testing.TB, path string) {
+    var last int64 = -1
+    for i := 0; i < 50; i++ {
+        time.Sleep(20 * time.Millisecond)
+        info, err := os.Stat(path)
+        if err != nil { t.Fatalf("Cannot stat journal: %v", err) }
+        if info.Size() == last { return }
+        last = info.Size()
+    }
+}
@@ -0,0 +1,303 @@
+/* Rooms, each an independent quiz, run side by side in this server.
+
+A single server can run several quizzes at once, such as the heats of a competition in neighbouring rooms. Each room
+has its own command processor, scoreboard, controller, swarm, firmware updater and journal, and so its own Go
+routines, so a busy room, or one with a misbehaving swarm, can't hold up presses or decisions in another. Only the
+listening sockets, the UDP transport and the output streams are shared.
+
+Buzzers are assigned to a room as they connect. Each room takes a range of buzzer numbers, within every team, so which
+room a buzzer belongs to can be set with its ID links. A framed buzzer may instead ask for a room, by number, in its
+hello, see Protocol.txt, which takes precedence. A buzzer that's in no room's range, and doesn't ask for one we have,
+is turned away.
+
+While there's more than one room:
+  Each room's output lines are prefixed with its name, and its metrics are labelled with it.
+  Framed buzzers are told their room's number, and mode broadcasts carry it, so buzzers ignore other rooms' broadcasts.
+  Buzzers using the single byte protocol can't tell broadcasts apart, so are always sent their modes directly.
+
+Console commands go to the selected room, which is initially the first. Prefixing a command with a room's name and a
+colon sends it to that room instead, and "*:" sends it to every room. "room" lists the rooms and "room NAME" selects
+one.
+
+*/
+
+package main
+
+import "bufio"
+import "fmt"
+import "os"
+import "quiz/journal"
+import "strconv"
+import "strings"
+
+
+// External interface.
+
+// Parse the given room spec, a comma separated list of NAME:FIRST-LAST, each giving a room and the range of buzzer
+// numbers, within each team, that belong to it. An empty spec gives a single room, for all buzzers. Ranges may not
+// overlap.
+// Returns false, having reported why, if the spec is bad.
+func ParseRoomSpec(spec string) ([]RoomConfig, bool) {
+    if spec == "" {
+        return []RoomConfig{ { name: DefaultRoom, first: 0, last: MaxTeamBuzzers - 1 } }, true
+    }
+
+    var configs []RoomConfig
+    for _, item := range strings.Split(spec, ",") {
+        var config RoomConfig
+        name, numbers, found := cutString(strings.TrimSpace(item), ":")
+        firstText, lastText, ranged := cutString(numbers, "-")
+        first, err := strconv.Atoi(firstText)
+        last, err2 := strconv.Atoi(lastText)
+
+        if !found || !ranged || name == "" || name == "*" || err != nil || err2 != nil {
+            fmt.Fprintf(os.Stderr, "Bad room \"%s\", expected NAME:FIRST-LAST\n", item)
+            return nil, false
+        }
+
+        if first < 0 || first > last || last >= MaxTeamBuzzers {
+            fmt.Fprintf(os.Stderr, "Bad range in room \"%s\", buzzer numbers are 0 to %d\n", item, MaxTeamBuzzers - 1)
+            return nil, false
+        }
+
+        for _, other := range configs {
+            if other.name == name {
+                fmt.Fprintf(os.Stderr, "Room %s given twice\n", name)
+                return nil, false
+            }
+
+            if first <= other.last && other.first <= last {
+                fmt.Fprintf(os.Stderr, "Rooms %s and %s overlap\n", other.name, name)
+                return nil, false
+            }
+        }
+
+        config.name = name
+        config.first = first
+        config.last = last
+        configs = append(configs, config)
+    }
+
+    if len(configs) > MaxRooms {
+        fmt.Fprintf(os.Stderr, "Too many rooms, up to %d allowed\n", MaxRooms)
+        return nil, false
+    }
+
+    return configs, true
+}
+
+
+// Create the given rooms and start them all running.
+// Mode broadcasts are sent via the given UDP transport, which may be nil.
+func CreateRooms(configs []RoomConfig, udp *UdpTransport) *Rooms {
+    var p Rooms
+
+    for i, config := range configs {
+        p.rooms = append(p.rooms, createRoom(i + 1, config, len(configs) > 1, udp))
+    }
+
+    p.selected = p.rooms[0]
+    return &p
+}
+
+
+// Report all our rooms, in number order.
+func (this *Rooms) All() []*Room {
+    return this.rooms
+}
+
+
+// Report the room the buzzer with the given ID belongs in, having asked for the given room number, 0 for none.
+// Returns nil if there's no room for it.
+// May be called from any thread context.
+func (this *Rooms) Assign(id int, requested int) *Room {
+    if requested > 0 && requested <= len(this.rooms) { return this.rooms[requested - 1] }
+
+    n := id & (MaxTeamBuzzers - 1)
+    for _, room := range this.rooms {
+        if n >= room.first && n <= room.last { return room }
+    }
+
+    return nil
+}
+
+
+// Read stdin and process all resulting commands.
+// Never returns.
+func (this *Rooms) ProcessStdin() {
+    StreamInput.Printf("? to show usage\n")
+    stdin := bufio.NewReader(os.Stdin)
+
+    for {
+        text, _ := stdin.ReadString('\n')
+        text = strings.TrimSpace(text)
+
+        // Ignore blank lines.
+        if text != "" {
+            this.Process(text)
+        }
+    }
+}
+
+
+// Process the given console command line, sending it to the room it's for.
+// Must only be called from the console's Go routine.
+func (this *Rooms) Process(cmdLine string) {
+    if cmdLine == "room" {
+        this.list()
+        return
+    }
+
+    if strings.HasPrefix(cmdLine, "room ") {
+        this.selectRoom(strings.TrimSpace(cmdLine[len("room "):]))
+        return
+    }
+
+    targets := []*Room{this.selected}
+    if name, rest, found := cutString(cmdLine, ":"); found {
+        name = strings.TrimSpace(name)
+        cmdLine = strings.TrimSpace(rest)
+
+        if name == "*" {
+            targets = this.rooms
+        } else if room := this.find(name); room != nil {
+            targets = []*Room{room}
+        } else {
+            StreamInput.Printf("No room %s\n", name)
+            return
+        }
+    }
+
+    for _, room := range targets {
+        room.cmdProc.process(cmdLine)
+        if cmdLine == "?" { this.usage() }
+    }
+}
+
+
+// Maximum number of rooms, each identified to buzzers by a single byte.
+const (
+    MaxRooms = 255
+)
+
+// Name of the room we have when none are given.
+const (
+    DefaultRoom = "main"
+)
+
+
+// Settings for a single room.
+type RoomConfig struct {
+    name string
+    first int  // Lowest buzzer number, within each team, in this room.
+    last int  // Highest buzzer number, within each team, in this room.
+    teams int  // Number of teams in this room's quiz.
+    journal *journal.Writer  // Journal for this room. nil for none.
+    firmware string  // Firmware image to update buzzers with.
+}
+
+
+// A single quiz, with its own set of buzzers.
+type Room struct {
+    number int  // From 1, in the order rooms were given.
+    name string
+    first int  // Lowest buzzer number, within each team, in this room.
+    last int  // Highest buzzer number, within each team, in this room.
+    tag byte  // Identifies us in messages to buzzers, so they ignore other rooms' broadcasts. 0 if we're the only room.
+    prefix string  // Added to our output lines. Empty if we're the only room.
+    label string  // Added to our metrics labels. Empty if we're the only room.
+    cmdProc *CommandProcessor
+    journal *journal.Writer  // nil for none.
+    scoreboard *Scoreboard
+    controller *Controller
+    swarm *Swarm
+    ota *Ota
+}
+
+
+// The set of rooms in this server.
+type Rooms struct {
+    rooms []*Room  // In number order.
+    selected *Room  // Room that console commands go to by default. Only used by the console's Go routine.
+}
+
+
+// Internals.
+
+// Create a room, with the given number, from the given config, and start it running.
+// The room is shared if other rooms run alongside it in this server.
+func createRoom(number int, config RoomConfig, shared bool, udp *UdpTransport) *Room {
+    var p Room
+    p.number = number
+    p.name = config.name
+    p.first = config.first
+    p.last = config.last
+    p.journal = config.journal
+
+    if shared {
+        p.tag = byte(number)
+        p.prefix = "[" + config.name + "] "
+        p.label = fmt.Sprintf(`room="%s"`, config.name)
+    }
+
+    p.cmdProc = CreateCommandProcessor()
+    p.scoreboard = CreateScoreboard(&p, config.teams)
+    p.controller = CreateController(&p, p.scoreboard)
+    p.swarm = CreateSwarm(&p, p.controller, udp)
+    p.ota = CreateOta(&p, p.swarm, config.firmware)
+    p.controller.Run(p.swarm, p.ota)
+
+    return &p
+}
+
+
+// Report the room with the given name, ignoring case. Returns nil if there's none.
+func (this *Rooms) find(name string) *Room {
+    for _, room := range this.rooms {
+        if strings.EqualFold(room.name, name) { return room }
+    }
+
+    return nil
+}
+
+
+// Select the room with the given name for console commands to go to.
+func (this *Rooms) selectRoom(name string) {
+    room := this.find(name)
+    if room == nil {
+        StreamInput.Printf("No room %s\n", name)
+        return
+    }
+
+    this.selected = room
+    StreamInput.Printf("Commands go to room %s\n", room.name)
+}
+
+
+// Print out our rooms.
+func (this *Rooms) list() {
+    StreamInput.Printf("Rooms:\n")
+
+    for _, room := range this.rooms {
+        selected := ""
+        if room == this.selected { selected = ", selected" }
+
+        StreamInput.Printf("  %d %s: buzzers %d-%d%s\n", room.number, room.name, room.first, room.last, selected)
+    }
+}
+
+
+// Print a usage message for the commands we handle ourselves.
+func (this *Rooms) usage() {
+    StreamInput.Printf("  room Show rooms\n")
+    StreamInput.Printf("  room {name} Send commands to the specified room\n")
+    StreamInput.Printf("  {name}: {command} Send 1 command to the specified room, or every room for *\n")
+}
+
+
+// Split the given string around the first instance of the given separator.
+// Returns false, with the whole string before, if the separator isn't found.
+func cutString(s string, sep string) (before string, after string, found bool) {
+    if i := strings.Index(s, sep); i >= 0 { return s[:i], s[i + len(sep):], true }
+    return s, "", false
+}
@@ -0,0 +1,126 @@
+/* Tests for rooms, using the fake buzzers from replay_test.go. */
+
+package main
+
+import "testing"
+import "time"
+
+
+// Check room specs are parsed, and bad ones rejected.
+func TestRoomSpec(t *testing.T) {
+    configs, ok := ParseRoomSpec("main:0-15, side:16-31")
+    if !ok || len(configs) != 2 || configs[1].name != "side" || configs[1].first != 16 || configs[1].last != 31 {
+        t.Errorf("Good spec parsed as %v, %v", configs, ok)
+    }
+
+    configs, ok = ParseRoomSpec("")
+    if !ok || len(configs) != 1 || configs[0].first != 0 || configs[0].last != MaxTeamBuzzers - 1 {
+        t.Errorf("Empty spec parsed as %v, %v", configs, ok)
+    }
+
+    for _, spec := range []string{"main", "main:0-15,side:15-31", "main:0-15,main:16-31", "main:5-4", "main:0-256",
+        "*:0-15"} {
+        if _, ok := ParseRoomSpec(spec); ok { t.Errorf("Bad spec %s accepted", spec) }
+    }
+}
+
+
+// Check buzzers join rooms by their number within their team, or by the room they ask for, and other buzzers are
+// turned away.
+func TestRoomAssignment(t *testing.T) {
+    rig := createRoomsRig(t, []RoomConfig{ { name: "main", first: 0, last: 15 },
+        { name: "side", first: 16, last: 31 } })
+    defer rig.Close()
+
+    first := rig.Connect(0x001, 0)
+    side := rig.Connect(0x111, 0)
+    asked := rig.Connect(0x002, 2)
+    away := rig.Connect(0x040, 0)  // In neither room.
+    away.ExpectDisconnect()
+
+    for _, buzzer := range []*fakeBuzzer{first, side, asked} { buzzer.WaitReady() }
+
+    select {
+    case <-away.gone:
+    case <-time.After(ReplayTimeout):
+        t.Errorf("Buzzer %s not turned away", BuzzerIdToString(away.id))
+    }
+
+    expected := map[*fakeBuzzer]byte{ first: 1, side: 2, asked: 2 }
+    for buzzer, room := range expected {
+        select {
+        case tag := <-buzzer.rooms:
+            if tag != room { t.Errorf("Buzzer %s told room %d, expected %d", BuzzerIdToString(buzzer.id), tag, room) }
+
+        case <-time.After(ReplayTimeout):
+            t.Errorf("Buzzer %s never told its room", BuzzerIdToString(buzzer.id))
+        }
+    }
+
+    rooms := rig.rooms.All()
+    inMain := rooms[0].swarm.Buzzers()
+    inSide := rooms[1].swarm.Buzzers()
+
+    if len(inMain) != 1 || inMain[0x001] == nil { t.Errorf("Main room has buzzers %v", inMain) }
+    if len(inSide) != 2 || inSide[0x111] == nil || inSide[0x002] == nil { t.Errorf("Side room has buzzers %v", inSide) }
+}
+
+
+// Check console commands go to the room they're meant for.
+func TestRoomConsole(t *testing.T) {
+    rig := createRoomsRig(t, []RoomConfig{ { name: "main", first: 0, last: 15 },
+        { name: "side", first: 16, last: 31 } })
+    defer rig.Close()
+
+    rig.Connect(0x001, 0)
+    rig.Connect(0x111, 0)
+    rig.Connect(0x112, 0)
+    for _, buzzer := range rig.buzzers { buzzer.WaitReady() }
+
+    // Only the side room's buzzers should arm.
+    rig.rooms.Process("side: qn")
+    rig.waitArmed(t, map[int]bool{ 0x111: true, 0x112: true })
+
+    // Then the main room's, once it's selected.
+    rig.rooms.Process("room main")
+    rig.rooms.Process("qn")
+    rig.waitArmed(t, map[int]bool{ 0x001: true })
+
+    // Every room's go idle together.
+    rig.rooms.Process("*: idle")
+    for _, room := range rig.rooms.All() {
+        if m, _ := room.controller.Metrics(); m.state != ConStIdle {
+            t.Errorf("Room %s in state %d after idling all rooms", room.name, m.state)
+        }
+    }
+}
+
+
+// Wait until exactly the given buzzers are armed, failing if any others are.
+func (this *testRig) waitArmed(t *testing.T, ids map[int]bool) {
+    waiting := make(map[int]bool)
+    for id := range ids { waiting[id] = true }
+
+    timeout := time.After(ReplayTimeout)
+    for len(waiting) > 0 {
+        select {
+        case m := <-this.modes:
+            if (m.mode & CmdModeArmed) == 0 { continue }
+            if !ids[m.id] { t.Fatalf("Buzzer %s armed, but not in the room asked", BuzzerIdToString(m.id)) }
+            delete(waiting, m.id)
+
+        case <-timeout:
+            t.Fatalf("Buzzers never armed")
+        }
+    }
+
+    // Give any stray modes a chance to arrive.
+    select {
+    case m := <-this.modes:
+        if (m.mode & CmdModeArmed) != 0 && !ids[m.id] {
+            t.Fatalf("Buzzer %s armed, but not in the room asked", BuzzerIdToString(m.id))
+        }
+
+    case <-time.After(50 * time.Millisecond):
+    }
+}
@@ -4,17 +4,21 @@
 
 package main
 
-import "fmt"
+import "quiz/journal"
 
 
-// Create a scoreboard.
-func CreateScoreboard(cmdProc *CommandProcessor) *Scoreboard {
+// Create a scoreboard for the given room, for the given number of teams, which must be no more than MaxTeams.
+// Score changes are recorded in the room's journal, if it has one.
+func CreateScoreboard(room *Room, teams int) *Scoreboard {
     var p Scoreboard
-    p.scores = make([]int, 4)
+    p.room = room
+    p.journal = room.journal
+    p.scores = make([]int, teams)
     p.requests = make(chan func(), 1000)
 
     go p.run()
 
+    cmdProc := room.cmdProc
     cmdProc.AddCommand(p.commandAdd, "Give points to a team", "+", LEX_TEAM, LEX_UINT)
     cmdProc.AddCommand(p.commandSub, "Deduct points from a team", "-", LEX_TEAM, LEX_UINT)
     cmdProc.AddCommand(p.commandScore, "Show team scores", "score")
@@ -23,10 +27,38 @@ func CreateScoreboard(cmdProc *CommandProcessor) *Scoreboard {
 }
 
 
+// Report how many teams we have. These are the teams with IDs 0 up to one less than this.
+// May be called from any thread context.
+func (this *Scoreboard) Teams() int {
+    return len(this.scores)
+}
+
+
 // Add points to the specified team.
 func (this *Scoreboard) Add(team int, points int) {
     this.requests <- func() {
+        if team >= len(this.scores) {
+            StreamInput.In(this.room).Printf("No team %s in this quiz\n", TeamIdToString(team))
+            return
+        }
+
         this.scores[team] += points
+        this.journal.Score(team, points)
+        this.printLocal()
+    }
+}
+
+
+// Add points to several teams at once, indexed by team ID, printing the scores only once.
+func (this *Scoreboard) AddBatch(points []int) {
+    this.requests <- func() {
+        for team, p := range points {
+            if p != 0 && team < len(this.scores) {
+                this.scores[team] += p
+                this.journal.Score(team, p)
+            }
+        }
+
         this.printLocal()
     }
 }
@@ -42,7 +74,9 @@ func (this *Scoreboard) Print() {
 
 // Scoreboard object.
 type Scoreboard struct {
+    room *Room
     scores []int
+    journal *journal.Writer  // nil for none.
     requests chan func()  // All requests are handling in the central Go routine.
 }
 
@@ -63,11 +97,11 @@ func (this *Scoreboard) run() {
 // Print out the current scores.
 // Must only be called from our central thread.
 func (this *Scoreboard) printLocal() {
-    fmt.Printf("Scores:\n")
-    fmt.Printf("B: %3d\n", this.scores[0])
-    fmt.Printf("G: %3d\n", this.scores[1])
-    fmt.Printf("R: %3d\n", this.scores[2])
-    fmt.Printf("Y: %3d\n", this.scores[3])
+    StreamScore.In(this.room).Printf("Scores:\n")
+
+    for team, score := range this.scores {
+        StreamScore.In(this.room).Printf("%s: %3d\n", TeamIdToString(team), score)
+    }
 }
 
 
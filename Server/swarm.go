@@ -1,44 +1,89 @@
 /* Functions for managing a swarm of physical buzzers.
 
-For each known buzzer we record timing stats, to spot any latency issues.
+For each known buzzer we record timing stats, to spot any latency issues. We record histograms of both the gaps
+between heartbeats received and the round trip times of probes we send regularly. These are updated for every message,
+so are kept in a separate link stats object, see link.go, which buzzers update directly.
 
 We record for both the current connection session and the total duration of this program. This is intended to allow
 checking whether a power cycle fixes a buzzer that's having problems. To enable this, we do not delete our record for
 a buzzer when it disconnects.
 
+We tell buzzers how often to send heartbeats, quickly while a question is open so a dead buzzer is noticed fast, and
+slowly otherwise to save battery and airtime. Probes are slowed down to match. Each buzzer's gaps between heartbeats
+feed a failure detector, see link.go, which is told what gap to expect whenever the heartbeat period changes. Buzzers
+that look unhealthy are marked as suspect, so they can be flagged before a question, and those that are very likely
+dead are disconnected.
 
+Buzzers also report telemetry on their own health, see telemetry.go. We keep the latest from each, across sessions,
+so we can see what state a buzzer was in when it went missing.
+
+We also drive the clock sync for each buzzer, by regularly sending sync pings. The resulting sync is kept in the
+buzzer's record so we can report on it.
+
+Mode changes for all buzzers are broadcast, if possible, so the whole swarm changes at once. Buzzers report when they
+applied each broadcast, from which we measure how spread out the swarm was. Any buzzer that doesn't report in time,
+or doesn't support broadcasts, is sent the mode change directly.
+
+A mode change can also arm the buzzers of selected teams, so they light up as soon as they're pressed, or leave out
+one buzzer, so a winner can be confirmed while everyone else is cancelled.
+
+Each room has its own swarm, see room.go. While other rooms share this server our broadcasts carry our room's number,
+so only our buzzers apply them. Only the team mode broadcast has room for it, so that's the only form we send, and
+buzzers using the single byte protocol are sent their modes directly.
+
+Each session is issued a resume token. A buzzer that drops its connection and comes back with the token, without
+having rebooted, resumes its previous session, keeping its stats and clock sync, and is put back into the mode the
+rest of the swarm is in.
+
+Firmware updates are run by the updater, see ota.go. We pass buzzers' update status and disconnections on to it.
 
 */
 
 package main
 
-import "fmt"
+import "crypto/rand"
+import "encoding/binary"
+import "quiz/journal"
 import "sort"
 import "time"
 
 
 // External interface.
 
-// Create a Swarm object, which will track our buzzers.
-func CreateSwarm(cmdProc *CommandProcessor, controller *Controller) *Swarm {
+// Create a Swarm object, which will track the buzzers in the given room.
+// Mode broadcasts are sent via the given UDP transport, which may be nil.
+// Mode changes and presses are recorded in the room's journal, if it has one.
+func CreateSwarm(room *Room, controller *Controller, udp *UdpTransport) *Swarm {
     var p Swarm
+    p.room = room
+    p.journal = room.journal
     p.controller = controller
+    p.udp = udp
     p.buzzers = make(map[int]*buzzerRecord)
     p.requests = make(chan func(), 1000)
+    p.heartbeat = DefaultHeartbeat
 
     go p.run()
 
+    cmdProc := room.cmdProc
     cmdProc.AddCommand(p.PrintStats, "Print stats", "stats")
     cmdProc.AddCommand(p.commandOn, "Enable outputs on 1 buzzer", "on", LEX_BUZ_ID)
     cmdProc.AddCommand(p.commandOffAll, "Disable outputs on all buzzers", "offall")
     cmdProc.AddCommand(p.commandOff, "Disable outputs on 1 buzzer", "off", LEX_BUZ_ID)
+    cmdProc.AddCommand(p.commandTrace, "Dump latency trace from 1 buzzer", "trace", LEX_BUZ_ID)
 
     return &p
 }
 
 
-// Report discovery of a new buzzer.
-func (this *Swarm) NewBuzzer(id int, buzzer *Buzzer) {
+// Report discovery of a new buzzer, which presented the given resume token, 0 for none.
+// If the token matches the one we last issued for this ID, the buzzer's previous session is resumed, keeping its
+// stats and clock sync, and it's put back into the mode it was last in.
+// Returns the link stats the buzzer should update.
+func (this *Swarm) NewBuzzer(id int, buzzer *Buzzer, token uint32) *linkStats {
+    // Create channel to get response.
+    response := make(chan *linkStats, 1)
+
     this.requests <- func() {
         // Lookup buzzer.
         p, ok := this.buzzers[id]
@@ -47,62 +92,135 @@ func (this *Swarm) NewBuzzer(id int, buzzer *Buzzer) {
             // Record not found for new buzzer, create one.
             var rec buzzerRecord
             rec.id = id
+            rec.stats = createLinkStats(id, this.room)
+            rec.mode = ModeCommand(false, false)
+            if this.modeAll != nil { rec.mode = this.modeAll.modeFor(id) }
             p = &rec
             this.buzzers[id] = p
         }
 
+        resumed := (ok && token != 0 && token == p.token)
+        now := time.Now()
         p.buzzer = buzzer
+        p.connects++
+
+        if resumed {
+            // The buzzer hasn't rebooted, so its clock sync is still good.
+            StreamConnect.In(this.room).Printf("Resuming buzzer %s\n", BuzzerIdToString(id))
+            buzzer.clock = p.clock
+            p.stats.Resume(now)
+            p.resumes++
+        } else {
+            // Clear sessions stats.
+            p.clock = buzzer.clock
+            p.stats.NewSession(now)
+        }
+
+        // Buzzers sharing this server with other rooms need to know which broadcasts are ours.
+        if this.room.tag != 0 { buzzer.SendRoom(this.room.tag) }
+
+        // Issue a new token each session, so a stale one can't be reused.
+        p.token = newResumeToken()
+        buzzer.SetResumeToken(p.token)
+        buzzer.SetRadioProfile(this.lowLatency)
+        buzzer.SetHeartbeat(this.heartbeat)
+        p.stats.ExpectGap(this.expectedGap(buzzer))
+        if resumed { buzzer.SendMode(p.mode) }
+
+        response <- p.stats
+    }
+
+    // Wait for response.
+    return <-response
+}
+
 
-        // Clear sessions stats.
-        p.lastMsgTime = time.Now()
-        p.slow2sCountSession = 0
-        p.slow3sCountSession = 0
+// Report all connected buzzers, indexed by ID.
+func (this *Swarm) Buzzers() map[int]*Buzzer {
+    // Create channel to get response.
+    response := make(chan map[int]*Buzzer, 1)
+
+    this.requests <- func() {
+        buzzers := make(map[int]*Buzzer)
+        for id, rec := range this.buzzers {
+            if rec.buzzer != nil { buzzers[id] = rec.buzzer }
+        }
+
+        response <- buzzers
     }
+
+    // Wait for response.
+    return <-response
 }
 
 
-// Report disconnection from a buzzer.
-func (this *Swarm) Disconnected(id int, buzzer *Buzzer) {
+// Set the firmware updater to pass buzzers' update status and disconnections on to.
+func (this *Swarm) SetOta(ota *Ota) {
     this.requests <- func() {
-        // Lookup buzzer.
+        this.ota = ota
+    }
+}
+
+
+// Report firmware update status from a buzzer.
+func (this *Swarm) OtaStatus(id int, buzzer *Buzzer, status byte, written int) {
+    this.requests <- func() {
+        // Lookup buzzer, and check it's the same one, as for disconnection.
         rec, ok := this.buzzers[id]
-        if !ok { return }  // Buzzer not found, nothing to do.
+        if !ok || rec.buzzer != buzzer { return }
 
-        // Buzzer ID found. We have to check it's the same buzzer, because concurrency.
-        if rec.buzzer != buzzer { return }  // Specified buzzer has already been replaced, nothing to do.
+        this.ota.Status(id, buzzer, status, written)
+    }
+}
 
-        // We've found the specified buzzer. Ditch it.
-        // We keep the record for stats purposes.
-        rec.buzzer = nil
+
+// Report which connected buzzers the failure detector currently suspects, in ID order.
+func (this *Swarm) Suspects() []int {
+    // Create channel to get response.
+    response := make(chan []int, 1)
+
+    this.requests <- func() {
+        var ids []int
+        for id, buzzer := range this.buzzers {
+            if buzzer.buzzer != nil && buzzer.suspect { ids = append(ids, id) }
+        }
+
+        sort.Ints(ids)
+        response <- ids
+    }
+
+    // Wait for response.
+    return <-response
+}
+
+
+// Report telemetry received from a buzzer.
+func (this *Swarm) Telemetry(id int, buzzer *Buzzer, telemetry Telemetry) {
+    this.requests <- func() {
+        // Lookup buzzer, and check it's the same one, as for disconnection.
+        rec, ok := this.buzzers[id]
+        if !ok || rec.buzzer != buzzer { return }
+
+        rec.telemetry = &telemetry
     }
 }
 
 
-// Report that a message has been received from a buzzer.
-func (this *Swarm) Received(id int) {
+// Report disconnection from a buzzer.
+func (this *Swarm) Disconnected(id int, buzzer *Buzzer) {
     this.requests <- func() {
         // Lookup buzzer.
         rec, ok := this.buzzers[id]
         if !ok { return }  // Buzzer not found, nothing to do.
 
-        now := time.Now()
-        gap := now.Sub(rec.lastMsgTime)
-        rec.lastMsgTime = now
-        slow := false
-
-        if gap > (3 * time.Second) {
-            rec.slow3sCountSession++
-            rec.slow3sCountTotal++
-            slow = true
-        } else if gap > (2 * time.Second) {
-            rec.slow2sCountSession++
-            rec.slow2sCountTotal++
-            slow = true
-        }
+        // Buzzer ID found. We have to check it's the same buzzer, because concurrency.
+        if rec.buzzer != buzzer { return }  // Specified buzzer has already been replaced, nothing to do.
 
-        if slow {
-            fmt.Printf("Slow message %v\n", gap)
-        }
+        // We've found the specified buzzer. Ditch it.
+        // We keep the record for stats purposes.
+        rec.buzzer = nil
+        rec.suspect = false
+        this.ota.Disconnected(id, buzzer)
     }
 }
 
@@ -122,8 +240,15 @@ func (this *Swarm) SetMode(buzzerId int, ledOn bool, buzzerOn bool) bool {
             return
         }
 
-        // Sending can be slow, so use a fresh Go routine.
-        rec.buzzer.SetMode(ledOn, buzzerOn)
+        rec.mode = ModeCommand(ledOn, buzzerOn)
+        this.journal.Mode(buzzerId, rec.mode)
+        if rec.buzzer == nil {
+            // Buzzer not connected, it'll get this mode if it resumes.
+            response <- false
+            return
+        }
+
+        rec.buzzer.SendMode(rec.mode)
         response <- true
     }
 
@@ -135,10 +260,86 @@ func (this *Swarm) SetMode(buzzerId int, ledOn bool, buzzerOn bool) bool {
 // Send a mode message to all connected buzzers.
 func (this *Swarm) SetModeAll(ledOn bool, buzzerOn bool) {
     this.requests <- func() {
-        // Run through each buzzer in turn.
+        this.setModeAll(ledOn, buzzerOn, 0, -1)
+    }
+
+    // No need to wait for a response.
+}
+
+
+// Send a mode message to all connected buzzers except the specified one.
+func (this *Swarm) SetModeAllExcept(ledOn bool, buzzerOn bool, exceptId int) {
+    this.requests <- func() {
+        this.setModeAll(ledOn, buzzerOn, 0, exceptId)
+    }
+
+    // No need to wait for a response.
+}
+
+
+// Turn off outputs on all connected buzzers, and arm those in the allowed teams.
+// Allowed teams are indexed by team ID.
+func (this *Swarm) ArmAll(teamsAllowed []bool) {
+    var armTeams uint16
+    for team, allowed := range teamsAllowed {
+        if allowed { armTeams |= 1 << uint(team) }
+    }
+
+    this.requests <- func() {
+        this.setModeAll(false, false, armTeams, -1)
+    }
+
+    // No need to wait for a response.
+}
+
+
+// Report that a buzzer has applied a mode broadcast.
+// If synced is false the apply time couldn't be converted to our time.
+func (this *Swarm) ModeApplied(id int, seq uint16, applyTime time.Time, synced bool) {
+    this.requests <- func() {
+        if this.broadcast == nil || this.broadcast.seq != seq { return }  // Too late, ignore.
+        if !this.broadcast.expected[id] { return }
+
+        if synced {
+            this.broadcast.applied[id] = applyTime
+        } else {
+            this.broadcast.unsynced++
+        }
+
+        delete(this.broadcast.expected, id)
+    }
+}
+
+
+// Select the radio profile for all connected buzzers, and any that connect later.
+func (this *Swarm) SetRadioAll(lowLatency bool) {
+    this.requests <- func() {
+        if lowLatency == this.lowLatency { return }  // No change.
+        this.lowLatency = lowLatency
+
+        for _, buzzer := range this.buzzers {
+            if buzzer.buzzer != nil {
+                buzzer.buzzer.SetRadioProfile(lowLatency)
+            }
+        }
+    }
+
+    // No need to wait for a response.
+}
+
+
+// Select the heartbeat period for all connected buzzers, and any that connect later.
+// Probes are sent no more often than heartbeats, so a slow period saves airtime overall.
+func (this *Swarm) SetHeartbeatAll(period time.Duration) {
+    this.requests <- func() {
+        if period == this.heartbeat { return }  // No change.
+        this.heartbeat = period
+
+        // Our failure detector's idea of normal no longer applies.
         for _, buzzer := range this.buzzers {
             if buzzer.buzzer != nil {
-                buzzer.buzzer.SetMode(ledOn, buzzerOn)
+                buzzer.stats.ExpectGap(this.expectedGap(buzzer.buzzer))
+                buzzer.buzzer.SetHeartbeat(period)
             }
         }
     }
@@ -147,17 +348,67 @@ func (this *Swarm) SetModeAll(ledOn bool, buzzerOn bool) {
 }
 
 
+// Take a copy of our metrics, and those of all known buzzers in ID order. Returns false if we're too busy to answer.
+// May be called from any thread context.
+func (this *Swarm) Metrics() (swarmMetrics, bool) {
+    response := make(chan swarmMetrics, 1)
+
+    this.requests <- func() {
+        var m swarmMetrics
+        m.broadcastLatency = this.broadcastLatency
+        m.broadcastSpread = this.broadcastSpread
+        m.broadcastMissed = this.broadcastMissed
+
+        now := time.Now()
+        for _, rec := range this.buzzers {
+            b := buzzerMetrics{
+                id: rec.id,
+                connected: rec.buzzer != nil,
+                suspect: rec.suspect,
+                connects: rec.connects,
+                resumes: rec.resumes,
+                stats: rec.stats.Snapshot(),
+            }
+
+            if rec.buzzer != nil {
+                b.phi, _ = rec.stats.Phi(now)
+                b.sendQueue = len(rec.buzzer.sends)
+            }
+
+            if rec.clock != nil { b.clockError = rec.clock.ErrorBound() }
+            if rec.telemetry != nil {
+                t := *rec.telemetry
+                b.telemetry = &t
+            }
+
+            m.buzzers = append(m.buzzers, b)
+        }
+
+        sort.Slice(m.buzzers, func(i, j int) bool { return m.buzzers[i].id < m.buzzers[j].id })
+        response <- m
+    }
+
+    select {
+    case m := <-response:
+        return m, true
+
+    case <-time.After(MetricsTimeout):
+        return swarmMetrics{}, false
+    }
+}
+
+
 // Print out stats for all known buzzers.
 func (this *Swarm) PrintStats(value ...int) {
     this.requests <- func() {
         // Run through all buzzers.
-        sumSlow2sCountSession := 0
-        sumSlow3sCountSession := 0
-        sumSlow2sCountTotal := 0
-        sumSlow3sCountTotal := 0
+        var sumGap, sumRtt Histogram
         okCount := 0
 
-        fmt.Printf("             >2s >3s (>2s >3s)\n")
+        out := StreamConnect.In(this.room)
+        out.Requested("%13s%-28s%s\n", "", "Gap (ms)", "RTT (ms)")
+        out.Requested("%13s%6s %6s %6s %6s %6s %6s %6s %6s\n", "", "p50", "p95", "p99", "max", "p50", "p95", "p99",
+            "max")
 
         // First get and sort the buzzer IDs.
         ids := make([]int, 0, len(this.buzzers))
@@ -167,58 +418,169 @@ func (this *Swarm) PrintStats(value ...int) {
         sort.Ints(ids)
 
         // Now run through the buzzers in ID order.
+        // Each has a line for its current session and one for the total duration.
         for _, id := range ids {
             buzzer, _ := this.buzzers[id]
             status := "Missing"
             if buzzer.buzzer != nil {
                 status = "OK     "
+                if buzzer.suspect { status = "Suspect" }
                 okCount++
             }
 
-            fmt.Printf("%3s: %s %3d %3d (%3d %3d)\n", BuzzerIdToString(buzzer.id), status,
-                buzzer.slow2sCountSession, buzzer.slow3sCountSession,
-                buzzer.slow2sCountTotal, buzzer.slow3sCountTotal)
+            stats := buzzer.stats.Snapshot()
+            out.Requested("%3s: %s %s %s\n", BuzzerIdToString(buzzer.id), status,
+                stats.gapSession.String(), stats.rttSession.String())
+            out.Requested("     (total) %s %s\n", stats.gapTotal.String(), stats.rttTotal.String())
 
-            sumSlow2sCountSession += buzzer.slow2sCountSession
-            sumSlow3sCountSession += buzzer.slow3sCountSession
-            sumSlow2sCountTotal += buzzer.slow2sCountTotal
-            sumSlow3sCountTotal += buzzer.slow3sCountTotal
+            sumGap.Merge(&stats.gapSession)
+            sumRtt.Merge(&stats.rttSession)
         }
 
-        fmt.Printf("Sum: %2d OK   %3d %3d (%3d %3d)\n", okCount,
-            sumSlow2sCountSession, sumSlow3sCountSession,
-            sumSlow2sCountTotal, sumSlow3sCountTotal)
+        out.Requested("All: %2d OK   %s %s\n", okCount, sumGap.String(), sumRtt.String())
+
+        // Mode broadcast performance.
+        out.Requested("Mode broadcast latency %s\n", this.broadcastLatency.String())
+        out.Requested("Mode broadcast spread  %s\n", this.broadcastSpread.String())
+        out.Requested("Mode broadcasts missed %d\n", this.broadcastMissed)
+
+        // Clock sync quality for the current, or last, session.
+        out.Requested("Clock sync:\n")
+        for _, id := range ids {
+            buzzer, _ := this.buzzers[id]
+            sync := "unsynced"
+            if buzzer.clock != nil { sync = buzzer.clock.String() }
+            out.Requested("%3s: %s\n", BuzzerIdToString(buzzer.id), sync)
+        }
+
+        // Latest telemetry, which may be from a previous session.
+        out.Requested("Telemetry:\n")
+        now := time.Now()
+        for _, id := range ids {
+            buzzer, _ := this.buzzers[id]
+            telemetry := "none"
+            if buzzer.telemetry != nil { telemetry = buzzer.telemetry.String(now) }
+            out.Requested("%3s: %s\n", BuzzerIdToString(buzzer.id), telemetry)
+        }
     }
 }
 
 
 // Object to represent a physical buzzer with which we're communicating.
 type Swarm struct {
+    room *Room
     controller *Controller
     buzzers map[int]*buzzerRecord  // Indexed by ID.
+    lowLatency bool  // Whether buzzers should use their low latency radio profile.
+    heartbeat time.Duration  // Heartbeat period buzzers should use.
+    lastProbe time.Time  // When we last sent probes.
+    lastSync time.Time  // When we last sent sync pings to every buzzer.
+    udp *UdpTransport  // Used for broadcasts. nil if none.
+    journal *journal.Writer  // Journal for presses and mode changes, also used by our buzzers. nil for none.
+    ota *Ota  // Firmware updater. nil for none.
+    broadcastSeq uint16  // Sequence number of the last mode broadcast.
+    broadcast *modeBroadcast  // The most recent mode broadcast. nil if none.
+    modeAll *modeBroadcast  // The most recent mode change for all buzzers, whether broadcast or not. nil if none.
+    broadcastLatency Histogram  // Time from sending each broadcast to the last buzzer applying it.
+    broadcastSpread Histogram  // Time from the first buzzer applying each broadcast to the last.
+    broadcastMissed int  // Total number of times buzzers haven't reported applying a broadcast.
     requests chan func()  // All requests are handling in the central Go routine.
 }
 
 
 // Internals.
 
+// How often we ping each buzzer for clock sync and probe for round trip time, at most.
+// Sync pings are also the buzzers' keepalive. Buzzers that hear nothing from us for 3s, or 4 heartbeat periods if
+// that's longer, assume the link is dead.
+const (
+    SyncPingInterval = 500 * time.Millisecond
+    ProbeInterval = 200 * time.Millisecond
+)
+
+// Heartbeat period buzzers use until told otherwise.
+const (
+    DefaultHeartbeat = time.Second
+)
+
+// Failure detector settings. See link.go for what phi means.
+const (
+    DisconnectCheckInterval = 250 * time.Millisecond
+    SuspectPhi = 3.0  // Buzzers this unlikely to still be healthy are reported as suspect.
+    DeadPhi = 8.0  // Buzzers this unlikely to still be healthy are disconnected.
+    MinDeadQuiet = 2 * time.Second  // However steady a buzzer's messages are, we allow it this long.
+    MaxQuiet = 10 * time.Second  // However unsteady a buzzer's messages are, we allow it no longer than this...
+    MaxQuietHeartbeats = 4  // ...or this many heartbeat periods, whichever is longer.
+)
+
+// How long we wait for buzzers to report applying a mode broadcast.
+const (
+    ModeApplyWindow = 250 * time.Millisecond
+)
+
+
+// A mode broadcast we're waiting for buzzers to apply.
+type modeBroadcast struct {
+    seq uint16
+    ledOn bool
+    buzzerOn bool
+    armTeams uint16  // Bitmask of teams whose buzzers should also arm.
+    except int  // ID of buzzer that should ignore the broadcast. <0 for none.
+    sent time.Time
+    expected map[int]bool  // IDs of buzzers we're still waiting for.
+    applied map[int]time.Time  // Apply times reported by buzzers, in our time.
+    unsynced int  // Number of buzzers that reported applying, but without clock sync.
+}
+
+
+// Report the mode command this broadcast sets for the buzzer with the given ID.
+func (this *modeBroadcast) modeFor(id int) byte {
+    b := ModeCommand(this.ledOn, this.buzzerOn)
+    if (this.armTeams & (1 << uint(BuzzerTeam(id)))) != 0 { b |= CmdModeArmed }
+    return b
+}
+
+
+// Send the mode for this broadcast directly to the given buzzer, with the given ID.
+func (this *modeBroadcast) sendDirect(buzzer *Buzzer, id int) {
+    buzzer.SendMode(this.modeFor(id))
+}
+
+
 // Info we need to store per buzzer.
 type buzzerRecord struct {
     buzzer *Buzzer  // nil if disconnected.
     id int
-    lastMsgTime time.Time
-    slow2sCountSession int
-    slow3sCountSession int
-    slow2sCountTotal int
-    slow3sCountTotal int
+    clock *ClockSync  // Clock sync for the current, or last, session.
+    stats *linkStats  // Timing stats, updated directly by the buzzer.
+    suspect bool  // Whether the failure detector thinks the buzzer may have failed.
+    token uint32  // Token the buzzer can present to resume its session.
+    mode byte  // Mode command the buzzer should currently be in.
+    telemetry *Telemetry  // Latest telemetry from the buzzer. nil if none.
+    connects int  // Number of times the buzzer has connected to us.
+    resumes int  // Number of those connections that resumed the previous session.
+}
+
+
+// Generate a new resume token. Tokens are random, so those issued by a previous run of this program won't match.
+// Never returns 0, which means no token.
+func newResumeToken() uint32 {
+    var b [4]byte
+    for {
+        rand.Read(b[:])
+        token := binary.BigEndian.Uint32(b[:])
+        if token != 0 { return token }
+    }
 }
 
 
 // Handles requests in a single thread.
 // Never returns. Should be called as a Go routine.
 func (this *Swarm) run() {
-    // Setup a tick for checking for dead connections.
-    ticker := time.NewTicker(time.Second)
+    // Setup ticks for checking for dead connections and clock sync.
+    ticker := time.NewTicker(DisconnectCheckInterval)
+    syncTicker := time.NewTicker(SyncPingInterval)
+    probeTicker := time.NewTicker(ProbeInterval)
 
     // Process incoming messages forever.
     for {
@@ -228,30 +590,196 @@ func (this *Swarm) run() {
 
         case <-ticker.C:
             this.checkDisconnects()
+
+        case <-syncTicker.C:
+            this.sendSyncPings()
+
+        case <-probeTicker.C:
+            this.sendProbes()
         }
     }
 }
 
 
-// Check if any buzzers have disappeared.
+// Check if any buzzers have disappeared, or are looking unhealthy.
 func (this *Swarm) checkDisconnects() {
     now := time.Now()
 
     // Check each buzzer in turn.
     for id, buzzer := range this.buzzers {
         if buzzer.buzzer != nil {
+            phi, quiet := buzzer.stats.Phi(now)
 
-            age := now.Sub(buzzer.lastMsgTime)
-
-            if age > (5 * time.Second) {
+            if (phi >= DeadPhi && quiet >= MinDeadQuiet) || quiet >= this.maxQuiet() {
                 // We've not heard from this buzzer for too long, disconnect it.
-                fmt.Printf("Buzzer %s quiet for >10s, disconnecting\n", BuzzerIdToString(id))
+                StreamConnect.In(this.room).Printf("Buzzer %s quiet for %.1fs (phi %.1f), disconnecting\n",
+                    BuzzerIdToString(id), quiet.Seconds(), phi)
 
                 // We don't need to adjust our records now, since the buzzer will tell us it's disconnected.
+                buzzer.suspect = false
                 buzzer.buzzer.Disconnect()
+                continue
+            }
+
+            suspect := (phi >= SuspectPhi)
+            if suspect && !buzzer.suspect {
+                StreamConnect.In(this.room).Printf("Buzzer %s suspect, quiet for %.1fs (phi %.1f)\n",
+                    BuzzerIdToString(id), quiet.Seconds(), phi)
+            } else if !suspect && buzzer.suspect {
+                StreamConnect.In(this.room).Printf("Buzzer %s healthy again\n", BuzzerIdToString(id))
+            }
+
+            buzzer.suspect = suspect
+        }
+    }
+}
+
+
+// Send a mode change to all connected buzzers, broadcast if possible.
+// Buzzers in teams with their bit set in armTeams are also armed, and the except buzzer is left alone, if >= 0.
+func (this *Swarm) setModeAll(ledOn bool, buzzerOn bool, armTeams uint16, except int) {
+    broadcast := &modeBroadcast{
+        ledOn: ledOn,
+        buzzerOn: buzzerOn,
+        armTeams: armTeams,
+        except: except,
+        expected: make(map[int]bool),
+        applied: make(map[int]time.Time),
+    }
+
+    this.modeAll = broadcast
+
+    journalExcept := except
+    if except < 0 { journalExcept = journal.AllBuzzers }
+    this.journal.ModeAll(ModeCommand(ledOn, buzzerOn), armTeams, journalExcept)
+
+    // Only framed buzzers listen for broadcasts. Arming, exceptions and rooms sharing this server need the team form.
+    team := (armTeams != 0 || except >= 0 || this.room.tag != 0)
+    canBroadcast := (this.udp != nil && this.udp.CanBroadcast())
+
+    // Run through each buzzer in turn. Those that will get the broadcast don't need a direct message.
+    // Disconnected buzzers record the mode, in case they resume.
+    for id, buzzer := range this.buzzers {
+        if id != except { buzzer.mode = broadcast.modeFor(id) }
+
+        if buzzer.buzzer != nil && id != except {
+            if canBroadcast && buzzer.buzzer.framed {
+                broadcast.expected[id] = true
+            } else {
+                broadcast.sendDirect(buzzer.buzzer, id)
             }
         }
     }
+
+    if len(broadcast.expected) == 0 { return }
+
+    // Send the broadcast, and give buzzers a while to report they've applied it.
+    this.broadcastSeq++
+    broadcast.seq = this.broadcastSeq
+    this.broadcast = broadcast
+    broadcast.sent = time.Now()
+
+    if team {
+        this.udp.BroadcastTeamMode(broadcast.seq, ModeCommand(ledOn, buzzerOn), armTeams, except, this.room.tag)
+    } else {
+        this.udp.BroadcastMode(broadcast.seq, ModeCommand(ledOn, buzzerOn))
+    }
+
+    time.AfterFunc(ModeApplyWindow, func() {
+        this.requests <- func() { this.finishBroadcast(broadcast) }
+    })
+}
+
+
+// Report the longest we allow a buzzer to be quiet, whatever the failure detector says.
+func (this *Swarm) maxQuiet() time.Duration {
+    quiet := this.heartbeat * MaxQuietHeartbeats
+    if quiet < MaxQuiet { quiet = MaxQuiet }
+    return quiet
+}
+
+
+// Finish measuring the given mode broadcast, and send its mode directly to any buzzers that missed it.
+func (this *Swarm) finishBroadcast(broadcast *modeBroadcast) {
+    if len(broadcast.applied) > 0 {
+        var first, last time.Time
+        for _, t := range broadcast.applied {
+            if first.IsZero() || t.Before(first) { first = t }
+            if last.IsZero() || t.After(last) { last = t }
+        }
+
+        this.broadcastLatency.Add(last.Sub(broadcast.sent))
+        this.broadcastSpread.Add(last.Sub(first))
+    }
+
+    if len(broadcast.expected) == 0 { return }
+
+    // If there's been a newer mode for everyone since, the buzzers that missed this one don't need its mode anymore.
+    // Nor do any that have been sent another mode directly since, such as one that pressed and was locked in.
+    current := (broadcast == this.broadcast && broadcast == this.modeAll)
+
+    missed := ""
+    for id := range broadcast.expected {
+        this.broadcastMissed++
+        missed += " " + BuzzerIdToString(id)
+
+        rec, ok := this.buzzers[id]
+        if current && ok && rec.buzzer != nil && rec.mode == broadcast.modeFor(id) {
+            broadcast.sendDirect(rec.buzzer, id)
+        }
+    }
+
+    StreamConnect.In(this.room).Noisy("broadcast missed", "Mode broadcast missed by%s\n", missed)
+}
+
+
+// Send a clock sync ping to all connected buzzers, if it's time.
+// Each ping gets an immediate pong, so while heartbeats are slow we ping only once per heartbeat period, to let the
+// buzzers' radios sleep.
+func (this *Swarm) sendSyncPings() {
+    now := time.Now()
+    if now.Sub(this.lastSync) < this.syncInterval() - (SyncPingInterval / 2) { return }  // Not yet.
+    this.lastSync = now
+
+    for _, buzzer := range this.buzzers {
+        if buzzer.buzzer != nil { buzzer.buzzer.SendSyncPing() }
+    }
+}
+
+
+// Report how often we should currently ping the buzzers for clock sync.
+// Heartbeats faster than our default don't need us to ping any faster.
+func (this *Swarm) syncInterval() time.Duration {
+    if this.heartbeat > DefaultHeartbeat { return this.heartbeat }
+    return SyncPingInterval
+}
+
+
+// Report the gap we expect between heartbeats from the given buzzer.
+func (this *Swarm) expectedGap(buzzer *Buzzer) time.Duration {
+    if !buzzer.framed { return DefaultHeartbeat }
+    return this.heartbeat
+}
+
+
+// Report how often we should currently probe the buzzers.
+func (this *Swarm) probeInterval() time.Duration {
+    if this.heartbeat > ProbeInterval { return this.heartbeat }
+    return ProbeInterval
+}
+
+
+// Send a round trip time probe to all connected buzzers, if it's time.
+func (this *Swarm) sendProbes() {
+    now := time.Now()
+    if now.Sub(this.lastProbe) < this.probeInterval() - (ProbeInterval / 2) { return }  // Not yet.
+    this.lastProbe = now
+
+    for _, buzzer := range this.buzzers {
+        if buzzer.buzzer != nil {
+            buzzer.buzzer.SendProbe()
+        }
+    }
 }
 
 
@@ -271,3 +799,21 @@ func (this *Swarm) commandOff(value ...int) {
 func (this *Swarm) commandOffAll(value ...int) {
     this.SetModeAll(false, false)
 }
+
+
+// Command handler for dumping the latency trace from a specified buzzer.
+func (this *Swarm) commandTrace(value ...int) {
+    id := value[0]
+
+    this.requests <- func() {
+        rec, ok := this.buzzers[id]
+        if !ok || rec.buzzer == nil {
+            StreamInput.In(this.room).Printf("Buzzer %s not connected\n", BuzzerIdToString(id))
+            return
+        }
+
+        if !rec.buzzer.RequestTrace() {
+            StreamInput.In(this.room).Printf("Buzzer %s doesn't support tracing\n", BuzzerIdToString(id))
+        }
+    }
+}
@@ -0,0 +1,140 @@
+/* Tests for the swarm, using the fake buzzers from replay_test.go. */
+
+package main
+
+import "reflect"
+import "testing"
+import "time"
+
+
+// Check a buzzer that misses a broadcast is sent its mode directly, unless it's been sent another mode since.
+func TestBroadcastMissedAfterDirectMode(t *testing.T) {
+    rig := createRig(t, 0x001, 0x101)
+    defer rig.Close()
+    rig.drainModes()
+
+    // Both buzzers miss an arming broadcast. In the meantime 0x001 presses and is locked in.
+    broadcast := rig.fakeBroadcast(0x03, 0x001, 0x101)
+    if !rig.swarm.SetMode(0x001, true, false) { t.Fatalf("Cannot set mode of buzzer 001") }
+    rig.swarm.requests <- func() { rig.swarm.finishBroadcast(broadcast) }
+
+    modes := modesById(rig.drainModes())
+    expected := map[int][]byte{
+        0x001: {ModeCommand(true, false)},
+        0x101: {ModeCommand(false, false) | CmdModeArmed},
+    }
+
+    if !reflect.DeepEqual(modes, expected) { t.Errorf("Buzzers sent modes %v, expected %v", modes, expected) }
+}
+
+
+// Check a missed broadcast isn't resent once there's been a newer mode for everyone.
+func TestBroadcastMissedAfterNewerMode(t *testing.T) {
+    rig := createRig(t, 0x001)
+    defer rig.Close()
+    rig.drainModes()
+
+    broadcast := rig.fakeBroadcast(0x01, 0x001)
+    rig.swarm.SetModeAll(false, false)  // Sent directly, since the rig has no UDP.
+    rig.swarm.requests <- func() { rig.swarm.finishBroadcast(broadcast) }
+
+    modes := rig.drainModes()
+    if len(modes) != 1 || modes[0] != (fakeMode{0x001, ModeCommand(false, false)}) {
+        t.Errorf("Buzzer sent modes %v", modes)
+    }
+}
+
+
+// Check that while heartbeats are slow, sync pings are only sent once per heartbeat period, and never to buzzers
+// using the single byte protocol, which don't support them.
+func TestSyncPingsFollowIdleHeartbeat(t *testing.T) {
+    rig := createMixedRig(t, nil, []int{0x001}, []int{0x201})
+    defer rig.Close()
+
+    rig.swarm.SetHeartbeatAll(IdleHeartbeat)
+    done := make(chan struct{})
+    rig.swarm.requests <- func() {
+        defer close(done)
+        framed := rig.swarm.buzzers[0x001].buzzer
+        legacy := rig.swarm.buzzers[0x201].buzzer
+
+        // Since the last ping to everyone, nobody is due one.
+        rig.swarm.lastSync = time.Now().Add(-SyncPingInterval)
+        framedSeq := framed.syncSeq
+        rig.swarm.sendSyncPings()
+        if framed.syncSeq != framedSeq {
+            t.Errorf("Pinged %d times before heartbeat period", framed.syncSeq - framedSeq)
+        }
+
+        // A heartbeat period later, the framed buzzer is.
+        rig.swarm.lastSync = time.Now().Add(-IdleHeartbeat)
+        rig.swarm.sendSyncPings()
+        if framed.syncSeq != framedSeq + 1 {
+            t.Errorf("Pinged %d times after heartbeat period", framed.syncSeq - framedSeq)
+        }
+
+        if legacy.syncSeq != 0 { t.Errorf("Pinged legacy buzzer %d times", legacy.syncSeq) }
+    }
+
+    <-done
+}
+
+
+// Record a mode broadcast arming the given teams as sent, and waiting for the given buzzers to report applying it,
+// as if the rig could broadcast. Nothing is actually sent.
+func (this *testRig) fakeBroadcast(armTeams uint16, ids ...int) *modeBroadcast {
+    created := make(chan *modeBroadcast, 1)
+
+    this.swarm.requests <- func() {
+        swarm := this.swarm
+        broadcast := &modeBroadcast{
+            armTeams: armTeams,
+            except: -1,
+            expected: make(map[int]bool),
+            applied: make(map[int]time.Time),
+        }
+
+        swarm.broadcastSeq++
+        broadcast.seq = swarm.broadcastSeq
+        broadcast.sent = time.Now()
+        swarm.broadcast = broadcast
+        swarm.modeAll = broadcast
+
+        for _, id := range ids {
+            swarm.buzzers[id].mode = broadcast.modeFor(id)
+            broadcast.expected[id] = true
+        }
+
+        created <- broadcast
+    }
+
+    return <-created
+}
+
+
+// Report every mode sent to our fakes until none have been sent for a while, in the order they arrived.
+func (this *testRig) drainModes() []fakeMode {
+    var modes []fakeMode
+
+    for {
+        select {
+        case m := <-this.modes:
+            modes = append(modes, m)
+
+        case <-time.After(100 * time.Millisecond):
+            return modes
+        }
+    }
+}
+
+
+// Group the given modes by the buzzer they were sent to, keeping each buzzer's in order.
+// Each fake reports its modes from its own Go routine, so only the order for a single buzzer is fixed.
+func modesById(modes []fakeMode) map[int][]byte {
+    byId := make(map[int][]byte)
+    for _, m := range modes {
+        byId[m.id] = append(byId[m.id], m.mode)
+    }
+
+    return byId
+}
@@ -0,0 +1,72 @@
+/* Telemetry reported by buzzers.
+
+Buzzers regularly report on their own health: signal strength, how often they've had to reconnect, how many sends have
+failed, how close their tasks have come to running out of stack, free heap and battery voltage. When a buzzer is slow
+this tells us whether to blame the radio, the firmware or the battery.
+
+Counts are since the buzzer booted, so a drop in them means it has rebooted.
+
+*/
+
+package main
+
+import "encoding/binary"
+import "fmt"
+import "time"
+
+
+// External interface.
+
+// Decode the given telemetry message payload, received at the given time.
+func ParseTelemetry(payload []byte, recvTime time.Time) Telemetry {
+    var p Telemetry
+    p.received = recvTime
+    p.rssi = int(int8(payload[0]))
+    p.wifiConnects = int(binary.BigEndian.Uint16(payload[1:3]))
+    p.hostConnects = int(binary.BigEndian.Uint16(payload[3:5]))
+    p.wifiConnectTime = time.Duration(binary.BigEndian.Uint16(payload[5:7])) * time.Millisecond
+    p.wifiFast = (payload[7] & TelemetryFastConnect) != 0
+    p.sendFailures = int(binary.BigEndian.Uint16(payload[8:10]))
+    p.stackFree = int(binary.BigEndian.Uint16(payload[10:12]))
+    p.batteryMv = int(binary.BigEndian.Uint16(payload[12:14]))
+    p.heapFree = int(binary.BigEndian.Uint32(payload[14:18]))
+    return p
+}
+
+
+// Describe this telemetry, as of the given time.
+func (this *Telemetry) String(now time.Time) string {
+    connect := "full"
+    if this.wifiFast { connect = "fast" }
+
+    battery := "unknown"
+    if this.batteryMv != 0 { battery = fmt.Sprintf("%dmV", this.batteryMv) }
+
+    return fmt.Sprintf("RSSI %ddBm, WIFI %d connects (last %v %s), host %d connects, %d send fails, " +
+        "stack %dB, heap %dB, battery %s, %.0fs ago", this.rssi, this.wifiConnects, this.wifiConnectTime, connect,
+        this.hostConnects, this.sendFailures, this.stackFree, this.heapFree, battery,
+        now.Sub(this.received).Seconds())
+}
+
+
+// Telemetry from a buzzer.
+type Telemetry struct {
+    received time.Time  // When we received this.
+    rssi int  // Signal strength of the buzzer's AP, in dBm. 0 if unknown.
+    wifiConnects int  // Number of WIFI connections since boot.
+    hostConnects int  // Number of connections to us since boot.
+    wifiConnectTime time.Duration  // How long the last WIFI connection took.
+    wifiFast bool  // Whether the last WIFI connection was a fast reconnect.
+    sendFailures int  // Number of failed sends since boot.
+    stackFree int  // Least free stack any task has had, in bytes.
+    batteryMv int  // Battery voltage. 0 if unknown.
+    heapFree int  // Free heap, in bytes.
+}
+
+
+// Internals.
+
+// Telemetry flag bits.
+const (
+    TelemetryFastConnect = 0x01
+)
@@ -0,0 +1,94 @@
+/* Latency traces from buzzers.
+
+Buzzers record timestamped events along the path from a button press to sending it, and from receiving a message to
+applying it. On request they send us the most recent events, which we print out, so we can see where the time goes
+on real hardware.
+
+*/
+
+package main
+
+import "encoding/binary"
+import "fmt"
+
+
+// External interface.
+
+// Decode the given trace event.
+func ParseTraceEntry(payload []byte) TraceEntry {
+    var p TraceEntry
+    p.time = int64(binary.BigEndian.Uint64(payload[0:8]))
+    p.event = payload[8]
+    p.arg = payload[9]
+    return p
+}
+
+
+// Print out the given trace from the given buzzer, in the given room.
+// Times are the buzzer's, relative to the first event, along with the time since the previous event.
+func PrintTrace(room *Room, id int, entries []TraceEntry) {
+    out := StreamConnect.In(room)
+    out.Requested("Trace from %s, %d events\n", BuzzerIdToString(id), len(entries))
+    out.Requested("%10s %10s  %s\n", "Time (ms)", "Step (ms)", "Event")
+
+    for i, entry := range entries {
+        var step int64
+        if i > 0 { step = entry.time - entries[i - 1].time }
+
+        out.Requested("%10.3f %10.3f  %s\n", float64(entry.time - entries[0].time) / 1000, float64(step) / 1000,
+            entry.String())
+    }
+}
+
+
+// Describe this trace event.
+func (this *TraceEntry) String() string {
+    switch this.event {
+    case TraceButtonEdge:
+        if this.arg != 0 { return "Button pressed" }
+        return "Button released"
+
+    case TracePressQueued:
+        return "Press queued"
+
+    case TracePressDequeued:
+        return "Press dequeued"
+
+    case TraceSendStart:
+        return fmt.Sprintf("Sending press %d", this.arg)
+
+    case TraceSendDone:
+        return fmt.Sprintf("Sent press %d", this.arg)
+
+    case TraceRecv:
+        return fmt.Sprintf("Received 0x%02X", this.arg)
+
+    case TraceModeApplied:
+        return fmt.Sprintf("Applied mode 0x%02X", this.arg)
+
+    default:
+        return fmt.Sprintf("Unknown event %d, 0x%02X", this.event, this.arg)
+    }
+}
+
+
+// A single traced event.
+type TraceEntry struct {
+    time int64  // In us since the buzzer booted.
+    event byte
+    arg byte
+}
+
+
+// Internals.
+
+// Traced events, see trace.h in the firmware.
+const (
+    TraceButtonEdge = 1
+    TracePressQueued = 2
+    TracePressDequeued = 3
+    TraceSendStart = 4
+    TraceSendDone = 5
+    TraceRecv = 6
+    TraceModeApplied = 7
+)
@@ -0,0 +1,212 @@
+/* UDP transport for buzzers.
+
+Framed buzzers are told at handshake time to send their presses and heartbeats as UDP datagrams, rather than over
+their TCP connection. This stops a single lost TCP segment holding up everything behind it. Everything else, including
+all messages to the buzzers, stays on TCP. Buzzers using the single byte protocol only use TCP.
+
+Each datagram is the sending buzzer's ID, in 2 bytes with the top bit set, followed by a single message. Presses carry
+a sequence number, which we acknowledge, and the buzzer resends them until we do. Heartbeats are not acknowledged.
+
+Buzzers are looked up by their ID and IP address together, since buzzers in different rooms may share an ID, see
+room.go.
+
+We also broadcast mode changes for the whole swarm, so that all buzzers change at the same time. All framed buzzers
+listen for these, whichever transport they use. Broadcasts aren't acknowledged at the WIFI level, so are more likely
+to be lost than other packets. We send each one twice, and the swarm falls back to TCP for any buzzer that doesn't
+report applying it. A team mode broadcast can also arm selected teams, leave out a single buzzer, and carry a room
+number, so buzzers in other rooms ignore it.
+
+*/
+
+package main
+
+import "net"
+import "sync"
+
+
+// External interface.
+
+// Create a UDP transport listening on the given address and start processing incoming datagrams.
+// Mode broadcasts are sent to the given broadcast address, or not at all if that is empty.
+// Returns nil on failure.
+func ListenUdp(address string, broadcastAddress string) *UdpTransport {
+    addr, err := net.ResolveUDPAddr("udp", address)
+    if err != nil {
+        StreamConnect.Printf("Error resolving UDP address: %v\n", err)
+        return nil
+    }
+
+    var broadcast *net.UDPAddr
+    if broadcastAddress != "" {
+        broadcast, err = net.ResolveUDPAddr("udp", broadcastAddress)
+        if err != nil {
+            StreamConnect.Printf("Error resolving broadcast address: %v\n", err)
+            return nil
+        }
+    }
+
+    conn, err := net.ListenUDP("udp", addr)
+    if err != nil {
+        StreamConnect.Printf("Error listening for UDP: %v\n", err)
+        return nil
+    }
+
+    var p UdpTransport
+    p.conn = conn
+    p.broadcast = broadcast
+    p.buzzers = make(map[udpKey]*Buzzer)
+
+    go p.run()
+
+    return &p
+}
+
+
+// Register the given buzzer as using UDP.
+// May be called from any thread context.
+func (this *UdpTransport) Register(id int, buzzer *Buzzer) {
+    this.lock.Lock()
+    defer this.lock.Unlock()
+
+    this.buzzers[makeUdpKey(id, buzzer.remoteIP())] = buzzer
+}
+
+
+// Unregister the given buzzer.
+// Does nothing if the given buzzer has already been replaced by a newer connection with the same ID.
+// May be called from any thread context.
+func (this *UdpTransport) Unregister(id int, buzzer *Buzzer) {
+    this.lock.Lock()
+    defer this.lock.Unlock()
+
+    key := makeUdpKey(id, buzzer.remoteIP())
+    if this.buzzers[key] == buzzer {
+        delete(this.buzzers, key)
+    }
+}
+
+
+// Send a press acknowledgement to the given address.
+// May be called from any thread context.
+func (this *UdpTransport) SendAck(addr *net.UDPAddr, seq byte) {
+    this.conn.WriteToUDP([]byte{CmdPressAck, seq}, addr)
+}
+
+
+// Report whether we can broadcast mode changes.
+func (this *UdpTransport) CanBroadcast() bool {
+    return this.broadcast != nil
+}
+
+
+// Broadcast the given mode command with the given sequence number.
+// May be called from any thread context.
+func (this *UdpTransport) BroadcastMode(seq uint16, mode byte) {
+    this.sendBroadcast([]byte{CmdModeBroadcast, byte(seq >> 8), byte(seq), mode})
+}
+
+
+// Broadcast the given mode command with the given sequence number, for buzzers in the given room, or all buzzers if
+// that's 0. Buzzers in teams with their bit set in armTeams also arm. The buzzer with the except ID ignores the
+// broadcast, or none do if except is < 0.
+// May be called from any thread context.
+func (this *UdpTransport) BroadcastTeamMode(seq uint16, mode byte, armTeams uint16, except int, room byte) {
+    exceptId := uint16(UdpNoBuzzer)
+    if except >= 0 { exceptId = uint16(except) }
+
+    msg := []byte{CmdTeamModeBroadcast, byte(seq >> 8), byte(seq), mode, byte(armTeams >> 8), byte(armTeams),
+        byte(exceptId >> 8), byte(exceptId)}
+    if room != 0 { msg = append(msg, room) }
+    this.sendBroadcast(msg)
+}
+
+
+// UDP transport object.
+type UdpTransport struct {
+    conn *net.UDPConn
+    broadcast *net.UDPAddr  // nil if we shouldn't broadcast.
+    lock sync.Mutex  // Protects buzzers.
+    buzzers map[udpKey]*Buzzer  // Buzzers using UDP.
+}
+
+
+// Internals.
+
+// Largest datagram we expect.
+const (
+    UdpMaxDatagram = 64
+)
+
+// Number of copies of each broadcast we send.
+const (
+    UdpBroadcastCopies = 2
+)
+
+// Buzzer ID value meaning no buzzer.
+const (
+    UdpNoBuzzer = 0xFFFF
+)
+
+// Flag in the first byte of every datagram, showing its ID takes 2 bytes.
+const (
+    UdpWideId = 0x80
+)
+
+
+// Key identifying a buzzer using UDP, by its ID and IP address.
+type udpKey struct {
+    id int
+    ip [16]byte
+}
+
+
+// Make the key for the buzzer with the given ID and IP address.
+func makeUdpKey(id int, ip net.IP) udpKey {
+    key := udpKey{ id: id }
+    copy(key.ip[:], ip.To16())
+    return key
+}
+
+
+// Send the given broadcast message.
+func (this *UdpTransport) sendBroadcast(msg []byte) {
+    for i := 0; i < UdpBroadcastCopies; i++ {
+        _, err := this.conn.WriteToUDP(msg, this.broadcast)
+        if err != nil {
+            StreamConnect.Noisy("udp broadcast", "Error broadcasting: %v\n", err)
+            return
+        }
+    }
+}
+
+
+// Handles incoming datagrams.
+// Only returns on socket error. Should be called as a Go routine.
+func (this *UdpTransport) run() {
+    buffer := make([]byte, UdpMaxDatagram)
+
+    for {
+        n, addr, err := this.conn.ReadFromUDP(buffer)
+        if err != nil {
+            StreamConnect.Noisy("udp receive", "Error receiving UDP: %v\n", err)
+            return
+        }
+
+        // Anything too short, or without a 2 byte ID, is ignored.
+        if n < 3 || (buffer[0] & UdpWideId) == 0 { continue }
+
+        // Lookup the buzzer.
+        id := int(buffer[0] & ^byte(UdpWideId)) << 8 | int(buffer[1])
+
+        this.lock.Lock()
+        buzzer, ok := this.buzzers[makeUdpKey(id, addr.IP)]
+        this.lock.Unlock()
+
+        if !ok {
+            // Not a buzzer we know to be using UDP. Maybe it's from an old connection.
+            continue
+        }
+
+        buzzer.processDatagram(buffer[2:n], addr, this)
+    }
+}
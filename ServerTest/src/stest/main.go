@@ -1,45 +1,434 @@
+/* Swarm simulator and latency benchmark.
+
+Spawns many virtual buzzers, each with its own TCP connection to a real quiz server, following Protocol.txt. Each
+virtual buzzer sends a version and hello, heartbeats, and button presses at a configurable rate with jitter. It also
+answers sync pings and probes, so the server's clock sync and round trip stats work as with real buzzers.
+
+We measure the time from sending each press to receiving the next mode message from the server. This needs the server
+to be in test mode, where every press toggles the pressing buzzer's outputs.
+
+To measure how the server scales, several swarm sizes can be given, which are run one after another.
+
+Usage, with the server running and in test mode:
+  stest -server 127.0.0.1:9753 -sizes 10,50,128 -duration 30s -rate 1 -jitter 0.5
+
+Virtual buzzers frame their messages, as the real firmware does, and have 16 bit IDs, so up to 4096 buzzers, in 16
+teams, can be simulated at once. To see how the server copes with a large swarm:
+  stest -sizes 128,512,1024,4096 -duration 30s
+
+With -legacy they're version 4 buzzers instead, using the single byte protocol, with 7 bit IDs, so at most 128. These
+send untimed presses, and don't answer sync pings or probes.
+
+Framed buzzers can also be spread across several rooms, with the server running the same number of rooms, each in
+test mode. Buzzers ask for rooms in turn, and results are given for each room, so a busy room's effect on the others
+can be seen:
+  stest -rooms 3 -sizes 600 -duration 30s
+
+*/
+
 package main
 
+import "bufio"
+import "encoding/binary"
+import "flag"
 import "fmt"
+import "io"
+import "math/rand"
 import "net"
+import "sort"
+import "strconv"
+import "strings"
+import "sync"
+import "time"
 
 
-func handleConnection(conn net.Conn) {
-    buf := make([]byte, 1)
-    for {
-        n, err := conn.Read(buf)
+func main() {
+    server := flag.String("server", "127.0.0.1:9753", "Address of quiz server")
+    sizes := flag.String("sizes", "100", "Comma separated list of swarm sizes to run")
+    duration := flag.Duration("duration", 30 * time.Second, "How long to run each swarm size for")
+    rate := flag.Float64("rate", 1, "Presses per second per buzzer")
+    jitter := flag.Float64("jitter", 0.5, "Random variation in time between presses, as a fraction of the mean")
+    heartbeat := flag.Duration("heartbeat", time.Second, "Time between heartbeats")
+    legacy := flag.Bool("legacy", false, "Use the version 4 single byte protocol, rather than framing messages")
+    rooms := flag.Int("rooms", 1, fmt.Sprintf("Number of rooms to spread buzzers over, up to %d. Framed only",
+        MaxRooms))
+    flag.Parse()
 
-        if n > 0 {
-            fmt.Printf("%02x\n", buf[0])
-        }
+    if *rooms < 1 || *rooms > MaxRooms || (*rooms > 1 && *legacy) {
+        fmt.Printf("Rooms must be 1 to %d, and legacy buzzers have no rooms\n", MaxRooms)
+        return
+    }
 
-        if err != nil {
-            fmt.Printf("Error: %v\n", err)
+    maxBuzzers := MaxFramedBuzzers
+    if *legacy { maxBuzzers = MaxLegacyBuzzers }
+
+    for _, sizeText := range strings.Split(*sizes, ",") {
+        size, err := strconv.Atoi(strings.TrimSpace(sizeText))
+        if err != nil || size < 1 {
+            fmt.Printf("Bad swarm size \"%s\"\n", sizeText)
             return
         }
+
+        if size > maxBuzzers {
+            fmt.Printf("Swarm size %d too big, using %d\n", size, maxBuzzers)
+            size = maxBuzzers
+        }
+
+        var config simConfig
+        config.server = *server
+        config.size = size
+        config.duration = *duration
+        config.pressInterval = time.Duration(float64(time.Second) / *rate)
+        config.jitter = *jitter
+        config.heartbeat = *heartbeat
+        config.legacy = *legacy
+        config.rooms = *rooms
+
+        runSwarm(&config)
     }
 }
 
 
-func main() {
-    fmt.Printf("Fuck off\n")
+// Internals.
+
+const (
+    MaxLegacyBuzzers = 128  // 7 bit IDs.
+    MaxFramedBuzzers = 16 << 8  // 16 teams of up to 256.
+    MaxFrame = 1024  // Largest framed message the server sends.
+    MaxRooms = 255  // Room numbers are a single byte, with 0 for none.
+    LostResponseTime = 2 * time.Second  // Presses not responded to within this are considered lost.
+)
+
+// Message values, from Protocol.txt.
+const (
+    MsgModePrefix = 0x20
+    MsgModeMask = 0xF8
+    MsgPress = 0x30
+    MsgHeartbeat = 0x31
+    MsgSyncPong = 0x33
+    MsgProbeReply = 0x34
+    MsgSeqPress = 0x35
+    MsgHello = 0x3B
+    MsgIdPrefix = 0x80
+
+    CmdSyncPing = 0x40
+    CmdProbe = 0x41
+
+    LegacyVersion = 4  // Uses the single byte protocol, with 7 bit IDs.
+    FramedVersion = 18  // Frames its messages, and has 16 bit IDs.
+)
+
+// Settings for a single run.
+type simConfig struct {
+    server string
+    size int
+    duration time.Duration
+    pressInterval time.Duration
+    jitter float64
+    heartbeat time.Duration
+    legacy bool  // Whether buzzers use the single byte protocol, rather than framing.
+    rooms int  // Number of rooms buzzers are spread over. With 1 buzzers don't ask for a room.
+}
+
+// Results from a single run, shared by all virtual buzzers.
+type simResults struct {
+    lock sync.Mutex
+    connected int
+    failed int
+    presses int
+    lost int  // Presses we never got a response to.
+    latencies []time.Duration  // Press to mode message times.
+}
+
+// A single virtual buzzer.
+type virtualBuzzer struct {
+    id int  // For framed buzzers the team is in the top byte.
+    room byte  // Room we ask for, from 1. 0 for none.
+    config *simConfig
+    results *simResults
+    conn net.Conn
+    bootTime time.Time  // Our clock counts from here.
+    sendLock sync.Mutex  // Protects conn writes and pressTime.
+    pressTime time.Time  // Time of our outstanding press. Zero if none.
+    pressSeq byte
+}
+
 
-    netListener, err := net.Listen("tcp", ":9753")
+// Run a swarm of the given size and print the results.
+func runSwarm(config *simConfig) {
+    fmt.Printf("Running %d buzzers for %v\n", config.size, config.duration)
+
+    results := make([]simResults, config.rooms)
+    stop := make(chan bool)
+    var wg sync.WaitGroup
+
+    for i := 0; i < config.size; i++ {
+        var p virtualBuzzer
+        p.id = i
+        p.config = config
+        p.results = &results[i % config.rooms]
+        if config.rooms > 1 { p.room = byte(i % config.rooms + 1) }
+
+        // Each buzzer has its own clock, which started at some random point before now.
+        p.bootTime = time.Now().Add(-time.Duration(rand.Int63n(int64(time.Hour))))
+
+        wg.Add(1)
+        go func() {
+            defer wg.Done()
+            p.run(stop)
+        }()
+
+        // Don't all connect at once.
+        time.Sleep(2 * time.Millisecond)
+    }
+
+    time.Sleep(config.duration)
+    close(stop)
+    wg.Wait()
+
+    if config.rooms == 1 {
+        results[0].print(fmt.Sprintf("Size %d", config.size))
+        return
+    }
+
+    var all simResults
+    for i := range results {
+        results[i].print(fmt.Sprintf("Room %d", i + 1))
+        all.add(&results[i])
+    }
+
+    all.print(fmt.Sprintf("Size %d, all rooms", config.size))
+}
+
+
+// Run this virtual buzzer until told to stop.
+func (this *virtualBuzzer) run(stop chan bool) {
+    conn, err := net.Dial("tcp", this.config.server)
     if err != nil {
-        fmt.Printf("Failed to listen: %v\n", err)
+        this.results.lock.Lock()
+        this.results.failed++
+        this.results.lock.Unlock()
         return
     }
 
-    fmt.Printf("Listening on %s\n", netListener.Addr())
+    this.conn = conn
+    defer conn.Close()
+
+    this.results.lock.Lock()
+    this.results.connected++
+    this.results.lock.Unlock()
+
+    // Handshake. We never have a session to resume.
+    if this.framed() {
+        this.conn.Write([]byte{FramedVersion})  // Our version is never framed.
+        hello := []byte{MsgHello, byte(this.id >> 8), byte(this.id), 0, 0, 0, 0}
+        if this.room != 0 { hello = append(hello, this.room) }
+        this.send(hello)
+    } else {
+        this.send([]byte{LegacyVersion, MsgIdPrefix | byte(this.id)})
+    }
+
+    go this.receive()
+
+    // Spread our heartbeats and presses out from other buzzers.
+    heartbeat := time.NewTicker(this.config.heartbeat)
+    defer heartbeat.Stop()
+    press := time.NewTimer(this.nextPressDelay())
+    defer press.Stop()
 
     for {
-        fmt.Printf("Accepting\n")
-        conn, err := netListener.Accept()
-        if err != nil {
-            fmt.Printf("Failed to accept: %v\n", err)
+        select {
+        case <-stop:
+            return
+
+        case <-heartbeat.C:
+            this.send([]byte{MsgHeartbeat})
+
+        case <-press.C:
+            this.sendPress()
+            press.Reset(this.nextPressDelay())
+        }
+    }
+}
+
+
+// Pick a random delay until our next press.
+func (this *virtualBuzzer) nextPressDelay() time.Duration {
+    variation := ((rand.Float64() * 2) - 1) * this.config.jitter
+    return time.Duration(float64(this.config.pressInterval) * (1 + variation))
+}
+
+
+// Report our clock, in us since boot.
+func (this *virtualBuzzer) now() uint64 {
+    return uint64(time.Since(this.bootTime) / time.Microsecond)
+}
+
+
+// Report whether we frame our messages.
+func (this *virtualBuzzer) framed() bool {
+    return !this.config.legacy
+}
+
+
+// Send the given message to the server, framed if need be.
+func (this *virtualBuzzer) send(msg []byte) {
+    this.sendLock.Lock()
+    defer this.sendLock.Unlock()
+
+    this.write(msg)
+}
+
+
+// Write the given message to the server, framed if need be.
+// Must be called with sendLock held.
+func (this *virtualBuzzer) write(msg []byte) {
+    if this.framed() {
+        frame := make([]byte, 2, 2 + len(msg))
+        binary.BigEndian.PutUint16(frame, uint16(len(msg)))
+        msg = append(frame, msg...)
+    }
+
+    this.conn.Write(msg)
+}
+
+
+// Send a button press to the server. Legacy buzzers' presses are untimed.
+func (this *virtualBuzzer) sendPress() {
+    msg := []byte{MsgPress}
+    if this.framed() { msg = make([]byte, 14) }
+
+    this.sendLock.Lock()
+    defer this.sendLock.Unlock()
+
+    if !this.pressTime.IsZero() {
+        // Still waiting for a response to our last press. Give up on it if it's taking too long.
+        if time.Since(this.pressTime) < LostResponseTime { return }
+
+        this.results.lock.Lock()
+        this.results.lost++
+        this.results.lock.Unlock()
+    }
+
+    if this.framed() {
+        this.pressSeq++
+        msg[0] = MsgSeqPress
+        msg[1] = this.pressSeq
+        binary.BigEndian.PutUint64(msg[2:10], this.now())
+        binary.BigEndian.PutUint32(msg[10:14], 0)
+    }
+
+    this.pressTime = time.Now()
+    this.write(msg)
+
+    this.results.lock.Lock()
+    this.results.presses++
+    this.results.lock.Unlock()
+}
+
+
+// Process messages from the server until our connection closes.
+func (this *virtualBuzzer) receive() {
+    reader := bufio.NewReader(this.conn)
+    if this.framed() {
+        this.receiveFramed(reader)
+        return
+    }
+
+    // Legacy buzzers are only sent modes.
+    buffer := make([]byte, 1)
+    for {
+        if _, err := reader.Read(buffer); err != nil { return }
+
+        if (buffer[0] & MsgModeMask) == MsgModePrefix {
+            this.modeReceived()
         } else {
-            fmt.Printf("We got one\n")
-            go handleConnection(conn)
+            fmt.Printf("Buzzer %d got unexpected message 0x%02X\n", this.id, buffer[0])
+        }
+    }
+}
+
+
+// Process framed messages from the server until our connection closes.
+// Messages we don't need are skipped.
+func (this *virtualBuzzer) receiveFramed(reader *bufio.Reader) {
+    var size [2]byte
+    msg := make([]byte, MaxFrame)
+
+    for {
+        if _, err := io.ReadFull(reader, size[:]); err != nil { return }
+
+        n := int(binary.BigEndian.Uint16(size[:]))
+        if n == 0 || n > MaxFrame {
+            fmt.Printf("Buzzer %d got bad message size %d\n", this.id, n)
+            return
+        }
+
+        if _, err := io.ReadFull(reader, msg[:n]); err != nil { return }
+        recvTime := this.now()
+
+        b := msg[0]
+        switch {
+        case (b & MsgModeMask) == MsgModePrefix:
+            this.modeReceived()
+
+        case b == CmdSyncPing && n >= 2:
+            reply := make([]byte, 18)
+            reply[0] = MsgSyncPong
+            reply[1] = msg[1]
+            binary.BigEndian.PutUint64(reply[2:10], recvTime)
+            binary.BigEndian.PutUint64(reply[10:18], this.now())
+            this.send(reply)
+
+        case b == CmdProbe && n >= 2:
+            this.send([]byte{MsgProbeReply, msg[1]})
         }
     }
 }
+
+
+// Handle a mode message from the server. If we have a press outstanding, this is the response to it.
+func (this *virtualBuzzer) modeReceived() {
+    now := time.Now()
+    this.sendLock.Lock()
+    pressTime := this.pressTime
+    this.pressTime = time.Time{}
+    this.sendLock.Unlock()
+
+    if !pressTime.IsZero() {
+        this.results.lock.Lock()
+        this.results.latencies = append(this.results.latencies, now.Sub(pressTime))
+        this.results.lock.Unlock()
+    }
+}
+
+
+// Add the given results to these.
+func (this *simResults) add(other *simResults) {
+    this.connected += other.connected
+    this.failed += other.failed
+    this.presses += other.presses
+    this.lost += other.lost
+    this.latencies = append(this.latencies, other.latencies...)
+}
+
+
+// Print out the results of a run, or part of one, with the given title.
+func (this *simResults) print(title string) {
+    this.lock.Lock()
+    defer this.lock.Unlock()
+
+    sort.Slice(this.latencies, func(i, j int) bool { return this.latencies[i] < this.latencies[j] })
+
+    percentile := func(percent float64) float64 {
+        if len(this.latencies) == 0 { return 0 }
+        i := int((percent / 100) * float64(len(this.latencies)))
+        if i >= len(this.latencies) { i = len(this.latencies) - 1 }
+        return float64(this.latencies[i]) / float64(time.Millisecond)
+    }
+
+    fmt.Printf("%s: %d connected, %d failed, %d presses, %d responses, %d lost\n", title, this.connected,
+        this.failed, this.presses, len(this.latencies), this.lost)
+    fmt.Printf("  Press to mode (ms): p50 %.3f p95 %.3f p99 %.3f max %.3f\n", percentile(50), percentile(95),
+        percentile(99), percentile(100))
+}